@@ -0,0 +1,150 @@
+//------------------------------------------------------------------------------------------------
+// File:    deadreckoning.h
+//
+// Desc:    Decides when a player's state has drifted far enough from what others predict to send
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __DEADRECKONING_H__
+#define __DEADRECKONING_H__
+
+
+// Include files required to compile this header
+#include "platform.h"
+#include "protocol.h"
+#include "wireformat.h"
+
+// How far the real position can get from the predicted one before an update is sent, in units
+#define DEFAULT_POSITION_ERROR      0.1f
+
+// How far the facing direction can turn before an update is sent, in radians
+#define DEFAULT_YAW_ERROR           0.1f
+
+// Longest a player goes without sending anything, in milliseconds.  Keeps the server from
+// timing out players who are standing still.
+#define DEAD_RECKONING_HEARTBEAT    1000
+
+// Most updates a player sends each second, however far it drifts.  The client and ngsbot both
+// use this, and it's also the rate ngsbot sends at when it isn't dead reckoning.  Other players
+// are played back smoothly between snapshots, so it can be kept low.
+#define UPDATE_FREQUENCY            5
+
+/**
+ * Predicts where a player is now from a state that was sent earlier, the same way everyone who
+ * receives the state does:  it keeps moving at the velocity that was sent.
+ *   @param pState State that was sent
+ *   @param fSeconds Time since it was sent
+ *   @param pPosition Where the player is predicted to be
+ */
+inline VOID ExtrapolatePosition( const PlayerState * pState, FLOAT fSeconds, FLOAT * pPosition )
+{
+    for( int i = 0; i < 3; ++i )
+        pPosition[i] = pState->fPosition[i] + pState->fVelocity[i] * fSeconds;
+}
+
+/**
+ * Gets how far apart two angles are, going the short way around
+ */
+inline FLOAT AngleBetween( FLOAT fA, FLOAT fB )
+{
+    const FLOAT fTwoPi = 6.28318531f;
+    FLOAT fDifference = fmodf( fA - fB, fTwoPi );
+    if( fDifference < 0.0f )
+        fDifference += fTwoPi;
+    return fDifference > fTwoPi * 0.5f ? fTwoPi - fDifference : fDifference;
+}
+
+/**
+ * Tracks the last state a player sent and decides when the next one is needed.  An update goes
+ * out when the prediction made from the last one has drifted past the error thresholds, when
+ * the animation changes, or when the heartbeat comes due, but never more often than the
+ * minimum interval.  A player standing still or moving in a straight line sends almost nothing.
+ *   @author Karl Gluck
+ */
+class DeadReckoning
+{
+    public:
+
+        DeadReckoning() { Create( DEFAULT_POSITION_ERROR, DEFAULT_YAW_ERROR, 0 ); }
+
+        /// Sets the thresholds, and forgets what was sent so the next state goes out right away
+        VOID Create( FLOAT fPositionError, FLOAT fYawError, DWORD dwMinInterval )
+        {
+            m_fPositionError = fPositionError;
+            m_fYawError = fYawError;
+            m_dwMinInterval = dwMinInterval;
+            m_bSent = FALSE;
+            m_dwSentTime = 0;
+        }
+
+        /// Forgets what was sent, so the next state goes out right away
+        VOID Reset() { m_bSent = FALSE; }
+
+        /// Determines whether pState has to be sent at dwTime (in milliseconds)
+        BOOL NeedsUpdate( const PlayerState * pState, DWORD dwTime ) const
+        {
+            if( !m_bSent )
+                return TRUE;
+
+            DWORD dwElapsed = dwTime - m_dwSentTime;
+            if( dwElapsed < m_dwMinInterval )
+                return FALSE;
+            if( dwElapsed >= DEAD_RECKONING_HEARTBEAT || pState->dwState != m_Sent.dwState )
+                return TRUE;
+
+            // Compare against what everyone else is predicting
+            FLOAT fPredicted[3];
+            ExtrapolatePosition( &m_Sent, dwElapsed / 1000.0f, fPredicted );
+            FLOAT fErrorSq = 0.0f;
+            for( int i = 0; i < 3; ++i )
+                fErrorSq += (pState->fPosition[i] - fPredicted[i]) * (pState->fPosition[i] - fPredicted[i]);
+            return fErrorSq > m_fPositionError * m_fPositionError ||
+                   AngleBetween( pState->fYaw, m_Sent.fYaw ) > m_fYawError;
+        }
+
+        /// Records that pState was sent at dwTime.  The state is quantized the way it went over the
+        /// wire, so the prediction is exactly the one the receivers make.
+        VOID Sent( const PlayerState * pState, FLOAT fWorldBound, DWORD dwTime )
+        {
+            QuantizedState quantized;
+            QuantizeState( pState, fWorldBound, &quantized );
+            DequantizeState( &quantized, fWorldBound, &m_Sent );
+            m_dwSentTime = dwTime;
+            m_bSent = TRUE;
+        }
+
+    protected:
+
+        FLOAT m_fPositionError;
+        FLOAT m_fYawError;
+        DWORD m_dwMinInterval;
+        BOOL m_bSent;
+        PlayerState m_Sent;
+        DWORD m_dwSentTime;
+};
+
+#endif // __DEADRECKONING_H__
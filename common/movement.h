@@ -0,0 +1,222 @@
+//------------------------------------------------------------------------------------------------
+// File:    movement.h
+//
+// Desc:    How players move, shared by the client's prediction and the server's simulation
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __MOVEMENT_H__
+#define __MOVEMENT_H__
+
+
+// Include files required to compile this header
+#include "platform.h"
+#include "protocol.h"
+#include "wireformat.h"
+
+// What a player is doing.  These are the same numbers as the client's animation tracks, and
+// they're sent as the state of the player.
+#define MOVEMENT_RUN            1
+#define MOVEMENT_WALK           2
+#define MOVEMENT_IDLE           3
+
+// How the movement keys push a player along.  Velocity is along the facing direction, and
+// forward is negative.
+#define WALK_ACCELERATION       5.5f
+#define RUN_ACCELERATION        15.0f
+#define VELOCITY_DECAY          8.0f
+
+// Fastest a player can go, which is where running speeds it up as much as the decay slows it
+// down.  This has to fit within MAX_WIRE_SPEED.
+#define MAX_MOVEMENT_SPEED      (RUN_ACCELERATION / VELOCITY_DECAY)
+
+// How quickly a player turns toward the direction it's trying to face.  Each second, the part
+// of the turn still to go shrinks by a factor of e^MOVEMENT_TURN_RATE.
+#define MOVEMENT_TURN_RATE      13.2f
+
+// Longest one input can last, in milliseconds.  Longer frames are split into several inputs.
+#define MAX_INPUT_DURATION      100
+
+// Inputs a client remembers until the server has applied them, and most that fit in a message
+#define INPUT_HISTORY_SIZE      128
+#define MAX_INPUTS_PER_MESSAGE  32
+
+// How often a client sends its inputs when the server is authoritative.  Every message repeats
+// the inputs that haven't been acknowledged yet, so a lost one costs nothing.
+#define INPUT_SEND_FREQUENCY    20
+
+// How many milliseconds of input the server will take ahead of its own clock, which covers a
+// burst of late inputs but not a client that claims more time has passed than really has
+#define MAX_INPUT_BUDGET        250
+
+// Bits in each input in a MSG_PLAYERINPUT, and the largest that message can be:  the ID, a
+// varint sequence number and a one-byte count
+#define INPUT_DURATION_BITS     7
+#define INPUT_STATE_BITS        2
+#define INPUT_BITS              (INPUT_DURATION_BITS + INPUT_STATE_BITS + WIRE_YAW_BITS)
+#define MAX_PLAYER_INPUT_SIZE   (1 + 5 + 1 + (MAX_INPUTS_PER_MESSAGE * INPUT_BITS + 7) / 8)
+
+/**
+ * What a player's keys and mouse asked for over a stretch of time.  The yaw is kept quantized,
+ * so the client predicts with exactly what the server will apply.
+ */
+struct PlayerInput
+{
+    WORD wDuration;                 // Milliseconds, up to MAX_INPUT_DURATION
+    WORD wState;                    // One of the MOVEMENT_ values
+    WORD wYaw;                      // Direction the player is trying to face, from QuantizeAngle
+};
+
+/**
+ * Everything about a player that its inputs change
+ */
+struct MovementState
+{
+    FLOAT fPosition[3];
+    FLOAT fVelocity;                // Along the facing direction
+    FLOAT fYaw;                     // Direction the player is facing
+    FLOAT fTargetYaw;               // Direction it's turning toward
+    DWORD dwState;
+};
+
+/**
+ * Moves a player by one input.  The client and the server both call this, so that the server
+ * ends up wherever the client predicted as long as it gets the same inputs.
+ *   @param pMovement Player to move
+ *   @param pInput What the player's controls were doing
+ */
+inline VOID ApplyInput( MovementState * pMovement, const PlayerInput * pInput )
+{
+    const FLOAT fPi = 3.14159265f;
+    FLOAT fSeconds = pInput->wDuration / 1000.0f;
+    pMovement->dwState = pInput->wState;
+    pMovement->fTargetYaw = DequantizeAngle( pInput->wYaw, WIRE_YAW_BITS );
+
+    // Speed up while a movement key is held down
+    if( pInput->wState == MOVEMENT_RUN )
+        pMovement->fVelocity -= fSeconds * RUN_ACCELERATION;
+    else if( pInput->wState == MOVEMENT_WALK )
+        pMovement->fVelocity -= fSeconds * WALK_ACCELERATION;
+
+    // Turn toward the target the short way around
+    while( pMovement->fTargetYaw - pMovement->fYaw >  fPi ) pMovement->fYaw += fPi * 2.0f;
+    while( pMovement->fTargetYaw - pMovement->fYaw < -fPi ) pMovement->fYaw -= fPi * 2.0f;
+    pMovement->fYaw += (1.0f - expf( -MOVEMENT_TURN_RATE * fSeconds )) * (pMovement->fTargetYaw - pMovement->fYaw);
+
+    // Move, then let the velocity decay
+    pMovement->fPosition[0] += sinf( pMovement->fYaw ) * pMovement->fVelocity * fSeconds;
+    pMovement->fPosition[2] += cosf( pMovement->fYaw ) * pMovement->fVelocity * fSeconds;
+    pMovement->fVelocity *= 1.0f - fSeconds * VELOCITY_DECAY;
+}
+
+/**
+ * Gets the state that's sent to everyone else for a player moving this way.  The velocity is
+ * in world space, so that receivers can extrapolate with it.
+ *   @param pMovement How the player is moving
+ *   @param dwPlayerID Player's ID
+ *   @param pState State to fill in
+ */
+inline VOID GetMovementPlayerState( const MovementState * pMovement, DWORD dwPlayerID, PlayerState * pState )
+{
+    pState->dwPlayerID = dwPlayerID;
+    pState->fVelocity[0] = sinf( pMovement->fYaw ) * pMovement->fVelocity;
+    pState->fVelocity[1] = 0.0f;
+    pState->fVelocity[2] = cosf( pMovement->fYaw ) * pMovement->fVelocity;
+    pState->fPosition[0] = pMovement->fPosition[0];
+    pState->fPosition[1] = pMovement->fPosition[1];
+    pState->fPosition[2] = pMovement->fPosition[2];
+    pState->dwState = pMovement->dwState;
+    pState->fYaw = pMovement->fTargetYaw;
+}
+
+/**
+ * Packs a run of inputs into a MSG_PLAYERINPUT datagram
+ *   @param dwFirstSequence Sequence number of the first input
+ *   @param pInputs Inputs to send, oldest first
+ *   @param dwCount How many; no more than MAX_INPUTS_PER_MESSAGE
+ *   @param pBuffer Destination for the datagram
+ *   @param dwSize Number of bytes available; MAX_PLAYER_INPUT_SIZE is always enough
+ *   @return Number of bytes written, or 0 if the buffer was too small
+ */
+inline DWORD EncodePlayerInput( DWORD dwFirstSequence, const PlayerInput * pInputs, DWORD dwCount,
+                                BYTE * pBuffer, DWORD dwSize )
+{
+    BitWriter writer( pBuffer, dwSize );
+    if( dwCount > MAX_INPUTS_PER_MESSAGE ||
+        !writer.Write( MSG_PLAYERINPUT, 8 ) ||
+        !writer.WriteVarint( dwFirstSequence ) ||
+        !writer.Write( dwCount, 8 ) )
+        return 0;
+
+    for( DWORD i = 0; i < dwCount; ++i )
+    {
+        if( !writer.Write( pInputs[i].wDuration, INPUT_DURATION_BITS ) ||
+            !writer.Write( pInputs[i].wState, INPUT_STATE_BITS ) ||
+            !writer.Write( pInputs[i].wYaw, WIRE_YAW_BITS ) )
+            return 0;
+    }
+
+    return writer.GetSize();
+}
+
+/**
+ * Unpacks a datagram made by EncodePlayerInput
+ *   @param pBuffer Datagram that was received
+ *   @param dwSize Size of the datagram
+ *   @param pFirstSequence Gets the sequence number of the first input
+ *   @param pInputs Gets the inputs; must have room for MAX_INPUTS_PER_MESSAGE
+ *   @param pCount Gets the number of inputs
+ *   @return TRUE if the datagram was complete
+ */
+inline BOOL DecodePlayerInput( const BYTE * pBuffer, DWORD dwSize, DWORD * pFirstSequence,
+                               PlayerInput * pInputs, DWORD * pCount )
+{
+    BitReader reader( pBuffer, dwSize );
+    DWORD dwMsgID, dwCount, dwValue;
+    if( !reader.Read( &dwMsgID, 8 ) || dwMsgID != MSG_PLAYERINPUT ||
+        !reader.ReadVarint( pFirstSequence ) ||
+        !reader.Read( &dwCount, 8 ) || dwCount > MAX_INPUTS_PER_MESSAGE )
+        return FALSE;
+
+    for( DWORD i = 0; i < dwCount; ++i )
+    {
+        if( !reader.Read( &dwValue, INPUT_DURATION_BITS ) || dwValue > MAX_INPUT_DURATION )
+            return FALSE;
+        pInputs[i].wDuration = (WORD)dwValue;
+        if( !reader.Read( &dwValue, INPUT_STATE_BITS ) || dwValue == 0 )
+            return FALSE;
+        pInputs[i].wState = (WORD)dwValue;
+        if( !reader.Read( &dwValue, WIRE_YAW_BITS ) )
+            return FALSE;
+        pInputs[i].wYaw = (WORD)dwValue;
+    }
+
+    *pCount = dwCount;
+    return TRUE;
+}
+
+#endif // __MOVEMENT_H__
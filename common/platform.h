@@ -0,0 +1,318 @@
+//------------------------------------------------------------------------------------------------
+// File:    platform.h
+//
+// Desc:    Declarations that let the network code compile against Winsock or BSD sockets
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __PLATFORM_H__
+#define __PLATFORM_H__
+
+
+#if defined(WIN32) || defined(_WIN32)
+
+// The reactor selects on every session socket at once, so raise Winsock's default limit of 64.
+// This has to be defined before winsock2.h is included anywhere in the translation unit.
+#ifndef FD_SETSIZE
+#define FD_SETSIZE  4096
+#endif
+
+#include <winsock2.h>
+#include <windows.h>
+#include <conio.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef int socklen_t;
+typedef unsigned __int64 QWORD;
+
+#else
+
+// Include files required to emulate the parts of Win32 that the server uses
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+// Basic Win32 types.  DWORD has to stay 32 bits wide because it goes out on the wire.
+typedef uint32_t    DWORD;
+typedef uint16_t    WORD;
+typedef uint8_t     BYTE;
+typedef int32_t     BOOL;
+typedef int32_t     HRESULT;
+typedef uint64_t    QWORD;
+typedef float       FLOAT;
+typedef double      DOUBLE;
+typedef char        CHAR;
+typedef void *      LPVOID;
+typedef void *      HANDLE;
+typedef DWORD *     LPDWORD;
+typedef int32_t     LONG;
+typedef uintptr_t   DWORD_PTR;
+#define VOID        void
+#define WINAPI
+
+#define TRUE        1
+#define FALSE       0
+#define INFINITE    0xFFFFFFFF
+#define WAIT_OBJECT_0   0
+
+// Result codes
+#define S_OK            ((HRESULT)0L)
+#define S_FALSE         ((HRESULT)1L)
+#define E_FAIL          ((HRESULT)0x80004005L)
+#define E_OUTOFMEMORY   ((HRESULT)0x8007000EL)
+#define SUCCEEDED(hr)   (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)      (((HRESULT)(hr)) < 0)
+
+// Sockets
+typedef int                     SOCKET;
+typedef struct sockaddr         SOCKADDR;
+typedef struct sockaddr *       LPSOCKADDR;
+typedef struct sockaddr_in      SOCKADDR_IN;
+typedef struct sockaddr_in *    LPSOCKADDR_IN;
+typedef struct hostent *        LPHOSTENT;
+#define INVALID_SOCKET  (-1)
+#define SOCKET_ERROR    (-1)
+#define closesocket     close
+#define SD_SEND         SHUT_WR
+
+// Memory and debugging
+#define ZeroMemory( p, n )          memset( (p), 0, (n) )
+#define OutputDebugString( s )      ((void)0)
+
+// Console input
+#define _getch  getchar
+
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)( LPVOID );
+
+// High-resolution counter values; only QuadPart is used
+typedef union _LARGE_INTEGER
+{
+    int64_t QuadPart;
+} LARGE_INTEGER;
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetTickCount
+// Desc:  Milliseconds on a monotonic clock, like the Win32 call
+//------------------------------------------------------------------------------------------------
+inline DWORD GetTickCount()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (DWORD)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Sleep
+// Desc:  Blocks the calling thread for at least the given number of milliseconds
+//------------------------------------------------------------------------------------------------
+inline VOID Sleep( DWORD dwMilliseconds )
+{
+    usleep( dwMilliseconds * 1000 );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  QueryPerformanceCounter
+// Desc:  Nanoseconds on a monotonic clock.  QueryPerformanceFrequency reports the matching rate.
+//------------------------------------------------------------------------------------------------
+inline BOOL QueryPerformanceCounter( LARGE_INTEGER * pCount )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    pCount->QuadPart = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  QueryPerformanceFrequency
+// Desc:  QueryPerformanceCounter counts nanoseconds
+//------------------------------------------------------------------------------------------------
+inline BOOL QueryPerformanceFrequency( LARGE_INTEGER * pFrequency )
+{
+    pFrequency->QuadPart = 1000000000;
+    return TRUE;
+}
+
+
+// Thread handles are the only kind of HANDLE the server needs outside of Windows
+struct PosixThread
+{
+    pthread_t thread;
+    LPTHREAD_START_ROUTINE lpStartAddress;
+    LPVOID lpParameter;
+
+    static void * Entry( void * pParam )
+    {
+        PosixThread * pThread = (PosixThread*)pParam;
+        pThread->lpStartAddress( pThread->lpParameter );
+        return NULL;
+    }
+};
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CreateThread
+// Desc:  Starts a pthread using the Win32 calling convention.  Security, stack size, creation
+//        flags and the thread ID output are ignored.
+//------------------------------------------------------------------------------------------------
+inline HANDLE CreateThread( LPVOID, size_t, LPTHREAD_START_ROUTINE lpStartAddress,
+                            LPVOID lpParameter, DWORD, LPDWORD )
+{
+    PosixThread * pThread = new PosixThread;
+    pThread->lpStartAddress = lpStartAddress;
+    pThread->lpParameter = lpParameter;
+    if( 0 != pthread_create( &pThread->thread, NULL, PosixThread::Entry, pThread ) )
+    {
+        delete pThread;
+        return NULL;
+    }
+    return (HANDLE)pThread;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  WaitForSingleObject
+// Desc:  Joins a thread created with CreateThread.  Only an infinite wait is supported.
+//------------------------------------------------------------------------------------------------
+inline DWORD WaitForSingleObject( HANDLE hThread, DWORD )
+{
+    if( hThread )
+        pthread_join( ((PosixThread*)hThread)->thread, NULL );
+    return WAIT_OBJECT_0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CloseHandle
+// Desc:  Frees a thread handle
+//------------------------------------------------------------------------------------------------
+inline BOOL CloseHandle( HANDLE hThread )
+{
+    delete (PosixThread*)hThread;
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SetThreadAffinityMask
+// Desc:  Limits a thread created with CreateThread to the processors whose bits are set.
+//        Returns zero on failure; the previous mask isn't reported.
+//------------------------------------------------------------------------------------------------
+inline DWORD_PTR SetThreadAffinityMask( HANDLE hThread, DWORD_PTR dwMask )
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    for( DWORD i = 0; i < sizeof(dwMask) * 8; ++i )
+    {
+        if( dwMask & ((DWORD_PTR)1 << i) )
+            CPU_SET( i, &set );
+    }
+    if( 0 == pthread_setaffinity_np( ((PosixThread*)hThread)->thread, sizeof(set), &set ) )
+        return dwMask;
+#endif
+    return 0;
+}
+
+
+// Critical sections are plain mutexes
+typedef pthread_mutex_t CRITICAL_SECTION;
+#define InitializeCriticalSection( p )  pthread_mutex_init( (p), NULL )
+#define DeleteCriticalSection( p )      pthread_mutex_destroy( p )
+#define EnterCriticalSection( p )       pthread_mutex_lock( p )
+#define LeaveCriticalSection( p )       pthread_mutex_unlock( p )
+
+// Atomic counters
+#define InterlockedIncrement( p )       __sync_add_and_fetch( (p), 1 )
+#define InterlockedDecrement( p )       __sync_sub_and_fetch( (p), 1 )
+
+#endif
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SetSocketNonBlocking
+// Desc:  Makes receive calls on the socket return SOCKET_ERROR instead of waiting for data
+//------------------------------------------------------------------------------------------------
+inline BOOL SetSocketNonBlocking( SOCKET sSocket )
+{
+#if defined(WIN32) || defined(_WIN32)
+    u_long ulNonBlocking = 1;
+    return SOCKET_ERROR != ioctlsocket( sSocket, FIONBIO, &ulNonBlocking );
+#else
+    int iFlags = fcntl( sSocket, F_GETFL, 0 );
+    return -1 != fcntl( sSocket, F_SETFL, iFlags | O_NONBLOCK );
+#endif
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetProcessorCount
+// Desc:  How many processors the system has online
+//------------------------------------------------------------------------------------------------
+inline DWORD GetProcessorCount()
+{
+#if defined(WIN32) || defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo( &info );
+    return info.dwNumberOfProcessors;
+#else
+    long lCount = sysconf( _SC_NPROCESSORS_ONLN );
+    return lCount > 0 ? (DWORD)lCount : 1;
+#endif
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetMicrosecondCount
+// Desc:  Microseconds on the high-resolution counter, for timing things shorter than a tick
+//------------------------------------------------------------------------------------------------
+inline QWORD GetMicrosecondCount()
+{
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter( &count );
+    QueryPerformanceFrequency( &frequency );
+    return (QWORD)(count.QuadPart / frequency.QuadPart) * 1000000 +
+           (QWORD)(count.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+}
+
+
+#endif // __PLATFORM_H__
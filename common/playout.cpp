@@ -0,0 +1,262 @@
+//------------------------------------------------------------------------------------------------
+// File:    playout.cpp
+//
+// Desc:    Plays other players' snapshots back a little late, so that jitter doesn't show
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "playout.h"
+#include <string.h>
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  PlayoutClock
+// Desc:  
+//------------------------------------------------------------------------------------------------
+PlayoutClock::PlayoutClock()
+{
+    Reset();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Reset
+// Desc:  Forgets the timeline, so that the next snapshot starts it over.  Call this when the
+//        server starts numbering snapshots from the beginning again.
+//------------------------------------------------------------------------------------------------
+VOID PlayoutClock::Reset()
+{
+    m_bStarted = FALSE;
+    m_dwBase = 0;
+    m_fTransit = 0.0f;
+    m_fLastTransit = 0.0f;
+    m_fJitter = 0.0f;
+    m_fDelay = (FLOAT)SNAPSHOT_PERIOD;
+    m_dwPlayout = 0;
+    m_fFraction = 0.0f;
+    m_dwLastAdvance = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Arrived
+// Desc:  Measures a snapshot that arrived at local time dwTime (in milliseconds), and resizes the
+//        delay to match.  Returns TRUE if the snapshot came too late to be interpolated toward,
+//        meaning its players had to be extrapolated for a while.
+//------------------------------------------------------------------------------------------------
+BOOL PlayoutClock::Arrived( DWORD dwSequence, DWORD dwTime )
+{
+    DWORD dwSent = dwSequence * SNAPSHOT_PERIOD;
+
+    // The first snapshot sets up the timeline; transit times are measured relative to its own
+    if( !m_bStarted )
+    {
+        m_bStarted = TRUE;
+        m_dwBase = dwTime - dwSent;
+        m_dwPlayout = dwSent - SNAPSHOT_PERIOD;
+        m_dwLastAdvance = dwTime;
+        return FALSE;
+    }
+
+    // Catch the clock up to now, so that lateness is judged against where it actually is
+    Advance( dwTime );
+    BOOL bLate = (int)(m_dwPlayout - (dwSent - SNAPSHOT_PERIOD)) > 0;
+
+    // Average the transit time and the jitter
+    FLOAT fTransit = (FLOAT)(int)(dwTime - dwSent - m_dwBase);
+    m_fJitter += (fabsf( fTransit - m_fLastTransit ) - m_fJitter) / 16.0f;
+    m_fLastTransit = fTransit;
+    m_fTransit += (fTransit - m_fTransit) / 16.0f;
+
+    // Size the delay so that snapshots running a few times the jitter late still make it
+    m_fDelay = SNAPSHOT_PERIOD + PLAYOUT_JITTER_MARGIN * m_fJitter;
+    if( m_fDelay > MAX_PLAYOUT_DELAY )
+        m_fDelay = MAX_PLAYOUT_DELAY;
+
+    return bLate;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Advance
+// Desc:  Moves the clock up to local time dwTime (in milliseconds).  Call this once per frame
+//        before drawing.
+//------------------------------------------------------------------------------------------------
+VOID PlayoutClock::Advance( DWORD dwTime )
+{
+    if( !m_bStarted )
+        return;
+
+    FLOAT fElapsed = (FLOAT)(dwTime - m_dwLastAdvance);
+    m_dwLastAdvance = dwTime;
+
+    // Find where the clock should be:  the snapshot that's arriving right now, on average, less
+    // the delay.  The whole milliseconds are kept apart from the fraction so that the clock
+    // doesn't lose precision as the timeline gets longer.
+    FLOAT fBehind = m_fTransit + m_fDelay;
+    int iBehind = (int)ceilf( fBehind );
+    DWORD dwTarget = dwTime - m_dwBase - iBehind;
+    FLOAT fError = (FLOAT)(int)(dwTarget - m_dwPlayout) + (iBehind - fBehind) - m_fFraction - fElapsed;
+
+    // Run a little fast or slow to close the gap, unless it's so far off (after a stall, for
+    // example) that it's better to jump
+    FLOAT fStep;
+    if( fabsf( fError ) > MAX_PLAYOUT_DELAY )
+        fStep = fError;
+    else
+    {
+        FLOAT fSlew = fElapsed * PLAYOUT_SLEW;
+        fStep = fElapsed + (fError > fSlew ? fSlew : fError < -fSlew ? -fSlew : fError);
+    }
+
+    fStep += m_fFraction;
+    int iWhole = (int)floorf( fStep );
+    m_dwPlayout += iWhole;
+    m_fFraction = fStep - iWhole;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  PlayoutBuffer
+// Desc:  
+//------------------------------------------------------------------------------------------------
+PlayoutBuffer::PlayoutBuffer()
+{
+    Reset();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Reset
+// Desc:  Empties the buffer; used when the player comes into view
+//------------------------------------------------------------------------------------------------
+VOID PlayoutBuffer::Reset()
+{
+    m_dwCount = 0;
+    m_dwNewest = 0;
+    m_dwReceivedTime = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Add
+// Desc:  Stores the player's state from snapshot dwSequence.  Snapshots older than the newest
+//        one stored are ignored.
+//------------------------------------------------------------------------------------------------
+VOID PlayoutBuffer::Add( DWORD dwSequence, const PlayerState * pState )
+{
+    DWORD dwTime = dwSequence * SNAPSHOT_PERIOD;
+    if( m_dwCount && (int)(dwTime - m_Samples[m_dwNewest].dwTime) <= 0 )
+        return;
+
+    // Start extrapolating over whenever the player sends something new
+    if( !m_dwCount || 0 != memcmp( &m_Received, pState, sizeof(PlayerState) ) )
+    {
+        m_Received = *pState;
+        m_dwReceivedTime = dwTime;
+    }
+
+    // A player that hasn't sent anything for longer than the heartbeat has stopped sending, so
+    // don't carry it off into the distance
+    DWORD dwAge = dwTime - m_dwReceivedTime;
+    if( dwAge > DEAD_RECKONING_HEARTBEAT )
+        dwAge = DEAD_RECKONING_HEARTBEAT;
+
+    m_dwNewest = (m_dwNewest + 1) % PLAYOUT_HISTORY_SIZE;
+    if( m_dwCount < PLAYOUT_HISTORY_SIZE )
+        m_dwCount++;
+
+    PlayoutSample * pSample = &m_Samples[m_dwNewest];
+    pSample->dwTime = dwTime;
+    pSample->State = m_Received;
+    ExtrapolatePosition( &m_Received, dwAge / 1000.0f, pSample->State.fPosition );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Sample
+// Desc:  Gets the player's state at the clock's time.  Between two snapshots the position is
+//        interpolated; before the first it holds still, and past the newest it keeps moving for
+//        up to MAX_EXTRAPOLATION.  The facing and animation come from the earlier snapshot.
+//        Returns FALSE if there are no snapshots of this player.
+//------------------------------------------------------------------------------------------------
+BOOL PlayoutBuffer::Sample( const PlayoutClock * pClock, PlayerState * pState ) const
+{
+    if( !m_dwCount )
+        return FALSE;
+
+    // Find the newest snapshot at or before the clock
+    DWORD dwTime = pClock->GetTime();
+    DWORD dwIndex = m_dwNewest;
+    DWORD dwSearched = 1;
+    while( (int)(dwTime - m_Samples[dwIndex].dwTime) < 0 )
+    {
+        // The clock is before every snapshot we have, so stay at the oldest
+        if( dwSearched == m_dwCount )
+        {
+            *pState = m_Samples[dwIndex].State;
+            return TRUE;
+        }
+
+        dwIndex = (dwIndex + PLAYOUT_HISTORY_SIZE - 1) % PLAYOUT_HISTORY_SIZE;
+        dwSearched++;
+    }
+
+    const PlayoutSample * pFrom = &m_Samples[dwIndex];
+    FLOAT fSince = (dwTime - pFrom->dwTime) + pClock->GetFraction();
+    *pState = pFrom->State;
+
+    // The next snapshot hasn't arrived yet, so keep the player moving the way it was
+    if( dwIndex == m_dwNewest )
+    {
+        if( fSince > MAX_EXTRAPOLATION )
+            fSince = MAX_EXTRAPOLATION;
+        ExtrapolatePosition( &pFrom->State, fSince / 1000.0f, pState->fPosition );
+        return TRUE;
+    }
+
+    // Follow the curve from this snapshot to the next.  The Hermite basis takes tangents over
+    // the whole interval, so the velocities are scaled by its length.
+    const PlayoutSample * pTo = &m_Samples[(dwIndex + 1) % PLAYOUT_HISTORY_SIZE];
+    FLOAT fInterval = (FLOAT)(pTo->dwTime - pFrom->dwTime);
+    FLOAT t = fSince / fInterval;
+    FLOAT t2 = t * t, t3 = t2 * t;
+    FLOAT h00 = 2.0f * t3 - 3.0f * t2 + 1.0f;
+    FLOAT h10 = t3 - 2.0f * t2 + t;
+    FLOAT h01 = 3.0f * t2 - 2.0f * t3;
+    FLOAT h11 = t3 - t2;
+    FLOAT fSeconds = fInterval / 1000.0f;
+    for( int i = 0; i < 3; ++i )
+    {
+        pState->fPosition[i] = h00 * pFrom->State.fPosition[i] + h10 * fSeconds * pFrom->State.fVelocity[i] +
+                               h01 * pTo->State.fPosition[i] + h11 * fSeconds * pTo->State.fVelocity[i];
+        pState->fVelocity[i] = pFrom->State.fVelocity[i] + t * (pTo->State.fVelocity[i] - pFrom->State.fVelocity[i]);
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,149 @@
+//------------------------------------------------------------------------------------------------
+// File:    playout.h
+//
+// Desc:    Plays other players' snapshots back a little late, so that jitter doesn't show
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __PLAYOUT_H__
+#define __PLAYOUT_H__
+
+
+// Include files required to compile this header
+#include "platform.h"
+#include "protocol.h"
+#include "snapshot.h"
+#include "deadreckoning.h"
+
+// How many snapshots are kept for each player.  This has to cover the longest playout delay,
+// plus the snapshot on either side of it.
+#define PLAYOUT_HISTORY_SIZE    8
+
+// Limits on how far behind the server the other players are drawn, in milliseconds.  The delay
+// is never less than one snapshot period, since there has to be a snapshot on each side of the
+// time being drawn.
+#define MAX_PLAYOUT_DELAY       500
+
+// How many times the measured jitter is added to the delay.  More drops fewer late snapshots,
+// at the cost of drawing everyone further in the past.
+#define PLAYOUT_JITTER_MARGIN   3.0f
+
+// How much faster or slower than real time the playout clock may run while it catches up with
+// a new delay.  Small enough that the change in speed can't be seen.
+#define PLAYOUT_SLEW            0.1f
+
+// Longest a player keeps moving past its newest snapshot when the next one is late, in ms
+#define MAX_EXTRAPOLATION       250
+
+/**
+ * Decides what point in the server's timeline to draw the other players at.  Snapshots are sent
+ * once per SNAPSHOT_PERIOD, so a snapshot's sequence number says when the server sent it.  How
+ * long they take to arrive is averaged, and so is how much that varies from one snapshot to the
+ * next (the jitter, measured the way RTP does it).  The clock runs behind the newest snapshot by
+ * one period plus a few times the jitter, so the snapshot on the far side of the time being
+ * drawn has almost always arrived.  When the delay changes, the clock speeds up or slows down a
+ * little until it's caught up instead of jumping.
+ *   @author Karl Gluck
+ */
+class PlayoutClock
+{
+    public:
+
+        PlayoutClock();
+        VOID Reset();
+
+        BOOL Arrived( DWORD dwSequence, DWORD dwTime );
+        VOID Advance( DWORD dwTime );
+
+        /// Gets the time being drawn, in milliseconds on the server's snapshot timeline
+        DWORD GetTime() const { return m_dwPlayout; }
+
+        /// Gets the part of a millisecond past GetTime() being drawn
+        FLOAT GetFraction() const { return m_fFraction; }
+
+        /// Gets how far behind the newest snapshot the clock is trying to run, in milliseconds
+        FLOAT GetDelay() const { return m_fDelay; }
+
+        /// Gets the measured jitter, in milliseconds
+        FLOAT GetJitter() const { return m_fJitter; }
+
+    protected:
+
+        BOOL m_bStarted;
+        DWORD m_dwBase;             // Local time minus snapshot time for the first snapshot
+        FLOAT m_fTransit;           // Average transit time, relative to the first snapshot's
+        FLOAT m_fLastTransit;
+        FLOAT m_fJitter;
+        FLOAT m_fDelay;
+
+        DWORD m_dwPlayout;          // Time being drawn, on the snapshot timeline
+        FLOAT m_fFraction;
+        DWORD m_dwLastAdvance;      // Local time the clock was last moved forward
+};
+
+/**
+ * One player's state from one snapshot
+ */
+struct PlayoutSample
+{
+    DWORD dwTime;                   // When the snapshot was sent, on the snapshot timeline
+    PlayerState State;              // Position extrapolated to dwTime
+};
+
+/**
+ * The most recent snapshots of one other player, which are interpolated to draw it at the time
+ * the PlayoutClock gives.  Positions between two snapshots follow a cubic Hermite curve through
+ * both positions with both velocities as tangents, so the player moves smoothly through each
+ * snapshot even when they're far apart.
+ *
+ * Players only send when their movement changes, and snapshots repeat the last thing they sent
+ * until then.  A repeated state is moved along by its velocity for the time since it first
+ * appeared, so that the samples follow the player instead of piling up in one place.
+ *   @author Karl Gluck
+ */
+class PlayoutBuffer
+{
+    public:
+
+        PlayoutBuffer();
+        VOID Reset();
+
+        VOID Add( DWORD dwSequence, const PlayerState * pState );
+        BOOL Sample( const PlayoutClock * pClock, PlayerState * pState ) const;
+
+    protected:
+
+        PlayoutSample m_Samples[PLAYOUT_HISTORY_SIZE];
+        DWORD m_dwCount;
+        DWORD m_dwNewest;           // Index of the newest sample
+
+        // The last state this player sent, and the snapshot time it first showed up at
+        PlayerState m_Received;
+        DWORD m_dwReceivedTime;
+};
+
+#endif // __PLAYOUT_H__
@@ -0,0 +1,155 @@
+//------------------------------------------------------------------------------------------------
+// File:    prediction.cpp
+//
+// Desc:    Moves the local player ahead of the server, and corrects it when the server disagrees
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "prediction.h"
+#include <math.h>
+#include <string.h>
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  InputPrediction
+// Desc:  
+//------------------------------------------------------------------------------------------------
+InputPrediction::InputPrediction()
+{
+    MovementState start;
+    memset( &start, 0, sizeof(start) );
+    start.dwState = MOVEMENT_IDLE;
+    Reset( &start );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Reset
+// Desc:  Puts the player at pStart and forgets every input
+//------------------------------------------------------------------------------------------------
+VOID InputPrediction::Reset( const MovementState * pStart )
+{
+    m_Movement = *pStart;
+    m_fCarry = 0.0f;
+    memset( m_Inputs, 0, sizeof(m_Inputs) );
+    m_dwNextInput = 1;
+    m_dwAckedInput = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Predict
+// Desc:  Moves the player by the controls that were held for fElapsedTime seconds.  Inputs are
+//        whole milliseconds, so whatever is left over is carried into the next call.
+//------------------------------------------------------------------------------------------------
+VOID InputPrediction::Predict( FLOAT fElapsedTime, DWORD dwState, FLOAT fTargetYaw )
+{
+    PlayerInput input;
+    input.wState = (WORD)dwState;
+    input.wYaw = (WORD)QuantizeAngle( fTargetYaw, WIRE_YAW_BITS );
+
+    m_fCarry += fElapsedTime * 1000.0f;
+    while( m_fCarry >= 1.0f )
+    {
+        input.wDuration = (WORD)(m_fCarry < MAX_INPUT_DURATION ? m_fCarry : MAX_INPUT_DURATION);
+        m_fCarry -= input.wDuration;
+        ApplyInput( &m_Movement, &input );
+        m_Inputs[m_dwNextInput++ % INPUT_HISTORY_SIZE] = input;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  EncodeInputs
+// Desc:  Builds a MSG_PLAYERINPUT with the oldest inputs the server hasn't applied yet.  Returns
+//        its size, or 0 if there's nothing to send.  If pLastSequence isn't NULL, it gets the
+//        sequence number of the newest input in the message.
+//------------------------------------------------------------------------------------------------
+DWORD InputPrediction::EncodeInputs( BYTE * pBuffer, DWORD dwSize, DWORD * pLastSequence ) const
+{
+    DWORD dwFirst = GetOldestUnacked();
+    DWORD dwCount = m_dwNextInput - dwFirst;
+    if( dwCount > MAX_INPUTS_PER_MESSAGE )
+        dwCount = MAX_INPUTS_PER_MESSAGE;
+    if( !dwCount )
+        return 0;
+
+    PlayerInput inputs[MAX_INPUTS_PER_MESSAGE];
+    for( DWORD i = 0; i < dwCount; ++i )
+        inputs[i] = m_Inputs[(dwFirst + i) % INPUT_HISTORY_SIZE];
+
+    if( pLastSequence )
+        *pLastSequence = dwFirst + dwCount - 1;
+    return EncodePlayerInput( dwFirst, inputs, dwCount, pBuffer, dwSize );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Reconcile
+// Desc:  Starts again from where the server says its inputs have put the player, and replays the
+//        inputs the server hasn't applied yet.  pfCorrection gets how far that moved the player.
+//        Returns FALSE if the acknowledgement was older than one already handled.
+//------------------------------------------------------------------------------------------------
+BOOL InputPrediction::Reconcile( const InputAckMessage * pAck, FLOAT * pfCorrection )
+{
+    if( (int)(pAck->dwSequence - m_dwAckedInput) <= 0 ||
+        (int)(m_dwNextInput - pAck->dwSequence) <= 0 )
+        return FALSE;
+
+    FLOAT fPredictedX = m_Movement.fPosition[0];
+    FLOAT fPredictedZ = m_Movement.fPosition[2];
+
+    memcpy( m_Movement.fPosition, pAck->fPosition, sizeof(m_Movement.fPosition) );
+    m_Movement.fVelocity = pAck->fVelocity;
+    m_Movement.fYaw = pAck->fYaw;
+    m_Movement.fTargetYaw = pAck->fTargetYaw;
+    m_Movement.dwState = pAck->dwState;
+    m_dwAckedInput = pAck->dwSequence;
+
+    for( DWORD dwSequence = GetOldestUnacked(); dwSequence != m_dwNextInput; ++dwSequence )
+        ApplyInput( &m_Movement, &m_Inputs[dwSequence % INPUT_HISTORY_SIZE] );
+
+    FLOAT fX = m_Movement.fPosition[0] - fPredictedX;
+    FLOAT fZ = m_Movement.fPosition[2] - fPredictedZ;
+    *pfCorrection = sqrtf( fX * fX + fZ * fZ );
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetOldestUnacked
+// Desc:  Gets the sequence number of the oldest input the server hasn't applied.  Inputs that
+//        have dropped out of the history are lost; the server just skips over them.
+//------------------------------------------------------------------------------------------------
+DWORD InputPrediction::GetOldestUnacked() const
+{
+    DWORD dwFirst = m_dwAckedInput + 1;
+    if( m_dwNextInput - dwFirst > INPUT_HISTORY_SIZE )
+        dwFirst = m_dwNextInput - INPUT_HISTORY_SIZE;
+    return dwFirst;
+}
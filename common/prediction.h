@@ -0,0 +1,81 @@
+//------------------------------------------------------------------------------------------------
+// File:    prediction.h
+//
+// Desc:    Moves the local player ahead of the server, and corrects it when the server disagrees
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __PREDICTION_H__
+#define __PREDICTION_H__
+
+
+// Include files required to compile this header
+#include "platform.h"
+#include "protocol.h"
+#include "movement.h"
+
+/**
+ * Moves the local player straight away from its controls, and remembers each input it made so
+ * that they can be sent to an authoritative server.  When the server says where an input put
+ * the player, the prediction starts over from there and the inputs the server hasn't seen yet
+ * are replayed on top.  As long as the server applied the same inputs, nothing moves.
+ *
+ * Inputs are numbered from 1 each time the prediction is reset, which should happen whenever
+ * the player logs on.
+ *   @author Karl Gluck
+ */
+class InputPrediction
+{
+    public:
+
+        InputPrediction();
+        VOID Reset( const MovementState * pStart );
+
+        VOID Predict( FLOAT fElapsedTime, DWORD dwState, FLOAT fTargetYaw );
+        DWORD EncodeInputs( BYTE * pBuffer, DWORD dwSize, DWORD * pLastSequence ) const;
+        BOOL Reconcile( const InputAckMessage * pAck, FLOAT * pfCorrection );
+
+        /// Gets where the local player is predicted to be
+        const MovementState * GetMovement() const { return &m_Movement; }
+
+    protected:
+
+        DWORD GetOldestUnacked() const;
+
+    protected:
+
+        MovementState m_Movement;
+        FLOAT m_fCarry;             // Milliseconds simulated that aren't in an input yet
+
+        // Inputs made, newest at m_dwNextInput - 1.  The ones after m_dwAckedInput haven't
+        // been applied by the server yet.
+        PlayerInput m_Inputs[INPUT_HISTORY_SIZE];
+        DWORD m_dwNextInput;
+        DWORD m_dwAckedInput;
+};
+
+#endif // __PREDICTION_H__
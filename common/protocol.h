@@ -0,0 +1,219 @@
+//------------------------------------------------------------------------------------------------
+// File:    protocol.h
+//
+// Desc:    Messages transacted between the client and the server
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+
+// Include files required to compile this header
+#include "platform.h"
+
+// Settings shared by both ends of the connection
+#define SERVER_COMM_PORT    27192                           /* Server listens on port 27192 */
+#define MAX_PACKET_SIZE     1024                            /* Largest packet is 1024 bytes */
+
+// Player IDs keep the server's slot number in the low 16 bits and the slot's generation in the high
+// 16 bits.  The generation changes every time a slot is reused, so messages about a player who has
+// left can't be mistaken for messages about whoever took the slot next.
+#define MAX_PLAYER_SLOTS                0xFFFF
+#define MAKE_PLAYER_ID( slot, gen )     ((DWORD)(((gen) << 16) | ((slot) & 0xFFFF)))
+#define PLAYER_SLOT( id )               ((DWORD)(id) & 0xFFFF)
+#define PLAYER_GENERATION( id )         ((DWORD)(id) >> 16)
+#define INVALID_PLAYER_ID               0
+
+/**
+ * List of message IDs that are transacted with the server
+ *   @author Karl Gluck
+ */
+enum Message
+{
+    MSG_LOGON,
+    MSG_LOGOFF,
+    MSG_UPDATEPLAYER,
+    MSG_CONFIRMLOGON,
+    MSG_PLAYERLOGGEDOFF,
+    MSG_COMPACTUPDATE,
+    MSG_DELTASNAPSHOT,
+    MSG_SNAPSHOTACK,
+    MSG_LOGONCHALLENGE,
+    MSG_PLAYERINPUT,
+    MSG_INPUTACK,
+};
+
+// Flags in ConfirmLogOnMessage::dwFlags
+#define LOGON_AUTHORITATIVE     0x1     /* Send MSG_PLAYERINPUT; the server moves the player */
+
+/**
+ * First structure in every message except MSG_COMPACTUPDATE, MSG_DELTASNAPSHOT and
+ * MSG_PLAYERINPUT, which only have a single byte for their ID (see wireformat.h, snapshot.h and
+ * movement.h)
+ *   @author Karl Gluck
+ */
+struct MessageHeader
+{
+    Message MsgID;
+};
+
+/**
+ * Gets the type of a message.  Every ID fits in a byte and the header is little-endian, so the
+ * first byte is the ID for both the full header and the one-byte compact header.
+ */
+inline Message GetMessageID( const CHAR * pBuffer )
+{
+    return (Message)(BYTE)pBuffer[0];
+}
+
+/**
+ * Message sent to let the server know we want to log on.  The first one has no cookie; the
+ * server answers it with a LogOnChallengeMessage, and the client sends this again with the
+ * cookie from the challenge.
+ *   @author Karl Gluck
+ */
+struct LogOnMessage
+{
+    MessageHeader   Header;
+    DWORD           dwCookie;           // Zero, or the cookie the server sent back
+
+    LogOnMessage() { Header.MsgID = MSG_LOGON; dwCookie = 0; }
+};
+
+/**
+ * Sent by the server in reply to a logon without a good cookie.  The server doesn't give out a
+ * player slot until a logon comes back from the same address with this cookie.
+ *   @author Karl Gluck
+ */
+struct LogOnChallengeMessage
+{
+    MessageHeader   Header;
+    DWORD           dwCookie;
+
+    LogOnChallengeMessage() { Header.MsgID = MSG_LOGONCHALLENGE; }
+};
+
+/**
+ * Client wants to disconnect from the server
+ *   @author Karl Gluck
+ */
+struct LogOffMessage
+{
+    MessageHeader   Header;
+
+    LogOffMessage() { Header.MsgID = MSG_LOGOFF; }
+};
+
+/**
+ * Sent by the client to tell the server where its player is
+ *   @author Karl Gluck
+ */
+struct UpdatePlayerMessage
+{
+    MessageHeader   Header;
+    DWORD           dwPlayerID;
+    FLOAT           fVelocity[3];       // Expressed in meters / second
+    FLOAT           fPosition[3];
+    DWORD           dwState;
+    FLOAT           fYaw;
+
+    UpdatePlayerMessage() { Header.MsgID = MSG_UPDATEPLAYER; }
+};
+
+/**
+ * Sent by the server to tell the client that it has successfully logged on
+ *   @author Karl Gluck
+ */
+struct ConfirmLogOnMessage
+{
+    MessageHeader   Header;
+    DWORD           dwPlayerID;         // ID that the server uses for this client's player
+    FLOAT           fWorldBound;        // Edge of the world used to encode compact updates
+    DWORD           dwFlags;            // LOGON_ flags saying how the server runs
+
+    ConfirmLogOnMessage() { Header.MsgID = MSG_CONFIRMLOGON; dwFlags = 0; }
+};
+
+/**
+ * Another player has logged off
+ *   @author Karl Gluck
+ */
+struct PlayerLoggedOffMessage
+{
+    MessageHeader   Header;
+    DWORD           dwPlayerID;
+
+    PlayerLoggedOffMessage() { Header.MsgID = MSG_PLAYERLOGGEDOFF; }
+};
+
+/**
+ * The most recent state the server has for one player
+ *   @author Karl Gluck
+ */
+struct PlayerState
+{
+    DWORD           dwPlayerID;
+    FLOAT           fVelocity[3];       // Expressed in meters / second
+    FLOAT           fPosition[3];
+    DWORD           dwState;
+    FLOAT           fYaw;
+};
+
+/**
+ * Sent by the client with the newest delta snapshot it has decoded, so that the server can encode
+ * the next snapshots against it
+ *   @author Karl Gluck
+ */
+struct SnapshotAckMessage
+{
+    MessageHeader   Header;
+    DWORD           dwSequence;
+
+    SnapshotAckMessage() { Header.MsgID = MSG_SNAPSHOTACK; }
+};
+
+/**
+ * Sent by an authoritative server once per tick to a client whose inputs it has applied.  It
+ * holds the newest input applied and where that left the player, which the client starts from
+ * to replay the inputs the server hasn't seen yet.
+ *   @author Karl Gluck
+ */
+struct InputAckMessage
+{
+    MessageHeader   Header;
+    DWORD           dwSequence;         // Newest input that has been applied
+    FLOAT           fPosition[3];
+    FLOAT           fVelocity;          // Along the facing direction
+    FLOAT           fYaw;
+    FLOAT           fTargetYaw;
+    DWORD           dwState;
+
+    InputAckMessage() { Header.MsgID = MSG_INPUTACK; }
+};
+
+#endif // __PROTOCOL_H__
@@ -0,0 +1,419 @@
+//------------------------------------------------------------------------------------------------
+// File:    snapshot.cpp
+//
+// Desc:    Per-client snapshot history and delta encoding
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "snapshot.h"
+#include <stdlib.h>
+
+// Bits taken by a player that has just come into view: its slot, its generation and every field
+#define NEW_PLAYER_BITS     (16 + 16 + WIRE_POSITION_XZ_BITS * 2 + WIRE_POSITION_Y_BITS + \
+                             WIRE_VELOCITY_BITS * 3 + WIRE_YAW_BITS + WIRE_STATE_BITS)
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ComparePlayerIDs
+// Desc:  Sorts quantized states by player ID for qsort
+//------------------------------------------------------------------------------------------------
+static int ComparePlayerIDs( const void * pA, const void * pB )
+{
+    DWORD dwA = ((const QuantizedState*)pA)->dwPlayerID;
+    DWORD dwB = ((const QuantizedState*)pB)->dwPlayerID;
+    return (dwA < dwB) ? -1 : (dwA > dwB) ? 1 : 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SnapshotHistory
+// Desc:  
+//------------------------------------------------------------------------------------------------
+SnapshotHistory::SnapshotHistory()
+{
+    m_pFrames = NULL;
+    m_dwNumFrames = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~SnapshotHistory
+// Desc:  
+//------------------------------------------------------------------------------------------------
+SnapshotHistory::~SnapshotHistory()
+{
+    Destroy();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Create
+// Desc:  Sets up room for dwNumFrames snapshots.  Each frame's player list is allocated the first
+//        time something is stored in it.
+//------------------------------------------------------------------------------------------------
+HRESULT SnapshotHistory::Create( DWORD dwNumFrames )
+{
+    Destroy();
+
+    if( dwNumFrames == 0 )
+        return E_FAIL;
+
+    if( NULL == (m_pFrames = new SnapshotFrame[dwNumFrames]) )
+        return E_OUTOFMEMORY;
+
+    ZeroMemory( m_pFrames, sizeof(SnapshotFrame) * dwNumFrames );
+    m_dwNumFrames = dwNumFrames;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Destroy
+// Desc:  
+//------------------------------------------------------------------------------------------------
+VOID SnapshotHistory::Destroy()
+{
+    if( m_pFrames != NULL )
+    {
+        for( DWORD i = 0; i < m_dwNumFrames; ++i )
+        {
+            if( m_pFrames[i].pPlayers )
+                delete [] m_pFrames[i].pPlayers;
+        }
+
+        delete [] m_pFrames;
+        m_pFrames = NULL;
+    }
+
+    m_dwNumFrames = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Reset
+// Desc:  Forgets every snapshot, but keeps the memory for the next client
+//------------------------------------------------------------------------------------------------
+VOID SnapshotHistory::Reset()
+{
+    for( DWORD i = 0; i < m_dwNumFrames; ++i )
+    {
+        m_pFrames[i].dwSequence = 0;
+        m_pFrames[i].dwNumPlayers = 0;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Find
+// Desc:  Gets a snapshot if it hasn't been overwritten yet
+//------------------------------------------------------------------------------------------------
+SnapshotFrame * SnapshotHistory::Find( DWORD dwSequence )
+{
+    if( dwSequence == 0 || m_dwNumFrames == 0 )
+        return NULL;
+
+    SnapshotFrame * pFrame = &m_pFrames[dwSequence % m_dwNumFrames];
+    return pFrame->dwSequence == dwSequence ? pFrame : NULL;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Store
+// Desc:  Gets the frame that a snapshot goes into, with room for at least dwMaxPlayers players.
+//        The frame is emptied and isn't marked with the sequence number; that's up to the caller
+//        once the frame has been filled in.
+//------------------------------------------------------------------------------------------------
+SnapshotFrame * SnapshotHistory::Store( DWORD dwSequence, DWORD dwMaxPlayers )
+{
+    if( m_dwNumFrames == 0 )
+        return NULL;
+
+    SnapshotFrame * pFrame = &m_pFrames[dwSequence % m_dwNumFrames];
+    pFrame->dwSequence = 0;
+    pFrame->dwNumPlayers = 0;
+
+    // Grow the player list if it's too small
+    if( pFrame->dwMaxPlayers < dwMaxPlayers )
+    {
+        DWORD dwNewMax = pFrame->dwMaxPlayers ? pFrame->dwMaxPlayers : 16;
+        while( dwNewMax < dwMaxPlayers )
+            dwNewMax *= 2;
+
+        QuantizedState * pNewPlayers = new QuantizedState[dwNewMax];
+        if( !pNewPlayers )
+            return NULL;
+
+        if( pFrame->pPlayers )
+            delete [] pFrame->pPlayers;
+        pFrame->pPlayers = pNewPlayers;
+        pFrame->dwMaxPlayers = dwNewMax;
+    }
+
+    return pFrame;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SortByPlayerID
+// Desc:  Puts a list of players in the order that snapshots keep them in
+//------------------------------------------------------------------------------------------------
+VOID SortByPlayerID( QuantizedState * pPlayers, DWORD dwNumPlayers )
+{
+    qsort( pPlayers, dwNumPlayers, sizeof(QuantizedState), ComparePlayerIDs );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  EncodeDeltaSnapshot
+// Desc:  Writes a MSG_DELTASNAPSHOT datagram that turns pBaseline into the given list of players.
+//        pPlayers must be sorted by player ID.  If pBaseline is NULL, every player is sent in full.
+//
+//        The datagram has the message ID, the sequence number and how far back the baseline is
+//        (0 for none).  Then, for each player in the baseline, one bit says whether it is still
+//        in view and one bit says whether it changed; a changed player has a bit for each field
+//        followed by the new value of the fields that differ.  Last is a count of the players
+//        that weren't in the baseline and the full state of each one.
+//
+//        pSent needs room for the players in both the baseline and the new list.
+//
+//        If everything doesn't fit in dwSize bytes, some changes and new players are held back
+//        for a later snapshot.  pSent gets exactly what the client will end up with, so that it
+//        can be used as a baseline later.  Returns the number of bytes written, or 0 on failure.
+//------------------------------------------------------------------------------------------------
+DWORD EncodeDeltaSnapshot( DWORD dwSequence, const SnapshotFrame * pBaseline,
+                           const QuantizedState * pPlayers, DWORD dwNumPlayers,
+                           SnapshotFrame * pSent, BYTE * pBuffer, DWORD dwSize )
+{
+    BitWriter writer( pBuffer, dwSize );
+    DWORD dwNumBaseline = pBaseline ? pBaseline->dwNumPlayers : 0;
+    DWORD dwCapacity = dwSize * 8;
+    if( !writer.Write( MSG_DELTASNAPSHOT, 8 ) ||
+        !writer.WriteVarint( dwSequence ) ||
+        !writer.WriteVarint( pBaseline ? dwSequence - pBaseline->dwSequence : 0 ) )
+        return 0;
+
+    // Leave room for the two bits each baseline player needs, and for the count of new players
+    // along with the padding in front of it
+    DWORD dwReserved = dwNumBaseline * 2 + 4 * 8 + 7;
+    if( writer.GetBitCount() + dwReserved > dwCapacity )
+        return 0;
+
+    pSent->dwSequence = dwSequence;
+    pSent->dwNumPlayers = 0;
+
+    // Walk through the baseline and the new list together; both are sorted
+    DWORD j = 0;
+    for( DWORD i = 0; i < dwNumBaseline; ++i )
+    {
+        const QuantizedState * pOld = &pBaseline->pPlayers[i];
+        dwReserved -= 2;
+
+        while( j < dwNumPlayers && pPlayers[j].dwPlayerID < pOld->dwPlayerID )
+            ++j;
+
+        // This player went out of view
+        if( j == dwNumPlayers || pPlayers[j].dwPlayerID != pOld->dwPlayerID )
+        {
+            writer.Write( 0, 1 );
+            continue;
+        }
+
+        // Find out how much it will take to send the fields that changed
+        const QuantizedState * pNew = &pPlayers[j++];
+        DWORD dwChangedBits = 0;
+        for( int f = 0; f < WIRE_NUM_FIELDS; ++f )
+        {
+            if( pNew->wField[f] != pOld->wField[f] )
+                dwChangedBits += WIRE_FIELD_BITS[f];
+        }
+
+        writer.Write( 1, 1 );
+
+        // If nothing changed or there isn't room for the change, the client keeps the old state
+        if( dwChangedBits == 0 ||
+            writer.GetBitCount() + 1 + WIRE_NUM_FIELDS + dwChangedBits + dwReserved > dwCapacity )
+        {
+            writer.Write( 0, 1 );
+            pSent->pPlayers[pSent->dwNumPlayers++] = *pOld;
+            continue;
+        }
+
+        writer.Write( 1, 1 );
+        for( int f = 0; f < WIRE_NUM_FIELDS; ++f )
+        {
+            if( pNew->wField[f] != pOld->wField[f] )
+            {
+                writer.Write( 1, 1 );
+                writer.Write( pNew->wField[f], WIRE_FIELD_BITS[f] );
+            }
+            else
+                writer.Write( 0, 1 );
+        }
+        pSent->pPlayers[pSent->dwNumPlayers++] = *pNew;
+    }
+
+    // Count the players that weren't in the baseline
+    DWORD dwNumKept = pSent->dwNumPlayers;
+    DWORD dwNumNew = 0;
+    j = 0;
+    for( DWORD i = 0; i < dwNumPlayers; ++i )
+    {
+        while( j < dwNumKept && pSent->pPlayers[j].dwPlayerID < pPlayers[i].dwPlayerID )
+            ++j;
+
+        // Everyone in pSent so far was also in the baseline
+        if( j == dwNumKept || pSent->pPlayers[j].dwPlayerID != pPlayers[i].dwPlayerID )
+            ++dwNumNew;
+    }
+
+    // Send as many of them as will fit.  The count is written as a varint, so leave room for it.
+    DWORD dwUsed = ((writer.GetBitCount() + 7) & ~7) + 3 * 8;
+    DWORD dwFits = dwUsed < dwCapacity ? (dwCapacity - dwUsed) / NEW_PLAYER_BITS : 0;
+    if( dwNumNew > dwFits )
+        dwNumNew = dwFits;
+    if( !writer.WriteVarint( dwNumNew ) )
+        return 0;
+
+    j = 0;
+    DWORD dwWritten = 0;
+    for( DWORD i = 0; i < dwNumPlayers && dwWritten < dwNumNew; ++i )
+    {
+        while( j < dwNumKept && pSent->pPlayers[j].dwPlayerID < pPlayers[i].dwPlayerID )
+            ++j;
+        if( j < dwNumKept && pSent->pPlayers[j].dwPlayerID == pPlayers[i].dwPlayerID )
+            continue;
+
+        const QuantizedState * pNew = &pPlayers[i];
+        writer.Write( PLAYER_SLOT( pNew->dwPlayerID ), 16 );
+        writer.Write( PLAYER_GENERATION( pNew->dwPlayerID ), 16 );
+        for( int f = 0; f < WIRE_NUM_FIELDS; ++f )
+            writer.Write( pNew->wField[f], WIRE_FIELD_BITS[f] );
+
+        pSent->pPlayers[pSent->dwNumPlayers++] = *pNew;
+        ++dwWritten;
+    }
+
+    // The kept and new players were each added in order; put them back together
+    if( dwWritten > 0 && dwNumKept > 0 )
+        SortByPlayerID( pSent->pPlayers, pSent->dwNumPlayers );
+
+    return writer.GetSize();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  DecodeDeltaSnapshot
+// Desc:  Reads a MSG_DELTASNAPSHOT datagram into pHistory.  The snapshot is ignored if its
+//        sequence number isn't greater than dwNewerThan, if we no longer have its baseline, or if
+//        it's malformed.  Returns the decoded frame, or NULL if it was ignored.
+//------------------------------------------------------------------------------------------------
+SnapshotFrame * DecodeDeltaSnapshot( const BYTE * pBuffer, DWORD dwSize, DWORD dwNewerThan,
+                                     SnapshotHistory * pHistory )
+{
+    BitReader reader( pBuffer, dwSize );
+    DWORD dwMsgID, dwSequence, dwBaselineDistance;
+    if( !reader.Read( &dwMsgID, 8 ) || dwMsgID != MSG_DELTASNAPSHOT ||
+        !reader.ReadVarint( &dwSequence ) || dwSequence <= dwNewerThan ||
+        !reader.ReadVarint( &dwBaselineDistance ) || dwBaselineDistance >= SNAPSHOT_HISTORY_SIZE ||
+        dwBaselineDistance > dwSequence )
+        return NULL;
+
+    // Find the snapshot this one was built from
+    const SnapshotFrame * pBaseline = NULL;
+    DWORD dwNumBaseline = 0;
+    if( dwBaselineDistance > 0 )
+    {
+        if( NULL == (pBaseline = pHistory->Find( dwSequence - dwBaselineDistance )) )
+            return NULL;
+        dwNumBaseline = pBaseline->dwNumPlayers;
+    }
+
+    // Every baseline player takes at least a bit and every new one takes NEW_PLAYER_BITS, so
+    // the datagram's size limits how many players there can be
+    SnapshotFrame * pFrame = pHistory->Store( dwSequence, dwNumBaseline + (dwSize * 8) / NEW_PLAYER_BITS );
+    if( !pFrame )
+        return NULL;
+
+    // Apply the changes to each player in the baseline
+    DWORD dwBit, dwValue;
+    for( DWORD i = 0; i < dwNumBaseline; ++i )
+    {
+        if( !reader.Read( &dwBit, 1 ) )
+            return NULL;
+
+        // Went out of view
+        if( !dwBit )
+            continue;
+
+        QuantizedState * pState = &pFrame->pPlayers[pFrame->dwNumPlayers++];
+        *pState = pBaseline->pPlayers[i];
+
+        if( !reader.Read( &dwBit, 1 ) )
+            return NULL;
+
+        if( dwBit )
+        {
+            for( int f = 0; f < WIRE_NUM_FIELDS; ++f )
+            {
+                if( !reader.Read( &dwBit, 1 ) || (dwBit && !reader.Read( &dwValue, WIRE_FIELD_BITS[f] )) )
+                    return NULL;
+                if( dwBit )
+                    pState->wField[f] = (WORD)dwValue;
+            }
+        }
+    }
+
+    // Add the players that came into view
+    DWORD dwNumKept = pFrame->dwNumPlayers;
+    DWORD dwNumNew, dwSlot, dwGeneration;
+    if( !reader.ReadVarint( &dwNumNew ) || dwNumNew > pFrame->dwMaxPlayers - dwNumKept )
+        return NULL;
+
+    for( DWORD i = 0; i < dwNumNew; ++i )
+    {
+        if( !reader.Read( &dwSlot, 16 ) || !reader.Read( &dwGeneration, 16 ) )
+            return NULL;
+
+        QuantizedState * pState = &pFrame->pPlayers[pFrame->dwNumPlayers++];
+        pState->dwPlayerID = MAKE_PLAYER_ID( dwSlot, dwGeneration );
+        for( int f = 0; f < WIRE_NUM_FIELDS; ++f )
+        {
+            if( !reader.Read( &dwValue, WIRE_FIELD_BITS[f] ) )
+                return NULL;
+            pState->wField[f] = (WORD)dwValue;
+        }
+    }
+
+    if( dwNumNew > 0 && dwNumKept > 0 )
+        SortByPlayerID( pFrame->pPlayers, pFrame->dwNumPlayers );
+
+    // The frame is complete, so it can be used as a baseline
+    pFrame->dwSequence = dwSequence;
+    return pFrame;
+}
@@ -0,0 +1,93 @@
+//------------------------------------------------------------------------------------------------
+// File:    snapshot.h
+//
+// Desc:    Per-client snapshot history and delta encoding
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+
+// Include files required to compile this header
+#include "platform.h"
+#include "protocol.h"
+#include "wireformat.h"
+
+// How many snapshots each end remembers.  A snapshot can only be encoded against a baseline
+// that is fewer than this many snapshots old; past that, the server sends every player in full.
+#define SNAPSHOT_HISTORY_SIZE   16
+
+// How often the server sends each client a snapshot, in milliseconds.  Clients use this to work
+// out when a snapshot was sent from its sequence number.
+#define SNAPSHOT_PERIOD         100
+
+/**
+ * Every player that one client could see at one tick, sorted by player ID
+ *   @author Karl Gluck
+ */
+struct SnapshotFrame
+{
+    DWORD dwSequence;               // Zero if this frame doesn't hold a snapshot
+    DWORD dwNumPlayers;
+    DWORD dwMaxPlayers;
+    QuantizedState * pPlayers;
+};
+
+/**
+ * Ring of the most recent snapshots, indexed by sequence number.  The server keeps one of these
+ * for each client with the snapshots it sent, and the client keeps one with the snapshots it
+ * received, so that both ends have the baseline the next snapshot is encoded against.
+ *   @author Karl Gluck
+ */
+class SnapshotHistory
+{
+    public:
+
+        SnapshotHistory();
+        ~SnapshotHistory();
+        HRESULT Create( DWORD dwNumFrames );
+        VOID Destroy();
+        VOID Reset();
+
+        SnapshotFrame * Find( DWORD dwSequence );
+        SnapshotFrame * Store( DWORD dwSequence, DWORD dwMaxPlayers );
+
+    protected:
+
+        SnapshotFrame * m_pFrames;
+        DWORD m_dwNumFrames;
+};
+
+VOID SortByPlayerID( QuantizedState * pPlayers, DWORD dwNumPlayers );
+DWORD EncodeDeltaSnapshot( DWORD dwSequence, const SnapshotFrame * pBaseline,
+                           const QuantizedState * pPlayers, DWORD dwNumPlayers,
+                           SnapshotFrame * pSent, BYTE * pBuffer, DWORD dwSize );
+SnapshotFrame * DecodeDeltaSnapshot( const BYTE * pBuffer, DWORD dwSize, DWORD dwNewerThan,
+                                     SnapshotHistory * pHistory );
+
+#endif // __SNAPSHOT_H__
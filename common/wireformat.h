@@ -0,0 +1,373 @@
+//------------------------------------------------------------------------------------------------
+// File:    wireformat.h
+//
+// Desc:    Quantized encoding for player updates
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __WIREFORMAT_H__
+#define __WIREFORMAT_H__
+
+
+// Include files required to compile this header
+#include "platform.h"
+#include "protocol.h"
+#include <math.h>
+
+// Default edge of the world.  Positions are stored as fixed-point values between -bound and
+// +bound; the server can pick a different bound and tells clients about it when they log on.
+#define DEFAULT_WORLD_BOUND     256.0f
+
+// Fastest speed that can be sent, in meters / second, along each axis.  Receivers extrapolate
+// with the velocity, so the range is kept tight for precision; players can't move faster than
+// MAX_MOVEMENT_SPEED, which is under 2, and "ngsbench -wire" checks that it fits.
+#define MAX_WIRE_SPEED          4.0f
+
+// How many bits each field of a compact update takes up.  The total is 88 bits, so the fields
+// take 11 bytes after the one-byte message ID and a player ID of usually 2 or 3 bytes.
+#define WIRE_POSITION_XZ_BITS   16
+#define WIRE_POSITION_Y_BITS    14
+#define WIRE_VELOCITY_BITS      8
+#define WIRE_YAW_BITS           16
+#define WIRE_STATE_BITS         2
+#define WIRE_FIELD_BYTES        11
+
+// Order in which the fields of a player's state are written
+enum WireField
+{
+    WIRE_POSITION_X,
+    WIRE_POSITION_Y,
+    WIRE_POSITION_Z,
+    WIRE_VELOCITY_X,
+    WIRE_VELOCITY_Y,
+    WIRE_VELOCITY_Z,
+    WIRE_YAW,
+    WIRE_STATE,
+    WIRE_NUM_FIELDS,
+};
+
+// Size of each field, in the order above
+static const DWORD WIRE_FIELD_BITS[WIRE_NUM_FIELDS] =
+{
+    WIRE_POSITION_XZ_BITS, WIRE_POSITION_Y_BITS, WIRE_POSITION_XZ_BITS,
+    WIRE_VELOCITY_BITS, WIRE_VELOCITY_BITS, WIRE_VELOCITY_BITS,
+    WIRE_YAW_BITS, WIRE_STATE_BITS,
+};
+
+// Largest size of an encoded update: a 3-byte varint slot and generation each
+#define MAX_COMPACT_UPDATE_SIZE (1 + 3 + 3 + WIRE_FIELD_BYTES)
+
+// Largest difference between a value and what comes out of the decoder, not counting float
+// rounding.  Each is half of one quantization step.
+#define WIRE_POSITION_XZ_ERROR( bound ) ((bound) / (2.0f * ((1 << (WIRE_POSITION_XZ_BITS - 1)) - 1)))
+#define WIRE_POSITION_Y_ERROR( bound )  ((bound) / (2.0f * ((1 << (WIRE_POSITION_Y_BITS - 1)) - 1)))
+#define WIRE_VELOCITY_ERROR             (MAX_WIRE_SPEED / (2.0f * ((1 << (WIRE_VELOCITY_BITS - 1)) - 1)))
+#define WIRE_YAW_ERROR                  (3.14159265f / (1 << WIRE_YAW_BITS))
+
+/**
+ * Maps a value in [-fRange, fRange] onto an unsigned integer of dwBits bits.  Values outside of
+ * the range are clamped.  Zero always comes back out as exactly zero.
+ */
+inline DWORD QuantizeSigned( FLOAT fValue, FLOAT fRange, DWORD dwBits )
+{
+    int iMax = (1 << (dwBits - 1)) - 1;
+    FLOAT fScaled = fValue / fRange * iMax;
+
+    // NaN fails both tests and is sent as zero
+    int iValue = 0;
+    if( fScaled >= iMax )
+        iValue = iMax;
+    else if( fScaled <= -iMax )
+        iValue = -iMax;
+    else if( fScaled == fScaled )
+        iValue = (int)floorf( fScaled + 0.5f );
+
+    return (DWORD)(iValue + iMax);
+}
+
+/**
+ * Turns a value made by QuantizeSigned back into a float
+ */
+inline FLOAT DequantizeSigned( DWORD dwValue, FLOAT fRange, DWORD dwBits )
+{
+    int iMax = (1 << (dwBits - 1)) - 1;
+    return ((int)dwValue - iMax) * fRange / iMax;
+}
+
+/**
+ * Maps an angle onto dwBits bits after wrapping it into [0, 2pi)
+ */
+inline DWORD QuantizeAngle( FLOAT fAngle, DWORD dwBits )
+{
+    const FLOAT fTwoPi = 6.28318531f;
+    if( fAngle != fAngle )
+        return 0;
+
+    FLOAT fTurns = fAngle / fTwoPi;
+    fTurns -= floorf( fTurns );
+    return (DWORD)floorf( fTurns * (1 << dwBits) + 0.5f ) & ((1 << dwBits) - 1);
+}
+
+/**
+ * Turns a value made by QuantizeAngle back into an angle in [0, 2pi)
+ */
+inline FLOAT DequantizeAngle( DWORD dwValue, DWORD dwBits )
+{
+    return dwValue * (6.28318531f / (1 << dwBits));
+}
+
+/**
+ * A player's state after quantization.  Two of these are equal exactly when they would be sent
+ * as the same bits, which is what lets snapshots leave out fields that haven't changed.
+ *   @author Karl Gluck
+ */
+struct QuantizedState
+{
+    DWORD           dwPlayerID;
+    WORD            wField[WIRE_NUM_FIELDS];
+};
+
+/**
+ * Quantizes each field of a player's state
+ */
+inline VOID QuantizeState( const PlayerState * pState, FLOAT fWorldBound, QuantizedState * pQuantized )
+{
+    // A velocity too fast to send is scaled down along its own direction rather than clamped
+    // one axis at a time, so receivers still extrapolate the way the player is really going.
+    // Only a full-size update from a client can be this fast.
+    FLOAT fLargest = MAX_WIRE_SPEED;
+    for( int i = 0; i < 3; ++i )
+    {
+        if( fabsf( pState->fVelocity[i] ) > fLargest )
+            fLargest = fabsf( pState->fVelocity[i] );
+    }
+    FLOAT fScale = MAX_WIRE_SPEED / fLargest;
+
+    pQuantized->dwPlayerID = pState->dwPlayerID;
+    pQuantized->wField[WIRE_POSITION_X] = (WORD)QuantizeSigned( pState->fPosition[0], fWorldBound, WIRE_POSITION_XZ_BITS );
+    pQuantized->wField[WIRE_POSITION_Y] = (WORD)QuantizeSigned( pState->fPosition[1], fWorldBound, WIRE_POSITION_Y_BITS );
+    pQuantized->wField[WIRE_POSITION_Z] = (WORD)QuantizeSigned( pState->fPosition[2], fWorldBound, WIRE_POSITION_XZ_BITS );
+    pQuantized->wField[WIRE_VELOCITY_X] = (WORD)QuantizeSigned( pState->fVelocity[0] * fScale, MAX_WIRE_SPEED, WIRE_VELOCITY_BITS );
+    pQuantized->wField[WIRE_VELOCITY_Y] = (WORD)QuantizeSigned( pState->fVelocity[1] * fScale, MAX_WIRE_SPEED, WIRE_VELOCITY_BITS );
+    pQuantized->wField[WIRE_VELOCITY_Z] = (WORD)QuantizeSigned( pState->fVelocity[2] * fScale, MAX_WIRE_SPEED, WIRE_VELOCITY_BITS );
+    pQuantized->wField[WIRE_YAW] = (WORD)QuantizeAngle( pState->fYaw, WIRE_YAW_BITS );
+    pQuantized->wField[WIRE_STATE] = (WORD)(pState->dwState & ((1 << WIRE_STATE_BITS) - 1));
+}
+
+/**
+ * Turns a quantized state back into floats
+ */
+inline VOID DequantizeState( const QuantizedState * pQuantized, FLOAT fWorldBound, PlayerState * pState )
+{
+    pState->dwPlayerID = pQuantized->dwPlayerID;
+    pState->fPosition[0] = DequantizeSigned( pQuantized->wField[WIRE_POSITION_X], fWorldBound, WIRE_POSITION_XZ_BITS );
+    pState->fPosition[1] = DequantizeSigned( pQuantized->wField[WIRE_POSITION_Y], fWorldBound, WIRE_POSITION_Y_BITS );
+    pState->fPosition[2] = DequantizeSigned( pQuantized->wField[WIRE_POSITION_Z], fWorldBound, WIRE_POSITION_XZ_BITS );
+    pState->fVelocity[0] = DequantizeSigned( pQuantized->wField[WIRE_VELOCITY_X], MAX_WIRE_SPEED, WIRE_VELOCITY_BITS );
+    pState->fVelocity[1] = DequantizeSigned( pQuantized->wField[WIRE_VELOCITY_Y], MAX_WIRE_SPEED, WIRE_VELOCITY_BITS );
+    pState->fVelocity[2] = DequantizeSigned( pQuantized->wField[WIRE_VELOCITY_Z], MAX_WIRE_SPEED, WIRE_VELOCITY_BITS );
+    pState->fYaw = DequantizeAngle( pQuantized->wField[WIRE_YAW], WIRE_YAW_BITS );
+    pState->dwState = pQuantized->wField[WIRE_STATE];
+}
+
+/**
+ * Writes fields of any number of bits, lowest bits first, into a byte buffer
+ *   @author Karl Gluck
+ */
+class BitWriter
+{
+    public:
+
+        BitWriter( BYTE * pBuffer, DWORD dwSize ) : m_pBuffer( pBuffer ), m_dwSize( dwSize ), m_dwBits( 0 ) {}
+
+        /// Adds the low dwBits bits of dwValue.  Returns FALSE if the buffer is full.
+        BOOL Write( DWORD dwValue, DWORD dwBits )
+        {
+            if( m_dwBits + dwBits > m_dwSize * 8 )
+                return FALSE;
+
+            for( DWORD i = 0; i < dwBits; ++i, ++m_dwBits )
+            {
+                BYTE bMask = (BYTE)(1 << (m_dwBits & 7));
+                if( dwValue & (1UL << i) )
+                    m_pBuffer[m_dwBits >> 3] |= bMask;
+                else
+                    m_pBuffer[m_dwBits >> 3] &= ~bMask;
+            }
+
+            return TRUE;
+        }
+
+        /// Adds an unsigned integer in 7-bit groups, low group first, with the high bit of each
+        /// byte set if another byte follows.  Always starts on a byte boundary.
+        BOOL WriteVarint( DWORD dwValue )
+        {
+            m_dwBits = (m_dwBits + 7) & ~7;
+            do
+            {
+                BYTE bByte = (BYTE)(dwValue & 0x7F);
+                dwValue >>= 7;
+                if( !Write( bByte | (dwValue ? 0x80 : 0), 8 ) )
+                    return FALSE;
+            } while( dwValue );
+
+            return TRUE;
+        }
+
+        /// Number of bytes that have been touched
+        DWORD GetSize() const { return (m_dwBits + 7) >> 3; }
+
+        /// Number of bits that have been written
+        DWORD GetBitCount() const { return m_dwBits; }
+
+    protected:
+
+        BYTE * m_pBuffer;
+        DWORD m_dwSize;
+        DWORD m_dwBits;
+};
+
+/**
+ * Reads fields that were written by a BitWriter
+ *   @author Karl Gluck
+ */
+class BitReader
+{
+    public:
+
+        BitReader( const BYTE * pBuffer, DWORD dwSize ) : m_pBuffer( pBuffer ), m_dwSize( dwSize ), m_dwBits( 0 ) {}
+
+        /// Gets the next dwBits bits.  Returns FALSE if the buffer runs out.
+        BOOL Read( DWORD * pValue, DWORD dwBits )
+        {
+            if( m_dwBits + dwBits > m_dwSize * 8 )
+                return FALSE;
+
+            DWORD dwValue = 0;
+            for( DWORD i = 0; i < dwBits; ++i, ++m_dwBits )
+            {
+                if( m_pBuffer[m_dwBits >> 3] & (1 << (m_dwBits & 7)) )
+                    dwValue |= 1UL << i;
+            }
+
+            *pValue = dwValue;
+            return TRUE;
+        }
+
+        /// Gets an integer written by BitWriter::WriteVarint
+        BOOL ReadVarint( DWORD * pValue )
+        {
+            m_dwBits = (m_dwBits + 7) & ~7;
+
+            DWORD dwValue = 0, dwByte;
+            for( DWORD dwShift = 0; dwShift < 35; dwShift += 7 )
+            {
+                if( !Read( &dwByte, 8 ) )
+                    return FALSE;
+
+                dwValue |= (dwByte & 0x7F) << dwShift;
+                if( !(dwByte & 0x80) )
+                {
+                    *pValue = dwValue;
+                    return TRUE;
+                }
+            }
+
+            // Too many continuation bytes
+            return FALSE;
+        }
+
+        /// Number of bytes that have been read
+        DWORD GetSize() const { return (m_dwBits + 7) >> 3; }
+
+    protected:
+
+        const BYTE * m_pBuffer;
+        DWORD m_dwSize;
+        DWORD m_dwBits;
+};
+
+/**
+ * Packs a player's state into a MSG_COMPACTUPDATE datagram.  The player ID is written as a
+ * varint slot followed by a varint generation, so that it usually takes 2 bytes.
+ *   @param pState State to encode
+ *   @param fWorldBound Edge of the world that the server told us about
+ *   @param pBuffer Destination for the datagram
+ *   @param dwSize Number of bytes available; MAX_COMPACT_UPDATE_SIZE is always enough
+ *   @return Number of bytes written, or 0 if the buffer was too small
+ */
+inline DWORD EncodeCompactUpdate( const PlayerState * pState, FLOAT fWorldBound, BYTE * pBuffer, DWORD dwSize )
+{
+    QuantizedState quantized;
+    QuantizeState( pState, fWorldBound, &quantized );
+
+    BitWriter writer( pBuffer, dwSize );
+    if( !writer.Write( MSG_COMPACTUPDATE, 8 ) ||
+        !writer.WriteVarint( PLAYER_SLOT( quantized.dwPlayerID ) ) ||
+        !writer.WriteVarint( PLAYER_GENERATION( quantized.dwPlayerID ) ) )
+        return 0;
+
+    for( int i = 0; i < WIRE_NUM_FIELDS; ++i )
+    {
+        if( !writer.Write( quantized.wField[i], WIRE_FIELD_BITS[i] ) )
+            return 0;
+    }
+
+    return writer.GetSize();
+}
+
+/**
+ * Unpacks a datagram made by EncodeCompactUpdate
+ *   @param pBuffer Datagram that was received
+ *   @param dwSize Size of the datagram
+ *   @param fWorldBound Edge of the world
+ *   @param pState Gets the decoded state
+ *   @return TRUE if the datagram was complete
+ */
+inline BOOL DecodeCompactUpdate( const BYTE * pBuffer, DWORD dwSize, FLOAT fWorldBound, PlayerState * pState )
+{
+    BitReader reader( pBuffer, dwSize );
+    DWORD dwMsgID, dwSlot, dwGeneration, dwValue;
+    if( !reader.Read( &dwMsgID, 8 ) || dwMsgID != MSG_COMPACTUPDATE ||
+        !reader.ReadVarint( &dwSlot ) || dwSlot >= MAX_PLAYER_SLOTS ||
+        !reader.ReadVarint( &dwGeneration ) || dwGeneration > 0xFFFF )
+        return FALSE;
+
+    QuantizedState quantized;
+    quantized.dwPlayerID = MAKE_PLAYER_ID( dwSlot, dwGeneration );
+    for( int i = 0; i < WIRE_NUM_FIELDS; ++i )
+    {
+        if( !reader.Read( &dwValue, WIRE_FIELD_BITS[i] ) )
+            return FALSE;
+        quantized.wField[i] = (WORD)dwValue;
+    }
+
+    DequantizeState( &quantized, fWorldBound, pState );
+    return TRUE;
+}
+
+#endif // __WIREFORMAT_H__
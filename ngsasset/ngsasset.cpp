@@ -0,0 +1,458 @@
+//------------------------------------------------------------------------------------------------
+// File:    ngsasset.cpp
+//
+// Desc:    Loads character assets outside the client, to check and time the loaders
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "../ngsclient/xfile.h"
+#include "../ngsclient/bakedasset.h"
+#include "../ngsclient/assetbaker.h"
+#include "../ngsclient/skinning.h"
+#include <stdlib.h>
+#include <math.h>
+
+#define DEFAULT_FILE            "tiny/tiny_4anim.x"         /* Run from the Bin directory, like the client */
+#define DEFAULT_RUNS            7
+#define MAX_RUNS                101
+#define MAX_FILE_NAME           260
+#define BAKED_EXTENSION         ".baked"                    /* Added to the name of the .x file, like the client does */
+#define PALETTES_PER_RUN        10000
+#define PALETTE_TOLERANCE       1.0e-3f                     /* How far apart the two ways of building a palette can be */
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetNanosecondCount
+// Desc:  Reads the high-resolution counter in nanoseconds
+//------------------------------------------------------------------------------------------------
+DOUBLE GetNanosecondCount()
+{
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter( &count );
+    QueryPerformanceFrequency( &frequency );
+    return (DOUBLE)count.QuadPart * 1.0e9 / (DOUBLE)frequency.QuadPart;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CompareDoubles
+// Desc:  qsort comparison for run times
+//------------------------------------------------------------------------------------------------
+int CompareDoubles( const void * pA, const void * pB )
+{
+    DOUBLE a = *(const DOUBLE*)pA, b = *(const DOUBLE*)pB;
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  PrintName
+// Desc:  Prints a name from the file, or a placeholder if it doesn't have one
+//------------------------------------------------------------------------------------------------
+VOID PrintName( const XString * pName )
+{
+    if( pName->dwLength > 0 )
+        printf( "%.*s", (int)pName->dwLength, pName->pText );
+    else
+        printf( "<none>" );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  PrintContents
+// Desc:  Lists what was read from the file
+//------------------------------------------------------------------------------------------------
+VOID PrintContents( const XFile * pFile )
+{
+    printf( "%u bytes, %u frames, %u meshes, %u animation sets at %u ticks per second\n",
+            pFile->GetFileSize(), pFile->GetNumFrames(), pFile->GetNumMeshes(),
+            pFile->GetNumAnimationSets(), pFile->GetTicksPerSecond() );
+
+    for( DWORD i = 0; i < pFile->GetNumMeshes(); ++i )
+    {
+        const XMesh * pMesh = pFile->GetMesh( i );
+        printf( "  mesh " );
+        PrintName( &pMesh->Name );
+        printf( ":  %u vertices, %u triangles, %u materials, %u bones", pMesh->dwNumVertices,
+                pMesh->dwNumTriangles, pMesh->dwNumMaterials, pMesh->dwNumBones );
+        if( pMesh->dwNumBones > 0 )
+            printf( " (at most %u per vertex, %u per face)", pMesh->wMaxSkinWeightsPerVertex,
+                    pMesh->wMaxSkinWeightsPerFace );
+        printf( "\n" );
+    }
+
+    for( DWORD i = 0; i < pFile->GetNumAnimationSets(); ++i )
+    {
+        const XAnimationSet * pSet = pFile->GetAnimationSet( i );
+        DWORD dwKeys = 0, dwUnresolved = 0;
+        for( DWORD j = 0; j < pSet->dwNumAnimations; ++j )
+        {
+            for( DWORD k = 0; k < XKEY_TYPES; ++k )
+                dwKeys += pSet->pAnimations[j].Keys[k].dwNumKeys;
+            if( pSet->pAnimations[j].dwFrame == XFILE_NONE )
+                ++dwUnresolved;
+        }
+        printf( "  animation set " );
+        PrintName( &pSet->Name );
+        printf( ":  %.2f seconds, %u animations, %u keys", (DOUBLE)pSet->dwLength / pFile->GetTicksPerSecond(),
+                pSet->dwNumAnimations, dwKeys );
+        if( dwUnresolved > 0 )
+            printf( ", %u for frames that don't exist", dwUnresolved );
+        printf( "\n" );
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  TimeLoads
+// Desc:  Loads the file over and over and prints the median and fastest times
+//------------------------------------------------------------------------------------------------
+HRESULT TimeLoads( const CHAR * strFile, DWORD dwThreads, DWORD dwRuns )
+{
+    DOUBLE dRunNs[MAX_RUNS];
+    XFile file;
+    for( DWORD i = 0; i < dwRuns; ++i )
+    {
+        DOUBLE dStart = GetNanosecondCount();
+        HRESULT hr = file.Load( strFile, dwThreads );
+        dRunNs[i] = GetNanosecondCount() - dStart;
+        if( FAILED( hr ) )
+            return hr;
+    }
+
+    qsort( dRunNs, dwRuns, sizeof(DOUBLE), CompareDoubles );
+    DOUBLE dMegabytes = file.GetFileSize() / (1024.0 * 1024.0);
+    printf( "load     %3u threads  %9.3f ms  (min %9.3f)  %8.1f MB/s\n", dwThreads,
+            dRunNs[dwRuns / 2] / 1.0e6, dRunNs[0] / 1.0e6, dMegabytes / (dRunNs[dwRuns / 2] / 1.0e9) );
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  PrintBakedContents
+// Desc:  Lists what the baker made of the file's meshes
+//------------------------------------------------------------------------------------------------
+VOID PrintBakedContents( const BakedAsset * pAsset )
+{
+    printf( "%u bytes, %u frames, %u skinned meshes, %u animation sets\n", pAsset->GetSize(),
+            pAsset->GetNumFrames(), pAsset->GetNumMeshes(), pAsset->GetNumAnimationSets() );
+    for( DWORD i = 0; i < pAsset->GetNumMeshes(); ++i )
+    {
+        const BakedMesh * pMesh = pAsset->GetMesh( i );
+        printf( "  mesh %s:  %u vertices, %u triangles, %u bone combinations of %u bones, %u-bit indices\n",
+                pMesh->Name.dwCount > 0 ? pAsset->GetString( &pMesh->Name ) : "<none>",
+                pMesh->Vertices.dwCount, pMesh->Indices.dwCount / 3, pMesh->BoneCombinations.dwCount,
+                pMesh->dwMaxFaceInfluences, pMesh->dwIndexSize * 8 );
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  TimeBake
+// Desc:  Reads and bakes the file, saves the result and prints how long it took
+//------------------------------------------------------------------------------------------------
+HRESULT TimeBake( const CHAR * strFile, const CHAR * strBakedFile, DWORD dwThreads )
+{
+    DOUBLE dStart = GetNanosecondCount();
+    MappedFile source;
+    if( !source.Open( strFile ) )
+        return E_FAIL;
+    QWORD qwHash = BakedAsset::Hash( source.GetData(), source.GetSize() );
+    source.Close();
+    XFile file;
+    AssetBaker baker;
+    HRESULT hr = file.Load( strFile, dwThreads );
+    if( SUCCEEDED( hr ) )
+        hr = baker.Bake( &file, qwHash );
+    if( SUCCEEDED( hr ) )
+        hr = baker.Write( strBakedFile );
+    if( FAILED( hr ) )
+        return hr;
+    printf( "bake     %3u threads  %9.3f ms\n", dwThreads, (GetNanosecondCount() - dStart) / 1.0e6 );
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  TimeBakedLoads
+// Desc:  Times what the client does at startup:  checking the baked file against its source and
+//        mapping it
+//------------------------------------------------------------------------------------------------
+HRESULT TimeBakedLoads( const CHAR * strFile, const CHAR * strBakedFile, DWORD dwRuns )
+{
+    DOUBLE dRunNs[MAX_RUNS];
+    BakedAsset asset;
+    for( DWORD i = 0; i < dwRuns; ++i )
+    {
+        DOUBLE dStart = GetNanosecondCount();
+        HRESULT hr = asset.Load( strBakedFile, strFile );
+        dRunNs[i] = GetNanosecondCount() - dStart;
+        if( FAILED( hr ) )
+            return hr;
+    }
+
+    qsort( dRunNs, dwRuns, sizeof(DOUBLE), CompareDoubles );
+    printf( "baked                 %9.3f ms  (min %9.3f)\n", dRunNs[dwRuns / 2] / 1.0e6, dRunNs[0] / 1.0e6 );
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  TimePalettes
+// Desc:  Times building a palette many times over, and returns the median time per palette
+//------------------------------------------------------------------------------------------------
+DOUBLE TimePalettes( BOOL bReference, const FLOAT * pOffsets, const DWORD * pdwBoneFrames,
+                     const FLOAT * pWorldMatrices, DWORD dwNumBones, FLOAT * pPalette, DWORD dwRuns )
+{
+    DOUBLE dRunNs[MAX_RUNS];
+    for( DWORD i = 0; i < dwRuns; ++i )
+    {
+        DOUBLE dStart = GetNanosecondCount();
+        for( DWORD j = 0; j < PALETTES_PER_RUN; ++j )
+        {
+            if( bReference )
+                ComputeSkinningPaletteReference( pOffsets, pdwBoneFrames, pWorldMatrices, dwNumBones, pPalette );
+            else
+                ComputeSkinningPalette( pOffsets, pdwBoneFrames, pWorldMatrices, dwNumBones, pPalette );
+        }
+        dRunNs[i] = (GetNanosecondCount() - dStart) / PALETTES_PER_RUN;
+    }
+    qsort( dRunNs, dwRuns, sizeof(DOUBLE), CompareDoubles );
+    return dRunNs[dwRuns / 2];
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CheckPalettes
+// Desc:  Poses each baked mesh's skeleton the way its frames are stored and builds the skinning
+//        palette for it both ways.  The two have to agree, and then both are timed.
+//------------------------------------------------------------------------------------------------
+HRESULT CheckPalettes( const BakedAsset * pAsset, DWORD dwRuns )
+{
+    // The palette code needs 16-byte aligned matrices.  The frames' world matrices are followed
+    // by an identity matrix that the roots use as their parent.
+    DWORD dwNumFrames = pAsset->GetNumFrames();
+    DWORD dwMaxBones = 0;
+    for( DWORD i = 0; i < pAsset->GetNumMeshes(); ++i )
+    {
+        if( pAsset->GetMesh( i )->Bones.dwCount > dwMaxBones )
+            dwMaxBones = pAsset->GetMesh( i )->Bones.dwCount;
+    }
+    DWORD dwNumMatrices = dwNumFrames + 1 + dwMaxBones * 3;
+    BYTE * pBuffer = new BYTE[ dwNumMatrices * 16 * sizeof(FLOAT) + 15 ];
+    DWORD * pdwFrames = new DWORD[ dwMaxBones + 1 ];
+    if( !pBuffer || !pdwFrames )
+    {
+        delete [] pBuffer;
+        delete [] pdwFrames;
+        return E_OUTOFMEMORY;
+    }
+    FLOAT * pWorld = (FLOAT*)(((DWORD_PTR)pBuffer + 15) & ~(DWORD_PTR)15);
+    FLOAT * pOffsets = pWorld + (dwNumFrames + 1) * 16;
+    FLOAT * pPalette = pOffsets + dwMaxBones * 16;
+    FLOAT * pReference = pPalette + dwMaxBones * 16;
+
+    // Build the bind pose.  Parents come first, so each frame's parent is ready before it is.
+    FLOAT * pIdentity = &pWorld[dwNumFrames * 16];
+    memset( pIdentity, 0, 16 * sizeof(FLOAT) );
+    pIdentity[0] = pIdentity[5] = pIdentity[10] = pIdentity[15] = 1.0f;
+    for( DWORD i = 0; i < dwNumFrames; ++i )
+    {
+        const BakedFrame * pFrame = pAsset->GetFrame( i );
+        DWORD dwParent = pFrame->dwParent == BAKED_NONE ? dwNumFrames : pFrame->dwParent;
+        memcpy( pOffsets, pFrame->fTransform, 16 * sizeof(FLOAT) );
+        ComputeSkinningPaletteReference( pOffsets, &dwParent, pWorld, 1, &pWorld[i * 16] );
+    }
+
+    HRESULT hr = S_OK;
+    for( DWORD i = 0; i < pAsset->GetNumMeshes(); ++i )
+    {
+        const BakedMesh * pMesh = pAsset->GetMesh( i );
+        const BakedBone * pBones = pAsset->GetBones( pMesh );
+        DWORD dwNumBones = pMesh->Bones.dwCount;
+        for( DWORD b = 0; b < dwNumBones; ++b )
+        {
+            memcpy( &pOffsets[b * 16], pBones[b].fOffset, 16 * sizeof(FLOAT) );
+            pdwFrames[b] = pBones[b].dwFrame;
+        }
+
+        // Compare the results
+        ComputeSkinningPalette( pOffsets, pdwFrames, pWorld, dwNumBones, pPalette );
+        ComputeSkinningPaletteReference( pOffsets, pdwFrames, pWorld, dwNumBones, pReference );
+        FLOAT fMaxDifference = 0.0f;
+        for( DWORD j = 0; j < dwNumBones * 16; ++j )
+        {
+            FLOAT fDifference = fabsf( pPalette[j] - pReference[j] );
+            if( fDifference > fMaxDifference ) fMaxDifference = fDifference;
+        }
+        printf( "palette  %3u bones    largest difference from reference %g\n", dwNumBones, fMaxDifference );
+        if( fMaxDifference > PALETTE_TOLERANCE )
+        {
+            hr = E_FAIL;
+            break;
+        }
+
+        // Time them
+        DOUBLE dNs = TimePalettes( FALSE, pOffsets, pdwFrames, pWorld, dwNumBones, pPalette, dwRuns );
+        DOUBLE dReferenceNs = TimePalettes( TRUE, pOffsets, pdwFrames, pWorld, dwNumBones, pReference, dwRuns );
+        printf( "palette               %9.3f us  (reference %9.3f us)\n", dNs / 1.0e3, dReferenceNs / 1.0e3 );
+    }
+
+    delete [] pBuffer;
+    delete [] pdwFrames;
+    return hr;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  main
+// Desc:  Entry point for the program
+//------------------------------------------------------------------------------------------------
+int main( int argc, char * argv[] )
+{
+    // Read the command line.  "-threads N" sets how many threads load the file, as well as one,
+    // and "-runs N" how many timed loads the median is taken from.  "-bake" also bakes the file
+    // the way the client would and times loading that, and "-palette" checks and times the
+    // skinning palette for the baked meshes.  Anything else is the file.
+    const CHAR * strFile = DEFAULT_FILE;
+    DWORD dwThreads = GetProcessorCount();
+    DWORD dwRuns = DEFAULT_RUNS;
+    BOOL bBake = FALSE;
+    BOOL bPalette = FALSE;
+    for( int i = 1; i < argc; ++i )
+    {
+        if( 0 == strcmp( argv[i], "-threads" ) && i + 1 < argc )
+            dwThreads = (DWORD)atoi( argv[++i] );
+        else if( 0 == strcmp( argv[i], "-runs" ) && i + 1 < argc )
+            dwRuns = (DWORD)atoi( argv[++i] );
+        else if( 0 == strcmp( argv[i], "-bake" ) )
+            bBake = TRUE;
+        else if( 0 == strcmp( argv[i], "-palette" ) )
+            bPalette = TRUE;
+        else
+            strFile = argv[i];
+    }
+
+    if( dwRuns < 1 || dwRuns > MAX_RUNS || dwThreads < 1 )
+    {
+        printf( "Between 1 and %u runs can be timed, with at least one thread\n", MAX_RUNS );
+        return -1;
+    }
+
+    XFile file;
+    if( FAILED( file.Load( strFile, dwThreads ) ) )
+    {
+        printf( "Couldn't read %s\n", strFile );
+        return -1;
+    }
+    printf( "%s:  ", strFile );
+    PrintContents( &file );
+    file.Release();
+
+    printf( "\nMedian of %u runs\n", dwRuns );
+    if( FAILED( TimeLoads( strFile, 1, dwRuns ) ) ||
+        (dwThreads > 1 && FAILED( TimeLoads( strFile, dwThreads, dwRuns ) )) )
+    {
+        printf( "Loading failed\n" );
+        return -1;
+    }
+
+    CHAR strBakedFile[MAX_FILE_NAME];
+    if( strlen( strFile ) + sizeof(BAKED_EXTENSION) > sizeof(strBakedFile) )
+    {
+        printf( "%s has too long a name to bake\n", strFile );
+        return -1;
+    }
+    strcpy( strBakedFile, strFile );
+    strcat( strBakedFile, BAKED_EXTENSION );
+
+    if( bBake )
+    {
+        BakedAsset asset;
+        if( FAILED( TimeBake( strFile, strBakedFile, dwThreads ) ) ||
+            FAILED( asset.Load( strBakedFile, strFile ) ) )
+        {
+            printf( "Couldn't bake %s into %s\n", strFile, strBakedFile );
+            return -1;
+        }
+        printf( "\n%s:  ", strBakedFile );
+        PrintBakedContents( &asset );
+        asset.Release();
+
+        printf( "\nMedian of %u runs\n", dwRuns );
+        if( FAILED( TimeBakedLoads( strFile, strBakedFile, dwRuns ) ) )
+        {
+            printf( "Loading the baked file failed\n" );
+            return -1;
+        }
+    }
+
+    if( bPalette )
+    {
+        BakedAsset asset;
+        if( FAILED( asset.LoadOrBake( strFile, strBakedFile, dwThreads ) ) )
+        {
+            printf( "Couldn't bake %s\n", strFile );
+            return -1;
+        }
+        printf( "\nMedian of %u runs of %u palettes\n", dwRuns, PALETTES_PER_RUN );
+        if( FAILED( CheckPalettes( &asset, dwRuns ) ) )
+        {
+            printf( "The skinning palette is wrong\n" );
+            return -1;
+        }
+    }
+
+    // Success
+    return 0;
+}
@@ -0,0 +1,710 @@
+//------------------------------------------------------------------------------------------------
+// File:    ngsbench.cpp
+//
+// Desc:    Microbenchmarks for the server's packet handling and relay loop
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "../ngsserver/server.h"
+#include <new>
+#include <stdlib.h>
+#include <math.h>
+
+#define DEFAULT_USER_COUNTS     "16,64,256,1024,4096"
+#define DEFAULT_RUNS            7
+#define DEFAULT_AREA            100.0f              /* Same spread as the load bot */
+#define MAX_USER_COUNTS         16
+#define UPDATES_PER_RUN         100000              /* Packets timed per run of the update benchmarks */
+#define MEMORY_SOCKET_SIZE      65536
+#define WIRE_CHECK_STATES       200000              /* Random states round-tripped by -wire */
+#define WIRE_CHECK_TOLERANCE    1.0e-6f             /* Float rounding allowed on top of each error bound, relative to its range */
+
+
+// Every allocation the server makes goes through these, so the benchmarks can count them
+static QWORD g_qwAllocations = 0;
+
+void * operator new( size_t size )
+{
+    g_qwAllocations++;
+    void * p = malloc( size ? size : 1 );
+    if( !p )
+        throw std::bad_alloc();
+    return p;
+}
+
+void * operator new[]( size_t size )
+{
+    g_qwAllocations++;
+    void * p = malloc( size ? size : 1 );
+    if( !p )
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete( void * p ) throw() { free( p ); }
+void operator delete[]( void * p ) throw() { free( p ); }
+void operator delete( void * p, size_t size ) throw() { free( p ); }
+void operator delete[]( void * p, size_t size ) throw() { free( p ); }
+
+
+/**
+ * Stands in for the server's socket.  Packets are copied into a ring buffer so that sending
+ * costs about what a kernel copy would, and nothing ever leaves the process.
+ */
+struct MemorySocket
+{
+    BYTE Buffer[MEMORY_SOCKET_SIZE];
+    DWORD dwWritePos;
+    QWORD qwPackets;
+    QWORD qwBytes;
+};
+
+/**
+ * One measurement, repeated once per run
+ */
+struct BenchResult
+{
+    const CHAR * strName;
+    DWORD dwUsers;
+    DOUBLE dRunNs[DEFAULT_RUNS * 8];
+    DWORD dwRuns;
+    QWORD qwOperations;         // Per run
+    QWORD qwAllocations;        // Total over every run
+    QWORD qwPackets;            // Sent to the memory socket, over every run
+    QWORD qwBytes;
+};
+
+
+// Global variables
+Room g_Room;
+LogOnCookies g_Cookies;
+const CookieSecret g_BenchSecret = { { 0x5EED5EED5EED5EEDULL, 0x0123456789ABCDEFULL } };    // The clients know it, so they skip the challenge
+MemorySocket g_Socket;
+SOCKADDR_IN * g_UserAddresses = NULL;
+DWORD * g_UserIds = NULL;
+FLOAT * g_UserX = NULL;
+FLOAT * g_UserZ = NULL;
+FLOAT g_fArea = DEFAULT_AREA;
+DWORD g_dwRuns = DEFAULT_RUNS;
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetNanosecondCount
+// Desc:  Reads the high-resolution counter in nanoseconds
+//------------------------------------------------------------------------------------------------
+DOUBLE GetNanosecondCount()
+{
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter( &count );
+    QueryPerformanceFrequency( &frequency );
+    return (DOUBLE)count.QuadPart * 1.0e9 / (DOUBLE)frequency.QuadPart;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RandomFloat
+// Desc:  Returns a number between fMin and fMax
+//------------------------------------------------------------------------------------------------
+FLOAT RandomFloat( FLOAT fMin, FLOAT fMax )
+{
+    return fMin + (fMax - fMin) * (rand() / (FLOAT)RAND_MAX);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  MemorySend
+// Desc:  The send function given to every user; writes the packet into the memory socket
+//------------------------------------------------------------------------------------------------
+int MemorySend( LPVOID pContext, const SOCKADDR_IN * pAddress, const CHAR * pBuffer, int length )
+{
+    MemorySocket * pSocket = (MemorySocket*)pContext;
+    if( pSocket->dwWritePos + length > MEMORY_SOCKET_SIZE )
+        pSocket->dwWritePos = 0;
+    memcpy( &pSocket->Buffer[pSocket->dwWritePos], pBuffer, length );
+    pSocket->dwWritePos += length;
+    pSocket->qwPackets++;
+    pSocket->qwBytes += length;
+    return length;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  InitResult
+// Desc:  Clears a result before its first run
+//------------------------------------------------------------------------------------------------
+VOID InitResult( BenchResult * pResult, const CHAR * strName, DWORD dwUsers, QWORD qwOperations )
+{
+    ZeroMemory( pResult, sizeof(BenchResult) );
+    pResult->strName = strName;
+    pResult->dwUsers = dwUsers;
+    pResult->qwOperations = qwOperations;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  BeginRun
+// Desc:  Resets the socket counters before a timed section
+//------------------------------------------------------------------------------------------------
+VOID BeginRun( QWORD * pAllocations, QWORD * pPackets, QWORD * pBytes )
+{
+    *pAllocations = g_qwAllocations;
+    *pPackets = g_Socket.qwPackets;
+    *pBytes = g_Socket.qwBytes;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  EndRun
+// Desc:  Adds a timed section to the result
+//------------------------------------------------------------------------------------------------
+VOID EndRun( BenchResult * pResult, DOUBLE dNs, QWORD qwAllocations, QWORD qwPackets, QWORD qwBytes )
+{
+    pResult->dRunNs[pResult->dwRuns++] = dNs;
+    pResult->qwAllocations += g_qwAllocations - qwAllocations;
+    pResult->qwPackets += g_Socket.qwPackets - qwPackets;
+    pResult->qwBytes += g_Socket.qwBytes - qwBytes;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CompareDoubles
+// Desc:  qsort comparison for run times
+//------------------------------------------------------------------------------------------------
+int CompareDoubles( const void * pA, const void * pB )
+{
+    DOUBLE a = *(const DOUBLE*)pA, b = *(const DOUBLE*)pB;
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  PrintResult
+// Desc:  Prints the median and fastest run, per operation, along with allocations and packets
+//------------------------------------------------------------------------------------------------
+VOID PrintResult( BenchResult * pResult )
+{
+    qsort( pResult->dRunNs, pResult->dwRuns, sizeof(DOUBLE), CompareDoubles );
+    DOUBLE dOps = (DOUBLE)pResult->qwOperations;
+    DOUBLE dTotalOps = dOps * pResult->dwRuns;
+    printf( "%-8s %6u users  %12.1f ns/op  (min %12.1f)  %6.2f allocs/op  %8.2f packets/op  %7.1f bytes/packet\n",
+            pResult->strName, pResult->dwUsers,
+            pResult->dRunNs[pResult->dwRuns / 2] / dOps, pResult->dRunNs[0] / dOps,
+            pResult->qwAllocations / dTotalOps, pResult->qwPackets / dTotalOps,
+            pResult->qwPackets ? (DOUBLE)pResult->qwBytes / pResult->qwPackets : 0.0 );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  LogOnAll
+// Desc:  Logs every synthetic client on through the shared-port path, with the cookie the
+//        server would have challenged it with
+//------------------------------------------------------------------------------------------------
+VOID LogOnAll( DWORD dwUsers )
+{
+    LogOnMessage packet;
+    for( DWORD i = 0; i < dwUsers; ++i )
+    {
+        packet.dwCookie = g_Cookies.Make( &g_UserAddresses[i], 0 );
+        g_Room.ProcessServerPacket( &g_UserAddresses[i], (const CHAR*)&packet, sizeof(packet) );
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  FloodAll
+// Desc:  Sends a logon without a cookie from every synthetic client, the way a forged flood would
+//------------------------------------------------------------------------------------------------
+VOID FloodAll( DWORD dwUsers )
+{
+    LogOnMessage packet;
+    for( DWORD i = 0; i < dwUsers; ++i )
+        g_Room.ProcessServerPacket( &g_UserAddresses[i], (const CHAR*)&packet, sizeof(packet) );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  PlaceAll
+// Desc:  Looks up every client's player ID and sends one update so that it's in the world
+//------------------------------------------------------------------------------------------------
+VOID PlaceAll( DWORD dwUsers )
+{
+    for( DWORD i = 0; i < dwUsers; ++i )
+    {
+        g_UserIds[i] = g_Room.FindPlayer( &g_UserAddresses[i] );
+
+        FLOAT fAngle = RandomFloat( 0.0f, 6.2831853f );
+        FLOAT fDistance = g_fArea * sqrtf( RandomFloat( 0.0f, 1.0f ) );
+        g_UserX[i] = sinf( fAngle ) * fDistance;
+        g_UserZ[i] = cosf( fAngle ) * fDistance;
+
+        PlayerState state;
+        ZeroMemory( &state, sizeof(state) );
+        state.dwPlayerID = g_UserIds[i];
+        state.fPosition[0] = g_UserX[i];
+        state.fPosition[2] = g_UserZ[i];
+        state.dwState = 3;
+
+        BYTE buffer[MAX_COMPACT_UPDATE_SIZE];
+        DWORD dwSize = EncodeCompactUpdate( &state, g_fWorldBound, buffer, sizeof(buffer) );
+        g_Room.ProcessUserPacket( g_Room.GetUser( g_UserIds[i] ), (const CHAR*)buffer, dwSize );
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  AckAll
+// Desc:  Has every client acknowledge the newest snapshot it was sent, like a lossless network
+//------------------------------------------------------------------------------------------------
+VOID AckAll( DWORD dwUsers )
+{
+    SnapshotAckMessage packet;
+    for( DWORD i = 0; i < dwUsers; ++i )
+    {
+        packet.dwSequence = g_Room.GetNextSequence( g_UserIds[i] ) - 1;
+        g_Room.ProcessUserPacket( g_Room.GetUser( g_UserIds[i] ), (const CHAR*)&packet, sizeof(packet) );
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  DisconnectAll
+// Desc:  Drops every client without telling anyone, so logons can be timed again
+//------------------------------------------------------------------------------------------------
+VOID DisconnectAll()
+{
+    while( g_Room.GetPlayerCount() )
+        g_Room.DisconnectUser( g_Room.GetUser( g_Room.GetPlayer( 0 ) ) );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  BuildUpdates
+// Desc:  Encodes a batch of compact updates that move random players to random places.  Each
+//        packet is MAX_COMPACT_UPDATE_SIZE bytes apart in pBuffer.
+//------------------------------------------------------------------------------------------------
+VOID BuildUpdates( DWORD dwUsers, BYTE * pBuffer, DWORD * pSizes, DWORD * pUsers, DWORD dwCount )
+{
+    for( DWORD i = 0; i < dwCount; ++i )
+    {
+        DWORD dwUser = rand() % dwUsers;
+        PlayerState state;
+        ZeroMemory( &state, sizeof(state) );
+        state.dwPlayerID = g_UserIds[dwUser];
+        state.fVelocity[0] = RandomFloat( -2.0f, 2.0f );
+        state.fVelocity[2] = RandomFloat( -2.0f, 2.0f );
+        state.fPosition[0] = g_UserX[dwUser] + RandomFloat( -1.0f, 1.0f );
+        state.fPosition[2] = g_UserZ[dwUser] + RandomFloat( -1.0f, 1.0f );
+        state.dwState = 2;
+        state.fYaw = RandomFloat( -3.14159f, 3.14159f );
+
+        pUsers[i] = dwUser;
+        pSizes[i] = EncodeCompactUpdate( &state, g_fWorldBound, &pBuffer[i * MAX_COMPACT_UPDATE_SIZE], MAX_COMPACT_UPDATE_SIZE );
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CheckWireError
+// Desc:  Makes sure one decoded field is within its error bound, and keeps track of the largest
+//        error seen as a fraction of the bound
+//------------------------------------------------------------------------------------------------
+BOOL CheckWireError( FLOAT fError, FLOAT fBound, FLOAT fRange, FLOAT * pWorst )
+{
+    fError = fabsf( fError );
+    if( fError / fBound > *pWorst )
+        *pWorst = fError / fBound;
+    return fError <= fBound + fRange * WIRE_CHECK_TOLERANCE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CheckWireFormat
+// Desc:  Round-trips player states through EncodeCompactUpdate and DecodeCompactUpdate and
+//        checks that every field comes back within its WIRE_*_ERROR bound.  Along with random
+//        states, this covers zero velocity, yaw on either side of a full turn, values right at
+//        the edges of each range, velocities too fast to send and slot numbers that need more
+//        than one varint byte.  It also makes sure a running player fits within MAX_WIRE_SPEED.
+//------------------------------------------------------------------------------------------------
+HRESULT CheckWireFormat()
+{
+    const FLOAT fTwoPi = 6.28318531f;
+
+    // Run flat out, at the longest input the server takes and then at a few milliseconds a frame
+    MovementState movement;
+    memset( &movement, 0, sizeof(movement) );
+    PlayerInput input = { MAX_INPUT_DURATION, MOVEMENT_RUN, 0 };
+    FLOAT fFastest = 0.0f;
+    for( DWORD n = 0; n < 1000; ++n )
+    {
+        input.wDuration = (n < 500) ? MAX_INPUT_DURATION : 3;
+        ApplyInput( &movement, &input );
+        if( fabsf( movement.fVelocity ) > fFastest )
+            fFastest = fabsf( movement.fVelocity );
+    }
+    printf( "wire     running speed %.3f  limit %.3f  largest that can be sent %.3f\n",
+            fFastest, MAX_MOVEMENT_SPEED, MAX_WIRE_SPEED );
+    if( fFastest > MAX_MOVEMENT_SPEED || MAX_MOVEMENT_SPEED > MAX_WIRE_SPEED )
+    {
+        printf( "wire     players can move faster than MAX_WIRE_SPEED\n" );
+        return E_FAIL;
+    }
+
+    const FLOAT fBounds[] = { 64.0f, DEFAULT_WORLD_BOUND, 4096.0f };
+    const DWORD dwNumBounds = sizeof(fBounds) / sizeof(fBounds[0]);
+
+    FLOAT fWorstPosition = 0.0f, fWorstVelocity = 0.0f, fWorstYaw = 0.0f;
+    DWORD dwFailures = 0, dwLargestSize = 0;
+    for( DWORD b = 0; b < dwNumBounds; ++b )
+    {
+        FLOAT fBound = fBounds[b];
+        for( DWORD n = 0; n < WIRE_CHECK_STATES; ++n )
+        {
+            // Every eighth state sits on the edges of the ranges or is moving too fast to send, and
+            // every fourth one stands still
+            PlayerState state;
+            state.dwPlayerID = MAKE_PLAYER_ID( rand() % MAX_PLAYER_SLOTS, rand() & 0xFFFF );
+            if( n < 4 )
+                state.dwPlayerID = MAKE_PLAYER_ID( (n & 1) ? 127 : 128, (n & 2) ? 0xFFFF : 0 );
+            for( int i = 0; i < 3; ++i )
+            {
+                state.fPosition[i] = RandomFloat( -fBound, fBound );
+                state.fVelocity[i] = RandomFloat( -MAX_WIRE_SPEED, MAX_WIRE_SPEED );
+                if( n % 8 == 1 )
+                {
+                    state.fPosition[i] = (rand() & 1) ? fBound : -fBound;
+                    state.fVelocity[i] = (rand() & 1) ? MAX_WIRE_SPEED : -MAX_WIRE_SPEED;
+                }
+                if( n % 8 == 6 )
+                    state.fVelocity[i] = RandomFloat( -8.0f * MAX_WIRE_SPEED, 8.0f * MAX_WIRE_SPEED );
+                if( n % 4 == 3 )
+                    state.fVelocity[i] = 0.0f;
+            }
+
+            // Too fast a velocity should come back slowed down, but pointing the same way
+            FLOAT fLargest = MAX_WIRE_SPEED, fExpected[3];
+            for( int i = 0; i < 3; ++i )
+            {
+                if( fabsf( state.fVelocity[i] ) > fLargest )
+                    fLargest = fabsf( state.fVelocity[i] );
+            }
+            for( int i = 0; i < 3; ++i )
+                fExpected[i] = state.fVelocity[i] * (MAX_WIRE_SPEED / fLargest);
+            state.fYaw = RandomFloat( -2.0f * fTwoPi, 2.0f * fTwoPi );
+            if( n % 8 == 5 )
+                state.fYaw = fTwoPi + RandomFloat( -WIRE_YAW_ERROR, WIRE_YAW_ERROR );
+            state.dwState = rand() & ((1 << WIRE_STATE_BITS) - 1);
+
+            BYTE buffer[MAX_COMPACT_UPDATE_SIZE];
+            PlayerState decoded;
+            DWORD dwSize = EncodeCompactUpdate( &state, fBound, buffer, sizeof(buffer) );
+            if( !dwSize || !DecodeCompactUpdate( buffer, dwSize, fBound, &decoded ) ||
+                decoded.dwPlayerID != state.dwPlayerID || decoded.dwState != state.dwState )
+            {
+                dwFailures++;
+                continue;
+            }
+            if( dwSize > dwLargestSize )
+                dwLargestSize = dwSize;
+
+            // A player's velocity is zero whenever it stands still, so that has to be exact
+            BOOL bPassed = TRUE;
+            for( int i = 0; i < 3; ++i )
+            {
+                FLOAT fPositionError = (i == 1) ? WIRE_POSITION_Y_ERROR( fBound ) : WIRE_POSITION_XZ_ERROR( fBound );
+                bPassed &= CheckWireError( decoded.fPosition[i] - state.fPosition[i], fPositionError, fBound, &fWorstPosition );
+                bPassed &= CheckWireError( decoded.fVelocity[i] - fExpected[i], WIRE_VELOCITY_ERROR, MAX_WIRE_SPEED, &fWorstVelocity );
+                if( state.fVelocity[i] == 0.0f && decoded.fVelocity[i] != 0.0f )
+                    bPassed = FALSE;
+            }
+
+            // Angles are compared the short way around
+            FLOAT fYawError = fmodf( decoded.fYaw - state.fYaw, fTwoPi );
+            if( fYawError > fTwoPi * 0.5f )
+                fYawError -= fTwoPi;
+            else if( fYawError < -fTwoPi * 0.5f )
+                fYawError += fTwoPi;
+            bPassed &= CheckWireError( fYawError, WIRE_YAW_ERROR, fTwoPi, &fWorstYaw );
+            bPassed &= decoded.fYaw >= 0.0f && decoded.fYaw < fTwoPi;
+
+            if( !bPassed )
+                dwFailures++;
+        }
+    }
+
+    printf( "wire     %u states  largest %u bytes  worst error / bound:  position %.3f  velocity %.3f  yaw %.3f\n",
+            WIRE_CHECK_STATES * dwNumBounds, dwLargestSize, fWorstPosition, fWorstVelocity, fWorstYaw );
+    if( dwFailures || dwLargestSize > MAX_COMPACT_UPDATE_SIZE )
+    {
+        printf( "wire     %u states didn't round-trip within their error bounds\n", dwFailures );
+        return E_FAIL;
+    }
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RunBenchmarks
+// Desc:  Runs every benchmark with dwUsers clients logged on
+//------------------------------------------------------------------------------------------------
+HRESULT RunBenchmarks( DWORD dwUsers, FLOAT fViewRadius )
+{
+    if( FAILED( g_Room.Create( dwUsers, fViewRadius, 0, &g_BenchSecret ) ) )
+        return E_FAIL;
+    g_Cookies.Create( &g_BenchSecret );
+    g_Room.SetReplySend( MemorySend, &g_Socket );
+    for( DWORD i = 0; i < dwUsers; ++i )
+        g_Room.GetUserBySlot( i )->Create( MemorySend, &g_Socket );
+
+    g_UserAddresses = new SOCKADDR_IN[dwUsers];
+    g_UserIds = new DWORD[dwUsers];
+    g_UserX = new FLOAT[dwUsers];
+    g_UserZ = new FLOAT[dwUsers];
+    for( DWORD i = 0; i < dwUsers; ++i )
+    {
+        ZeroMemory( &g_UserAddresses[i], sizeof(SOCKADDR_IN) );
+        g_UserAddresses[i].sin_family = AF_INET;
+        g_UserAddresses[i].sin_port = htons( (WORD)(SERVER_COMM_PORT + 1 + (i & 0xFFF)) );
+        g_UserAddresses[i].sin_addr.s_addr = htonl( 0x0A000000 + i );
+    }
+    BYTE * pUpdates = new BYTE[UPDATES_PER_RUN * MAX_COMPACT_UPDATE_SIZE];
+    DWORD * pUpdateSizes = new DWORD[UPDATES_PER_RUN];
+    DWORD * pUpdateUsers = new DWORD[UPDATES_PER_RUN];
+
+    // Every configuration starts from the same random numbers
+    srand( dwUsers );
+
+    QWORD qwAllocations, qwPackets, qwBytes;
+    DOUBLE dStart;
+
+    // Logons without a cookie: all the server does is answer with one
+    {
+        BenchResult result;
+        InitResult( &result, "flood", dwUsers, dwUsers );
+        DisconnectAll();
+        for( DWORD run = 0; run <= g_dwRuns; ++run )
+        {
+            BeginRun( &qwAllocations, &qwPackets, &qwBytes );
+            dStart = GetNanosecondCount();
+            FloodAll( dwUsers );
+            DOUBLE dNs = GetNanosecondCount() - dStart;
+            if( run > 0 )
+                EndRun( &result, dNs, qwAllocations, qwPackets, qwBytes );
+        }
+        PrintResult( &result );
+    }
+
+    // Logging on: the cookie check, the address lookup miss, slot allocation and the
+    // confirmation packet
+    {
+        BenchResult result;
+        InitResult( &result, "logon", dwUsers, dwUsers );
+        for( DWORD run = 0; run <= g_dwRuns; ++run )
+        {
+            DisconnectAll();
+            BeginRun( &qwAllocations, &qwPackets, &qwBytes );
+            dStart = GetNanosecondCount();
+            LogOnAll( dwUsers );
+            DOUBLE dNs = GetNanosecondCount() - dStart;
+
+            // The first run warms up the tables
+            if( run > 0 )
+                EndRun( &result, dNs, qwAllocations, qwPackets, qwBytes );
+        }
+        PrintResult( &result );
+    }
+
+    // Put everyone in the world and settle the snapshots into the steady state.  Every frame in
+    // each user's history gets used once, so the tick doesn't count their first allocations.
+    PlaceAll( dwUsers );
+    for( DWORD i = 0; i < SNAPSHOT_HISTORY_SIZE + 1; ++i )
+    {
+        g_Room.SendSnapshots();
+        AckAll( dwUsers );
+    }
+
+    // Updates handed straight to ProcessUserPacket, then the same thing through the shared
+    // socket's address lookup
+    for( DWORD bDemux = 0; bDemux < 2; ++bDemux )
+    {
+        BenchResult result;
+        InitResult( &result, bDemux ? "demux" : "update", dwUsers, UPDATES_PER_RUN );
+        for( DWORD run = 0; run <= g_dwRuns; ++run )
+        {
+            BuildUpdates( dwUsers, pUpdates, pUpdateSizes, pUpdateUsers, UPDATES_PER_RUN );
+            BeginRun( &qwAllocations, &qwPackets, &qwBytes );
+            dStart = GetNanosecondCount();
+            if( bDemux )
+            {
+                for( DWORD i = 0; i < UPDATES_PER_RUN; ++i )
+                    g_Room.ProcessServerPacket( &g_UserAddresses[pUpdateUsers[i]],
+                                         (const CHAR*)&pUpdates[i * MAX_COMPACT_UPDATE_SIZE], pUpdateSizes[i] );
+            }
+            else
+            {
+                for( DWORD i = 0; i < UPDATES_PER_RUN; ++i )
+                    g_Room.ProcessUserPacket( g_Room.GetUser( g_UserIds[pUpdateUsers[i]] ),
+                                       (const CHAR*)&pUpdates[i * MAX_COMPACT_UPDATE_SIZE], pUpdateSizes[i] );
+            }
+            DOUBLE dNs = GetNanosecondCount() - dStart;
+            if( run > 0 )
+                EndRun( &result, dNs, qwAllocations, qwPackets, qwBytes );
+        }
+        PrintResult( &result );
+    }
+
+    // The relay loop: one tick with everyone moving, fanned out to everyone who can see them
+    {
+        BenchResult result;
+        InitResult( &result, "tick", dwUsers, 1 );
+        DWORD dwTicks = g_dwRuns * 4;
+        if( dwTicks > sizeof(result.dRunNs) / sizeof(result.dRunNs[0]) - 1 )
+            dwTicks = sizeof(result.dRunNs) / sizeof(result.dRunNs[0]) - 1;
+        QWORD qwVisible = 0;
+        for( DWORD run = 0; run <= dwTicks; ++run )
+        {
+            BuildUpdates( dwUsers, pUpdates, pUpdateSizes, pUpdateUsers, dwUsers );
+            for( DWORD i = 0; i < dwUsers; ++i )
+                g_Room.ProcessUserPacket( g_Room.GetUser( g_UserIds[pUpdateUsers[i]] ),
+                                   (const CHAR*)&pUpdates[i * MAX_COMPACT_UPDATE_SIZE], pUpdateSizes[i] );
+
+            BeginRun( &qwAllocations, &qwPackets, &qwBytes );
+            dStart = GetNanosecondCount();
+            g_Room.SendSnapshots();
+            DOUBLE dNs = GetNanosecondCount() - dStart;
+            if( run > 0 )
+                EndRun( &result, dNs, qwAllocations, qwPackets, qwBytes );
+
+            AckAll( dwUsers );
+            for( DWORD i = 0; i < dwUsers; ++i )
+                qwVisible += g_Room.GetVisibleCount( g_UserIds[i] );
+        }
+        PrintResult( &result );
+        printf( "         %6u users  %12.1f ns/snapshot  %6.1f players in view\n", dwUsers,
+                result.dRunNs[result.dwRuns / 2] / dwUsers, (DOUBLE)qwVisible / (dwUsers * (dwTicks + 1)) );
+    }
+
+    // Logging off: telling the players in view, and taking the player out of the world
+    {
+        BenchResult result;
+        InitResult( &result, "logoff", dwUsers, dwUsers );
+        LogOffMessage packet;
+        for( DWORD run = 0; run <= g_dwRuns; ++run )
+        {
+            DisconnectAll();
+            LogOnAll( dwUsers );
+            PlaceAll( dwUsers );
+
+            // Players are only told about players they can see, so give everyone a view first
+            g_Room.SendSnapshots();
+
+            BeginRun( &qwAllocations, &qwPackets, &qwBytes );
+            dStart = GetNanosecondCount();
+            for( DWORD i = 0; i < dwUsers; ++i )
+                g_Room.ProcessUserPacket( g_Room.GetUser( g_UserIds[i] ), (const CHAR*)&packet, sizeof(packet) );
+            DOUBLE dNs = GetNanosecondCount() - dStart;
+            if( run > 0 )
+                EndRun( &result, dNs, qwAllocations, qwPackets, qwBytes );
+        }
+        PrintResult( &result );
+    }
+
+    printf( "\n" );
+
+    delete [] pUpdates;
+    delete [] pUpdateSizes;
+    delete [] pUpdateUsers;
+    delete [] g_UserAddresses;
+    delete [] g_UserIds;
+    delete [] g_UserX;
+    delete [] g_UserZ;
+    g_Room.Destroy();
+
+    // Success
+    return S_OK;
+}
+
+
+int main( int argc, char * argv[] )
+{
+    // Read the command line.  "-users A,B,C" lists how many clients to run each benchmark with,
+    // "-runs N" sets how many timed runs the median is taken from, "-area R" is how far from the
+    // middle of the world the players are spread and "-view R" is the server's view radius.
+    // "-wire" checks the compact update encoding instead of running the benchmarks.
+    const CHAR * strUserCounts = DEFAULT_USER_COUNTS;
+    FLOAT fViewRadius = VIEW_RADIUS;
+    BOOL bCheckWire = FALSE;
+    for( int i = 1; i < argc; ++i )
+    {
+        if( 0 == strcmp( argv[i], "-wire" ) )
+            bCheckWire = TRUE;
+        else if( 0 == strcmp( argv[i], "-users" ) && i + 1 < argc )
+            strUserCounts = argv[++i];
+        else if( 0 == strcmp( argv[i], "-runs" ) && i + 1 < argc )
+            g_dwRuns = (DWORD)atoi( argv[++i] );
+        else if( 0 == strcmp( argv[i], "-area" ) && i + 1 < argc )
+            g_fArea = (FLOAT)atof( argv[++i] );
+        else if( 0 == strcmp( argv[i], "-view" ) && i + 1 < argc )
+            fViewRadius = (FLOAT)atof( argv[++i] );
+    }
+
+    if( bCheckWire )
+        return FAILED( CheckWireFormat() ) ? -1 : 0;
+
+    if( g_dwRuns < 1 || g_dwRuns > DEFAULT_RUNS * 2 )
+    {
+        printf( "Between 1 and %u runs can be timed\n", DEFAULT_RUNS * 2 );
+        return -1;
+    }
+
+    // The server runs the same way it does with a shared port, but sends into memory
+    g_bSharedPort = TRUE;
+    g_fWorldBound = DEFAULT_WORLD_BOUND;
+    g_bLogEvents = FALSE;
+
+    printf( "Median of %u runs; players spread within %.0f units, view radius %.0f\n\n", g_dwRuns, g_fArea, fViewRadius );
+
+    const CHAR * pCount = strUserCounts;
+    while( *pCount )
+    {
+        DWORD dwUsers = (DWORD)atoi( pCount );
+        if( dwUsers < 1 || dwUsers > MAX_PLAYER_SLOTS || FAILED( RunBenchmarks( dwUsers, fViewRadius ) ) )
+        {
+            printf( "Couldn't run with %u users\n", dwUsers );
+            return -1;
+        }
+
+        while( *pCount && *pCount != ',' )
+            ++pCount;
+        if( *pCount == ',' )
+            ++pCount;
+    }
+
+    // Success
+    return 0;
+}
@@ -0,0 +1,495 @@
+//------------------------------------------------------------------------------------------------
+// File:    bot.cpp
+//
+// Desc:    A simulated player that the load generator drives
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "bot.h"
+#include <math.h>
+
+#define PI                  3.14159265f
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RandomFloat
+// Desc:  Returns a number between fMin and fMax
+//------------------------------------------------------------------------------------------------
+static FLOAT RandomFloat( FLOAT fMin, FLOAT fMax )
+{
+    return fMin + (fMax - fMin) * (rand() / (FLOAT)RAND_MAX);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Bot
+// Desc:  
+//------------------------------------------------------------------------------------------------
+Bot::Bot()
+{
+    m_sSocket = INVALID_SOCKET;
+    ZeroMemory( &m_Server, sizeof(m_Server) );
+    m_dwId = INVALID_PLAYER_ID;
+    m_fWorldBound = DEFAULT_WORLD_BOUND;
+    m_dwLogOnTime = 0;
+    m_dwCookie = 0;
+    m_fArea = 0.0f;
+    m_fOriginYaw = 0.0f;
+    m_fTurnRate = 0.0f;
+    m_fDecisionTime = 0.0f;
+    m_bMoving = FALSE;
+    m_bRunning = FALSE;
+    ZeroMemory( m_Sent, sizeof(m_Sent) );
+    m_dwNextSent = 0;
+    m_bAuthoritative = FALSE;
+    ZeroMemory( m_InputSendTimes, sizeof(m_InputSendTimes) );
+    m_dwNextUnsentInput = 1;
+    m_dwLastSequence = 0;
+    m_dwAckedSequence = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~Bot
+// Desc:  
+//------------------------------------------------------------------------------------------------
+Bot::~Bot()
+{
+    Destroy();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Create
+// Desc:  Opens the bot's socket and drops the bot somewhere within fArea of the middle of the
+//        world.  pfnOnPacket is called with this bot when its socket has data.
+//------------------------------------------------------------------------------------------------
+HRESULT Bot::Create( const SOCKADDR_IN * pServer, FLOAT fArea, Reactor * pReactor, ReactorCallback pfnOnPacket )
+{
+    Destroy();
+
+    // Every bot has its own socket, so the server sees it as a separate client
+    m_sSocket = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+    if( m_sSocket == INVALID_SOCKET )
+        return E_FAIL;
+
+    if( !SetSocketNonBlocking( m_sSocket ) ||
+        FAILED( pReactor->Register( m_sSocket, pfnOnPacket, this ) ) ||
+        FAILED( m_Snapshots.Create( SNAPSHOT_HISTORY_SIZE ) ) )
+    {
+        closesocket( m_sSocket );
+        m_sSocket = INVALID_SOCKET;
+        return E_FAIL;
+    }
+
+    m_Server = *pServer;
+    m_fArea = fArea;
+    FLOAT fAngle = RandomFloat( 0.0f, 2.0f * PI );
+    FLOAT fDistance = fArea * sqrtf( RandomFloat( 0.0f, 1.0f ) );
+    MovementState start;
+    ZeroMemory( &start, sizeof(start) );
+    start.fPosition[0] = sinf( fAngle ) * fDistance;
+    start.fPosition[2] = cosf( fAngle ) * fDistance;
+    m_fOriginYaw = start.fYaw = start.fTargetYaw = RandomFloat( -PI, PI );
+    start.dwState = MOVEMENT_IDLE;
+    m_Prediction.Reset( &start );
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Destroy
+// Desc:  Closes the socket.  The caller should unregister it from the reactor first.
+//------------------------------------------------------------------------------------------------
+VOID Bot::Destroy()
+{
+    if( m_sSocket != INVALID_SOCKET )
+    {
+        closesocket( m_sSocket );
+        m_sSocket = INVALID_SOCKET;
+    }
+
+    m_Snapshots.Destroy();
+    m_dwId = INVALID_PLAYER_ID;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  LogOn
+// Desc:  Asks the server for a player slot.  Called again if the reply doesn't come.
+//------------------------------------------------------------------------------------------------
+VOID Bot::LogOn()
+{
+    LogOnMessage packet;
+    packet.dwCookie = m_dwCookie;
+    sendto( m_sSocket, (const CHAR*)&packet, sizeof(packet), 0, (LPSOCKADDR)&m_Server, sizeof(SOCKADDR_IN) );
+    m_dwLogOnTime = GetTickCount();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  AnswerChallenge
+// Desc:  Logs on again with the cookie the server sent back
+//------------------------------------------------------------------------------------------------
+VOID Bot::AnswerChallenge( DWORD dwCookie )
+{
+    if( m_dwId != INVALID_PLAYER_ID )
+        return;
+
+    m_dwCookie = dwCookie;
+    LogOn();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ConfirmLogOn
+// Desc:  Handles the server's reply to LogOn.  Like the client, the bot talks to whatever
+//        address the reply came from from now on.  An authoritative server starts everyone
+//        standing in the middle of the world.
+//------------------------------------------------------------------------------------------------
+VOID Bot::ConfirmLogOn( DWORD dwPlayerID, FLOAT fWorldBound, DWORD dwFlags, const SOCKADDR_IN * pFrom )
+{
+    if( m_dwId != INVALID_PLAYER_ID )
+        return;
+
+    connect( m_sSocket, (const SOCKADDR*)pFrom, sizeof(SOCKADDR_IN) );
+    m_Server = *pFrom;
+    m_dwId = dwPlayerID;
+    m_fWorldBound = fWorldBound;
+    m_Snapshots.Reset();
+    m_dwLastSequence = 0;
+    m_dwAckedSequence = 0;
+    m_Reckoning.Reset();
+    m_Playout.Reset();
+
+    m_bAuthoritative = (dwFlags & LOGON_AUTHORITATIVE) != 0;
+    if( m_bAuthoritative )
+    {
+        MovementState start;
+        ZeroMemory( &start, sizeof(start) );
+        start.dwState = MOVEMENT_IDLE;
+        m_Prediction.Reset( &start );
+        m_dwNextUnsentInput = 1;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  LogOff
+// Desc:  Tells the server that the bot is leaving
+//------------------------------------------------------------------------------------------------
+VOID Bot::LogOff()
+{
+    if( m_dwId == INVALID_PLAYER_ID )
+        return;
+
+    LogOffMessage packet;
+    send( m_sSocket, (const CHAR*)&packet, sizeof(packet), 0 );
+    m_dwId = INVALID_PLAYER_ID;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  IsLoggedOn
+// Desc:  
+//------------------------------------------------------------------------------------------------
+BOOL Bot::IsLoggedOn() const
+{
+    return m_dwId != INVALID_PLAYER_ID;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetId
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DWORD Bot::GetId() const
+{
+    return m_dwId;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetLogOnTime
+// Desc:  Returns when LogOn was last called
+//------------------------------------------------------------------------------------------------
+DWORD Bot::GetLogOnTime() const
+{
+    return m_dwLogOnTime;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetServer
+// Desc:  Where the bot sends to.  Once it's logged on, this is the port of its room.
+//------------------------------------------------------------------------------------------------
+const SOCKADDR_IN * Bot::GetServer() const
+{
+    return &m_Server;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  IsAuthoritative
+// Desc:  Determines whether the server moves this bot from its inputs
+//------------------------------------------------------------------------------------------------
+BOOL Bot::IsAuthoritative() const
+{
+    return m_bAuthoritative;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SetUpdateThresholds
+// Desc:  Sets how far the bot can drift from what others predict before it sends an update, and
+//        the shortest time between updates
+//------------------------------------------------------------------------------------------------
+VOID Bot::SetUpdateThresholds( FLOAT fPositionError, FLOAT fYawError, DWORD dwMinInterval )
+{
+    m_Reckoning.Create( fPositionError, fYawError, dwMinInterval );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Simulate
+// Desc:  Picks some input for the bot, then moves it the same way UpdatePlayer moves the
+//        client's player
+//------------------------------------------------------------------------------------------------
+VOID Bot::Simulate( FLOAT fElapsedTime )
+{
+    // Every few seconds, decide whether to stand, walk or run, and how fast to turn
+    m_fDecisionTime -= fElapsedTime;
+    if( m_fDecisionTime <= 0.0f )
+    {
+        int iChoice = rand() % 10;
+        m_bMoving = iChoice >= 2;
+        m_bRunning = iChoice >= 8;
+        m_fTurnRate = RandomFloat( -1.0f, 1.0f );
+        m_fDecisionTime = RandomFloat( 1.0f, 5.0f );
+    }
+
+    // Turn back toward the middle after wandering too far out
+    const FLOAT * pPosition = m_Prediction.GetMovement()->fPosition;
+    if( pPosition[0] * pPosition[0] + pPosition[2] * pPosition[2] > m_fArea * m_fArea )
+        m_fOriginYaw = atan2f( pPosition[0], pPosition[2] );
+    else
+        m_fOriginYaw += m_fTurnRate * fElapsedTime;
+
+    m_Prediction.Predict( fElapsedTime, m_bMoving ? (m_bRunning ? MOVEMENT_RUN : MOVEMENT_WALK) : MOVEMENT_IDLE,
+                          m_fOriginYaw );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetState
+// Desc:  Gets the bot's state the way the client reports its player's
+//------------------------------------------------------------------------------------------------
+VOID Bot::GetState( PlayerState * pState ) const
+{
+    GetMovementPlayerState( m_Prediction.GetMovement(), m_dwId, pState );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  NeedsUpdate
+// Desc:  Determines whether the bot has drifted far enough from its last update to send another
+//------------------------------------------------------------------------------------------------
+BOOL Bot::NeedsUpdate( DWORD dwTime ) const
+{
+    if( m_dwId == INVALID_PLAYER_ID )
+        return FALSE;
+
+    PlayerState state;
+    GetState( &state );
+    return m_Reckoning.NeedsUpdate( &state, dwTime );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SendUpdate
+// Desc:  Sends the bot's state to the server and remembers it for latency measurements.
+//        Returns the number of bytes sent, or SOCKET_ERROR.
+//------------------------------------------------------------------------------------------------
+int Bot::SendUpdate( DWORD dwTime )
+{
+    if( m_dwId == INVALID_PLAYER_ID )
+        return SOCKET_ERROR;
+
+    PlayerState state;
+    GetState( &state );
+    m_Reckoning.Sent( &state, m_fWorldBound, dwTime );
+
+    BYTE buffer[MAX_COMPACT_UPDATE_SIZE];
+    DWORD dwSize = EncodeCompactUpdate( &state, m_fWorldBound, buffer, sizeof(buffer) );
+    if( !dwSize )
+        return SOCKET_ERROR;
+
+    // Remember exactly what the server will relay
+    QuantizedState quantized;
+    QuantizeState( &state, m_fWorldBound, &quantized );
+    SentState * pSent = &m_Sent[m_dwNextSent++ % BOT_SENT_HISTORY];
+    memcpy( pSent->wField, quantized.wField, sizeof(pSent->wField) );
+    pSent->qwTime = GetMicrosecondCount();
+
+    return send( m_sSocket, (const CHAR*)buffer, dwSize, 0 );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  FindSentState
+// Desc:  Looks for the most recent update this bot sent with the same fields as pState
+//------------------------------------------------------------------------------------------------
+BOOL Bot::FindSentState( const QuantizedState * pState, QWORD * pSendTime ) const
+{
+    DWORD dwCount = m_dwNextSent < BOT_SENT_HISTORY ? m_dwNextSent : BOT_SENT_HISTORY;
+    for( DWORD i = 1; i <= dwCount; ++i )
+    {
+        const SentState * pSent = &m_Sent[(m_dwNextSent - i) % BOT_SENT_HISTORY];
+        if( 0 == memcmp( pSent->wField, pState->wField, sizeof(pSent->wField) ) )
+        {
+            *pSendTime = pSent->qwTime;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SendInputs
+// Desc:  Sends the server the oldest inputs it hasn't applied yet.  Returns the number of bytes
+//        sent, 0 if there was nothing to send, or SOCKET_ERROR.
+//------------------------------------------------------------------------------------------------
+int Bot::SendInputs()
+{
+    if( m_dwId == INVALID_PLAYER_ID || !m_bAuthoritative )
+        return SOCKET_ERROR;
+
+    BYTE buffer[MAX_PLAYER_INPUT_SIZE];
+    DWORD dwLastSequence;
+    DWORD dwSize = m_Prediction.EncodeInputs( buffer, sizeof(buffer), &dwLastSequence );
+    if( !dwSize )
+        return 0;
+
+    // Inputs are repeated until they're acknowledged, so only time them from the first send
+    QWORD qwNow = GetMicrosecondCount();
+    if( (int)(dwLastSequence + 1 - m_dwNextUnsentInput) > INPUT_HISTORY_SIZE )
+        m_dwNextUnsentInput = dwLastSequence + 1 - INPUT_HISTORY_SIZE;
+    for( ; (int)(dwLastSequence - m_dwNextUnsentInput) >= 0; ++m_dwNextUnsentInput )
+        m_InputSendTimes[m_dwNextUnsentInput % INPUT_HISTORY_SIZE] = qwNow;
+
+    return send( m_sSocket, (const CHAR*)buffer, dwSize, 0 );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  FindInputSendTime
+// Desc:  Gets when the input with the given sequence number was first sent to the server
+//------------------------------------------------------------------------------------------------
+BOOL Bot::FindInputSendTime( DWORD dwSequence, QWORD * pSendTime ) const
+{
+    if( (int)(m_dwNextUnsentInput - dwSequence) <= 0 ||
+        m_dwNextUnsentInput - dwSequence > INPUT_HISTORY_SIZE )
+        return FALSE;
+
+    *pSendTime = m_InputSendTimes[dwSequence % INPUT_HISTORY_SIZE];
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Reconcile
+// Desc:  Corrects the bot's position with where the server says its inputs have put it.
+//        pfCorrection gets how far the bot moved.  Returns FALSE if the acknowledgement was out
+//        of date.
+//------------------------------------------------------------------------------------------------
+BOOL Bot::Reconcile( const InputAckMessage * pAck, FLOAT * pfCorrection )
+{
+    return m_bAuthoritative && m_Prediction.Reconcile( pAck, pfCorrection );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RecvPacket
+// Desc:  Gets the next datagram waiting on the bot's socket
+//------------------------------------------------------------------------------------------------
+int Bot::RecvPacket( CHAR * pBuffer, int length, SOCKADDR_IN * pFrom )
+{
+    socklen_t iFromLen = sizeof(SOCKADDR_IN);
+    return recvfrom( m_sSocket, pBuffer, length, 0, (LPSOCKADDR)pFrom, &iFromLen );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  DecodeSnapshot
+// Desc:  Decodes a delta snapshot.  ppPrevious gets the snapshot that was the newest one before
+//        this, or NULL if there wasn't one or it's gone from the history.  pbLate is set if the
+//        snapshot arrived too late for the client to interpolate toward it.
+//------------------------------------------------------------------------------------------------
+SnapshotFrame * Bot::DecodeSnapshot( const BYTE * pBuffer, DWORD dwSize, SnapshotFrame ** ppPrevious,
+                                     BOOL * pbLate )
+{
+    DWORD dwPreviousSequence = m_dwLastSequence;
+    SnapshotFrame * pFrame = DecodeDeltaSnapshot( pBuffer, dwSize, m_dwLastSequence, &m_Snapshots );
+    if( !pFrame )
+        return NULL;
+
+    m_dwLastSequence = pFrame->dwSequence;
+    *ppPrevious = m_Snapshots.Find( dwPreviousSequence );
+    *pbLate = m_Playout.Arrived( pFrame->dwSequence, GetTickCount() );
+    return pFrame;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetPlayoutClock
+// Desc:  Gets the playout clock that the snapshots are timed with
+//------------------------------------------------------------------------------------------------
+const PlayoutClock * Bot::GetPlayoutClock() const
+{
+    return &m_Playout;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SendAck
+// Desc:  Acknowledges the newest snapshot if that hasn't been done yet.  Returns the number of
+//        bytes sent, or 0 if there was nothing to acknowledge.
+//------------------------------------------------------------------------------------------------
+int Bot::SendAck()
+{
+    if( m_dwLastSequence == m_dwAckedSequence )
+        return 0;
+
+    SnapshotAckMessage packet;
+    packet.dwSequence = m_dwLastSequence;
+    m_dwAckedSequence = m_dwLastSequence;
+    return send( m_sSocket, (const CHAR*)&packet, sizeof(packet), 0 );
+}
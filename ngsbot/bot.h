@@ -0,0 +1,140 @@
+//------------------------------------------------------------------------------------------------
+// File:    bot.h
+//
+// Desc:    A simulated player that the load generator drives
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __BOT_H__
+#define __BOT_H__
+
+
+// Include files required to compile this header
+#include "../common/platform.h"
+#include "../common/protocol.h"
+#include "../common/wireformat.h"
+#include "../common/snapshot.h"
+#include "../common/deadreckoning.h"
+#include "../common/playout.h"
+#include "../common/prediction.h"
+#include "../ngsserver/reactor.h"
+
+// How many of its own updates each bot remembers, for matching them up when they're relayed back
+#define BOT_SENT_HISTORY    32
+
+/**
+ * One headless player.  It moves around the way the real client does under keyboard input,
+ * sends compact updates to the server when dead reckoning says they're needed (or its inputs,
+ * when the server is authoritative), and decodes and acknowledges the snapshots that come back.
+ *   @author Karl Gluck
+ */
+class Bot
+{
+    public:
+
+        Bot();
+        ~Bot();
+        HRESULT Create( const SOCKADDR_IN * pServer, FLOAT fArea, Reactor * pReactor, ReactorCallback pfnOnPacket );
+        VOID Destroy();
+
+        VOID LogOn();
+        VOID AnswerChallenge( DWORD dwCookie );
+        VOID ConfirmLogOn( DWORD dwPlayerID, FLOAT fWorldBound, DWORD dwFlags, const SOCKADDR_IN * pFrom );
+        VOID LogOff();
+        BOOL IsLoggedOn() const;
+        DWORD GetId() const;
+        const SOCKADDR_IN * GetServer() const;
+        DWORD GetLogOnTime() const;
+        BOOL IsAuthoritative() const;
+
+        VOID SetUpdateThresholds( FLOAT fPositionError, FLOAT fYawError, DWORD dwMinInterval );
+        VOID Simulate( FLOAT fElapsedTime );
+        BOOL NeedsUpdate( DWORD dwTime ) const;
+        int SendUpdate( DWORD dwTime );
+        BOOL FindSentState( const QuantizedState * pState, QWORD * pSendTime ) const;
+        int SendInputs();
+        BOOL FindInputSendTime( DWORD dwSequence, QWORD * pSendTime ) const;
+        BOOL Reconcile( const InputAckMessage * pAck, FLOAT * pfCorrection );
+
+        int RecvPacket( CHAR * pBuffer, int length, SOCKADDR_IN * pFrom );
+        SnapshotFrame * DecodeSnapshot( const BYTE * pBuffer, DWORD dwSize, SnapshotFrame ** ppPrevious,
+                                        BOOL * pbLate );
+        int SendAck();
+        const PlayoutClock * GetPlayoutClock() const;
+
+    protected:
+
+        VOID GetState( PlayerState * pState ) const;
+
+    protected:
+
+        /**
+         * An update this bot sent, and when it went out
+         */
+        struct SentState
+        {
+            WORD wField[WIRE_NUM_FIELDS];
+            QWORD qwTime;
+        };
+
+        // Connection
+        SOCKET m_sSocket;
+        SOCKADDR_IN m_Server;
+        DWORD m_dwId;
+        FLOAT m_fWorldBound;
+        DWORD m_dwLogOnTime;
+        DWORD m_dwCookie;           // Last cookie the server challenged the bot with
+
+        // Movement, using the same model as the client and the server
+        FLOAT m_fArea;
+        InputPrediction m_Prediction;
+        FLOAT m_fOriginYaw;
+        FLOAT m_fTurnRate;          // Stands in for the mouse
+        FLOAT m_fDecisionTime;      // Seconds until the bot picks something else to do
+        BOOL m_bMoving;
+        BOOL m_bRunning;
+
+        // Updates sent, newest at m_dwNextSent - 1, and what the other bots predict from them
+        DeadReckoning m_Reckoning;
+        SentState m_Sent[BOT_SENT_HISTORY];
+        DWORD m_dwNextSent;
+
+        // When the server is authoritative, m_Prediction's inputs are sent instead.  Each one's
+        // send time is kept until it drops out of the history, so the server's acknowledgement
+        // of it can be timed.
+        BOOL m_bAuthoritative;
+        QWORD m_InputSendTimes[INPUT_HISTORY_SIZE];
+        DWORD m_dwNextUnsentInput;
+
+        // Snapshots received
+        SnapshotHistory m_Snapshots;
+        DWORD m_dwLastSequence;
+        DWORD m_dwAckedSequence;
+        PlayoutClock m_Playout;     // When the client would draw the other players
+};
+
+#endif // __BOT_H__
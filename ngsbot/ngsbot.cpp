@@ -0,0 +1,574 @@
+//------------------------------------------------------------------------------------------------
+// File:    ngsbot.cpp
+//
+// Desc:    Headless load generator that logs many simulated players on to a server
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "bot.h"
+#if !defined(WIN32) && !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+#define DEFAULT_BOTS            100
+#define DEFAULT_DURATION        30                          /* Run for 30 seconds */
+#define DEFAULT_AREA            100.0f                      /* Wander within 100 units of the middle */
+#define CORRECTION_EPSILON      0.001f                      /* Reconciling moved the bot by more than rounding */
+#define SIMULATE_PERIOD         10                          /* Move every bot each 10 ms */
+#define REPORT_PERIOD           1000                        /* Print progress every second */
+#define LOGON_RETRY             1000                        /* Ask again if no reply after a second */
+#define LOGONS_PER_STEP         64                          /* Don't flood the server with logons */
+
+// Relay latencies are counted in buckets this many microseconds wide, up to LATENCY_MAX_US
+#define LATENCY_BUCKET_US       50
+#define LATENCY_MAX_US          5000000
+#define LATENCY_BUCKETS         (LATENCY_MAX_US / LATENCY_BUCKET_US + 1)
+
+
+/**
+ * Running totals for the whole test
+ */
+struct BotStatistics
+{
+    QWORD qwUpdatesSent;
+    QWORD qwUpdateBytes;
+    QWORD qwAcksSent;
+    QWORD qwSendErrors;
+    QWORD qwSnapshotsReceived;
+    QWORD qwSnapshotBytes;
+    QWORD qwSnapshotsMissed;        // Sequence numbers skipped over, i.e. lost on the way
+    QWORD qwSnapshotsRejected;      // Arrived out of order, or their baseline was gone
+    QWORD qwSnapshotsLate;          // Arrived after the client would have needed them
+    QWORD qwUnmatchedChanges;       // Relayed states that didn't match anything the sender sent
+    QWORD qwLatencySamples;
+    QWORD qwLatencyTotal;
+    QWORD qwLatencyMax;
+    QWORD qwInputAcks;              // Acknowledgements of inputs, when the server is authoritative
+    QWORD qwCorrections;            // Acknowledgements that didn't match what the bot predicted
+    FLOAT fMaxCorrection;
+};
+
+
+// Global variables
+Reactor g_Reactor;
+Bot * g_Bots = NULL;
+DWORD g_dwNumBots = 0;
+DWORD * g_BotTable = NULL;          // Logged-on bots by room and player ID; g_dwNumBots is empty
+DWORD g_dwBotTableMask = 0;
+DWORD g_dwLoggedOn = 0;
+DWORD g_dwStep = 0;
+QWORD g_qwStartTime = 0;
+QWORD g_qwLastStepTime = 0;
+BOOL g_bFixedRate = FALSE;          // Send every update period instead of when dead reckoning says to
+BotStatistics g_Stats;
+BotStatistics g_LastReport;
+DWORD * g_LatencyBuckets = NULL;
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  BotTableIndex
+// Desc:  Where to start looking for a player in g_BotTable.  Every room numbers its players
+//        from the same slots, so the room's port is part of the key.
+//------------------------------------------------------------------------------------------------
+inline DWORD BotTableIndex( const SOCKADDR_IN * pRoom, DWORD dwPlayerID )
+{
+    QWORD qwKey = ((QWORD)pRoom->sin_port << 32) | dwPlayerID;
+    qwKey = (qwKey ^ (qwKey >> 33)) * 0xFF51AFD7ED558CCDULL;
+    return (DWORD)(qwKey ^ (qwKey >> 33)) & g_dwBotTableMask;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  AddBot
+// Desc:  Puts a bot that just logged on into g_BotTable.  Bots never log on twice, so the table
+//        never holds more than g_dwNumBots of them.
+//------------------------------------------------------------------------------------------------
+VOID AddBot( DWORD dwBot )
+{
+    DWORD i = BotTableIndex( g_Bots[dwBot].GetServer(), g_Bots[dwBot].GetId() );
+    while( g_BotTable[i] != g_dwNumBots )
+        i = (i + 1) & g_dwBotTableMask;
+    g_BotTable[i] = dwBot;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  FindBot
+// Desc:  Gets the bot playing dwPlayerID in the room at pRoom, or g_dwNumBots if it isn't ours
+//------------------------------------------------------------------------------------------------
+DWORD FindBot( const SOCKADDR_IN * pRoom, DWORD dwPlayerID )
+{
+    for( DWORD i = BotTableIndex( pRoom, dwPlayerID ); g_BotTable[i] != g_dwNumBots; i = (i + 1) & g_dwBotTableMask )
+    {
+        const Bot * pBot = &g_Bots[g_BotTable[i]];
+        if( pBot->GetId() == dwPlayerID &&
+            pBot->GetServer()->sin_port == pRoom->sin_port &&
+            pBot->GetServer()->sin_addr.s_addr == pRoom->sin_addr.s_addr )
+            return g_BotTable[i];
+    }
+    return g_dwNumBots;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RecordLatency
+// Desc:  Adds one send-to-peer-receipt measurement
+//------------------------------------------------------------------------------------------------
+VOID RecordLatency( QWORD qwMicroseconds )
+{
+    DWORD dwBucket = (DWORD)((qwMicroseconds < LATENCY_MAX_US ? qwMicroseconds : LATENCY_MAX_US) / LATENCY_BUCKET_US);
+    g_LatencyBuckets[dwBucket]++;
+    g_Stats.qwLatencySamples++;
+    g_Stats.qwLatencyTotal += qwMicroseconds;
+    if( qwMicroseconds > g_Stats.qwLatencyMax )
+        g_Stats.qwLatencyMax = qwMicroseconds;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  LatencyPercentile
+// Desc:  Returns the latency in milliseconds that fPercent of the samples were at or under
+//------------------------------------------------------------------------------------------------
+FLOAT LatencyPercentile( FLOAT fPercent )
+{
+    if( !g_Stats.qwLatencySamples )
+        return 0.0f;
+
+    QWORD qwTarget = (QWORD)(g_Stats.qwLatencySamples * (fPercent / 100.0f));
+    if( qwTarget < 1 )
+        qwTarget = 1;
+    QWORD qwCount = 0;
+    for( DWORD i = 0; i < LATENCY_BUCKETS; ++i )
+    {
+        qwCount += g_LatencyBuckets[i];
+        if( qwCount >= qwTarget )
+            return (i + 1) * LATENCY_BUCKET_US / 1000.0f;
+    }
+
+    return LATENCY_MAX_US / 1000.0f;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  MeasureRelays
+// Desc:  Finds the players whose state changed between two snapshots that pBot received, and
+//        for the ones run by this program, times how long the new state took to get here from
+//        its sender.  The sender has to be in pBot's room, since IDs repeat from room to room.
+//------------------------------------------------------------------------------------------------
+VOID MeasureRelays( const Bot * pBot, const SnapshotFrame * pPrevious, const SnapshotFrame * pFrame, QWORD qwNow )
+{
+    // Both frames are sorted by ID, so walk them together
+    DWORD p = 0;
+    for( DWORD i = 0; i < pFrame->dwNumPlayers; ++i )
+    {
+        const QuantizedState * pState = &pFrame->pPlayers[i];
+        while( p < pPrevious->dwNumPlayers && pPrevious->pPlayers[p].dwPlayerID < pState->dwPlayerID )
+            ++p;
+        if( p >= pPrevious->dwNumPlayers || pPrevious->pPlayers[p].dwPlayerID != pState->dwPlayerID )
+            continue;
+        if( 0 == memcmp( pPrevious->pPlayers[p].wField, pState->wField, sizeof(pState->wField) ) )
+            continue;
+
+        // Find the bot that sent this
+        DWORD dwBot = FindBot( pBot->GetServer(), pState->dwPlayerID );
+        QWORD qwSendTime;
+        if( dwBot < g_dwNumBots && g_Bots[dwBot].FindSentState( pState, &qwSendTime ) )
+            RecordLatency( qwNow - qwSendTime );
+        else
+            g_Stats.qwUnmatchedChanges++;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  BotReadable
+// Desc:  Called by the reactor when a bot's socket has data.  Drains every waiting packet.
+//------------------------------------------------------------------------------------------------
+VOID BotReadable( LPVOID pContext )
+{
+    Bot * pBot = (Bot*)pContext;
+
+    CHAR buffer[MAX_PACKET_SIZE];
+    SOCKADDR_IN from;
+    int iSize;
+    while( 0 < (iSize = pBot->RecvPacket( buffer, sizeof(buffer), &from )) )
+    {
+        QWORD qwNow = GetMicrosecondCount();
+
+        switch( GetMessageID( buffer ) )
+        {
+            case MSG_LOGONCHALLENGE:
+            {
+                if( iSize >= (int)sizeof(LogOnChallengeMessage) )
+                    pBot->AnswerChallenge( ((LogOnChallengeMessage*)buffer)->dwCookie );
+            } break;
+
+            case MSG_CONFIRMLOGON:
+            {
+                if( iSize < (int)sizeof(ConfirmLogOnMessage) || pBot->IsLoggedOn() )
+                    break;
+
+                ConfirmLogOnMessage * pMsg = (ConfirmLogOnMessage*)buffer;
+                pBot->ConfirmLogOn( pMsg->dwPlayerID, pMsg->fWorldBound, pMsg->dwFlags, &from );
+                AddBot( (DWORD)(pBot - g_Bots) );
+                g_dwLoggedOn++;
+
+            } break;
+
+            case MSG_DELTASNAPSHOT:
+            {
+                g_Stats.qwSnapshotsReceived++;
+                g_Stats.qwSnapshotBytes += iSize;
+
+                DWORD dwLastSequence = 0;
+                SnapshotFrame * pPrevious = NULL;
+                BOOL bLate = FALSE;
+                SnapshotFrame * pFrame = pBot->DecodeSnapshot( (BYTE*)buffer, iSize, &pPrevious, &bLate );
+                if( !pFrame )
+                {
+                    g_Stats.qwSnapshotsRejected++;
+                    break;
+                }
+                if( bLate )
+                    g_Stats.qwSnapshotsLate++;
+
+                // Sequence numbers go up by one per snapshot sent to this bot.  An authoritative
+                // server relays where it moved the bots, not what they sent, so nothing in the
+                // snapshot matches; the input acknowledgements are timed instead.
+                if( pPrevious )
+                {
+                    dwLastSequence = pPrevious->dwSequence;
+                    g_Stats.qwSnapshotsMissed += pFrame->dwSequence - dwLastSequence - 1;
+                    if( !pBot->IsAuthoritative() )
+                        MeasureRelays( pBot, pPrevious, pFrame, qwNow );
+                }
+
+            } break;
+
+            case MSG_INPUTACK:
+            {
+                FLOAT fCorrection;
+                InputAckMessage * pAck = (InputAckMessage*)buffer;
+                if( iSize < (int)sizeof(InputAckMessage) || !pBot->Reconcile( pAck, &fCorrection ) )
+                    break;
+
+                // Time how long the newest input it covers took to get to the server and back
+                QWORD qwSendTime;
+                if( pBot->FindInputSendTime( pAck->dwSequence, &qwSendTime ) )
+                    RecordLatency( qwNow - qwSendTime );
+                else
+                    g_Stats.qwUnmatchedChanges++;
+
+                g_Stats.qwInputAcks++;
+                if( fCorrection > CORRECTION_EPSILON )
+                    g_Stats.qwCorrections++;
+                if( fCorrection > g_Stats.fMaxCorrection )
+                    g_Stats.fMaxCorrection = fCorrection;
+
+            } break;
+
+            default:
+                // Other messages aren't needed to generate load
+                break;
+        }
+    }
+
+    // One acknowledgement covers everything that just arrived
+    if( 0 < pBot->SendAck() )
+        g_Stats.qwAcksSent++;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  StepBots
+// Desc:  Moves every bot, sends the updates that are due and retries logons that went unanswered.
+//        When the server is authoritative, the updates are the bots' inputs instead.
+//------------------------------------------------------------------------------------------------
+VOID StepBots( LPVOID pContext, DWORD dwTime )
+{
+    QWORD qwNow = GetMicrosecondCount();
+    FLOAT fElapsedTime = (qwNow - g_qwLastStepTime) / 1000000.0f;
+    g_qwLastStepTime = qwNow;
+
+    // At a fixed rate, the bots' updates are spread evenly over each update period
+    DWORD dwStepsPerUpdate = 1000 / (SIMULATE_PERIOD * UPDATE_FREQUENCY);
+    DWORD dwStepsPerInput = 1000 / (SIMULATE_PERIOD * INPUT_SEND_FREQUENCY);
+    DWORD dwLogOns = 0;
+    for( DWORD i = 0; i < g_dwNumBots; ++i )
+    {
+        Bot * pBot = &g_Bots[i];
+        if( !pBot->IsLoggedOn() )
+        {
+            if( dwLogOns < LOGONS_PER_STEP &&
+                (!pBot->GetLogOnTime() || dwTime - pBot->GetLogOnTime() > LOGON_RETRY) )
+            {
+                pBot->LogOn();
+                dwLogOns++;
+            }
+            continue;
+        }
+
+        pBot->Simulate( fElapsedTime );
+        if( pBot->IsAuthoritative() )
+        {
+            if( (g_dwStep + i) % dwStepsPerInput != 0 )
+                continue;
+
+            int iSent = pBot->SendInputs();
+            if( iSent > 0 )
+            {
+                g_Stats.qwUpdatesSent++;
+                g_Stats.qwUpdateBytes += iSent;
+            }
+            else if( iSent < 0 )
+                g_Stats.qwSendErrors++;
+        }
+        else if( g_bFixedRate ? (g_dwStep + i) % dwStepsPerUpdate == 0 : pBot->NeedsUpdate( dwTime ) )
+        {
+            int iSent = pBot->SendUpdate( dwTime );
+            if( iSent > 0 )
+            {
+                g_Stats.qwUpdatesSent++;
+                g_Stats.qwUpdateBytes += iSent;
+            }
+            else
+                g_Stats.qwSendErrors++;
+        }
+    }
+
+    g_dwStep++;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  PrintProgress
+// Desc:  Prints one line of rates since the last report
+//------------------------------------------------------------------------------------------------
+VOID PrintProgress( LPVOID pContext, DWORD dwTime )
+{
+    FLOAT fSeconds = REPORT_PERIOD / 1000.0f;
+    printf( "%5.0fs  bots %u/%u  sent %6.0f/s  recv %6.0f/s (%7.1f KB/s)  missed %llu  p99 %.2f ms\n",
+            (GetMicrosecondCount() - g_qwStartTime) / 1000000.0f,
+            g_dwLoggedOn, g_dwNumBots,
+            (g_Stats.qwUpdatesSent - g_LastReport.qwUpdatesSent) / fSeconds,
+            (g_Stats.qwSnapshotsReceived - g_LastReport.qwSnapshotsReceived) / fSeconds,
+            (g_Stats.qwSnapshotBytes - g_LastReport.qwSnapshotBytes) / fSeconds / 1024.0f,
+            (unsigned long long)g_Stats.qwSnapshotsMissed,
+            LatencyPercentile( 99.0f ) );
+    g_LastReport = g_Stats;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  StopTest
+// Desc:  Ends the run once the requested time has passed
+//------------------------------------------------------------------------------------------------
+VOID StopTest( LPVOID pContext, DWORD dwTime )
+{
+    g_Reactor.Stop();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  PrintSummary
+// Desc:  Prints the totals for the whole run
+//------------------------------------------------------------------------------------------------
+VOID PrintSummary( FLOAT fSeconds )
+{
+    QWORD qwExpected = g_Stats.qwSnapshotsReceived + g_Stats.qwSnapshotsMissed;
+    printf( "\nBots logged on:    %u of %u\n", g_dwLoggedOn, g_dwNumBots );
+    printf( "Duration:          %.1f s\n", fSeconds );
+    printf( "Updates sent:      %llu (%.0f/s, %.1f KB/s, %llu send errors)\n",
+            (unsigned long long)g_Stats.qwUpdatesSent, g_Stats.qwUpdatesSent / fSeconds,
+            g_Stats.qwUpdateBytes / fSeconds / 1024.0f, (unsigned long long)g_Stats.qwSendErrors );
+    printf( "Snapshots:         %llu (%.0f/s, %.1f KB/s, %.1f bytes each)\n",
+            (unsigned long long)g_Stats.qwSnapshotsReceived, g_Stats.qwSnapshotsReceived / fSeconds,
+            g_Stats.qwSnapshotBytes / fSeconds / 1024.0f,
+            g_Stats.qwSnapshotsReceived ? (FLOAT)g_Stats.qwSnapshotBytes / g_Stats.qwSnapshotsReceived : 0.0f );
+    printf( "Snapshot loss:     %.3f%% (%llu missed, %llu rejected)\n",
+            qwExpected ? 100.0f * g_Stats.qwSnapshotsMissed / qwExpected : 0.0f,
+            (unsigned long long)g_Stats.qwSnapshotsMissed, (unsigned long long)g_Stats.qwSnapshotsRejected );
+
+    // Where the client would be drawing everyone, averaged over the bots that are still on
+    FLOAT fDelay = 0.0f, fJitter = 0.0f;
+    DWORD dwClocks = 0;
+    for( DWORD i = 0; i < g_dwNumBots; ++i )
+    {
+        if( !g_Bots[i].IsLoggedOn() )
+            continue;
+        fDelay += g_Bots[i].GetPlayoutClock()->GetDelay();
+        fJitter += g_Bots[i].GetPlayoutClock()->GetJitter();
+        dwClocks++;
+    }
+    printf( "Playout:           %.1f ms delay, %.1f ms jitter, %.3f%% late (%llu)\n",
+            dwClocks ? fDelay / dwClocks : 0.0f, dwClocks ? fJitter / dwClocks : 0.0f,
+            g_Stats.qwSnapshotsReceived ? 100.0f * g_Stats.qwSnapshotsLate / g_Stats.qwSnapshotsReceived : 0.0f,
+            (unsigned long long)g_Stats.qwSnapshotsLate );
+    if( g_Stats.qwInputAcks )
+        printf( "Prediction:        %llu input acks, %.3f%% corrected (max %.3f units)\n",
+                (unsigned long long)g_Stats.qwInputAcks, 100.0f * g_Stats.qwCorrections / g_Stats.qwInputAcks,
+                g_Stats.fMaxCorrection );
+    // Against an authoritative server, the samples are from sending an input until its
+    // acknowledgement came back, rather than from a bot's update to its relay to the others
+    printf( "%s %llu samples, %llu unmatched\n", g_Stats.qwInputAcks ? "Input latency:    " : "Relay latency:    ",
+            (unsigned long long)g_Stats.qwLatencySamples, (unsigned long long)g_Stats.qwUnmatchedChanges );
+    if( g_Stats.qwLatencySamples )
+    {
+        printf( "                   mean %.2f ms  p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f  max %.2f ms\n",
+                g_Stats.qwLatencyTotal / (FLOAT)g_Stats.qwLatencySamples / 1000.0f,
+                LatencyPercentile( 50.0f ), LatencyPercentile( 90.0f ), LatencyPercentile( 99.0f ),
+                LatencyPercentile( 99.9f ), g_Stats.qwLatencyMax / 1000.0f );
+    }
+}
+
+
+int main( int argc, char * argv[] )
+{
+    // Read the command line.  "-server A" is the server's address, "-bots N" is how many
+    // players to simulate, "-time S" is how many seconds to run for and "-area R" is how far
+    // from the middle of the world the bots wander.  Bots send an update when they drift "-error E"
+    // units from where the others predict they are (DEFAULT_POSITION_ERROR by default); "-error 0"
+    // sends one every update period, the way older clients did.
+    const CHAR * strServer = "127.0.0.1";
+    DWORD dwDuration = DEFAULT_DURATION;
+    FLOAT fArea = DEFAULT_AREA;
+    FLOAT fPositionError = DEFAULT_POSITION_ERROR;
+    g_dwNumBots = DEFAULT_BOTS;
+    for( int i = 1; i < argc; ++i )
+    {
+        if( 0 == strcmp( argv[i], "-server" ) && i + 1 < argc )
+            strServer = argv[++i];
+        else if( 0 == strcmp( argv[i], "-bots" ) && i + 1 < argc )
+            g_dwNumBots = (DWORD)atoi( argv[++i] );
+        else if( 0 == strcmp( argv[i], "-time" ) && i + 1 < argc )
+            dwDuration = (DWORD)atoi( argv[++i] );
+        else if( 0 == strcmp( argv[i], "-area" ) && i + 1 < argc )
+            fArea = (FLOAT)atof( argv[++i] );
+        else if( 0 == strcmp( argv[i], "-error" ) && i + 1 < argc )
+            fPositionError = (FLOAT)atof( argv[++i] );
+    }
+    g_bFixedRate = !(fPositionError > 0.0f);
+
+    if( g_dwNumBots < 1 || g_dwNumBots > MAX_PLAYER_SLOTS )
+    {
+        printf( "Between 1 and %u bots can be run\n", MAX_PLAYER_SLOTS );
+        return -1;
+    }
+
+#if defined(WIN32) || defined(_WIN32)
+    // Start up Winsock
+    {
+        // Stores information about Winsock
+        WSADATA wsaData;
+
+        // Call the DLL initialization function
+        if( SOCKET_ERROR == WSAStartup( WINSOCK_VERSION, &wsaData ) ||
+                    wsaData.wVersion != WINSOCK_VERSION )
+            return -1;
+    }
+#else
+    // Each bot has its own socket, which can go past the default descriptor limit
+    {
+        struct rlimit limit;
+        if( 0 == getrlimit( RLIMIT_NOFILE, &limit ) && limit.rlim_cur < g_dwNumBots + 64 )
+        {
+            limit.rlim_cur = limit.rlim_max < g_dwNumBots + 64 ? limit.rlim_max : g_dwNumBots + 64;
+            setrlimit( RLIMIT_NOFILE, &limit );
+        }
+    }
+#endif
+
+    // Look up the server
+    SOCKADDR_IN server;
+    ZeroMemory( &server, sizeof(server) );
+    server.sin_family = AF_INET;
+    server.sin_port = htons( SERVER_COMM_PORT );
+    server.sin_addr.s_addr = inet_addr( strServer );
+    if( server.sin_addr.s_addr == INADDR_NONE )
+    {
+        LPHOSTENT pHostEnt = gethostbyname( strServer );
+        if( !pHostEnt )
+        {
+            printf( "Couldn't find the server '%s'\n", strServer );
+            return -1;
+        }
+        memcpy( &server.sin_addr, pHostEnt->h_addr_list[0], sizeof(server.sin_addr) );
+    }
+
+    // Create the bots
+    if( FAILED( g_Reactor.Create( g_dwNumBots ) ) )
+        return -1;
+    g_Bots = new Bot[g_dwNumBots];
+    g_dwBotTableMask = 1;
+    while( g_dwBotTableMask < g_dwNumBots * 2 )
+        g_dwBotTableMask <<= 1;
+    g_BotTable = new DWORD[g_dwBotTableMask--];
+    g_LatencyBuckets = new DWORD[LATENCY_BUCKETS];
+    ZeroMemory( g_LatencyBuckets, sizeof(DWORD) * LATENCY_BUCKETS );
+    ZeroMemory( &g_Stats, sizeof(g_Stats) );
+    ZeroMemory( &g_LastReport, sizeof(g_LastReport) );
+    for( DWORD i = 0; i <= g_dwBotTableMask; ++i )
+        g_BotTable[i] = g_dwNumBots;
+    srand( (unsigned)GetTickCount() );
+    for( DWORD i = 0; i < g_dwNumBots; ++i )
+    {
+        if( FAILED( g_Bots[i].Create( &server, fArea, &g_Reactor, BotReadable ) ) )
+        {
+            printf( "Couldn't create bot %u; raise the open file limit\n", i );
+            return -1;
+        }
+        g_Bots[i].SetUpdateThresholds( fPositionError, DEFAULT_YAW_ERROR, 1000 / UPDATE_FREQUENCY );
+    }
+
+    printf( "Running %u bots against %s for %u seconds...\n", g_dwNumBots, inet_ntoa( server.sin_addr ), dwDuration );
+
+    // Run the test
+    g_qwStartTime = g_qwLastStepTime = GetMicrosecondCount();
+    g_Reactor.AddTimer( SIMULATE_PERIOD, StepBots, NULL );
+    g_Reactor.AddTimer( REPORT_PERIOD, PrintProgress, NULL );
+    g_Reactor.AddTimer( dwDuration * 1000, StopTest, NULL );
+    g_Reactor.Run();
+
+    PrintSummary( (GetMicrosecondCount() - g_qwStartTime) / 1000000.0f );
+
+    // Log everyone off so the server can free their slots right away
+    for( DWORD i = 0; i < g_dwNumBots; ++i )
+        g_Bots[i].LogOff();
+
+    delete [] g_Bots;
+    delete [] g_BotTable;
+    delete [] g_LatencyBuckets;
+    g_Reactor.Destroy();
+
+#if defined(WIN32) || defined(_WIN32)
+    // Shut down Winsock
+    WSACleanup();
+#endif
+
+    // Success
+    return 0;
+}
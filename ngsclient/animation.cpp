@@ -30,6 +30,9 @@
 //  authors and should not be interpreted as representing official policies, either expressed
 //  or implied, of Karl Gluck.
 //------------------------------------------------------------------------------------------------
+#include "xfile.h"       // Has to come first, since it pulls in Winsock 2 ahead of windows.h
+#include "bakedasset.h"
+#include "skinning.h"
 #include <d3dx9.h>
 #include "animation.h"
 #include <tchar.h>
@@ -44,6 +47,25 @@
 #define SAFE_DELETE_ARRAY( a )  if( a ) { delete [] a; a = NULL; }
 
 
+//------------------------------------------------------------------------------------------------
+// Name:  BAKED_FILE_EXTENSION
+// Desc:  Added to the name of an X file to get the name of its baked copy
+//------------------------------------------------------------------------------------------------
+#define BAKED_FILE_EXTENSION    ".baked"
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  MeshVertex
+// Desc:  Layout of the vertices in meshes built from XFile data (D3DFVF_XYZ|NORMAL|TEX1)
+//------------------------------------------------------------------------------------------------
+struct MeshVertex
+{
+    FLOAT fPosition[3];
+    FLOAT fNormal[3];
+    FLOAT fTexCoord[2];
+};
+
+
 //------------------------------------------------------------------------------------------------
 // Name:  DEBUG_MSG
 // Desc:  Outputs a message to the debugger when compiling in debug mode
@@ -55,6 +77,24 @@
 #endif
 
 
+//------------------------------------------------------------------------------------------------
+// Name:  LinkFrame
+// Desc:  Adds a frame after the last child of its parent, or after the last root if it has no
+//        parent, so that frames stay in the order they were created
+//------------------------------------------------------------------------------------------------
+static VOID LinkFrame( D3DXFRAME * pFrame, D3DXFRAME * pParent, D3DXFRAME ** ppRoot,
+                       D3DXFRAME ** ppLastSibling )
+{
+    if( *ppLastSibling )
+        (*ppLastSibling)->pFrameSibling = pFrame;
+    else if( pParent )
+        pParent->pFrameFirstChild = pFrame;
+    else
+        *ppRoot = pFrame;
+    *ppLastSibling = pFrame;
+}
+
+
 //------------------------------------------------------------------------------------------------
 // Name:  CreateBonePointers
 // Desc:  Sets up bone pointers in this container
@@ -65,13 +105,13 @@ HRESULT MeshContainer::CreateBonePointers( MeshFrame * pFrameRoot )
     if( pSkinInfo )
     {
         // Get rid of the array if it exists
-        SAFE_DELETE_ARRAY( ppBoneMatrixPointers );
+        SAFE_DELETE_ARRAY( ppBoneFrames );
 
         // Get the number of bones this mesh has
-        DWORD dwNumBones = pSkinInfo->GetNumBones();
+        dwNumBones = pSkinInfo->GetNumBones();
 
         // Set up the array
-        if( NULL == (ppBoneMatrixPointers = new D3DXMATRIX*[ dwNumBones ]) )
+        if( NULL == (ppBoneFrames = new MeshFrame*[ dwNumBones ]) )
             return E_OUTOFMEMORY;
 
         // Set up the pointers using frames
@@ -84,7 +124,7 @@ HRESULT MeshContainer::CreateBonePointers( MeshFrame * pFrameRoot )
             if( !pFrame ) return E_FAIL;
 
             // Set the pointer
-            ppBoneMatrixPointers[ i ] = &((MeshFrame*)(pFrame))->matCombined;
+            ppBoneFrames[ i ] = (MeshFrame*)pFrame;
         }
     }
     else
@@ -514,7 +554,7 @@ HRESULT AllocateHierarchy::DestroyMeshContainer( D3DXMESHCONTAINER* pContainer )
     SAFE_RELEASE( pMeshContainer->pMesh );
     SAFE_RELEASE( pMeshContainer->pBoneCombinationBuffer );
     SAFE_DELETE_ARRAY( pMeshContainer->pBoneMatrixOffsets );
-    SAFE_DELETE_ARRAY( pMeshContainer->ppBoneMatrixPointers );
+    SAFE_DELETE_ARRAY( pMeshContainer->ppBoneFrames );
 
     // Reset mesh information
     pMeshContainer->dwMaxFaceInfluences = 0;
@@ -541,16 +581,731 @@ HRESULT AllocateHierarchy::LoadTexture( LPDIRECT3DDEVICE9 pDevice, LPCSTR strFil
 
 //------------------------------------------------------------------------------------------------
 // Name:  LoadMeshHierarchyFromX
-// Desc:  Creates a mesh's hierarchy from a source X file
+// Desc:  Creates a mesh's hierarchy from a source X file.  The file is read with XFile instead
+//        of D3DX, and the frames, meshes and animation controller are built from what it read.
 //------------------------------------------------------------------------------------------------
 HRESULT AllocateHierarchy::LoadMeshHierarchyFromX( LPDIRECT3DDEVICE9 pDevice,
                                                    LPCSTR strFileName,
                                                    LPD3DXFRAME* ppFrameHierarchy,
                                                    LPD3DXANIMATIONCONTROLLER* ppAnimController )
 {
-    // Pass parameters to the default loading function
-    return D3DXLoadMeshHierarchyFromX( strFileName, 0, pDevice, this, NULL,
-                                       ppFrameHierarchy, ppAnimController );
+    // Read the file, spreading the animation sets over the processors
+    XFile file;
+    HRESULT hr = file.Load( strFileName, GetProcessorCount() );
+    if( FAILED( hr ) )
+    {
+        DEBUG_MSG( "AllocateHierarchy::LoadMeshHierarchyFromX:  Unable to read the file" );
+        return hr;
+    }
+
+    return CreateHierarchy( pDevice, &file, ppFrameHierarchy, ppAnimController );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CreateHierarchy
+// Desc:  Builds the frames, mesh containers and animation controller for a file that XFile has
+//        read, calling CreateFrame and CreateMeshContainer the way D3DX would
+//------------------------------------------------------------------------------------------------
+HRESULT AllocateHierarchy::CreateHierarchy( LPDIRECT3DDEVICE9 pDevice, const XFile * pFile,
+                                            LPD3DXFRAME* ppFrameHierarchy,
+                                            LPD3DXANIMATIONCONTROLLER* ppAnimController )
+{
+    // A file without frames gets a root for its meshes to hang from
+    DWORD dwNumFrames = pFile->GetNumFrames();
+    DWORD dwNumCreated = dwNumFrames > 0 ? dwNumFrames : 1;
+    D3DXFRAME ** ppFrames = new D3DXFRAME*[ dwNumCreated ];
+    D3DXFRAME ** ppLastChild = new D3DXFRAME*[ dwNumCreated ];
+    if( !ppFrames || !ppLastChild )
+    {
+        SAFE_DELETE_ARRAY( ppFrames );
+        SAFE_DELETE_ARRAY( ppLastChild );
+        return E_OUTOFMEMORY;
+    }
+    ZeroMemory( ppFrames, sizeof(D3DXFRAME*) * dwNumCreated );
+    ZeroMemory( ppLastChild, sizeof(D3DXFRAME*) * dwNumCreated );
+
+    // Parents come before their children in the file, so each frame can be linked in as soon as
+    // it's created.  Children and siblings keep the order they were written in.
+    HRESULT hr = S_OK;
+    D3DXFRAME * pRoot = NULL;
+    D3DXFRAME * pLastRoot = NULL;
+    CHAR strName[MAX_PATH];
+    for( DWORD i = 0; i < dwNumCreated; ++i )
+    {
+        const XFrame * pFrame = i < dwNumFrames ? pFile->GetFrame( i ) : NULL;
+        BOOL bNamed = pFrame && pFrame->Name.dwLength > 0;
+        if( bNamed )
+            XStringCopy( &pFrame->Name, strName, sizeof(strName) );
+        hr = CreateFrame( bNamed ? strName : NULL, &ppFrames[i] );
+        if( FAILED( hr ) )
+            break;
+
+        if( pFrame )
+            memcpy( &ppFrames[i]->TransformationMatrix, pFrame->fTransform, sizeof(D3DXMATRIX) );
+        else
+            D3DXMatrixIdentity( &ppFrames[i]->TransformationMatrix );
+
+        DWORD dwParent = pFrame ? pFrame->dwParent : XFILE_NONE;
+        if( dwParent == XFILE_NONE )
+            LinkFrame( ppFrames[i], NULL, &pRoot, &pLastRoot );
+        else
+            LinkFrame( ppFrames[i], ppFrames[dwParent], &pRoot, &ppLastChild[dwParent] );
+    }
+
+    // Hang each mesh from its frame
+    for( DWORD i = 0; SUCCEEDED( hr ) && i < pFile->GetNumMeshes(); ++i )
+    {
+        const XMesh * pMesh = pFile->GetMesh( i );
+        D3DXMESHCONTAINER * pContainer = NULL;
+        hr = CreateMesh( pDevice, pMesh, &pContainer );
+        if( FAILED( hr ) )
+            break;
+
+        D3DXFRAME * pFrame = pMesh->dwFrame != XFILE_NONE ? ppFrames[pMesh->dwFrame] : pRoot;
+        pContainer->pNextMeshContainer = pFrame->pMeshContainer;
+        pFrame->pMeshContainer = pContainer;
+    }
+
+    // Build the animation sets
+    LPD3DXANIMATIONCONTROLLER pController = NULL;
+    if( SUCCEEDED( hr ) )
+        hr = CreateAnimationController( pFile, ppFrames, &pController );
+
+    SAFE_DELETE_ARRAY( ppFrames );
+    SAFE_DELETE_ARRAY( ppLastChild );
+    if( FAILED( hr ) )
+    {
+        if( pRoot )
+            D3DXFrameDestroy( pRoot, this );
+        return hr;
+    }
+
+    *ppFrameHierarchy = pRoot;
+    *ppAnimController = pController;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CreateMesh
+// Desc:  Copies a mesh that XFile has read into a D3DX mesh and skin, and passes them to
+//        CreateMeshContainer
+//------------------------------------------------------------------------------------------------
+HRESULT AllocateHierarchy::CreateMesh( LPDIRECT3DDEVICE9 pDevice, const XMesh * pMesh,
+                                       D3DXMESHCONTAINER** ppContainer )
+{
+    // The mesh is only a source for ConvertToBlendedMesh, so keep it in system memory
+    const DWORD dwFVF = D3DFVF_XYZ | D3DFVF_NORMAL | D3DFVF_TEX1;
+    BOOL b32BitIndices = pMesh->dwNumVertices > 0xFFFF;
+    LPD3DXMESH pD3DMesh = NULL;
+    HRESULT hr = D3DXCreateMeshFVF( pMesh->dwNumTriangles, pMesh->dwNumVertices,
+                                    D3DXMESH_SYSTEMMEM | (b32BitIndices ? D3DXMESH_32BIT : 0),
+                                    dwFVF, pDevice, &pD3DMesh );
+    if( FAILED( hr ) )
+        return hr;
+
+    // Fill in the vertices
+    MeshVertex * pVertices;
+    if( SUCCEEDED( hr = pD3DMesh->LockVertexBuffer( 0, (LPVOID*)&pVertices ) ) )
+    {
+        ZeroMemory( pVertices, sizeof(MeshVertex) * pMesh->dwNumVertices );
+        for( DWORD i = 0; i < pMesh->dwNumVertices; ++i )
+        {
+            memcpy( pVertices[i].fPosition, &pMesh->pPositions[i * 3], sizeof(FLOAT) * 3 );
+            if( pMesh->pNormals )
+                memcpy( pVertices[i].fNormal, &pMesh->pNormals[i * 3], sizeof(FLOAT) * 3 );
+            if( pMesh->pTexCoords )
+                memcpy( pVertices[i].fTexCoord, &pMesh->pTexCoords[i * 2], sizeof(FLOAT) * 2 );
+        }
+        pD3DMesh->UnlockVertexBuffer();
+    }
+
+    // Indices
+    LPVOID pIndices;
+    if( SUCCEEDED( hr ) && SUCCEEDED( hr = pD3DMesh->LockIndexBuffer( 0, &pIndices ) ) )
+    {
+        DWORD dwNumIndices = pMesh->dwNumTriangles * 3;
+        if( b32BitIndices )
+            memcpy( pIndices, pMesh->pIndices, sizeof(DWORD) * dwNumIndices );
+        else
+        {
+            for( DWORD i = 0; i < dwNumIndices; ++i )
+                ((WORD*)pIndices)[i] = (WORD)pMesh->pIndices[i];
+        }
+        pD3DMesh->UnlockIndexBuffer();
+    }
+
+    // Which material each triangle uses
+    DWORD * pAttributes;
+    if( SUCCEEDED( hr ) && SUCCEEDED( hr = pD3DMesh->LockAttributeBuffer( 0, &pAttributes ) ) )
+    {
+        if( pMesh->pAttributes )
+            memcpy( pAttributes, pMesh->pAttributes, sizeof(DWORD) * pMesh->dwNumTriangles );
+        else
+            ZeroMemory( pAttributes, sizeof(DWORD) * pMesh->dwNumTriangles );
+        pD3DMesh->UnlockAttributeBuffer();
+    }
+
+    // Make up normals if the file didn't have any
+    if( SUCCEEDED( hr ) && !pMesh->pNormals )
+        hr = D3DXComputeNormals( pD3DMesh, NULL );
+
+    // The blended mesh conversion wants to know which faces touch
+    DWORD * pAdjacency = NULL;
+    if( SUCCEEDED( hr ) )
+    {
+        pAdjacency = new DWORD[ pMesh->dwNumTriangles * 3 ];
+        hr = pAdjacency ? pD3DMesh->GenerateAdjacency( 1e-6f, pAdjacency ) : E_OUTOFMEMORY;
+    }
+
+    // Materials; the texture names have to be terminated
+    D3DXMATERIAL * pMaterials = NULL;
+    if( SUCCEEDED( hr ) && pMesh->dwNumMaterials > 0 )
+    {
+        pMaterials = new D3DXMATERIAL[ pMesh->dwNumMaterials ];
+        if( !pMaterials )
+            hr = E_OUTOFMEMORY;
+        else
+            ZeroMemory( pMaterials, sizeof(D3DXMATERIAL) * pMesh->dwNumMaterials );
+        for( DWORD i = 0; SUCCEEDED( hr ) && i < pMesh->dwNumMaterials; ++i )
+        {
+            const XMaterial * pMaterial = &pMesh->pMaterials[i];
+            D3DMATERIAL9 * pD3DMaterial = &pMaterials[i].MatD3D;
+            pD3DMaterial->Diffuse.r = pMaterial->fDiffuse[0];
+            pD3DMaterial->Diffuse.g = pMaterial->fDiffuse[1];
+            pD3DMaterial->Diffuse.b = pMaterial->fDiffuse[2];
+            pD3DMaterial->Diffuse.a = pMaterial->fDiffuse[3];
+            pD3DMaterial->Power = pMaterial->fPower;
+            pD3DMaterial->Specular.r = pMaterial->fSpecular[0];
+            pD3DMaterial->Specular.g = pMaterial->fSpecular[1];
+            pD3DMaterial->Specular.b = pMaterial->fSpecular[2];
+            pD3DMaterial->Specular.a = 1.0f;
+            pD3DMaterial->Emissive.r = pMaterial->fEmissive[0];
+            pD3DMaterial->Emissive.g = pMaterial->fEmissive[1];
+            pD3DMaterial->Emissive.b = pMaterial->fEmissive[2];
+            pD3DMaterial->Emissive.a = 1.0f;
+            if( pMaterial->TextureFilename.dwLength > 0 )
+            {
+                DWORD dwSize = pMaterial->TextureFilename.dwLength + 1;
+                if( NULL == (pMaterials[i].pTextureFilename = new CHAR[ dwSize ]) )
+                    hr = E_OUTOFMEMORY;
+                else
+                    XStringCopy( &pMaterial->TextureFilename, pMaterials[i].pTextureFilename, dwSize );
+            }
+        }
+    }
+
+    // Skin
+    LPD3DXSKININFO pSkinInfo = NULL;
+    if( SUCCEEDED( hr ) && pMesh->dwNumBones > 0 )
+        hr = D3DXCreateSkinInfoFVF( pMesh->dwNumVertices, dwFVF, pMesh->dwNumBones, &pSkinInfo );
+    CHAR strName[MAX_PATH];
+    for( DWORD i = 0; SUCCEEDED( hr ) && i < pMesh->dwNumBones; ++i )
+    {
+        const XSkinWeights * pBone = &pMesh->pBones[i];
+        XStringCopy( &pBone->BoneName, strName, sizeof(strName) );
+        if( SUCCEEDED( hr = pSkinInfo->SetBoneName( i, strName ) ) &&
+            SUCCEEDED( hr = pSkinInfo->SetBoneInfluence( i, pBone->dwNumWeights, pBone->pVertices, pBone->pWeights ) ) )
+            hr = pSkinInfo->SetBoneOffsetMatrix( i, (const D3DXMATRIX*)pBone->fOffset );
+    }
+
+    // Let the container take it from here
+    if( SUCCEEDED( hr ) )
+    {
+        D3DXMESHDATA meshData;
+        meshData.Type = D3DXMESHTYPE_MESH;
+        meshData.pMesh = pD3DMesh;
+        if( pMesh->Name.dwLength > 0 )
+            XStringCopy( &pMesh->Name, strName, sizeof(strName) );
+        hr = CreateMeshContainer( pMesh->Name.dwLength > 0 ? strName : NULL, &meshData, pMaterials, NULL,
+                                  pMesh->dwNumMaterials, pAdjacency, pSkinInfo, ppContainer );
+
+        // The container's copies of the materials would point at names that are about to go
+        if( SUCCEEDED( hr ) && (*ppContainer)->pMaterials )
+        {
+            for( DWORD i = 0; i < (*ppContainer)->NumMaterials; ++i )
+                (*ppContainer)->pMaterials[i].pTextureFilename = NULL;
+        }
+    }
+
+    // The container holds its own references
+    if( pMaterials )
+    {
+        for( DWORD i = 0; i < pMesh->dwNumMaterials; ++i )
+            SAFE_DELETE_ARRAY( pMaterials[i].pTextureFilename );
+        SAFE_DELETE_ARRAY( pMaterials );
+    }
+    SAFE_DELETE_ARRAY( pAdjacency );
+    SAFE_RELEASE( pSkinInfo );
+    SAFE_RELEASE( pD3DMesh );
+    return hr;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CreateAnimationController
+// Desc:  Creates a controller that drives the frames' transformation matrices with the file's
+//        animation sets.  Leaves the controller NULL if the file doesn't have any.
+//------------------------------------------------------------------------------------------------
+HRESULT AllocateHierarchy::CreateAnimationController( const XFile * pFile, D3DXFRAME ** ppFrames,
+                                                      LPD3DXANIMATIONCONTROLLER* ppAnimController )
+{
+    *ppAnimController = NULL;
+    DWORD dwNumSets = pFile->GetNumAnimationSets();
+    if( dwNumSets == 0 )
+        return S_OK;
+
+    LPD3DXANIMATIONCONTROLLER pController;
+    HRESULT hr = D3DXCreateAnimationController( pFile->GetNumFrames(), dwNumSets, 2, 30, &pController );
+    if( FAILED( hr ) )
+        return hr;
+
+    // Animations write straight into the matrices of the frames they're named after
+    for( DWORD i = 0; SUCCEEDED( hr ) && i < pFile->GetNumFrames(); ++i )
+    {
+        if( pFile->GetFrame( i )->Name.dwLength > 0 )
+            hr = pController->RegisterAnimationOutput( ppFrames[i]->Name, &ppFrames[i]->TransformationMatrix,
+                                                       NULL, NULL, NULL );
+    }
+
+    // D3DX registers the sets from last to first, and the client's track numbers depend on it
+    CHAR strName[MAX_PATH];
+    for( DWORD i = dwNumSets; SUCCEEDED( hr ) && i-- > 0; )
+    {
+        const XAnimationSet * pSet = pFile->GetAnimationSet( i );
+        LPD3DXKEYFRAMEDANIMATIONSET pAnimationSet;
+        XStringCopy( &pSet->Name, strName, sizeof(strName) );
+        hr = D3DXCreateKeyframedAnimationSet( strName, pFile->GetTicksPerSecond(), D3DXPLAY_LOOP,
+                                              pSet->dwNumAnimations, 0, NULL, &pAnimationSet );
+        if( FAILED( hr ) )
+            break;
+
+        for( DWORD j = 0; SUCCEEDED( hr ) && j < pSet->dwNumAnimations; ++j )
+        {
+            if( pSet->pAnimations[j].dwFrame != XFILE_NONE )
+                hr = RegisterAnimationKeys( pAnimationSet, &pSet->pAnimations[j] );
+        }
+        if( SUCCEEDED( hr ) )
+            hr = pController->RegisterAnimationSet( pAnimationSet );
+        pAnimationSet->Release();
+    }
+
+    if( FAILED( hr ) )
+    {
+        pController->Release();
+        return hr;
+    }
+
+    *ppAnimController = pController;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RegisterAnimationKeys
+// Desc:  Adds one frame's keys to an animation set.  Matrix keys are split into scale, rotation
+//        and translation, which is all a keyframed set can hold.
+//------------------------------------------------------------------------------------------------
+HRESULT AllocateHierarchy::RegisterAnimationKeys( LPD3DXKEYFRAMEDANIMATIONSET pAnimationSet,
+                                                  const XAnimation * pAnimation )
+{
+    const XAnimationKeys * pScales = &pAnimation->Keys[XKEY_SCALE];
+    const XAnimationKeys * pRotations = &pAnimation->Keys[XKEY_ROTATION];
+    const XAnimationKeys * pPositions = &pAnimation->Keys[XKEY_POSITION];
+    const XAnimationKeys * pMatrices = &pAnimation->Keys[XKEY_MATRIX];
+    if( pMatrices->dwNumKeys > 0 )
+        pScales = pRotations = pPositions = pMatrices;
+
+    D3DXKEY_VECTOR3 * pScaleKeys = new D3DXKEY_VECTOR3[ pScales->dwNumKeys + 1 ];
+    D3DXKEY_QUATERNION * pRotationKeys = new D3DXKEY_QUATERNION[ pRotations->dwNumKeys + 1 ];
+    D3DXKEY_VECTOR3 * pPositionKeys = new D3DXKEY_VECTOR3[ pPositions->dwNumKeys + 1 ];
+    HRESULT hr = E_OUTOFMEMORY;
+    if( pScaleKeys && pRotationKeys && pPositionKeys )
+    {
+        if( pMatrices->dwNumKeys > 0 )
+        {
+            for( DWORD i = 0; i < pMatrices->dwNumKeys; ++i )
+            {
+                pScaleKeys[i].Time = pRotationKeys[i].Time = pPositionKeys[i].Time = (FLOAT)pMatrices->pTimes[i];
+                D3DXMatrixDecompose( &pScaleKeys[i].Value, &pRotationKeys[i].Value, &pPositionKeys[i].Value,
+                                     (const D3DXMATRIX*)&pMatrices->pValues[i * 16] );
+            }
+        }
+        else
+        {
+            for( DWORD i = 0; i < pScales->dwNumKeys; ++i )
+            {
+                const FLOAT * pValue = &pScales->pValues[i * 3];
+                pScaleKeys[i].Time = (FLOAT)pScales->pTimes[i];
+                pScaleKeys[i].Value = D3DXVECTOR3( pValue[0], pValue[1], pValue[2] );
+            }
+
+            // The file stores w first, and D3DX wants the conjugate of what's stored
+            for( DWORD i = 0; i < pRotations->dwNumKeys; ++i )
+            {
+                const FLOAT * pValue = &pRotations->pValues[i * 4];
+                pRotationKeys[i].Time = (FLOAT)pRotations->pTimes[i];
+                pRotationKeys[i].Value = D3DXQUATERNION( -pValue[1], -pValue[2], -pValue[3], pValue[0] );
+            }
+
+            for( DWORD i = 0; i < pPositions->dwNumKeys; ++i )
+            {
+                const FLOAT * pValue = &pPositions->pValues[i * 3];
+                pPositionKeys[i].Time = (FLOAT)pPositions->pTimes[i];
+                pPositionKeys[i].Value = D3DXVECTOR3( pValue[0], pValue[1], pValue[2] );
+            }
+        }
+
+        CHAR strName[MAX_PATH];
+        XStringCopy( &pAnimation->FrameName, strName, sizeof(strName) );
+        hr = pAnimationSet->RegisterAnimationSRTKeys( strName, pScales->dwNumKeys, pRotations->dwNumKeys,
+                                                      pPositions->dwNumKeys, pScaleKeys, pRotationKeys,
+                                                      pPositionKeys, NULL );
+    }
+
+    SAFE_DELETE_ARRAY( pScaleKeys );
+    SAFE_DELETE_ARRAY( pRotationKeys );
+    SAFE_DELETE_ARRAY( pPositionKeys );
+    return hr;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  LoadMeshHierarchyFromBake
+// Desc:  Creates a mesh's hierarchy from a baked copy of an X file.  The meshes have already
+//        been converted for blending, so their buffers are only copied to the device.
+//------------------------------------------------------------------------------------------------
+HRESULT AllocateHierarchy::LoadMeshHierarchyFromBake( LPDIRECT3DDEVICE9 pDevice,
+                                                      const BakedAsset * pAsset,
+                                                      LPD3DXFRAME* ppFrameHierarchy,
+                                                      LPD3DXANIMATIONCONTROLLER* ppAnimController )
+{
+    // A file without frames gets a root for its meshes to hang from
+    DWORD dwNumFrames = pAsset->GetNumFrames();
+    DWORD dwNumCreated = dwNumFrames > 0 ? dwNumFrames : 1;
+    D3DXFRAME ** ppFrames = new D3DXFRAME*[ dwNumCreated ];
+    D3DXFRAME ** ppLastChild = new D3DXFRAME*[ dwNumCreated ];
+    if( !ppFrames || !ppLastChild )
+    {
+        SAFE_DELETE_ARRAY( ppFrames );
+        SAFE_DELETE_ARRAY( ppLastChild );
+        return E_OUTOFMEMORY;
+    }
+    ZeroMemory( ppFrames, sizeof(D3DXFRAME*) * dwNumCreated );
+    ZeroMemory( ppLastChild, sizeof(D3DXFRAME*) * dwNumCreated );
+
+    // Baked frames are stored parent-first
+    HRESULT hr = S_OK;
+    D3DXFRAME * pRoot = NULL;
+    D3DXFRAME * pLastRoot = NULL;
+    for( DWORD i = 0; i < dwNumCreated; ++i )
+    {
+        const BakedFrame * pFrame = i < dwNumFrames ? pAsset->GetFrame( i ) : NULL;
+        BOOL bNamed = pFrame && pFrame->Name.dwCount > 0;
+        hr = CreateFrame( bNamed ? pAsset->GetString( &pFrame->Name ) : NULL, &ppFrames[i] );
+        if( FAILED( hr ) )
+            break;
+
+        if( pFrame )
+            memcpy( &ppFrames[i]->TransformationMatrix, pFrame->fTransform, sizeof(D3DXMATRIX) );
+        else
+            D3DXMatrixIdentity( &ppFrames[i]->TransformationMatrix );
+
+        DWORD dwParent = pFrame ? pFrame->dwParent : BAKED_NONE;
+        if( dwParent == BAKED_NONE )
+            LinkFrame( ppFrames[i], NULL, &pRoot, &pLastRoot );
+        else
+            LinkFrame( ppFrames[i], ppFrames[dwParent], &pRoot, &ppLastChild[dwParent] );
+    }
+
+    // Hang each mesh from its frame
+    for( DWORD i = 0; SUCCEEDED( hr ) && i < pAsset->GetNumMeshes(); ++i )
+    {
+        const BakedMesh * pMesh = pAsset->GetMesh( i );
+        D3DXMESHCONTAINER * pContainer = NULL;
+        hr = CreateBakedMeshContainer( pDevice, pAsset, pMesh, ppFrames, &pContainer );
+        if( FAILED( hr ) )
+            break;
+
+        D3DXFRAME * pFrame = pMesh->dwFrame != BAKED_NONE ? ppFrames[pMesh->dwFrame] : pRoot;
+        pContainer->pNextMeshContainer = pFrame->pMeshContainer;
+        pFrame->pMeshContainer = pContainer;
+    }
+
+    // Build the animation sets
+    LPD3DXANIMATIONCONTROLLER pController = NULL;
+    if( SUCCEEDED( hr ) )
+        hr = CreateBakedAnimationController( pAsset, ppFrames, &pController );
+
+    SAFE_DELETE_ARRAY( ppFrames );
+    SAFE_DELETE_ARRAY( ppLastChild );
+    if( FAILED( hr ) )
+    {
+        if( pRoot )
+            D3DXFrameDestroy( pRoot, this );
+        return hr;
+    }
+
+    *ppFrameHierarchy = pRoot;
+    *ppAnimController = pController;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CreateBakedMeshContainer
+// Desc:  Sets up a mesh container for a baked mesh.  The bone IDs and texture names are used
+//        in place, so the asset has to stay loaded for as long as the container exists.
+//------------------------------------------------------------------------------------------------
+HRESULT AllocateHierarchy::CreateBakedMeshContainer( LPDIRECT3DDEVICE9 pDevice,
+                                                     const BakedAsset * pAsset,
+                                                     const BakedMesh * pMesh,
+                                                     D3DXFRAME ** ppFrames,
+                                                     D3DXMESHCONTAINER** ppContainer )
+{
+    // Vertex formats for each number of stored blend weights
+    static const DWORD dwPositionFVF[BAKED_MAX_INFLUENCES] =
+        { D3DFVF_XYZ, D3DFVF_XYZB1, D3DFVF_XYZB2, D3DFVF_XYZB3 };
+
+    // Create a mesh container using our custom derived structure
+    MeshContainer* pMeshContainer = new MeshContainer;
+    if( !pMeshContainer ) return E_OUTOFMEMORY;
+    ZeroMemory( pMeshContainer, sizeof( MeshContainer ) );
+
+    // Copy the name
+    pMeshContainer->Name = AllocateString( pMesh->Name.dwCount > 0 ? pAsset->GetString( &pMesh->Name ) : "<none>" );
+    if( !pMeshContainer->Name )
+    {
+        DestroyMeshContainer( pMeshContainer );
+        return E_OUTOFMEMORY;
+    }
+
+    // Find the first combination that uses more bones than the device can blend; from there on,
+    // the mesh is drawn with software vertex processing
+    DWORD dwNumCombinations = pMesh->BoneCombinations.dwCount;
+    const BakedBoneCombination * pCombinations = pAsset->GetBoneCombinations( pMesh );
+    const DWORD * pBoneIds = pAsset->GetBoneIds( pMesh );
+    pMeshContainer->dwMaxFaceInfluences = pMesh->dwMaxFaceInfluences;
+    pMeshContainer->dwNumAttributeGroups = dwNumCombinations;
+    for( pMeshContainer->dwStartSoftwareRenderAttribute = 0;
+         pMeshContainer->dwStartSoftwareRenderAttribute < dwNumCombinations;
+       ++pMeshContainer->dwStartSoftwareRenderAttribute )
+    {
+        const DWORD * pIds = &pBoneIds[pCombinations[pMeshContainer->dwStartSoftwareRenderAttribute].dwFirstBoneId];
+        DWORD dwTotalInfluences = 0;
+        for( DWORD i = 0; i < pMesh->dwMaxFaceInfluences; ++i )
+        {
+            if( pIds[i] != BAKED_NONE )
+                ++dwTotalInfluences;
+        }
+        if( dwTotalInfluences > m_dwMaxBlendedMatrices )
+            break;
+    }
+
+    // Create the mesh straight in its final form
+    DWORD dwFVF = dwPositionFVF[pMesh->dwNumWeights] | D3DFVF_NORMAL | D3DFVF_TEX1;
+    DWORD dwOptions = D3DXMESH_WRITEONLY;
+    if( pMesh->dwIndexSize == sizeof(DWORD) )
+        dwOptions |= D3DXMESH_32BIT;
+    if( pMeshContainer->dwStartSoftwareRenderAttribute < dwNumCombinations )
+        dwOptions |= D3DXMESH_SOFTWAREPROCESSING;
+    DWORD dwNumFaces = pMesh->Indices.dwCount / 3;
+    HRESULT hr = D3DXGetFVFVertexSize( dwFVF ) == pMesh->dwVertexSize ? S_OK : E_FAIL;
+    if( SUCCEEDED( hr ) )
+        hr = D3DXCreateMeshFVF( dwNumFaces, pMesh->Vertices.dwCount, dwOptions, dwFVF, pDevice,
+                               &pMeshContainer->pMesh );
+    if( FAILED( hr ) )
+    {
+        DestroyMeshContainer( pMeshContainer );
+        return hr;
+    }
+
+    // Copy the buffers
+    LPVOID pData;
+    if( SUCCEEDED( hr = pMeshContainer->pMesh->LockVertexBuffer( 0, &pData ) ) )
+    {
+        memcpy( pData, pAsset->GetVertices( pMesh ), pMesh->dwVertexSize * pMesh->Vertices.dwCount );
+        pMeshContainer->pMesh->UnlockVertexBuffer();
+    }
+    if( SUCCEEDED( hr ) && SUCCEEDED( hr = pMeshContainer->pMesh->LockIndexBuffer( 0, &pData ) ) )
+    {
+        memcpy( pData, pAsset->GetIndices( pMesh ), pMesh->dwIndexSize * pMesh->Indices.dwCount );
+        pMeshContainer->pMesh->UnlockIndexBuffer();
+    }
+
+    // Each combination is one subset
+    DWORD * pAttributes;
+    if( SUCCEEDED( hr ) && SUCCEEDED( hr = pMeshContainer->pMesh->LockAttributeBuffer( 0, &pAttributes ) ) )
+    {
+        for( DWORD c = 0; c < dwNumCombinations; ++c )
+        {
+            for( DWORD i = 0; i < pCombinations[c].dwFaceCount; ++i )
+                pAttributes[pCombinations[c].dwFaceStart + i] = c;
+        }
+        pMeshContainer->pMesh->UnlockAttributeBuffer();
+    }
+    if( SUCCEEDED( hr ) )
+    {
+        D3DXATTRIBUTERANGE * pAttributeTable = new D3DXATTRIBUTERANGE[ dwNumCombinations + 1 ];
+        if( !pAttributeTable )
+            hr = E_OUTOFMEMORY;
+        else
+        {
+            for( DWORD c = 0; c < dwNumCombinations; ++c )
+            {
+                pAttributeTable[c].AttribId = c;
+                pAttributeTable[c].FaceStart = pCombinations[c].dwFaceStart;
+                pAttributeTable[c].FaceCount = pCombinations[c].dwFaceCount;
+                pAttributeTable[c].VertexStart = pCombinations[c].dwVertexStart;
+                pAttributeTable[c].VertexCount = pCombinations[c].dwVertexCount;
+            }
+            hr = pMeshContainer->pMesh->SetAttributeTable( pAttributeTable, dwNumCombinations );
+            SAFE_DELETE_ARRAY( pAttributeTable );
+        }
+    }
+
+    // The combination table that DrawFrameMesh reads
+    if( SUCCEEDED( hr ) )
+        hr = D3DXCreateBuffer( sizeof(D3DXBONECOMBINATION) * (dwNumCombinations + 1),
+                              &pMeshContainer->pBoneCombinationBuffer );
+    if( FAILED( hr ) )
+    {
+        DestroyMeshContainer( pMeshContainer );
+        return hr;
+    }
+    D3DXBONECOMBINATION * pBoneComboBuffer = reinterpret_cast<D3DXBONECOMBINATION*>(pMeshContainer->pBoneCombinationBuffer->GetBufferPointer());
+    for( DWORD c = 0; c < dwNumCombinations; ++c )
+    {
+        pBoneComboBuffer[c].AttribId = pCombinations[c].dwAttribId;
+        pBoneComboBuffer[c].FaceStart = pCombinations[c].dwFaceStart;
+        pBoneComboBuffer[c].FaceCount = pCombinations[c].dwFaceCount;
+        pBoneComboBuffer[c].VertexStart = pCombinations[c].dwVertexStart;
+        pBoneComboBuffer[c].VertexCount = pCombinations[c].dwVertexCount;
+        pBoneComboBuffer[c].BoneId = (DWORD*)&pBoneIds[pCombinations[c].dwFirstBoneId];
+    }
+
+    // Bones already know their frames, so the pointers can be set now
+    DWORD dwNumBones = pMesh->Bones.dwCount;
+    const BakedBone * pBones = pAsset->GetBones( pMesh );
+    pMeshContainer->pBoneMatrixOffsets = new D3DXMATRIX[ dwNumBones + 1 ];
+    pMeshContainer->ppBoneFrames = new MeshFrame*[ dwNumBones + 1 ];
+    if( !pMeshContainer->pBoneMatrixOffsets || !pMeshContainer->ppBoneFrames )
+    {
+        DestroyMeshContainer( pMeshContainer );
+        return E_OUTOFMEMORY;
+    }
+    for( DWORD i = 0; i < dwNumBones; ++i )
+    {
+        memcpy( &pMeshContainer->pBoneMatrixOffsets[i], pBones[i].fOffset, sizeof(D3DXMATRIX) );
+        pMeshContainer->ppBoneFrames[i] = (MeshFrame*)ppFrames[pBones[i].dwFrame];
+    }
+    pMeshContainer->dwNumBones = dwNumBones;
+
+    // Materials and their textures
+    DWORD dwNumMaterials = pMesh->Materials.dwCount;
+    const BakedMaterial * pMaterials = pAsset->GetMaterials( pMesh );
+    pMeshContainer->NumMaterials = dwNumMaterials;
+    pMeshContainer->pMaterials = new D3DXMATERIAL[ dwNumMaterials ];
+    pMeshContainer->ppTextures = new IDirect3DTexture9*[ dwNumMaterials ];
+    if( pMeshContainer->pMaterials == NULL || pMeshContainer->ppTextures == NULL )
+    {
+        DestroyMeshContainer( pMeshContainer );
+        return E_OUTOFMEMORY;
+    }
+    ZeroMemory( pMeshContainer->ppTextures, sizeof(IDirect3DTexture9*) * dwNumMaterials );
+    for( DWORD i = 0; i < dwNumMaterials; ++i )
+    {
+        memcpy( &pMeshContainer->pMaterials[i].MatD3D, &pMaterials[i], sizeof(D3DMATERIAL9) );
+        pMeshContainer->pMaterials[i].pTextureFilename = NULL;
+        if( pMaterials[i].TextureFilename.dwCount == 0 )
+            continue;
+        pMeshContainer->pMaterials[i].pTextureFilename = (LPSTR)pAsset->GetString( &pMaterials[i].TextureFilename );
+        if( FAILED( LoadTexture( pDevice, pMeshContainer->pMaterials[i].pTextureFilename,
+                                &pMeshContainer->ppTextures[i] ) ) )
+        {
+            pMeshContainer->ppTextures[i] = NULL;
+            DEBUG_MSG( "AllocateHierarchy::CreateBakedMeshContainer:  Unable to load texture" );
+        }
+    }
+
+    // Store the mesh container
+    *ppContainer = pMeshContainer;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CreateBakedAnimationController
+// Desc:  Creates a controller for a baked file's animation sets.  The keys are already in D3DX's
+//        layout, so they're registered straight from the file.
+//------------------------------------------------------------------------------------------------
+HRESULT AllocateHierarchy::CreateBakedAnimationController( const BakedAsset * pAsset, D3DXFRAME ** ppFrames,
+                                                           LPD3DXANIMATIONCONTROLLER* ppAnimController )
+{
+    *ppAnimController = NULL;
+    DWORD dwNumSets = pAsset->GetNumAnimationSets();
+    if( dwNumSets == 0 )
+        return S_OK;
+
+    LPD3DXANIMATIONCONTROLLER pController;
+    HRESULT hr = D3DXCreateAnimationController( pAsset->GetNumFrames(), dwNumSets, 2, 30, &pController );
+    if( FAILED( hr ) )
+        return hr;
+
+    // Animations write straight into the matrices of the frames they're named after
+    for( DWORD i = 0; SUCCEEDED( hr ) && i < pAsset->GetNumFrames(); ++i )
+    {
+        if( pAsset->GetFrame( i )->Name.dwCount > 0 )
+            hr = pController->RegisterAnimationOutput( ppFrames[i]->Name, &ppFrames[i]->TransformationMatrix,
+                                                       NULL, NULL, NULL );
+    }
+
+    // D3DX registers the sets from last to first, and the client's track numbers depend on it
+    for( DWORD i = dwNumSets; SUCCEEDED( hr ) && i-- > 0; )
+    {
+        const BakedAnimationSet * pSet = pAsset->GetAnimationSet( i );
+        LPD3DXKEYFRAMEDANIMATIONSET pAnimationSet;
+        hr = D3DXCreateKeyframedAnimationSet( pAsset->GetString( &pSet->Name ), pSet->dwTicksPerSecond,
+                                              D3DXPLAY_LOOP, pSet->Animations.dwCount, 0, NULL, &pAnimationSet );
+        if( FAILED( hr ) )
+            break;
+
+        const BakedAnimation * pAnimations = pAsset->GetAnimations( pSet );
+        for( DWORD j = 0; SUCCEEDED( hr ) && j < pSet->Animations.dwCount; ++j )
+        {
+            const BakedAnimation * pAnimation = &pAnimations[j];
+            hr = pAnimationSet->RegisterAnimationSRTKeys( ppFrames[pAnimation->dwFrame]->Name,
+                                        pAnimation->ScaleKeys.dwCount, pAnimation->RotationKeys.dwCount,
+                                        pAnimation->TranslationKeys.dwCount,
+                                        (const D3DXKEY_VECTOR3*)pAsset->GetScaleKeys( pAnimation ),
+                                        (const D3DXKEY_QUATERNION*)pAsset->GetRotationKeys( pAnimation ),
+                                        (const D3DXKEY_VECTOR3*)pAsset->GetTranslationKeys( pAnimation ),
+                                        NULL );
+        }
+        if( SUCCEEDED( hr ) )
+            hr = pController->RegisterAnimationSet( pAnimationSet );
+        pAnimationSet->Release();
+    }
+
+    if( FAILED( hr ) )
+    {
+        pController->Release();
+        return hr;
+    }
+
+    *ppAnimController = pController;
+
+    // Success
+    return S_OK;
 }
 
 
@@ -579,6 +1334,15 @@ AnimatedMesh::AnimatedMesh()
     m_pFrameRoot = NULL;
     m_pAnimationController = NULL;
     m_pAllocateHierarchy = NULL;
+    m_dwNumFrames = 0;
+    m_pdwFrameParents = NULL;
+    m_ppFrames = NULL;
+    m_pBindPose = NULL;
+    m_ppMeshes = NULL;
+    m_dwNumMeshes = 0;
+    m_dwNumBones = 0;
+    m_pBoneOffsets = NULL;
+    m_pdwBoneFrames = NULL;
 }
 
 
@@ -609,19 +1373,42 @@ HRESULT AnimatedMesh::LoadMeshFromX( LPDIRECT3DDEVICE9 pDevice, LPCSTR strFileNa
     // Stores result codes
     HRESULT hr;
 
-    // Load the mesh
-    hr = m_pAllocateHierarchy->LoadMeshHierarchyFromX( pDevice, strFileName,
-                                                       (D3DXFRAME**)&m_pFrameRoot,
-                                                      &m_pAnimationController );
-    if( FAILED( hr ) || !m_pAnimationController )
+    // Use the baked copy of the file, baking it first if the file is new or has changed
+    CHAR strBakedFile[MAX_PATH];
+    if( strlen( strFileName ) + sizeof(BAKED_FILE_EXTENSION) > sizeof(strBakedFile) )
     {
         Release();
-        return hr;
+        return E_FAIL;
+    }
+    strcpy_s( strBakedFile, sizeof(strBakedFile), strFileName );
+    strcat_s( strBakedFile, sizeof(strBakedFile), BAKED_FILE_EXTENSION );
+    if( SUCCEEDED( hr = m_Asset.LoadOrBake( strFileName, strBakedFile, GetProcessorCount() ) ) )
+    {
+        hr = m_pAllocateHierarchy->LoadMeshHierarchyFromBake( pDevice, &m_Asset,
+                                                              (D3DXFRAME**)&m_pFrameRoot,
+                                                             &m_pAnimationController );
+    }
+    else
+    {
+        // Files the baker can't handle, such as ones with faces that need more than four bones,
+        // still load through D3DX's blended mesh conversion
+        DEBUG_MSG( "AnimatedMesh::LoadMeshFromX:  Unable to bake the file; loading it directly" );
+        hr = m_pAllocateHierarchy->LoadMeshHierarchyFromX( pDevice, strFileName,
+                                                           (D3DXFRAME**)&m_pFrameRoot,
+                                                          &m_pAnimationController );
+
+        // Set up bone pointers for this mesh
+        if( SUCCEEDED( hr ) && m_pFrameRoot )
+            hr = SetupBonePointers( m_pFrameRoot );
+    }
+    if( FAILED( hr ) || !m_pAnimationController || !m_pFrameRoot )
+    {
+        Release();
+        return FAILED( hr ) ? hr : E_FAIL;
     }
 
-    // Set up bone pointers for this mesh
-    hr = SetupBonePointers( m_pFrameRoot );
-    if( FAILED( hr ) )
+    // Lay the frames out for updating
+    if( FAILED( hr = CompileHierarchy() ) )
     {
         Release();
         return hr;
@@ -651,6 +1438,20 @@ VOID AnimatedMesh::Release()
         m_pFrameRoot = NULL;
     }
 
+    // The mesh containers used the baked file in place, so it can only go after them
+    m_Asset.Release();
+
+    // Free the compiled hierarchy
+    SAFE_DELETE_ARRAY( m_pdwFrameParents );
+    SAFE_DELETE_ARRAY( m_ppFrames );
+    SAFE_DELETE_ARRAY( m_pBindPose );
+    SAFE_DELETE_ARRAY( m_ppMeshes );
+    SAFE_DELETE_ARRAY( m_pBoneOffsets );
+    SAFE_DELETE_ARRAY( m_pdwBoneFrames );
+    m_dwNumFrames = 0;
+    m_dwNumMeshes = 0;
+    m_dwNumBones = 0;
+
     // Release the device
     SAFE_RELEASE( m_pd3dDevice );
 
@@ -660,36 +1461,53 @@ VOID AnimatedMesh::Release()
 
 
 //------------------------------------------------------------------------------------------------
-// Name:  CloneAnimationController
-// Desc:  
+// Name:  CreateAnimationController
+// Desc:  Builds a controller that animates a set of local matrices
 //------------------------------------------------------------------------------------------------
-HRESULT AnimatedMesh::CloneAnimationController( DWORD dwSimultaneousTracks,
-                                                LPD3DXANIMATIONCONTROLLER* ppAnimationController )
+HRESULT AnimatedMesh::CreateAnimationController( DWORD dwSimultaneousTracks, D3DXMATRIX* pLocalMatrices,
+                                                 LPD3DXANIMATIONCONTROLLER* ppAnimationController ) const
 {
-    // Holds return codes
-    HRESULT hr;
+    LPD3DXANIMATIONCONTROLLER pController;
+    HRESULT hr = D3DXCreateAnimationController( m_dwNumFrames,
+                                                m_pAnimationController->GetMaxNumAnimationSets(),
+                                                dwSimultaneousTracks,
+                                                m_pAnimationController->GetMaxNumEvents(),
+                                               &pController );
+    if( FAILED( hr ) )
+        return hr;
 
-    // Stores the temporary animation controller;
-    LPD3DXANIMATIONCONTROLLER pTempController;
+    // Animations find their outputs by name; unnamed frames were given "<none>" and can't be
+    // animated
+    for( DWORD i = 0; SUCCEEDED( hr ) && i < m_dwNumFrames; ++i )
+    {
+        if( strcmp( m_ppFrames[i]->Name, "<none>" ) != 0 )
+            hr = pController->RegisterAnimationOutput( m_ppFrames[i]->Name, &pLocalMatrices[i],
+                                                       NULL, NULL, NULL );
+    }
 
-    // Duplicate the controller interface
-    hr = m_pAnimationController->CloneAnimationController(
-                                m_pAnimationController->GetMaxNumAnimationOutputs(),
-                                m_pAnimationController->GetMaxNumAnimationSets(),
-                                dwSimultaneousTracks,
-                                m_pAnimationController->GetMaxNumEvents(),
-                               &pTempController );
+    // The animation sets hold no playback state, so every controller can share them.  They're
+    // added in the same order so that their indices don't change.
+    for( UINT i = 0; SUCCEEDED( hr ) && i < m_pAnimationController->GetNumAnimationSets(); ++i )
+    {
+        LPD3DXANIMATIONSET pAnimationSet;
+        if( SUCCEEDED( hr = m_pAnimationController->GetAnimationSet( i, &pAnimationSet ) ) )
+        {
+            hr = pController->RegisterAnimationSet( pAnimationSet );
+            pAnimationSet->Release();
+        }
+    }
 
-    // If error, return
     if( FAILED( hr ) )
+    {
+        pController->Release();
         return hr;
+    }
 
     // Set up the controller's tracks
     for( DWORD i = 0; i < dwSimultaneousTracks; ++i )
-        pTempController->SetTrackEnable( i, FALSE );
+        pController->SetTrackEnable( i, FALSE );
 
-    // Store the controller
-    *ppAnimationController = pTempController;
+    *ppAnimationController = pController;
 
     // Success
     return S_OK;
@@ -697,16 +1515,77 @@ HRESULT AnimatedMesh::CloneAnimationController( DWORD dwSimultaneousTracks,
 
 
 //------------------------------------------------------------------------------------------------
-// Name:  Render
-// Desc:  Draws the mesh
+// Name:  ComputePose
+// Desc:  Computes world matrices for the whole hierarchy in one linear pass
+//------------------------------------------------------------------------------------------------
+VOID AnimatedMesh::ComputePose( const D3DXMATRIX* pLocalMatrices, const D3DXMATRIX* pWorldMatrix,
+                                D3DXMATRIXA16* pWorldMatrices ) const
+{
+    for( DWORD i = 0; i < m_dwNumFrames; ++i )
+    {
+        DWORD dwParent = m_pdwFrameParents[i];
+        D3DXMatrixMultiply( &pWorldMatrices[i], &pLocalMatrices[i],
+                            dwParent == UNUSED32 ? pWorldMatrix : &pWorldMatrices[dwParent] );
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ComputePalette
+// Desc:  
 //------------------------------------------------------------------------------------------------
-HRESULT AnimatedMesh::Render( const D3DXMATRIX* pWorldMatrix )
+VOID AnimatedMesh::ComputePalette( const D3DXMATRIXA16* pWorldMatrices, D3DXMATRIXA16* pPalette ) const
 {
-    // Update the mesh's frame hierarchy
-    UpdateFrames( m_pFrameRoot, pWorldMatrix );
+    ComputeSkinningPalette( (const FLOAT*)m_pBoneOffsets, m_pdwBoneFrames,
+                            (const FLOAT*)pWorldMatrices, m_dwNumBones, (FLOAT*)pPalette );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  DrawPalette
+// Desc:  Draws every skinned mesh in the pose that the palette was computed for
+//------------------------------------------------------------------------------------------------
+HRESULT AnimatedMesh::DrawPalette( const D3DXMATRIXA16* pPalette ) const
+{
+    for( DWORD i = 0; i < m_dwNumMeshes; ++i )
+    {
+        HRESULT hr = DrawFrameMesh( m_ppMeshes[i], pPalette );
+        if( FAILED( hr ) )
+            return hr;
+    }
+
+    // Success
+    return S_OK;
+}
 
-    // Render the mesh
-    return DrawFrames( m_pFrameRoot );
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetNumFrames
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DWORD AnimatedMesh::GetNumFrames() const
+{
+    return m_dwNumFrames;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetNumBones
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DWORD AnimatedMesh::GetNumBones() const
+{
+    return m_dwNumBones;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetBindPose
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const D3DXMATRIXA16* AnimatedMesh::GetBindPose() const
+{
+    return m_pBindPose;
 }
 
 
@@ -750,64 +1629,103 @@ HRESULT AnimatedMesh::SetupBonePointers( MeshFrame* pFrame )
 
 
 //------------------------------------------------------------------------------------------------
-// Name:  UpdateFrames
-// Desc:  
+// Name:  CompileHierarchy
+// Desc:  Builds the flat frame arrays and the list of meshes from the loaded frame tree
 //------------------------------------------------------------------------------------------------
-void AnimatedMesh::UpdateFrames( MeshFrame* pFrame, const D3DXMATRIX* pParentMatrix )
+HRESULT AnimatedMesh::CompileHierarchy()
 {
-    // Update siblings using iteration
-    do
+    // Number the frames depth-first, which puts every parent ahead of its children
+    DWORD dwNumFrames = 0, dwNumMeshes = 0;
+    NumberFrames( m_pFrameRoot, UNUSED32, &dwNumFrames, &dwNumMeshes );
+
+    // Allocate the arrays
+    m_pdwFrameParents = new DWORD[ dwNumFrames ];
+    m_ppFrames = new MeshFrame*[ dwNumFrames ];
+    m_pBindPose = new D3DXMATRIXA16[ dwNumFrames ];
+    m_ppMeshes = new MeshContainer*[ dwNumMeshes + 1 ];
+    if( !m_pdwFrameParents || !m_ppFrames || !m_pBindPose || !m_ppMeshes )
+        return E_OUTOFMEMORY;
+    m_dwNumFrames = dwNumFrames;
+
+    // Number them again, this time recording where each frame is and who its parent is
+    dwNumFrames = 0;
+    dwNumMeshes = 0;
+    NumberFrames( m_pFrameRoot, UNUSED32, &dwNumFrames, &dwNumMeshes );
+
+    // Start from the bind pose
+    DWORD dwNumBones = 0;
+    for( DWORD i = 0; i < dwNumFrames; ++i )
     {
-        // Set up the transformation matrix
-        D3DXMatrixMultiply( &pFrame->matCombined,
-                            &pFrame->TransformationMatrix, pParentMatrix );
+        MeshFrame * pFrame = m_ppFrames[i];
+        m_pBindPose[i] = pFrame->TransformationMatrix;
 
-        // Transform children using recursion
-        if( pFrame->pFrameFirstChild )
-            UpdateFrames( (MeshFrame*)pFrame->pFrameFirstChild, &pFrame->matCombined );
+        // List the skinned meshes, and give each a range of the palette
+        for( D3DXMESHCONTAINER * pContainer = pFrame->pMeshContainer; pContainer;
+             pContainer = pContainer->pNextMeshContainer )
+        {
+            MeshContainer * pMeshContainer = (MeshContainer*)pContainer;
+            if( !pMeshContainer->ppBoneFrames )
+                continue;
+            pMeshContainer->dwFirstPaletteEntry = dwNumBones;
+            dwNumBones += pMeshContainer->dwNumBones;
+            m_ppMeshes[m_dwNumMeshes++] = pMeshContainer;
+        }
+    }
 
-        // Move to the next frame
-        pFrame = (MeshFrame*)pFrame->pFrameSibling;
+    // Gather the bones of every mesh into one table, so that the palette is built in one loop
+    m_pBoneOffsets = new D3DXMATRIXA16[ dwNumBones + 1 ];
+    m_pdwBoneFrames = new DWORD[ dwNumBones + 1 ];
+    if( !m_pBoneOffsets || !m_pdwBoneFrames )
+        return E_OUTOFMEMORY;
+    m_dwNumBones = dwNumBones;
+    for( DWORD i = 0; i < m_dwNumMeshes; ++i )
+    {
+        MeshContainer * pMeshContainer = m_ppMeshes[i];
+        for( DWORD b = 0; b < pMeshContainer->dwNumBones; ++b )
+        {
+            m_pBoneOffsets[pMeshContainer->dwFirstPaletteEntry + b] = pMeshContainer->pBoneMatrixOffsets[b];
+            m_pdwBoneFrames[pMeshContainer->dwFirstPaletteEntry + b] = pMeshContainer->ppBoneFrames[b]->dwIndex;
+        }
+    }
 
-    }while( pFrame != NULL );
+    // Success
+    return S_OK;
 }
 
 
 //------------------------------------------------------------------------------------------------
-// Name:  DrawFrames
-// Desc:  Recursively draws a frames' siblings and children
+// Name:  NumberFrames
+// Desc:  Assigns each frame its index in depth-first order
 //------------------------------------------------------------------------------------------------
-HRESULT AnimatedMesh::DrawFrames( MeshFrame* pFrame )
+VOID AnimatedMesh::NumberFrames( MeshFrame* pFrame, DWORD dwParent, DWORD* pdwNumFrames, DWORD* pdwNumMeshes )
 {
-    // Holds return codes
-    HRESULT hr;
-
-    // Do drawing for siblings using iteration
+    // Number siblings using iteration
     do
     {
-        // Draw the container if it exists
-        if( pFrame->pMeshContainer )
+        // The arrays don't exist on the counting pass
+        pFrame->dwIndex = (*pdwNumFrames)++;
+        if( m_ppFrames )
         {
-            hr = DrawFrameMesh( pFrame );
-            if( FAILED( hr ) )
-                return hr;
+            m_ppFrames[pFrame->dwIndex] = pFrame;
+            m_pdwFrameParents[pFrame->dwIndex] = dwParent;
         }
 
-        // Draw children using recursion--it's a bit easier
-        if( pFrame->pFrameFirstChild )
+        // Count the skinned meshes on this frame
+        for( D3DXMESHCONTAINER * pContainer = pFrame->pMeshContainer; pContainer;
+             pContainer = pContainer->pNextMeshContainer )
         {
-            hr = DrawFrames( (MeshFrame*)pFrame->pFrameFirstChild );
-            if( FAILED( hr ) )
-                return hr;
+            if( ((MeshContainer*)pContainer)->ppBoneFrames )
+                ++(*pdwNumMeshes);
         }
 
+        // Number children using recursion
+        if( pFrame->pFrameFirstChild )
+            NumberFrames( (MeshFrame*)pFrame->pFrameFirstChild, pFrame->dwIndex, pdwNumFrames, pdwNumMeshes );
+
         // Move to the next frame
         pFrame = (MeshFrame*)pFrame->pFrameSibling;
 
     } while( pFrame != NULL );
-
-    // Success
-    return S_OK;
 }
 
 
@@ -815,17 +1733,10 @@ HRESULT AnimatedMesh::DrawFrames( MeshFrame* pFrame )
 // Name:  DrawFrameMesh
 // Desc:  Draws the mesh attached to a certain frame's container
 //------------------------------------------------------------------------------------------------
-HRESULT AnimatedMesh::DrawFrameMesh( MeshFrame* pMeshFrame )
+HRESULT AnimatedMesh::DrawFrameMesh( MeshContainer* pMeshContainer, const D3DXMATRIXA16* pPalette ) const
 {
-    // Get the mesh container from this frame
-    MeshContainer * pMeshContainer = (MeshContainer*)pMeshFrame->pMeshContainer;
-
-    // Used to build matrices that are set into memory
-    D3DXMATRIX temporaryMatrix;
-
-    // If there is no skinning, return
-    if( pMeshContainer->pSkinInfo == NULL )
-        return S_OK;
+    // This mesh's part of the palette
+    pPalette += pMeshContainer->dwFirstPaletteEntry;
 
     // Get bone combinations
     D3DXBONECOMBINATION* boneComboBuffer = reinterpret_cast<D3DXBONECOMBINATION*>
@@ -863,13 +1774,8 @@ HRESULT AnimatedMesh::DrawFrameMesh( MeshFrame* pMeshFrame )
                 // Add this to the blend number
                 blendNumber = i;
 
-                // Build the matrix
-                D3DXMatrixMultiply( &temporaryMatrix,
-                                    &pMeshContainer->pBoneMatrixOffsets[matrixIndex],
-                                     pMeshContainer->ppBoneMatrixPointers[matrixIndex] );
-
-                // Set the matrix into memory
-                m_pd3dDevice->SetTransform( D3DTS_WORLDMATRIX(i), &temporaryMatrix );
+                // Set the bone's matrix into memory
+                m_pd3dDevice->SetTransform( D3DTS_WORLDMATRIX(i), &pPalette[matrixIndex] );
             }
         }
 
@@ -921,10 +1827,7 @@ HRESULT AnimatedMesh::DrawFrameMesh( MeshFrame* pMeshFrame )
                 if( matrixIndex != UINT_MAX )
                 {
                     blendNumber = i;
-                    D3DXMatrixMultiply( &temporaryMatrix,
-                                        &pMeshContainer->pBoneMatrixOffsets[matrixIndex],
-                                         pMeshContainer->ppBoneMatrixPointers[matrixIndex] );
-                    m_pd3dDevice->SetTransform( D3DTS_WORLDMATRIX(i), &temporaryMatrix );
+                    m_pd3dDevice->SetTransform( D3DTS_WORLDMATRIX(i), &pPalette[matrixIndex] );
                 }
             }
 
@@ -967,3 +1870,123 @@ HRESULT AnimatedMesh::DrawFrameMesh( MeshFrame* pMeshFrame )
     return S_OK;
 
 }
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  AnimatedMeshInstance
+// Desc:  
+//------------------------------------------------------------------------------------------------
+AnimatedMeshInstance::AnimatedMeshInstance()
+{
+    m_pMesh = NULL;
+    m_pAnimationController = NULL;
+    m_pLocalMatrices = NULL;
+    m_pWorldMatrices = NULL;
+    m_pPalette = NULL;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~AnimatedMeshInstance
+// Desc:  
+//------------------------------------------------------------------------------------------------
+AnimatedMeshInstance::~AnimatedMeshInstance()
+{
+    Release();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Create
+// Desc:  Allocates this instance's pose and gives it a controller of its own
+//------------------------------------------------------------------------------------------------
+HRESULT AnimatedMeshInstance::Create( const AnimatedMesh* pMesh, DWORD dwSimultaneousTracks )
+{
+    // Get rid of current information if any exists
+    Release();
+
+    // Allocate the buffers
+    DWORD dwNumFrames = pMesh->GetNumFrames();
+    m_pLocalMatrices = new D3DXMATRIXA16[ dwNumFrames ];
+    m_pWorldMatrices = new D3DXMATRIXA16[ dwNumFrames ];
+    m_pPalette = new D3DXMATRIXA16[ pMesh->GetNumBones() + 1 ];
+    if( !m_pLocalMatrices || !m_pWorldMatrices || !m_pPalette )
+    {
+        Release();
+        return E_OUTOFMEMORY;
+    }
+
+    // Start in the bind pose; frames that aren't animated stay there
+    const D3DXMATRIXA16 * pBindPose = pMesh->GetBindPose();
+    for( DWORD i = 0; i < dwNumFrames; ++i )
+        m_pLocalMatrices[i] = pBindPose[i];
+
+    // The controller writes into this instance's local matrices
+    HRESULT hr = pMesh->CreateAnimationController( dwSimultaneousTracks, m_pLocalMatrices,
+                                                  &m_pAnimationController );
+    if( FAILED( hr ) )
+    {
+        Release();
+        return hr;
+    }
+
+    // Draw the bind pose at the origin until the first update
+    m_pMesh = pMesh;
+    D3DXMATRIXA16 matIdentity;
+    D3DXMatrixIdentity( &matIdentity );
+    pMesh->ComputePose( m_pLocalMatrices, &matIdentity, m_pWorldMatrices );
+    pMesh->ComputePalette( m_pWorldMatrices, m_pPalette );
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Release
+// Desc:  
+//------------------------------------------------------------------------------------------------
+VOID AnimatedMeshInstance::Release()
+{
+    SAFE_RELEASE( m_pAnimationController );
+    SAFE_DELETE_ARRAY( m_pLocalMatrices );
+    SAFE_DELETE_ARRAY( m_pWorldMatrices );
+    SAFE_DELETE_ARRAY( m_pPalette );
+    m_pMesh = NULL;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetAnimationController
+// Desc:  
+//------------------------------------------------------------------------------------------------
+HRESULT AnimatedMeshInstance::GetAnimationController( LPD3DXANIMATIONCONTROLLER* ppAnimationController )
+{
+    if( !m_pAnimationController )
+        return E_FAIL;
+    (*ppAnimationController = m_pAnimationController)->AddRef();
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Update
+// Desc:  Animates the local matrices, then builds the world matrices and palette from them
+//------------------------------------------------------------------------------------------------
+VOID AnimatedMeshInstance::Update( DOUBLE dTimeDelta, const D3DXMATRIX* pWorldMatrix )
+{
+    m_pAnimationController->AdvanceTime( dTimeDelta, NULL );
+    m_pMesh->ComputePose( m_pLocalMatrices, pWorldMatrix, m_pWorldMatrices );
+    m_pMesh->ComputePalette( m_pWorldMatrices, m_pPalette );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Render
+// Desc:  
+//------------------------------------------------------------------------------------------------
+HRESULT AnimatedMeshInstance::Render() const
+{
+    return m_pMesh->DrawPalette( m_pPalette );
+}
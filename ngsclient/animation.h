@@ -33,6 +33,14 @@
 #ifndef __ANIMATION_H__
 #define __ANIMATION_H__
 
+// Include files required to compile this header
+#include "bakedasset.h"
+
+// Read by the native X file loader
+class XFile;
+struct XMesh;
+struct XAnimation;
+
 
 /**
  * Encapsulates a frame in the allocation hierarchy
@@ -40,8 +48,8 @@
  */
 struct MeshFrame : public D3DXFRAME
 {
-    /// Combined transformation matrix for this frame
-    D3DXMATRIXA16 matCombined;
+    /// Where this frame is in the compiled hierarchy of the mesh that owns it
+    DWORD dwIndex;
 };
 
 
@@ -60,10 +68,16 @@ struct MeshContainer : public D3DXMESHCONTAINER
     /// Bone offset matrices retrieved from the D3DXMESHCONTAINER::pSkinInfo interface
     D3DXMATRIX* pBoneMatrixOffsets;
 
-    /// Array used to look up transformation matrices.  The only function in this class,
-    /// createBonePointers, sets up this array.
-    ///     @see createBonePointers
-    D3DXMATRIX** ppBoneMatrixPointers;
+    /// How many bones the mesh is skinned to
+    DWORD dwNumBones;
+
+    /// The frame that each bone follows.  The only function in this class, CreateBonePointers,
+    /// sets up this array.
+    ///     @see CreateBonePointers
+    MeshFrame** ppBoneFrames;
+
+    /// Where this mesh's bones start in its AnimatedMesh's skinning palette
+    DWORD dwFirstPaletteEntry;
 
     /// Maximum number of matrix influences on a single face
     DWORD dwMaxFaceInfluences;
@@ -176,7 +190,7 @@ class AllocateHierarchy : public ID3DXAllocateHierarchy
 
         /**
          * Loads a mesh hierarchy from an X file.  This function is defined by this mesh class
-         * by default, but can be overridden in case the user needs to load encrypted files or
+         * by default (reading the file with XFile rather than D3DX), but can be overridden in case the user needs to load encrypted files or
          * load files from resources.
          *   @param pDevice Source device object to create the structure with
          *   @param strFileName Name of the file to load
@@ -187,6 +201,89 @@ class AllocateHierarchy : public ID3DXAllocateHierarchy
         STDMETHOD(LoadMeshHierarchyFromX)(THIS_ LPDIRECT3DDEVICE9 pDevice, LPCSTR strFileName,
                                                 LPD3DXFRAME* ppFrameHierarchy,
                                                 LPD3DXANIMATIONCONTROLLER* ppAnimController );
+
+        /**
+         * Loads a mesh hierarchy from a baked copy of an X file.  The meshes reference the baked
+         * file's bone tables and texture names in place, so it has to stay loaded until the
+         * hierarchy is destroyed.
+         *   @param pDevice Source device object to create the structure with
+         *   @param pAsset The baked file
+         *   @param ppFrameHierarchy Target variable for frame hierarchy
+         *   @param ppAnimController Returns a pointer to the animation controller
+         *   @return Result code
+         */
+        HRESULT LoadMeshHierarchyFromBake( LPDIRECT3DDEVICE9 pDevice, const BakedAsset * pAsset,
+                                           LPD3DXFRAME* ppFrameHierarchy,
+                                           LPD3DXANIMATIONCONTROLLER* ppAnimController );
+
+    protected:
+
+        /**
+         * Builds the frame hierarchy, mesh containers and animation controller from a file
+         * that has been read with XFile
+         *   @param pDevice Device to create the meshes on
+         *   @param pFile The file
+         *   @param ppFrameHierarchy Target variable for frame hierarchy
+         *   @param ppAnimController Returns a pointer to the animation controller
+         *   @return Result code
+         */
+        HRESULT CreateHierarchy( LPDIRECT3DDEVICE9 pDevice, const XFile * pFile,
+                                 LPD3DXFRAME* ppFrameHierarchy,
+                                 LPD3DXANIMATIONCONTROLLER* ppAnimController );
+
+        /**
+         * Creates a D3DX mesh and skin from one that XFile read, and passes them to
+         * CreateMeshContainer
+         *   @param pDevice Device to create the mesh on
+         *   @param pMesh Source mesh
+         *   @param ppContainer Output mesh container
+         *   @return Result code
+         */
+        HRESULT CreateMesh( LPDIRECT3DDEVICE9 pDevice, const XMesh * pMesh,
+                            D3DXMESHCONTAINER** ppContainer );
+
+        /**
+         * Creates an animation controller for the file's animation sets
+         *   @param pFile The file
+         *   @param ppFrames The frames created for the file, in the same order
+         *   @param ppAnimController Returns the controller, or NULL if there's no animation
+         *   @return Result code
+         */
+        HRESULT CreateAnimationController( const XFile * pFile, D3DXFRAME ** ppFrames,
+                                           LPD3DXANIMATIONCONTROLLER* ppAnimController );
+
+        /**
+         * Adds the keys that move one frame to an animation set
+         *   @param pAnimationSet Destination set
+         *   @param pAnimation Keys read from the file
+         *   @return Result code
+         */
+        HRESULT RegisterAnimationKeys( LPD3DXKEYFRAMEDANIMATIONSET pAnimationSet,
+                                       const XAnimation * pAnimation );
+
+        /**
+         * Creates a mesh container from a baked mesh, copying its buffers to the device
+         *   @param pDevice Device to create the mesh on
+         *   @param pAsset The baked file, which has to outlive the container
+         *   @param pMesh Source mesh
+         *   @param ppFrames The frames created for the file, in the same order
+         *   @param ppContainer Output mesh container
+         *   @return Result code
+         */
+        HRESULT CreateBakedMeshContainer( LPDIRECT3DDEVICE9 pDevice, const BakedAsset * pAsset,
+                                          const BakedMesh * pMesh, D3DXFRAME ** ppFrames,
+                                          D3DXMESHCONTAINER** ppContainer );
+
+        /**
+         * Creates an animation controller for a baked file's animation sets
+         *   @param pAsset The baked file
+         *   @param ppFrames The frames created for the file, in the same order
+         *   @param ppAnimController Returns the controller, or NULL if there's no animation
+         *   @return Result code
+         */
+        HRESULT CreateBakedAnimationController( const BakedAsset * pAsset, D3DXFRAME ** ppFrames,
+                                                LPD3DXANIMATIONCONTROLLER* ppAnimController );
+
     private:
 
         /**
@@ -202,8 +299,8 @@ class AllocateHierarchy : public ID3DXAllocateHierarchy
 
 
 /**
- * Stores the full definition of a skinned mesh.  The instance class should be used to render
- * it and update its matrices.
+ * Stores the full definition of a skinned mesh.  Once it's loaded, nothing in it changes; each
+ * character that's drawn with it is an AnimatedMeshInstance, which keeps its own pose.
  *   @author Karl Gluck
  */
 class AnimatedMesh
@@ -221,7 +318,9 @@ class AnimatedMesh
         ~AnimatedMesh();
 
         /**
-         * Loads this animated mesh from a source X file.
+         * Loads this animated mesh from a source X file.  The file is baked to a binary copy
+         * next to it (strFileName + ".baked") the first time, and again whenever it changes;
+         * after that, only the baked copy is read.
          *   @param pDevice Device to create the mesh on
          *   @param strFileName Name of the file to load
          *   @param pAllocateHierarchy Allocation hierarchy structure
@@ -231,26 +330,59 @@ class AnimatedMesh
                                AllocateHierarchy * pAllocateHierarchy );
 
         /**
-         * Deletes this mesh container
+         * Deletes this mesh container.  Every instance of the mesh has to be released first.
          */
         VOID Release();
 
         /**
-         * Creates a copy of the internal animation controller that manages a separate version of
-         * this animated mesh.
+         * Creates an animation controller with this mesh's animation sets, which writes each
+         * frame's transform into the given array.  The sets are shared, but the controller's
+         * tracks and time are its own.
          *   @param dwSimultaneousTracks How many tracks can exist at once on this controller
+         *   @param pLocalMatrices One matrix for each frame, which the controller animates
          *   @param ppAnimationController Destination for newly created animation controller interface
          *   @return Result code
          */
-        HRESULT CloneAnimationController( DWORD dwSimultaneousTracks,
-                                          LPD3DXANIMATIONCONTROLLER* ppAnimationController );
+        HRESULT CreateAnimationController( DWORD dwSimultaneousTracks, D3DXMATRIX* pLocalMatrices,
+                                           LPD3DXANIMATIONCONTROLLER* ppAnimationController ) const;
 
         /**
-         * Draws the mesh to the screen.  It will be drawn in the last post assigned by a call
-         * to the Update function.
+         * Computes the world matrix of every frame from the local matrices, in one pass
+         *   @param pLocalMatrices Each frame's transform relative to its parent
+         *   @param pWorldMatrix Transform for the root frames
+         *   @param pWorldMatrices Receives each frame's transform in world space
+         */
+        VOID ComputePose( const D3DXMATRIX* pLocalMatrices, const D3DXMATRIX* pWorldMatrix,
+                          D3DXMATRIXA16* pWorldMatrices ) const;
+
+        /**
+         * Computes every bone's final matrix from the frames' world matrices
+         *   @param pWorldMatrices Each frame's transform in world space
+         *   @param pPalette Receives one matrix per bone
+         */
+        VOID ComputePalette( const D3DXMATRIXA16* pWorldMatrices, D3DXMATRIXA16* pPalette ) const;
+
+        /**
+         * Draws the mesh with the bone matrices from ComputePalette
+         *   @param pPalette Final matrix of every bone
          *   @return Result code
          */
-        HRESULT Render( const D3DXMATRIX* pWorldMatrix );
+        HRESULT DrawPalette( const D3DXMATRIXA16* pPalette ) const;
+
+        /**
+         * Gets the number of frames in the hierarchy, which is the size of a pose
+         */
+        DWORD GetNumFrames() const;
+
+        /**
+         * Gets the number of bones in all of the meshes, which is the size of a palette
+         */
+        DWORD GetNumBones() const;
+
+        /**
+         * Gets the local matrix of each frame when it isn't being animated
+         */
+        const D3DXMATRIXA16* GetBindPose() const;
 
     private:
 
@@ -262,51 +394,152 @@ class AnimatedMesh
         HRESULT SetupBonePointers( MeshFrame* pFrame );
 
         /**
-         * Does a hierarchial transformation on the frame set specified
-         *   @param pFrame Frame to update
-         *   @param pParentMatrix Parent transformation matrix
+         * Flattens the frame tree into the parent-indexed arrays that poses are computed with,
+         * and lists the meshes to draw
+         *   @return Result code
          */
-        void UpdateFrames( MeshFrame* pFrame, const D3DXMATRIX* pParentMatrix );
+        HRESULT CompileHierarchy();
 
         /**
-         * Draws all meshes on this frame or on those that are siblings/children of it
-         *   @param pFrame The parent frame to draw
-         *   @return Result code
+         * Numbers a frame, its siblings and all of their children so that every parent comes
+         * before its children, and counts the meshes they hold.  Once the frame arrays have
+         * been allocated, each frame and its parent are recorded in them as well.
+         *   @param pFrame First frame of the sibling list
+         *   @param dwParent Index of the frames' parent, or UNUSED32 for the roots
+         *   @param pdwNumFrames Number of frames so far; updated on return
+         *   @param pdwNumMeshes Number of meshes so far; updated on return
          */
-        HRESULT DrawFrames( MeshFrame* pFrame );
+        VOID NumberFrames( MeshFrame* pFrame, DWORD dwParent, DWORD* pdwNumFrames, DWORD* pdwNumMeshes );
 
         /**
-         * Renders the mesh attached to the specified frame
-         *   @param pMeshFrame The frame to draw
+         * Renders a skinned mesh
+         *   @param pMeshContainer The mesh to draw
+         *   @param pPalette Final matrix of every bone
          *   @return Result code
          */
-        HRESULT DrawFrameMesh( MeshFrame* pMeshFrame );
+        HRESULT DrawFrameMesh( MeshContainer* pMeshContainer, const D3DXMATRIXA16* pPalette ) const;
 
     private:
 
         /// Local reference to the main rendering device.
         IDirect3DDevice9* m_pd3dDevice;
 
-        /// Root frame that encompasses the entire mesh hierarchy.  This structure is shared
-        /// between all instances.
+        /// Root frame that encompasses the entire mesh hierarchy
         MeshFrame* m_pFrameRoot;
 
-        /// Controller object that instances clone from to set up their own tracks.  This lets
-        /// each instance have its own separate animations running at the same time.
+        /// Controller that was loaded with the mesh.  It's never advanced; instances get their
+        /// own controllers with the same animation sets.
         ID3DXAnimationController* m_pAnimationController;
 
         /// User allocation hierarchy
         AllocateHierarchy* m_pAllocateHierarchy;
+
+        /// The baked copy of the source file.  Mesh containers reference it in place.
+        BakedAsset m_Asset;
+
+        /// How many frames are in the hierarchy
+        DWORD m_dwNumFrames;
+
+        /// Index of each frame's parent, or UNUSED32 for a root.  Frames are numbered so that
+        /// every parent comes before its children.
+        DWORD* m_pdwFrameParents;
+
+        /// The frames, in the order they're numbered
+        MeshFrame** m_ppFrames;
+
+        /// Each frame's transform relative to its parent when it isn't animated
+        D3DXMATRIXA16* m_pBindPose;
+
+        /// The skinned meshes in the hierarchy, in the order they're drawn
+        MeshContainer** m_ppMeshes;
+
+        /// How many entries are in the mesh list
+        DWORD m_dwNumMeshes;
+
+        /// Total number of bones in all of the meshes
+        DWORD m_dwNumBones;
+
+        /// Offset matrix of every bone, mesh after mesh
+        D3DXMATRIXA16* m_pBoneOffsets;
+
+        /// Index of the frame that each bone follows
+        DWORD* m_pdwBoneFrames;
 };
 
 
 /**
- * 
+ * One character drawn with an AnimatedMesh.  The instance owns its animation controller and
+ * the buffers that its pose is computed into, and only reads the mesh, so any number of
+ * instances can be updated at the same time on different threads.  The pose is kept until the
+ * next update, so it can be drawn any number of times.
  *   @author Karl Gluck
  */
 class AnimatedMeshInstance
 {
+    public:
+
+        /**
+         * Initializes the instance
+         */
+        AnimatedMeshInstance();
+
+        /**
+         * Cleans up the instance
+         */
+        ~AnimatedMeshInstance();
+
+        /**
+         * Sets up this instance of a mesh, starting in the mesh's bind pose with every track
+         * disabled.  The mesh has to outlive the instance.
+         *   @param pMesh The mesh to draw
+         *   @param dwSimultaneousTracks How many tracks the animation controller can play at once
+         *   @return Result code
+         */
+        HRESULT Create( const AnimatedMesh* pMesh, DWORD dwSimultaneousTracks );
+
+        /**
+         * Frees the instance's controller and buffers
+         */
+        VOID Release();
+
+        /**
+         * Gets the controller that animates this instance.  Its tracks can be changed freely;
+         * they only affect this instance.
+         *   @param ppAnimationController Receives the controller, which has to be released
+         *   @return Result code
+         */
+        HRESULT GetAnimationController( LPD3DXANIMATIONCONTROLLER* ppAnimationController );
+
+        /**
+         * Advances the animation and computes the new pose and palette.  This only touches the
+         * instance's own data, so it doesn't need the device.
+         *   @param dTimeDelta How far to advance the animation, in seconds
+         *   @param pWorldMatrix Where the character is
+         */
+        VOID Update( DOUBLE dTimeDelta, const D3DXMATRIX* pWorldMatrix );
+
+        /**
+         * Draws the instance in the pose from the last update
+         *   @return Result code
+         */
+        HRESULT Render() const;
+
+    protected:
+
+        /// The shared mesh
+        const AnimatedMesh* m_pMesh;
+
+        /// This instance's animation state
+        ID3DXAnimationController* m_pAnimationController;
+
+        /// Each frame's transform relative to its parent, written by the controller
+        D3DXMATRIXA16* m_pLocalMatrices;
+
+        /// Each frame's transform in world space
+        D3DXMATRIXA16* m_pWorldMatrices;
 
+        /// Final matrix of every bone
+        D3DXMATRIXA16* m_pPalette;
 };
 
 
@@ -0,0 +1,804 @@
+//------------------------------------------------------------------------------------------------
+// File:    assetbaker.cpp
+//
+// Desc:    Turns a text X file into the baked form that the client maps
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "assetbaker.h"
+#include "xfile.h"
+#include <stdlib.h>
+#include <math.h>
+
+// The buffer starts this big and doubles as it fills up
+#define INITIAL_CAPACITY        (256 * 1024)
+
+// Offsets are DWORDs, and no character needs more than this
+#define MAX_BAKED_SIZE          0x40000000
+
+// Longest bone name that can be looked up
+#define MAX_NAME_LENGTH         256
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  AllocateBuffer
+// Desc:  Allocates memory aligned for baked data.  The pointer malloc returned is kept just
+//        before the aligned block.
+//------------------------------------------------------------------------------------------------
+static BYTE * AllocateBuffer( DWORD dwSize )
+{
+    BYTE * pAllocation = (BYTE*)malloc( (size_t)dwSize + BAKED_ASSET_ALIGNMENT + sizeof(BYTE*) );
+    if( !pAllocation )
+        return NULL;
+    BYTE * pBuffer = (BYTE*)(((DWORD_PTR)pAllocation + sizeof(BYTE*) + BAKED_ASSET_ALIGNMENT - 1) &
+                             ~(DWORD_PTR)(BAKED_ASSET_ALIGNMENT - 1));
+    memcpy( pBuffer - sizeof(BYTE*), &pAllocation, sizeof(BYTE*) );
+    return pBuffer;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  DecomposeMatrix
+// Desc:  Splits a matrix with no shear or mirroring into scale, a rotation in D3DX's convention
+//        (the same result D3DXMatrixDecompose gives) and translation
+//------------------------------------------------------------------------------------------------
+static VOID DecomposeMatrix( const FLOAT * pMatrix, FLOAT * pScale, FLOAT * pRotation, FLOAT * pTranslation )
+{
+    FLOAT m[3][3];
+    for( int i = 0; i < 3; ++i )
+    {
+        const FLOAT * pRow = &pMatrix[i * 4];
+        pScale[i] = sqrtf( pRow[0] * pRow[0] + pRow[1] * pRow[1] + pRow[2] * pRow[2] );
+        FLOAT fInverse = pScale[i] > 0.0f ? 1.0f / pScale[i] : 0.0f;
+        for( int j = 0; j < 3; ++j )
+            m[i][j] = pRow[j] * fInverse;
+    }
+    pTranslation[0] = pMatrix[12];
+    pTranslation[1] = pMatrix[13];
+    pTranslation[2] = pMatrix[14];
+
+    // Work from whichever of w, x, y or z is largest, to keep the division accurate
+    FLOAT fTrace = m[0][0] + m[1][1] + m[2][2];
+    if( fTrace > 0.0f )
+    {
+        FLOAT s = 2.0f * sqrtf( fTrace + 1.0f );
+        pRotation[0] = (m[1][2] - m[2][1]) / s;
+        pRotation[1] = (m[2][0] - m[0][2]) / s;
+        pRotation[2] = (m[0][1] - m[1][0]) / s;
+        pRotation[3] = 0.25f * s;
+    }
+    else if( m[0][0] > m[1][1] && m[0][0] > m[2][2] )
+    {
+        FLOAT s = 2.0f * sqrtf( 1.0f + m[0][0] - m[1][1] - m[2][2] );
+        pRotation[0] = 0.25f * s;
+        pRotation[1] = (m[0][1] + m[1][0]) / s;
+        pRotation[2] = (m[0][2] + m[2][0]) / s;
+        pRotation[3] = (m[1][2] - m[2][1]) / s;
+    }
+    else if( m[1][1] > m[2][2] )
+    {
+        FLOAT s = 2.0f * sqrtf( 1.0f + m[1][1] - m[0][0] - m[2][2] );
+        pRotation[0] = (m[0][1] + m[1][0]) / s;
+        pRotation[1] = 0.25f * s;
+        pRotation[2] = (m[1][2] + m[2][1]) / s;
+        pRotation[3] = (m[2][0] - m[0][2]) / s;
+    }
+    else
+    {
+        FLOAT s = 2.0f * sqrtf( 1.0f + m[2][2] - m[0][0] - m[1][1] );
+        pRotation[0] = (m[0][2] + m[2][0]) / s;
+        pRotation[1] = (m[1][2] + m[2][1]) / s;
+        pRotation[2] = 0.25f * s;
+        pRotation[3] = (m[0][1] - m[1][0]) / s;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  AssetBaker
+// Desc:  
+//------------------------------------------------------------------------------------------------
+AssetBaker::AssetBaker()
+{
+    m_pBuffer = NULL;
+    m_dwSize = 0;
+    m_dwCapacity = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~AssetBaker
+// Desc:  
+//------------------------------------------------------------------------------------------------
+AssetBaker::~AssetBaker()
+{
+    Release();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Bake
+// Desc:  Builds the whole baked file in memory
+//------------------------------------------------------------------------------------------------
+HRESULT AssetBaker::Bake( const XFile * pFile, QWORD qwSourceHash )
+{
+    Release();
+
+    // Only skinned meshes are drawn
+    DWORD dwNumMeshes = 0;
+    for( DWORD i = 0; i < pFile->GetNumMeshes(); ++i )
+    {
+        if( pFile->GetMesh( i )->dwNumBones > 0 )
+            ++dwNumMeshes;
+    }
+
+    DWORD dwHeader;
+    BakedArray frames, meshes, animationSets;
+    if( !Reserve( sizeof(BakedHeader), BAKED_ASSET_ALIGNMENT, &dwHeader ) ||
+        !ReserveArray( pFile->GetNumFrames(), sizeof(BakedFrame), &frames ) ||
+        !ReserveArray( dwNumMeshes, sizeof(BakedMesh), &meshes ) ||
+        !ReserveArray( pFile->GetNumAnimationSets(), sizeof(BakedAnimationSet), &animationSets ) )
+    {
+        Release();
+        return E_OUTOFMEMORY;
+    }
+
+    // The file already lists frames parent-first
+    for( DWORD i = 0; i < pFile->GetNumFrames(); ++i )
+    {
+        const XFrame * pSource = pFile->GetFrame( i );
+        BakedArray name;
+        if( !AddString( &pSource->Name, &name ) )
+        {
+            Release();
+            return E_OUTOFMEMORY;
+        }
+        BakedFrame * pFrame = (BakedFrame*)At( frames.dwOffset ) + i;
+        pFrame->Name = name;
+        pFrame->dwParent = pSource->dwParent == XFILE_NONE ? BAKED_NONE : pSource->dwParent;
+        memcpy( pFrame->fTransform, pSource->fTransform, sizeof(pFrame->fTransform) );
+    }
+
+    HRESULT hr = S_OK;
+    for( DWORD i = 0, dwMesh = 0; SUCCEEDED( hr ) && i < pFile->GetNumMeshes(); ++i )
+    {
+        if( pFile->GetMesh( i )->dwNumBones > 0 )
+            hr = BakeMesh( pFile, pFile->GetMesh( i ), meshes.dwOffset + sizeof(BakedMesh) * dwMesh++ );
+    }
+    for( DWORD i = 0; SUCCEEDED( hr ) && i < pFile->GetNumAnimationSets(); ++i )
+        hr = BakeAnimationSet( pFile, pFile->GetAnimationSet( i ), animationSets.dwOffset + sizeof(BakedAnimationSet) * i );
+    if( FAILED( hr ) )
+    {
+        Release();
+        return hr;
+    }
+
+    BakedHeader * pHeader = (BakedHeader*)At( dwHeader );
+    pHeader->dwMagic = BAKED_ASSET_MAGIC;
+    pHeader->dwVersion = BAKED_ASSET_VERSION;
+    pHeader->dwSize = m_dwSize;
+    pHeader->dwSourceSize = pFile->GetFileSize();
+    pHeader->qwSourceHash = qwSourceHash;
+    pHeader->Frames = frames;
+    pHeader->Meshes = meshes;
+    pHeader->AnimationSets = animationSets;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Write
+// Desc:  Saves the baked file, removing it again if it couldn't all be written
+//------------------------------------------------------------------------------------------------
+HRESULT AssetBaker::Write( const CHAR * strFile ) const
+{
+    if( !m_pBuffer )
+        return E_FAIL;
+
+    FILE * pFile = fopen( strFile, "wb" );
+    if( !pFile )
+        return E_FAIL;
+    BOOL bWritten = fwrite( m_pBuffer, 1, m_dwSize, pFile ) == m_dwSize;
+    if( 0 != fclose( pFile ) )
+        bWritten = FALSE;
+    if( !bWritten )
+    {
+        remove( strFile );
+        return E_FAIL;
+    }
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Detach
+// Desc:  
+//------------------------------------------------------------------------------------------------
+BYTE * AssetBaker::Detach( DWORD * pdwSize )
+{
+    BYTE * pBuffer = m_pBuffer;
+    *pdwSize = m_dwSize;
+    m_pBuffer = NULL;
+    m_dwSize = 0;
+    m_dwCapacity = 0;
+    return pBuffer;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Release
+// Desc:  
+//------------------------------------------------------------------------------------------------
+VOID AssetBaker::Release()
+{
+    FreeBuffer( m_pBuffer );
+    m_pBuffer = NULL;
+    m_dwSize = 0;
+    m_dwCapacity = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  FreeBuffer
+// Desc:  
+//------------------------------------------------------------------------------------------------
+VOID AssetBaker::FreeBuffer( BYTE * pBuffer )
+{
+    if( pBuffer )
+    {
+        BYTE * pAllocation;
+        memcpy( &pAllocation, pBuffer - sizeof(BYTE*), sizeof(BYTE*) );
+        free( pAllocation );
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  BakeMesh
+// Desc:  Converts a skinned mesh into bone combinations and the vertex and index buffers that
+//        draw them, and writes it into the BakedMesh at dwOffset
+//------------------------------------------------------------------------------------------------
+HRESULT AssetBaker::BakeMesh( const XFile * pFile, const XMesh * pSource, DWORD dwOffset )
+{
+    DWORD dwNumVertices = pSource->dwNumVertices;
+    DWORD dwNumFaces = pSource->dwNumTriangles;
+    DWORD dwNumBones = pSource->dwNumBones;
+    DWORD dwNumMaterials = pSource->dwNumMaterials > 0 ? pSource->dwNumMaterials : 1;
+
+    // Scratch space for everything below comes out of one allocation
+    QWORD qwScratchSize = (QWORD)dwNumVertices * (sizeof(DWORD) * BAKED_MAX_INFLUENCES +
+                                                  sizeof(FLOAT) * BAKED_MAX_INFLUENCES +
+                                                  sizeof(FLOAT) * 3 + sizeof(DWORD) * 2 + 1) +
+                          (QWORD)dwNumFaces * (sizeof(DWORD) * BAKED_MAX_INFLUENCES * 2 +
+                                               sizeof(DWORD) * 2 + sizeof(DWORD) * 3 * 2 +
+                                               sizeof(BakedBoneCombination) + 1);
+    if( qwScratchSize > MAX_BAKED_SIZE )
+        return E_OUTOFMEMORY;
+    BYTE * pScratch = (BYTE*)malloc( (size_t)qwScratchSize );
+    if( !pScratch )
+        return E_OUTOFMEMORY;
+    BYTE * pNext = pScratch;
+    DWORD * pInfluenceBones = (DWORD*)pNext;                pNext += sizeof(DWORD) * BAKED_MAX_INFLUENCES * dwNumVertices;
+    FLOAT * pInfluenceWeights = (FLOAT*)pNext;              pNext += sizeof(FLOAT) * BAKED_MAX_INFLUENCES * dwNumVertices;
+    FLOAT * pComputedNormals = (FLOAT*)pNext;               pNext += sizeof(FLOAT) * 3 * dwNumVertices;
+    DWORD * pVertexCombination = (DWORD*)pNext;             pNext += sizeof(DWORD) * dwNumVertices;
+    DWORD * pVertexMap = (DWORD*)pNext;                     pNext += sizeof(DWORD) * dwNumVertices;
+    DWORD * pFaceBones = (DWORD*)pNext;                     pNext += sizeof(DWORD) * BAKED_MAX_INFLUENCES * dwNumFaces;
+    DWORD * pBoneIds = (DWORD*)pNext;                       pNext += sizeof(DWORD) * BAKED_MAX_INFLUENCES * dwNumFaces;
+    DWORD * pFaceCombination = (DWORD*)pNext;               pNext += sizeof(DWORD) * dwNumFaces;
+    DWORD * pFaceOrder = (DWORD*)pNext;                     pNext += sizeof(DWORD) * dwNumFaces;
+    DWORD * pNewVertices = (DWORD*)pNext;                   pNext += sizeof(DWORD) * 3 * dwNumFaces;
+    DWORD * pNewIndices = (DWORD*)pNext;                    pNext += sizeof(DWORD) * 3 * dwNumFaces;
+    BakedBoneCombination * pCombinations = (BakedBoneCombination*)pNext;
+                                                            pNext += sizeof(BakedBoneCombination) * dwNumFaces;
+    BYTE * pNumInfluences = pNext;                          pNext += dwNumVertices;
+    BYTE * pFaceNumBones = pNext;
+
+    // Keep the strongest influences on each vertex, and scale them to add up to 1.  A vertex
+    // that no bone moves follows the first one rather than collapsing to the origin.
+    ZeroMemory( pNumInfluences, dwNumVertices );
+    for( DWORD b = 0; b < dwNumBones; ++b )
+    {
+        const XSkinWeights * pBone = &pSource->pBones[b];
+        for( DWORD i = 0; i < pBone->dwNumWeights; ++i )
+        {
+            DWORD dwVertex = pBone->pVertices[i];
+            FLOAT fWeight = pBone->pWeights[i];
+            if( !(fWeight > 0.0f) )
+                continue;
+            DWORD * pBones = &pInfluenceBones[dwVertex * BAKED_MAX_INFLUENCES];
+            FLOAT * pWeights = &pInfluenceWeights[dwVertex * BAKED_MAX_INFLUENCES];
+            DWORD dwSlot = pNumInfluences[dwVertex];
+            if( dwSlot < BAKED_MAX_INFLUENCES )
+                ++pNumInfluences[dwVertex];
+            else
+            {
+                dwSlot = 0;
+                for( DWORD j = 1; j < BAKED_MAX_INFLUENCES; ++j )
+                {
+                    if( pWeights[j] < pWeights[dwSlot] )
+                        dwSlot = j;
+                }
+                if( pWeights[dwSlot] >= fWeight )
+                    continue;
+            }
+            pBones[dwSlot] = b;
+            pWeights[dwSlot] = fWeight;
+        }
+    }
+    for( DWORD v = 0; v < dwNumVertices; ++v )
+    {
+        DWORD * pBones = &pInfluenceBones[v * BAKED_MAX_INFLUENCES];
+        FLOAT * pWeights = &pInfluenceWeights[v * BAKED_MAX_INFLUENCES];
+        if( pNumInfluences[v] == 0 )
+        {
+            pNumInfluences[v] = 1;
+            pBones[0] = 0;
+            pWeights[0] = 1.0f;
+            continue;
+        }
+        FLOAT fTotal = 0.0f;
+        for( DWORD i = 0; i < pNumInfluences[v]; ++i )
+            fTotal += pWeights[i];
+        for( DWORD i = 0; i < pNumInfluences[v]; ++i )
+            pWeights[i] /= fTotal;
+    }
+
+    // Find the bones that move each face
+    DWORD dwMaxFaceInfluences = 1;
+    for( DWORD f = 0; f < dwNumFaces; ++f )
+    {
+        DWORD * pBones = &pFaceBones[f * BAKED_MAX_INFLUENCES];
+        DWORD dwNumFaceBones = 0;
+        for( DWORD k = 0; k < 3; ++k )
+        {
+            DWORD dwVertex = pSource->pIndices[f * 3 + k];
+            for( DWORD i = 0; i < pNumInfluences[dwVertex]; ++i )
+            {
+                DWORD dwBone = pInfluenceBones[dwVertex * BAKED_MAX_INFLUENCES + i];
+                DWORD j = 0;
+                while( j < dwNumFaceBones && pBones[j] != dwBone )
+                    ++j;
+                if( j < dwNumFaceBones )
+                    continue;
+                if( dwNumFaceBones == BAKED_MAX_INFLUENCES )
+                {
+                    free( pScratch );
+                    return E_FAIL;
+                }
+                pBones[dwNumFaceBones++] = dwBone;
+            }
+        }
+        pFaceNumBones[f] = (BYTE)dwNumFaceBones;
+        if( dwNumFaceBones > dwMaxFaceInfluences )
+            dwMaxFaceInfluences = dwNumFaceBones;
+    }
+
+    // Gather faces into combinations.  Each one starts with the first face that hasn't been
+    // placed yet, then takes every later face with the same material whose bones still fit.
+    memset( pFaceCombination, 0xFF, sizeof(DWORD) * dwNumFaces );
+    DWORD dwNumCombinations = 0;
+    DWORD dwNumPlaced = 0;
+    for( DWORD dwMaterial = 0; dwMaterial < dwNumMaterials; ++dwMaterial )
+    {
+        for( DWORD dwFirst = 0; dwFirst < dwNumFaces; ++dwFirst )
+        {
+            DWORD dwAttribute = pSource->pAttributes ? pSource->pAttributes[dwFirst] : 0;
+            if( pFaceCombination[dwFirst] != BAKED_NONE || dwAttribute != dwMaterial )
+                continue;
+
+            BakedBoneCombination * pCombination = &pCombinations[dwNumCombinations];
+            DWORD * pBones = &pBoneIds[dwNumCombinations * dwMaxFaceInfluences];
+            DWORD dwNumUsed = 0;
+            pCombination->dwAttribId = dwMaterial;
+            pCombination->dwFaceStart = dwNumPlaced;
+            pCombination->dwFirstBoneId = dwNumCombinations * dwMaxFaceInfluences;
+            for( DWORD f = dwFirst; f < dwNumFaces; ++f )
+            {
+                dwAttribute = pSource->pAttributes ? pSource->pAttributes[f] : 0;
+                if( pFaceCombination[f] != BAKED_NONE || dwAttribute != dwMaterial )
+                    continue;
+
+                DWORD dwNewBones[BAKED_MAX_INFLUENCES];
+                DWORD dwNumNew = 0;
+                for( DWORD i = 0; i < pFaceNumBones[f]; ++i )
+                {
+                    DWORD dwBone = pFaceBones[f * BAKED_MAX_INFLUENCES + i];
+                    DWORD j = 0;
+                    while( j < dwNumUsed && pBones[j] != dwBone )
+                        ++j;
+                    if( j == dwNumUsed )
+                        dwNewBones[dwNumNew++] = dwBone;
+                }
+                if( dwNumUsed + dwNumNew > dwMaxFaceInfluences )
+                    continue;
+
+                for( DWORD i = 0; i < dwNumNew; ++i )
+                    pBones[dwNumUsed++] = dwNewBones[i];
+                pFaceCombination[f] = dwNumCombinations;
+                pFaceOrder[dwNumPlaced++] = f;
+            }
+            while( dwNumUsed < dwMaxFaceInfluences )
+                pBones[dwNumUsed++] = BAKED_NONE;
+            pCombination->dwFaceCount = dwNumPlaced - pCombination->dwFaceStart;
+            ++dwNumCombinations;
+        }
+    }
+
+    // Each combination gets its own copy of the vertices it uses, since a vertex's weights are
+    // stored in the order of the combination's bones
+    memset( pVertexCombination, 0xFF, sizeof(DWORD) * dwNumVertices );
+    DWORD dwNumNewVertices = 0;
+    for( DWORD c = 0; c < dwNumCombinations; ++c )
+    {
+        BakedBoneCombination * pCombination = &pCombinations[c];
+        pCombination->dwVertexStart = dwNumNewVertices;
+        for( DWORD i = pCombination->dwFaceStart; i < pCombination->dwFaceStart + pCombination->dwFaceCount; ++i )
+        {
+            for( DWORD k = 0; k < 3; ++k )
+            {
+                DWORD dwVertex = pSource->pIndices[pFaceOrder[i] * 3 + k];
+                if( pVertexCombination[dwVertex] != c )
+                {
+                    pVertexCombination[dwVertex] = c;
+                    pVertexMap[dwVertex] = dwNumNewVertices;
+                    pNewVertices[dwNumNewVertices++] = dwVertex;
+                }
+                pNewIndices[i * 3 + k] = pVertexMap[dwVertex];
+            }
+        }
+        pCombination->dwVertexCount = dwNumNewVertices - pCombination->dwVertexStart;
+    }
+
+    // Make up normals if the file didn't have any, weighting each face by its area
+    const FLOAT * pNormals = pSource->pNormals;
+    if( !pNormals )
+    {
+        ZeroMemory( pComputedNormals, sizeof(FLOAT) * 3 * dwNumVertices );
+        for( DWORD f = 0; f < dwNumFaces; ++f )
+        {
+            const DWORD * pFace = &pSource->pIndices[f * 3];
+            const FLOAT * p0 = &pSource->pPositions[pFace[0] * 3];
+            const FLOAT * p1 = &pSource->pPositions[pFace[1] * 3];
+            const FLOAT * p2 = &pSource->pPositions[pFace[2] * 3];
+            FLOAT e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            FLOAT e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            FLOAT n[3] = { e1[1] * e2[2] - e1[2] * e2[1],
+                           e1[2] * e2[0] - e1[0] * e2[2],
+                           e1[0] * e2[1] - e1[1] * e2[0] };
+            for( DWORD k = 0; k < 3; ++k )
+            {
+                FLOAT * pNormal = &pComputedNormals[pFace[k] * 3];
+                pNormal[0] += n[0];
+                pNormal[1] += n[1];
+                pNormal[2] += n[2];
+            }
+        }
+        for( DWORD v = 0; v < dwNumVertices; ++v )
+        {
+            FLOAT * pNormal = &pComputedNormals[v * 3];
+            FLOAT fLength = sqrtf( pNormal[0] * pNormal[0] + pNormal[1] * pNormal[1] + pNormal[2] * pNormal[2] );
+            if( fLength > 0.0f )
+            {
+                pNormal[0] /= fLength;
+                pNormal[1] /= fLength;
+                pNormal[2] /= fLength;
+            }
+        }
+        pNormals = pComputedNormals;
+    }
+
+    // Make room for the mesh
+    DWORD dwNumWeights = dwMaxFaceInfluences - 1;
+    DWORD dwVertexSize = sizeof(FLOAT) * (3 + dwNumWeights + 3 + 2);
+    DWORD dwIndexSize = dwNumNewVertices > 0xFFFF ? sizeof(DWORD) : sizeof(WORD);
+    BakedArray name, vertices, indices, materials, bones, combinations, boneIds;
+    if( !AddString( &pSource->Name, &name ) ||
+        !ReserveArray( dwNumNewVertices, dwVertexSize, &vertices ) ||
+        !ReserveArray( dwNumFaces * 3, dwIndexSize, &indices ) ||
+        !ReserveArray( dwNumMaterials, sizeof(BakedMaterial), &materials ) ||
+        !ReserveArray( dwNumBones, sizeof(BakedBone), &bones ) ||
+        !ReserveArray( dwNumCombinations, sizeof(BakedBoneCombination), &combinations ) ||
+        !ReserveArray( dwNumCombinations * dwMaxFaceInfluences, sizeof(DWORD), &boneIds ) )
+    {
+        free( pScratch );
+        return E_OUTOFMEMORY;
+    }
+
+    // Materials.  Meshes without any get the plain grey one CreateMeshContainer used to make.
+    for( DWORD m = 0; m < dwNumMaterials; ++m )
+    {
+        const XMaterial * pSourceMaterial = m < pSource->dwNumMaterials ? &pSource->pMaterials[m] : NULL;
+        XString noTexture = { NULL, 0 };
+        BakedArray texture;
+        if( !AddString( pSourceMaterial ? &pSourceMaterial->TextureFilename : &noTexture, &texture ) )
+        {
+            free( pScratch );
+            return E_OUTOFMEMORY;
+        }
+        BakedMaterial * pMaterial = (BakedMaterial*)At( materials.dwOffset ) + m;
+        if( pSourceMaterial )
+        {
+            memcpy( pMaterial->fDiffuse, pSourceMaterial->fDiffuse, sizeof(FLOAT) * 4 );
+            memcpy( pMaterial->fSpecular, pSourceMaterial->fSpecular, sizeof(FLOAT) * 3 );
+            memcpy( pMaterial->fEmissive, pSourceMaterial->fEmissive, sizeof(FLOAT) * 3 );
+            pMaterial->fSpecular[3] = 1.0f;
+            pMaterial->fEmissive[3] = 1.0f;
+            pMaterial->fPower = pSourceMaterial->fPower;
+        }
+        else
+        {
+            pMaterial->fDiffuse[0] = pMaterial->fDiffuse[1] = pMaterial->fDiffuse[2] = 0.5f;
+            memcpy( pMaterial->fSpecular, pMaterial->fDiffuse, sizeof(FLOAT) * 4 );
+        }
+        pMaterial->TextureFilename = texture;
+    }
+
+    // Bones point at the frames they're named after
+    BakedBone * pBones = (BakedBone*)At( bones.dwOffset );
+    for( DWORD b = 0; b < dwNumBones; ++b )
+    {
+        CHAR strName[MAX_NAME_LENGTH];
+        XStringCopy( &pSource->pBones[b].BoneName, strName, sizeof(strName) );
+        pBones[b].dwFrame = pFile->FindFrame( strName );
+        if( pBones[b].dwFrame == XFILE_NONE )
+        {
+            free( pScratch );
+            return E_FAIL;
+        }
+        memcpy( pBones[b].fOffset, pSource->pBones[b].fOffset, sizeof(pBones[b].fOffset) );
+    }
+
+    // Vertices:  position, the weights of the combination's bones, normal, texture coordinate
+    BYTE * pVertices = At( vertices.dwOffset );
+    for( DWORD c = 0; c < dwNumCombinations; ++c )
+    {
+        const BakedBoneCombination * pCombination = &pCombinations[c];
+        const DWORD * pSlots = &pBoneIds[pCombination->dwFirstBoneId];
+        for( DWORD n = pCombination->dwVertexStart; n < pCombination->dwVertexStart + pCombination->dwVertexCount; ++n )
+        {
+            DWORD dwVertex = pNewVertices[n];
+            FLOAT * pVertex = (FLOAT*)(pVertices + n * dwVertexSize);
+            memcpy( pVertex, &pSource->pPositions[dwVertex * 3], sizeof(FLOAT) * 3 );
+            for( DWORD i = 0; i < pNumInfluences[dwVertex]; ++i )
+            {
+                DWORD dwBone = pInfluenceBones[dwVertex * BAKED_MAX_INFLUENCES + i];
+                for( DWORD s = 0; s < dwNumWeights; ++s )
+                {
+                    if( pSlots[s] == dwBone )
+                        pVertex[3 + s] = pInfluenceWeights[dwVertex * BAKED_MAX_INFLUENCES + i];
+                }
+            }
+            memcpy( &pVertex[3 + dwNumWeights], &pNormals[dwVertex * 3], sizeof(FLOAT) * 3 );
+            if( pSource->pTexCoords )
+                memcpy( &pVertex[6 + dwNumWeights], &pSource->pTexCoords[dwVertex * 2], sizeof(FLOAT) * 2 );
+        }
+    }
+
+    // Indices, in combination order
+    BYTE * pIndices = At( indices.dwOffset );
+    for( DWORD i = 0; i < dwNumFaces * 3; ++i )
+    {
+        if( dwIndexSize == sizeof(WORD) )
+            ((WORD*)pIndices)[i] = (WORD)pNewIndices[i];
+        else
+            ((DWORD*)pIndices)[i] = pNewIndices[i];
+    }
+
+    memcpy( At( combinations.dwOffset ), pCombinations, sizeof(BakedBoneCombination) * dwNumCombinations );
+    memcpy( At( boneIds.dwOffset ), pBoneIds, sizeof(DWORD) * dwNumCombinations * dwMaxFaceInfluences );
+    free( pScratch );
+
+    BakedMesh * pMesh = (BakedMesh*)At( dwOffset );
+    pMesh->Name = name;
+    pMesh->dwFrame = pSource->dwFrame == XFILE_NONE ? BAKED_NONE : pSource->dwFrame;
+    pMesh->dwNumWeights = dwNumWeights;
+    pMesh->dwVertexSize = dwVertexSize;
+    pMesh->dwIndexSize = dwIndexSize;
+    pMesh->dwMaxFaceInfluences = dwMaxFaceInfluences;
+    pMesh->Vertices = vertices;
+    pMesh->Indices = indices;
+    pMesh->Materials = materials;
+    pMesh->Bones = bones;
+    pMesh->BoneCombinations = combinations;
+    pMesh->BoneIds = boneIds;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  BakeAnimationSet
+// Desc:  Converts a set's keys into D3DX's layout and conventions, and writes it into the
+//        BakedAnimationSet at dwOffset.  Matrix keys are split into scale, rotation and
+//        translation.  Animations of frames that don't exist are dropped.
+//------------------------------------------------------------------------------------------------
+HRESULT AssetBaker::BakeAnimationSet( const XFile * pFile, const XAnimationSet * pSource, DWORD dwOffset )
+{
+    DWORD dwNumAnimations = 0;
+    for( DWORD i = 0; i < pSource->dwNumAnimations; ++i )
+    {
+        if( pSource->pAnimations[i].dwFrame != XFILE_NONE )
+            ++dwNumAnimations;
+    }
+
+    BakedArray name, animations;
+    if( !AddString( &pSource->Name, &name ) ||
+        !ReserveArray( dwNumAnimations, sizeof(BakedAnimation), &animations ) )
+        return E_OUTOFMEMORY;
+
+    for( DWORD i = 0, dwAnimation = 0; i < pSource->dwNumAnimations; ++i )
+    {
+        const XAnimation * pSourceAnimation = &pSource->pAnimations[i];
+        if( pSourceAnimation->dwFrame == XFILE_NONE )
+            continue;
+
+        const XAnimationKeys * pScales = &pSourceAnimation->Keys[XKEY_SCALE];
+        const XAnimationKeys * pRotations = &pSourceAnimation->Keys[XKEY_ROTATION];
+        const XAnimationKeys * pPositions = &pSourceAnimation->Keys[XKEY_POSITION];
+        const XAnimationKeys * pMatrices = &pSourceAnimation->Keys[XKEY_MATRIX];
+        if( pMatrices->dwNumKeys > 0 )
+            pScales = pRotations = pPositions = pMatrices;
+
+        BakedArray scaleKeys, rotationKeys, translationKeys;
+        if( !ReserveArray( pScales->dwNumKeys, sizeof(BakedVectorKey), &scaleKeys ) ||
+            !ReserveArray( pRotations->dwNumKeys, sizeof(BakedQuaternionKey), &rotationKeys ) ||
+            !ReserveArray( pPositions->dwNumKeys, sizeof(BakedVectorKey), &translationKeys ) )
+            return E_OUTOFMEMORY;
+
+        BakedVectorKey * pScaleKeys = (BakedVectorKey*)At( scaleKeys.dwOffset );
+        BakedQuaternionKey * pRotationKeys = (BakedQuaternionKey*)At( rotationKeys.dwOffset );
+        BakedVectorKey * pTranslationKeys = (BakedVectorKey*)At( translationKeys.dwOffset );
+        if( pMatrices->dwNumKeys > 0 )
+        {
+            for( DWORD k = 0; k < pMatrices->dwNumKeys; ++k )
+            {
+                pScaleKeys[k].fTime = pRotationKeys[k].fTime = pTranslationKeys[k].fTime = (FLOAT)pMatrices->pTimes[k];
+                DecomposeMatrix( &pMatrices->pValues[k * 16], pScaleKeys[k].fValue,
+                                 pRotationKeys[k].fValue, pTranslationKeys[k].fValue );
+            }
+        }
+        else
+        {
+            for( DWORD k = 0; k < pScales->dwNumKeys; ++k )
+            {
+                pScaleKeys[k].fTime = (FLOAT)pScales->pTimes[k];
+                memcpy( pScaleKeys[k].fValue, &pScales->pValues[k * 3], sizeof(FLOAT) * 3 );
+            }
+
+            // The file stores w first, and the conjugate of what D3DX uses
+            for( DWORD k = 0; k < pRotations->dwNumKeys; ++k )
+            {
+                const FLOAT * pValue = &pRotations->pValues[k * 4];
+                pRotationKeys[k].fTime = (FLOAT)pRotations->pTimes[k];
+                pRotationKeys[k].fValue[0] = -pValue[1];
+                pRotationKeys[k].fValue[1] = -pValue[2];
+                pRotationKeys[k].fValue[2] = -pValue[3];
+                pRotationKeys[k].fValue[3] = pValue[0];
+            }
+
+            for( DWORD k = 0; k < pPositions->dwNumKeys; ++k )
+            {
+                pTranslationKeys[k].fTime = (FLOAT)pPositions->pTimes[k];
+                memcpy( pTranslationKeys[k].fValue, &pPositions->pValues[k * 3], sizeof(FLOAT) * 3 );
+            }
+        }
+
+        BakedAnimation * pAnimation = (BakedAnimation*)At( animations.dwOffset ) + dwAnimation++;
+        pAnimation->dwFrame = pSourceAnimation->dwFrame;
+        pAnimation->ScaleKeys = scaleKeys;
+        pAnimation->RotationKeys = rotationKeys;
+        pAnimation->TranslationKeys = translationKeys;
+    }
+
+    BakedAnimationSet * pSet = (BakedAnimationSet*)At( dwOffset );
+    pSet->Name = name;
+    pSet->dwTicksPerSecond = pFile->GetTicksPerSecond();
+    pSet->dwLength = pSource->dwLength;
+    pSet->Animations = animations;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Reserve
+// Desc:  Adds zeroed space to the end of the file.  Anything returned by At before this is
+//        called may have moved.
+//------------------------------------------------------------------------------------------------
+BOOL AssetBaker::Reserve( DWORD dwSize, DWORD dwAlignment, DWORD * pdwOffset )
+{
+    DWORD dwOffset = (m_dwSize + dwAlignment - 1) & ~(dwAlignment - 1);
+    if( dwOffset > MAX_BAKED_SIZE || dwSize > MAX_BAKED_SIZE - dwOffset )
+        return FALSE;
+    DWORD dwEnd = dwOffset + dwSize;
+
+    if( dwEnd > m_dwCapacity )
+    {
+        DWORD dwCapacity = m_dwCapacity > 0 ? m_dwCapacity : INITIAL_CAPACITY;
+        while( dwCapacity < dwEnd )
+            dwCapacity *= 2;
+        BYTE * pBuffer = AllocateBuffer( dwCapacity );
+        if( !pBuffer )
+            return FALSE;
+        if( m_pBuffer )
+            memcpy( pBuffer, m_pBuffer, m_dwSize );
+        FreeBuffer( m_pBuffer );
+        m_pBuffer = pBuffer;
+        m_dwCapacity = dwCapacity;
+    }
+
+    memset( m_pBuffer + m_dwSize, 0, dwEnd - m_dwSize );
+    m_dwSize = dwEnd;
+    *pdwOffset = dwOffset;
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ReserveArray
+// Desc:  Adds zeroed, aligned space for an array to the end of the file
+//------------------------------------------------------------------------------------------------
+BOOL AssetBaker::ReserveArray( DWORD dwCount, DWORD dwElementSize, BakedArray * pArray )
+{
+    if( (QWORD)dwCount * dwElementSize > MAX_BAKED_SIZE ||
+        !Reserve( dwCount * dwElementSize, BAKED_ASSET_ALIGNMENT, &pArray->dwOffset ) )
+        return FALSE;
+    pArray->dwCount = dwCount;
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  AddString
+// Desc:  Copies text from the source file onto the end of the file, with a terminator
+//------------------------------------------------------------------------------------------------
+BOOL AssetBaker::AddString( const XString * pString, BakedArray * pArray )
+{
+    if( !Reserve( pString->dwLength + 1, 1, &pArray->dwOffset ) )
+        return FALSE;
+    if( pString->dwLength > 0 )
+        memcpy( At( pArray->dwOffset ), pString->pText, pString->dwLength );
+    pArray->dwCount = pString->dwLength;
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  At
+// Desc:  
+//------------------------------------------------------------------------------------------------
+BYTE * AssetBaker::At( DWORD dwOffset )
+{
+    return m_pBuffer + dwOffset;
+}
@@ -0,0 +1,107 @@
+//------------------------------------------------------------------------------------------------
+// File:    assetbaker.h
+//
+// Desc:    Turns a text X file into the baked form that the client maps
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __ASSETBAKER_H__
+#define __ASSETBAKER_H__
+
+// Include files required to compile this header
+#include "bakedasset.h"
+
+class XFile;
+struct XMesh;
+struct XAnimationSet;
+struct XString;
+
+
+/**
+ * Builds a baked file in memory from what XFile read.  Skinned meshes are split into runs of
+ * faces that use at most four bones each, with the weights of every vertex put in the order of
+ * its run's bones, the way ID3DXSkinInfo::ConvertToBlendedMesh does it; meshes without skin
+ * weights aren't drawn by the client, so they're left out.  Nothing here needs Direct3D, so
+ * files can be baked on any platform.
+ *   @author Karl Gluck
+ */
+class AssetBaker
+{
+    public:
+
+        AssetBaker();
+        ~AssetBaker();
+
+        /**
+         * Bakes a file
+         *   @param pFile The file, already loaded
+         *   @param qwSourceHash BakedAsset::Hash of the file's contents
+         *   @return E_FAIL if a face is touched by more than BAKED_MAX_INFLUENCES bones or a
+         *           bone isn't a frame, or E_OUTOFMEMORY
+         */
+        HRESULT Bake( const XFile * pFile, QWORD qwSourceHash );
+
+        /**
+         * Saves what was baked.  Nothing is left behind if this fails.
+         *   @param strFile Destination file
+         *   @return Result code
+         */
+        HRESULT Write( const CHAR * strFile ) const;
+
+        /**
+         * Hands over what was baked.  It has to be freed with FreeBuffer.
+         *   @param pdwSize Returns how many bytes there are
+         *   @return The baked data, aligned to BAKED_ASSET_ALIGNMENT
+         */
+        BYTE * Detach( DWORD * pdwSize );
+
+        VOID Release();
+
+        /**
+         * Frees memory returned by Detach
+         *   @param pBuffer Memory to free; may be NULL
+         */
+        static VOID FreeBuffer( BYTE * pBuffer );
+
+    protected:
+
+        HRESULT BakeMesh( const XFile * pFile, const XMesh * pSource, DWORD dwMesh );
+        HRESULT BakeAnimationSet( const XFile * pFile, const XAnimationSet * pSource, DWORD dwSet );
+        BOOL Reserve( DWORD dwSize, DWORD dwAlignment, DWORD * pdwOffset );
+        BOOL ReserveArray( DWORD dwCount, DWORD dwElementSize, BakedArray * pArray );
+        BOOL AddString( const XString * pString, BakedArray * pArray );
+        BYTE * At( DWORD dwOffset );
+
+    protected:
+
+        BYTE * m_pBuffer;
+        DWORD m_dwSize;
+        DWORD m_dwCapacity;
+};
+
+
+#endif // __ASSETBAKER_H__
@@ -0,0 +1,528 @@
+//------------------------------------------------------------------------------------------------
+// File:    bakedasset.cpp
+//
+// Desc:    Binary form of an animated mesh that can be used straight out of a mapped file
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "bakedasset.h"
+#include "assetbaker.h"
+#include "xfile.h"
+
+// Mixes the source file into its hash eight bytes at a time (the 64-bit FNV prime)
+#define HASH_PRIME              0x00000100000001B3ULL
+#define HASH_BASIS              0xCBF29CE484222325ULL
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  BakedAsset
+// Desc:  
+//------------------------------------------------------------------------------------------------
+BakedAsset::BakedAsset()
+{
+    m_pBuffer = NULL;
+    m_pData = NULL;
+    m_dwSize = 0;
+    m_pHeader = NULL;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~BakedAsset
+// Desc:  
+//------------------------------------------------------------------------------------------------
+BakedAsset::~BakedAsset()
+{
+    Release();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Load
+// Desc:  Maps a baked file and makes sure it can be used, and that it's up to date if the
+//        source file is given
+//------------------------------------------------------------------------------------------------
+HRESULT BakedAsset::Load( const CHAR * strFile, const CHAR * strSourceFile )
+{
+    Release();
+
+    if( !m_File.Open( strFile ) )
+        return E_FAIL;
+    m_pData = m_File.GetData();
+    m_dwSize = m_File.GetSize();
+    HRESULT hr = Validate();
+    if( FAILED( hr ) )
+    {
+        Release();
+        return hr;
+    }
+
+    // Compare against what the source file holds now
+    if( strSourceFile )
+    {
+        MappedFile source;
+        if( !source.Open( strSourceFile ) ||
+            source.GetSize() != m_pHeader->dwSourceSize ||
+            Hash( source.GetData(), source.GetSize() ) != m_pHeader->qwSourceHash )
+        {
+            Release();
+            return E_FAIL;
+        }
+    }
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  LoadOrBake
+// Desc:  Uses the baked file if it's current, and otherwise bakes the source file again
+//------------------------------------------------------------------------------------------------
+HRESULT BakedAsset::LoadOrBake( const CHAR * strSourceFile, const CHAR * strFile, DWORD dwThreads )
+{
+    // Without the source, whatever was baked last is all there is
+    QWORD qwHash;
+    DWORD dwSourceSize;
+    {
+        MappedFile source;
+        if( !source.Open( strSourceFile ) )
+            return Load( strFile, NULL );
+        qwHash = Hash( source.GetData(), source.GetSize() );
+        dwSourceSize = source.GetSize();
+    }
+
+    // Use the baked file if it was made from exactly this source
+    if( SUCCEEDED( Load( strFile, NULL ) ) )
+    {
+        if( m_pHeader->qwSourceHash == qwHash && m_pHeader->dwSourceSize == dwSourceSize )
+            return S_OK;
+        Release();
+    }
+
+    XFile file;
+    HRESULT hr = file.Load( strSourceFile, dwThreads );
+    if( FAILED( hr ) )
+        return hr;
+    AssetBaker baker;
+    hr = baker.Bake( &file, qwHash );
+    file.Release();
+    if( FAILED( hr ) )
+        return hr;
+
+    // Map what was written, so the memory can be shared with the file cache.  If it couldn't
+    // be written, keep using the copy that was just baked.
+    if( SUCCEEDED( baker.Write( strFile ) ) && SUCCEEDED( Load( strFile, NULL ) ) )
+        return S_OK;
+    m_pBuffer = baker.Detach( &m_dwSize );
+    m_pData = m_pBuffer;
+    hr = Validate();
+    if( FAILED( hr ) )
+        Release();
+    return hr;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Release
+// Desc:  
+//------------------------------------------------------------------------------------------------
+VOID BakedAsset::Release()
+{
+    m_File.Close();
+    AssetBaker::FreeBuffer( m_pBuffer );
+    m_pBuffer = NULL;
+    m_pData = NULL;
+    m_dwSize = 0;
+    m_pHeader = NULL;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetSize
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DWORD BakedAsset::GetSize() const
+{
+    return m_dwSize;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetNumFrames
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DWORD BakedAsset::GetNumFrames() const
+{
+    return m_pHeader ? m_pHeader->Frames.dwCount : 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetFrame
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const BakedFrame * BakedAsset::GetFrame( DWORD dwIndex ) const
+{
+    return (const BakedFrame*)(m_pData + m_pHeader->Frames.dwOffset) + dwIndex;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetNumMeshes
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DWORD BakedAsset::GetNumMeshes() const
+{
+    return m_pHeader ? m_pHeader->Meshes.dwCount : 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetMesh
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const BakedMesh * BakedAsset::GetMesh( DWORD dwIndex ) const
+{
+    return (const BakedMesh*)(m_pData + m_pHeader->Meshes.dwOffset) + dwIndex;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetNumAnimationSets
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DWORD BakedAsset::GetNumAnimationSets() const
+{
+    return m_pHeader ? m_pHeader->AnimationSets.dwCount : 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetAnimationSet
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const BakedAnimationSet * BakedAsset::GetAnimationSet( DWORD dwIndex ) const
+{
+    return (const BakedAnimationSet*)(m_pData + m_pHeader->AnimationSets.dwOffset) + dwIndex;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetString
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const CHAR * BakedAsset::GetString( const BakedArray * pString ) const
+{
+    return (const CHAR*)(m_pData + pString->dwOffset);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetVertices
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const BYTE * BakedAsset::GetVertices( const BakedMesh * pMesh ) const
+{
+    return m_pData + pMesh->Vertices.dwOffset;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetIndices
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const BYTE * BakedAsset::GetIndices( const BakedMesh * pMesh ) const
+{
+    return m_pData + pMesh->Indices.dwOffset;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetMaterials
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const BakedMaterial * BakedAsset::GetMaterials( const BakedMesh * pMesh ) const
+{
+    return (const BakedMaterial*)(m_pData + pMesh->Materials.dwOffset);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetBones
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const BakedBone * BakedAsset::GetBones( const BakedMesh * pMesh ) const
+{
+    return (const BakedBone*)(m_pData + pMesh->Bones.dwOffset);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetBoneCombinations
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const BakedBoneCombination * BakedAsset::GetBoneCombinations( const BakedMesh * pMesh ) const
+{
+    return (const BakedBoneCombination*)(m_pData + pMesh->BoneCombinations.dwOffset);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetBoneIds
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const DWORD * BakedAsset::GetBoneIds( const BakedMesh * pMesh ) const
+{
+    return (const DWORD*)(m_pData + pMesh->BoneIds.dwOffset);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetAnimations
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const BakedAnimation * BakedAsset::GetAnimations( const BakedAnimationSet * pSet ) const
+{
+    return (const BakedAnimation*)(m_pData + pSet->Animations.dwOffset);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetScaleKeys
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const BakedVectorKey * BakedAsset::GetScaleKeys( const BakedAnimation * pAnimation ) const
+{
+    return (const BakedVectorKey*)(m_pData + pAnimation->ScaleKeys.dwOffset);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetRotationKeys
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const BakedQuaternionKey * BakedAsset::GetRotationKeys( const BakedAnimation * pAnimation ) const
+{
+    return (const BakedQuaternionKey*)(m_pData + pAnimation->RotationKeys.dwOffset);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetTranslationKeys
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const BakedVectorKey * BakedAsset::GetTranslationKeys( const BakedAnimation * pAnimation ) const
+{
+    return (const BakedVectorKey*)(m_pData + pAnimation->TranslationKeys.dwOffset);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Hash
+// Desc:  FNV-1a over 64-bit words instead of bytes, which is fast enough to run over the source
+//        file on every load.  Any one changed word always changes the result.
+//------------------------------------------------------------------------------------------------
+QWORD BakedAsset::Hash( const BYTE * pData, DWORD dwSize )
+{
+    QWORD qwHash = HASH_BASIS ^ dwSize;
+    DWORD dwWords = dwSize / 8;
+    for( DWORD i = 0; i < dwWords; ++i )
+    {
+        QWORD qwWord;
+        memcpy( &qwWord, pData + i * 8, 8 );
+        qwHash = (qwHash ^ qwWord) * HASH_PRIME;
+    }
+    for( DWORD i = dwWords * 8; i < dwSize; ++i )
+        qwHash = (qwHash ^ pData[i]) * HASH_PRIME;
+    return qwHash;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Validate
+// Desc:  Checks the header and everything it leads to
+//------------------------------------------------------------------------------------------------
+HRESULT BakedAsset::Validate()
+{
+    if( m_dwSize < sizeof(BakedHeader) || ((DWORD_PTR)m_pData % BAKED_ASSET_ALIGNMENT) != 0 )
+        return E_FAIL;
+    const BakedHeader * pHeader = (const BakedHeader*)m_pData;
+    if( pHeader->dwMagic != BAKED_ASSET_MAGIC || pHeader->dwVersion != BAKED_ASSET_VERSION ||
+        pHeader->dwSize != m_dwSize ||
+        !CheckArray( &pHeader->Frames, sizeof(BakedFrame), BAKED_ASSET_ALIGNMENT ) ||
+        !CheckArray( &pHeader->Meshes, sizeof(BakedMesh), BAKED_ASSET_ALIGNMENT ) ||
+        !CheckArray( &pHeader->AnimationSets, sizeof(BakedAnimationSet), BAKED_ASSET_ALIGNMENT ) )
+        return E_FAIL;
+    m_pHeader = pHeader;
+
+    // Parents have to come first, so that world matrices can be built in order
+    for( DWORD i = 0; i < GetNumFrames(); ++i )
+    {
+        const BakedFrame * pFrame = GetFrame( i );
+        if( !CheckString( &pFrame->Name ) || (pFrame->dwParent != BAKED_NONE && pFrame->dwParent >= i) )
+            return E_FAIL;
+    }
+
+    for( DWORD i = 0; i < GetNumMeshes(); ++i )
+    {
+        if( !CheckMesh( GetMesh( i ) ) )
+            return E_FAIL;
+    }
+
+    for( DWORD i = 0; i < GetNumAnimationSets(); ++i )
+    {
+        if( !CheckAnimationSet( GetAnimationSet( i ) ) )
+            return E_FAIL;
+    }
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CheckArray
+// Desc:  Makes sure an array is aligned and inside the file
+//------------------------------------------------------------------------------------------------
+BOOL BakedAsset::CheckArray( const BakedArray * pArray, DWORD dwElementSize, DWORD dwAlignment ) const
+{
+    return pArray->dwOffset % dwAlignment == 0 &&
+           pArray->dwOffset <= m_dwSize &&
+           (QWORD)pArray->dwCount * dwElementSize <= m_dwSize - pArray->dwOffset;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CheckString
+// Desc:  Makes sure a string is inside the file and terminated
+//------------------------------------------------------------------------------------------------
+BOOL BakedAsset::CheckString( const BakedArray * pString ) const
+{
+    return pString->dwOffset < m_dwSize &&
+           pString->dwCount < m_dwSize - pString->dwOffset &&
+           m_pData[pString->dwOffset + pString->dwCount] == '\0';
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CheckMesh
+// Desc:  Makes sure a mesh's buffers, bones and combinations all refer to things that exist
+//------------------------------------------------------------------------------------------------
+BOOL BakedAsset::CheckMesh( const BakedMesh * pMesh ) const
+{
+    DWORD dwNumVertices = pMesh->Vertices.dwCount;
+    DWORD dwNumFaces = pMesh->Indices.dwCount / 3;
+    if( !CheckString( &pMesh->Name ) ||
+        (pMesh->dwFrame != BAKED_NONE && pMesh->dwFrame >= GetNumFrames()) ||
+        pMesh->dwMaxFaceInfluences < 1 || pMesh->dwMaxFaceInfluences > BAKED_MAX_INFLUENCES ||
+        pMesh->dwNumWeights + 1 < pMesh->dwMaxFaceInfluences ||
+        pMesh->dwNumWeights >= BAKED_MAX_INFLUENCES ||
+        pMesh->dwVertexSize != sizeof(FLOAT) * (3 + pMesh->dwNumWeights + 3 + 2) ||
+        (pMesh->dwIndexSize != 2 && pMesh->dwIndexSize != 4) ||
+        pMesh->Indices.dwCount % 3 != 0 ||
+        pMesh->Materials.dwCount == 0 ||
+        pMesh->BoneIds.dwCount != pMesh->BoneCombinations.dwCount * pMesh->dwMaxFaceInfluences ||
+        !CheckArray( &pMesh->Vertices, pMesh->dwVertexSize, BAKED_ASSET_ALIGNMENT ) ||
+        !CheckArray( &pMesh->Indices, pMesh->dwIndexSize, BAKED_ASSET_ALIGNMENT ) ||
+        !CheckArray( &pMesh->Materials, sizeof(BakedMaterial), BAKED_ASSET_ALIGNMENT ) ||
+        !CheckArray( &pMesh->Bones, sizeof(BakedBone), BAKED_ASSET_ALIGNMENT ) ||
+        !CheckArray( &pMesh->BoneCombinations, sizeof(BakedBoneCombination), BAKED_ASSET_ALIGNMENT ) ||
+        !CheckArray( &pMesh->BoneIds, sizeof(DWORD), BAKED_ASSET_ALIGNMENT ) )
+        return FALSE;
+
+    // Indices
+    const BYTE * pIndices = GetIndices( pMesh );
+    for( DWORD i = 0; i < pMesh->Indices.dwCount; ++i )
+    {
+        DWORD dwIndex = pMesh->dwIndexSize == 2 ? ((const WORD*)pIndices)[i] : ((const DWORD*)pIndices)[i];
+        if( dwIndex >= dwNumVertices )
+            return FALSE;
+    }
+
+    // Materials
+    const BakedMaterial * pMaterials = GetMaterials( pMesh );
+    for( DWORD i = 0; i < pMesh->Materials.dwCount; ++i )
+    {
+        if( !CheckString( &pMaterials[i].TextureFilename ) )
+            return FALSE;
+    }
+
+    // Bones
+    const BakedBone * pBones = GetBones( pMesh );
+    for( DWORD i = 0; i < pMesh->Bones.dwCount; ++i )
+    {
+        if( pBones[i].dwFrame >= GetNumFrames() )
+            return FALSE;
+    }
+
+    // Combinations have to cover faces and vertices that exist, and use bones that exist
+    const BakedBoneCombination * pCombinations = GetBoneCombinations( pMesh );
+    const DWORD * pBoneIds = GetBoneIds( pMesh );
+    for( DWORD i = 0; i < pMesh->BoneCombinations.dwCount; ++i )
+    {
+        const BakedBoneCombination * pCombination = &pCombinations[i];
+        if( pCombination->dwAttribId >= pMesh->Materials.dwCount ||
+            (QWORD)pCombination->dwFaceStart + pCombination->dwFaceCount > dwNumFaces ||
+            (QWORD)pCombination->dwVertexStart + pCombination->dwVertexCount > dwNumVertices ||
+            pCombination->dwFirstBoneId != i * pMesh->dwMaxFaceInfluences )
+            return FALSE;
+        for( DWORD j = 0; j < pMesh->dwMaxFaceInfluences; ++j )
+        {
+            DWORD dwBone = pBoneIds[pCombination->dwFirstBoneId + j];
+            if( dwBone != BAKED_NONE && dwBone >= pMesh->Bones.dwCount )
+                return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CheckAnimationSet
+// Desc:  Makes sure a set's keys are in the file and move frames that exist
+//------------------------------------------------------------------------------------------------
+BOOL BakedAsset::CheckAnimationSet( const BakedAnimationSet * pSet ) const
+{
+    if( !CheckString( &pSet->Name ) || pSet->dwTicksPerSecond == 0 ||
+        !CheckArray( &pSet->Animations, sizeof(BakedAnimation), BAKED_ASSET_ALIGNMENT ) )
+        return FALSE;
+
+    const BakedAnimation * pAnimations = GetAnimations( pSet );
+    for( DWORD i = 0; i < pSet->Animations.dwCount; ++i )
+    {
+        const BakedAnimation * pAnimation = &pAnimations[i];
+        if( pAnimation->dwFrame >= GetNumFrames() ||
+            !CheckArray( &pAnimation->ScaleKeys, sizeof(BakedVectorKey), BAKED_ASSET_ALIGNMENT ) ||
+            !CheckArray( &pAnimation->RotationKeys, sizeof(BakedQuaternionKey), BAKED_ASSET_ALIGNMENT ) ||
+            !CheckArray( &pAnimation->TranslationKeys, sizeof(BakedVectorKey), BAKED_ASSET_ALIGNMENT ) )
+            return FALSE;
+    }
+
+    return TRUE;
+}
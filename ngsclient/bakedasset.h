@@ -0,0 +1,275 @@
+//------------------------------------------------------------------------------------------------
+// File:    bakedasset.h
+//
+// Desc:    Binary form of an animated mesh that can be used straight out of a mapped file
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __BAKEDASSET_H__
+#define __BAKEDASSET_H__
+
+// Include files required to compile this header
+#include "../common/platform.h"
+#include "mappedfile.h"
+
+// "NGSB" read as a little-endian DWORD
+#define BAKED_ASSET_MAGIC       0x4253474E
+
+// Change this whenever the layout or the way meshes are baked changes, so old files get rebaked
+#define BAKED_ASSET_VERSION     1
+
+// Everything but strings starts on a 16-byte boundary, so matrices can be loaded with SSE
+#define BAKED_ASSET_ALIGNMENT   16
+
+// Marks a frame with no parent or an unused bone slot in a combination
+#define BAKED_NONE              0xFFFFFFFF
+
+// Fixed-function vertex blending can't mix more matrices than this
+#define BAKED_MAX_INFLUENCES    4
+
+
+/**
+ * Where a run of elements is in the file.  Offsets are from the start of the file.  Strings are
+ * runs of characters with a terminating zero that isn't counted.
+ */
+struct BakedArray
+{
+    DWORD dwOffset;
+    DWORD dwCount;
+};
+
+/**
+ * A frame in the hierarchy.  Parents always come before their children.
+ */
+struct BakedFrame
+{
+    BakedArray Name;
+    DWORD dwParent;             // BAKED_NONE for a root
+    DWORD dwReserved;
+    FLOAT fTransform[16];       // Relative to the parent
+};
+
+/**
+ * Same layout as D3DMATERIAL9, plus a texture
+ */
+struct BakedMaterial
+{
+    FLOAT fDiffuse[4];
+    FLOAT fAmbient[4];
+    FLOAT fSpecular[4];
+    FLOAT fEmissive[4];
+    FLOAT fPower;
+    BakedArray TextureFilename; // Empty if there's no texture
+    DWORD dwReserved;
+};
+
+/**
+ * A frame whose world matrix moves a mesh's vertices
+ */
+struct BakedBone
+{
+    DWORD dwFrame;
+    DWORD dwReserved[3];
+    FLOAT fOffset[16];          // Takes vertices from the mesh into the bone's space
+};
+
+/**
+ * A run of faces drawn with one material and up to dwMaxFaceInfluences bones; the same layout
+ * as D3DXBONECOMBINATION, except that the bone IDs are an offset into the mesh's BoneIds
+ */
+struct BakedBoneCombination
+{
+    DWORD dwAttribId;           // Material
+    DWORD dwFaceStart;
+    DWORD dwFaceCount;
+    DWORD dwVertexStart;
+    DWORD dwVertexCount;
+    DWORD dwFirstBoneId;
+};
+
+/**
+ * A skinned mesh, ready to be copied into vertex and index buffers.  Each vertex is a position,
+ * dwNumWeights blend weights, a normal and a texture coordinate, all FLOATs.  Faces are sorted by
+ * combination, and a vertex's weights are in the order of its combination's bones; the weight for
+ * the last bone a combination uses isn't stored, since it's 1 minus the others.
+ */
+struct BakedMesh
+{
+    BakedArray Name;
+    DWORD dwFrame;
+    DWORD dwNumWeights;
+    DWORD dwVertexSize;
+    DWORD dwIndexSize;          // 2 or 4 bytes
+    DWORD dwMaxFaceInfluences;  // How many bone IDs each combination has
+    DWORD dwReserved;
+    BakedArray Vertices;        // dwCount vertices of dwVertexSize bytes
+    BakedArray Indices;         // dwCount indices of dwIndexSize bytes, 3 per face
+    BakedArray Materials;       // BakedMaterial
+    BakedArray Bones;           // BakedBone
+    BakedArray BoneCombinations;// BakedBoneCombination
+    BakedArray BoneIds;         // DWORD
+};
+
+/**
+ * Same layout as D3DXKEY_VECTOR3
+ */
+struct BakedVectorKey
+{
+    FLOAT fTime;                // In ticks
+    FLOAT fValue[3];
+};
+
+/**
+ * Same layout as D3DXKEY_QUATERNION.  Rotations are x, y, z, w in D3DX's convention, which is
+ * the conjugate of the one .x files store.
+ */
+struct BakedQuaternionKey
+{
+    FLOAT fTime;
+    FLOAT fValue[4];
+};
+
+/**
+ * The keys that move one frame during an animation set
+ */
+struct BakedAnimation
+{
+    DWORD dwFrame;
+    BakedArray ScaleKeys;       // BakedVectorKey
+    BakedArray RotationKeys;    // BakedQuaternionKey
+    BakedArray TranslationKeys; // BakedVectorKey
+};
+
+/**
+ * A named animation, such as a walk cycle.  Sets are in the order the source file had them.
+ */
+struct BakedAnimationSet
+{
+    BakedArray Name;
+    DWORD dwTicksPerSecond;
+    DWORD dwLength;             // Time of the last key, in ticks
+    BakedArray Animations;      // BakedAnimation
+};
+
+/**
+ * Starts the file.  The source hash and size say which .x file this was baked from.
+ */
+struct BakedHeader
+{
+    DWORD dwMagic;
+    DWORD dwVersion;
+    DWORD dwSize;               // Of the whole file
+    DWORD dwSourceSize;
+    QWORD qwSourceHash;
+    BakedArray Frames;          // BakedFrame
+    BakedArray Meshes;          // BakedMesh
+    BakedArray AnimationSets;   // BakedAnimationSet
+};
+
+
+/**
+ * A baked animated mesh, mapped into memory and used in place.  Loading checks that every
+ * array, string and index in the file is in range, so nothing that uses it has to.  The file
+ * is little-endian, like every platform this runs on.
+ *   @author Karl Gluck
+ */
+class BakedAsset
+{
+    public:
+
+        BakedAsset();
+        ~BakedAsset();
+
+        /**
+         * Maps a baked file.  If the .x file it was baked from is given, the load fails when that
+         * file has changed since.
+         *   @param strFile The baked file
+         *   @param strSourceFile The .x file, or NULL to skip the check
+         *   @return E_FAIL if the file is missing, damaged, out of date or from another version
+         */
+        HRESULT Load( const CHAR * strFile, const CHAR * strSourceFile );
+
+        /**
+         * Loads a baked file, baking it again from its source first if it's missing or out of
+         * date.  A file that can't be written is baked into memory instead.
+         *   @param strSourceFile The .x file
+         *   @param strFile Where the baked version is kept
+         *   @param dwThreads How many threads to read the .x file with
+         *   @return Result code
+         */
+        HRESULT LoadOrBake( const CHAR * strSourceFile, const CHAR * strFile, DWORD dwThreads );
+
+        VOID Release();
+
+        DWORD GetSize() const;
+
+        DWORD GetNumFrames() const;
+        const BakedFrame * GetFrame( DWORD dwIndex ) const;
+        DWORD GetNumMeshes() const;
+        const BakedMesh * GetMesh( DWORD dwIndex ) const;
+        DWORD GetNumAnimationSets() const;
+        const BakedAnimationSet * GetAnimationSet( DWORD dwIndex ) const;
+
+        const CHAR * GetString( const BakedArray * pString ) const;
+        const BYTE * GetVertices( const BakedMesh * pMesh ) const;
+        const BYTE * GetIndices( const BakedMesh * pMesh ) const;
+        const BakedMaterial * GetMaterials( const BakedMesh * pMesh ) const;
+        const BakedBone * GetBones( const BakedMesh * pMesh ) const;
+        const BakedBoneCombination * GetBoneCombinations( const BakedMesh * pMesh ) const;
+        const DWORD * GetBoneIds( const BakedMesh * pMesh ) const;
+        const BakedAnimation * GetAnimations( const BakedAnimationSet * pSet ) const;
+        const BakedVectorKey * GetScaleKeys( const BakedAnimation * pAnimation ) const;
+        const BakedQuaternionKey * GetRotationKeys( const BakedAnimation * pAnimation ) const;
+        const BakedVectorKey * GetTranslationKeys( const BakedAnimation * pAnimation ) const;
+
+        /**
+         * Hashes a file's contents the same way the source hash in a baked file was made
+         *   @param pData The contents
+         *   @param dwSize How many bytes there are
+         *   @return The hash
+         */
+        static QWORD Hash( const BYTE * pData, DWORD dwSize );
+
+    protected:
+
+        HRESULT Validate();
+        BOOL CheckArray( const BakedArray * pArray, DWORD dwElementSize, DWORD dwAlignment ) const;
+        BOOL CheckString( const BakedArray * pString ) const;
+        BOOL CheckMesh( const BakedMesh * pMesh ) const;
+        BOOL CheckAnimationSet( const BakedAnimationSet * pSet ) const;
+
+    protected:
+
+        MappedFile m_File;
+        BYTE * m_pBuffer;           // Holds the data instead when it couldn't be written out
+        const BYTE * m_pData;
+        DWORD m_dwSize;
+        const BakedHeader * m_pHeader;
+};
+
+
+#endif // __BAKEDASSET_H__
@@ -0,0 +1,179 @@
+//------------------------------------------------------------------------------------------------
+// File:    mappedfile.cpp
+//
+// Desc:    Read-only view of a whole file
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "mappedfile.h"
+
+#if !defined(WIN32) && !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  MappedFile
+// Desc:  
+//------------------------------------------------------------------------------------------------
+MappedFile::MappedFile()
+{
+    m_pData = NULL;
+    m_dwSize = 0;
+#if defined(WIN32) || defined(_WIN32)
+    m_hFile = INVALID_HANDLE_VALUE;
+    m_hMapping = NULL;
+#else
+    m_iFile = -1;
+#endif
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~MappedFile
+// Desc:  
+//------------------------------------------------------------------------------------------------
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Open
+// Desc:  Maps the whole file read-only
+//------------------------------------------------------------------------------------------------
+BOOL MappedFile::Open( const CHAR * strFile )
+{
+    Close();
+
+    QWORD qwSize;
+#if defined(WIN32) || defined(_WIN32)
+    m_hFile = CreateFileA( strFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+    if( m_hFile == INVALID_HANDLE_VALUE )
+        return FALSE;
+    LARGE_INTEGER size;
+    if( !GetFileSizeEx( m_hFile, &size ) )
+    {
+        Close();
+        return FALSE;
+    }
+    qwSize = (QWORD)size.QuadPart;
+    if( qwSize == 0 || qwSize > 0x7FFFFFFF )
+    {
+        Close();
+        return FALSE;
+    }
+    m_hMapping = CreateFileMapping( m_hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+    if( !m_hMapping )
+    {
+        Close();
+        return FALSE;
+    }
+    m_pData = (const BYTE*)MapViewOfFile( m_hMapping, FILE_MAP_READ, 0, 0, 0 );
+    if( !m_pData )
+    {
+        Close();
+        return FALSE;
+    }
+#else
+    m_iFile = open( strFile, O_RDONLY );
+    if( m_iFile < 0 )
+        return FALSE;
+    struct stat info;
+    if( 0 != fstat( m_iFile, &info ) )
+    {
+        Close();
+        return FALSE;
+    }
+    qwSize = (QWORD)info.st_size;
+    if( qwSize == 0 || qwSize > 0x7FFFFFFF )
+    {
+        Close();
+        return FALSE;
+    }
+    void * pData = mmap( NULL, qwSize, PROT_READ, MAP_PRIVATE, m_iFile, 0 );
+    if( pData == MAP_FAILED )
+    {
+        Close();
+        return FALSE;
+    }
+    m_pData = (const BYTE*)pData;
+#endif
+
+    m_dwSize = (DWORD)qwSize;
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Close
+// Desc:  
+//------------------------------------------------------------------------------------------------
+VOID MappedFile::Close()
+{
+#if defined(WIN32) || defined(_WIN32)
+    if( m_pData )
+        UnmapViewOfFile( m_pData );
+    if( m_hMapping )
+        CloseHandle( m_hMapping );
+    if( m_hFile != INVALID_HANDLE_VALUE )
+        CloseHandle( m_hFile );
+    m_hMapping = NULL;
+    m_hFile = INVALID_HANDLE_VALUE;
+#else
+    if( m_pData )
+        munmap( (void*)m_pData, m_dwSize );
+    if( m_iFile >= 0 )
+        close( m_iFile );
+    m_iFile = -1;
+#endif
+
+    m_pData = NULL;
+    m_dwSize = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetData
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const BYTE * MappedFile::GetData() const
+{
+    return m_pData;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetSize
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DWORD MappedFile::GetSize() const
+{
+    return m_dwSize;
+}
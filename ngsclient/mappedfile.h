@@ -0,0 +1,79 @@
+//------------------------------------------------------------------------------------------------
+// File:    mappedfile.h
+//
+// Desc:    Read-only view of a whole file
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __MAPPEDFILE_H__
+#define __MAPPEDFILE_H__
+
+// Include files required to compile this header
+#include "../common/platform.h"
+
+
+/**
+ * Maps a file into memory read-only, so that it can be read in place without copying it
+ *   @author Karl Gluck
+ */
+class MappedFile
+{
+    public:
+
+        MappedFile();
+        ~MappedFile();
+
+        /**
+         * Maps the whole file.  Empty files and files of 2 GB or more can't be mapped.
+         *   @param strFile Name of the file
+         *   @return TRUE if the file was mapped
+         */
+        BOOL Open( const CHAR * strFile );
+
+        /**
+         * Unmaps the file.  Anything that points into it becomes invalid.
+         */
+        VOID Close();
+
+        const BYTE * GetData() const;
+        DWORD GetSize() const;
+
+    protected:
+
+        const BYTE * m_pData;
+        DWORD m_dwSize;
+
+#if defined(WIN32) || defined(_WIN32)
+        HANDLE m_hFile;
+        HANDLE m_hMapping;
+#else
+        int m_iFile;
+#endif
+};
+
+
+#endif // __MAPPEDFILE_H__
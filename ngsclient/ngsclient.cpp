@@ -42,16 +42,20 @@
 #include <iostream>     // Used for error reporting
 #include "animation.h"  // Controls animated X models
 #include "resource.h"   // Icon
+#include "../common/protocol.h" // Messages shared with the server
+#include "../common/wireformat.h" // Compact encoding of player updates
+#include "../common/snapshot.h"   // Delta-encoded snapshots of the other players
+#include "../common/deadreckoning.h" // Deciding when the server needs to hear from us
+#include "../common/playout.h"   // Smooths out the other players' movement
+#include "../common/prediction.h" // Moves the player ahead of an authoritative server
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 // Constants used in the program
 #define DECRYPT_STREAM_SIZE 512                             /* File decryption byte window */
 #define BACKGROUND_COLOR    D3DCOLOR_XRGB( 128, 128, 255 )  /* Sky-blue background color */
 #define WINSOCK_VERSION     MAKEWORD(2,2)                   /* Use Winsock version 2.2 */
-#define SERVER_COMM_PORT    27192                           /* Connect to port 27192 */
-#define MAX_PACKET_SIZE     1024                            /* Largest packet is 1024 bytes */
-#define MAX_USERS           16                              /* Maximum of 16 players */
-#define UPDATE_FREQUENCY        10                          /* Update 10 times per second */
 #define IDLE_UPDATE_FREQUENCY   2                           /* When idle, update twice a second */
 
 // Tracks in the tiny_4anim.x animation file
@@ -455,21 +459,6 @@ class BasicAllocateHierarchy : public AllocateHierarchy
         {
             return D3DXCreateTextureFromFile( pDevice, strFileName, ppTexture );
         }
-
-        /**
-         * Loads a mesh hierarchy from an X file
-         *   @param pDevice Source device object to create the structure with
-         *   @param strFileName Name of the file to load
-         *   @param ppFrameHierarchy Target variable for frame hierarchy
-         *   @param ppAnimController Returns a pointer to the animation controller
-         *   @return Result code
-         */
-        STDMETHOD(LoadMeshHierarchyFromX)(THIS_ LPDIRECT3DDEVICE9 pDevice, LPCSTR strFileName,
-                                                LPD3DXFRAME* ppFrameHierarchy,
-                                                LPD3DXANIMATIONCONTROLLER* ppAnimController )
-        {
-            return D3DXLoadMeshHierarchyFromX( strFileName, 0, pDevice, this, NULL, ppFrameHierarchy, ppAnimController );
-        }
 };
 
 /**
@@ -479,19 +468,19 @@ class BasicAllocateHierarchy : public AllocateHierarchy
 struct Player
 {
     AnimatedMesh mesh;
+    AnimatedMeshInstance instance;
     LPD3DXANIMATIONCONTROLLER pController;
     LPD3DXANIMATIONSET pWalkAnimation;
     LPD3DXANIMATIONSET pIdleAnimation;
     LPD3DXANIMATIONSET pRunAnimation;
+    InputPrediction Prediction;
     D3DXVECTOR3 vPosition;
-    FLOAT fCurrentPlayerYaw;
     FLOAT fTargetPlayerYaw;
     FLOAT fCameraZoom;
     FLOAT fCurrentCameraYaw;
     FLOAT fTargetCameraYaw;
     FLOAT fCurrentCameraHeight;
     FLOAT fTargetCameraHeight;
-    FLOAT fVelocity;
     D3DXMATRIXA16 matPosition;
     FLOAT fOriginYaw;
     DWORD dwState;
@@ -552,7 +541,8 @@ VOID TransitionPlayerToAnimation( Player * pPlayer, LPD3DXANIMATIONSET pAnimatio
 }
 
 /**
- * Updates a client-side player from the user's input
+ * Updates a client-side player's controls, camera and animation from the user's input.  The
+ * player is moved by UpdatePlayer.
  *   @param fElapsedTime How much time since the last frame was rendered
  *   @param keys Current keyboard state
  *   @param pMs Current mouse state
@@ -635,8 +625,6 @@ VOID UpdatePlayerFromInput( FLOAT fElapsedTime, const BYTE * keys, const DIMOUSE
             if( bShift )
             {
                 // Make the player run
-                pPlayer->fVelocity -= fElapsedTime * 15.0f;
-
                 if( pPlayer->dwState != TINYTRACK_RUN )
                 {
                     TransitionPlayerToAnimation( pPlayer, pPlayer->pRunAnimation );
@@ -645,9 +633,7 @@ VOID UpdatePlayerFromInput( FLOAT fElapsedTime, const BYTE * keys, const DIMOUSE
             }
             else
             {
-                // Move the player
-                pPlayer->fVelocity -= fElapsedTime * 5.5f;  
-
+                // Make the player walk
                 if( pPlayer->dwState != TINYTRACK_WALK )
                 {
                     TransitionPlayerToAnimation( pPlayer, pPlayer->pWalkAnimation );
@@ -669,33 +655,27 @@ VOID UpdatePlayerFromInput( FLOAT fElapsedTime, const BYTE * keys, const DIMOUSE
 }
 
 /**
- * Moves the client-side player and smoothes velocities
+ * Moves the client-side player and smoothes the camera.  The player is moved by the same inputs
+ * that are sent to an authoritative server, so that the server ends up in the same place.
  *   @param fElapsedTime How much time has elapsed since the last frame
  *   @param pPlayer Player to update
  */
 VOID UpdatePlayer( FLOAT fElapsedTime, Player * pPlayer )
 {
-    // Make sure that target yaw values are in the correct direction
-    while( pPlayer->fTargetPlayerYaw - pPlayer->fCurrentPlayerYaw >  D3DX_PI ) pPlayer->fCurrentPlayerYaw += D3DX_PI*2.0f;
-    while( pPlayer->fTargetPlayerYaw - pPlayer->fCurrentPlayerYaw < -D3DX_PI ) pPlayer->fCurrentPlayerYaw -= D3DX_PI*2.0f;
-
-    // Smooth the current to the target values
+    // Smooth the camera to the target values
     pPlayer->fCurrentCameraYaw = pPlayer->fCurrentCameraYaw + (1.0f - fElapsedTime) * 0.02f * (pPlayer->fTargetCameraYaw - pPlayer->fCurrentCameraYaw);
-    pPlayer->fCurrentPlayerYaw = pPlayer->fCurrentPlayerYaw + (1.0f - fElapsedTime) * 0.20f * (pPlayer->fTargetPlayerYaw - pPlayer->fCurrentPlayerYaw);
     pPlayer->fCurrentCameraHeight = pPlayer->fCurrentCameraHeight + (1.0f - fElapsedTime) * 0.02f * (pPlayer->fTargetCameraHeight - pPlayer->fCurrentCameraHeight);
 
-    // Move the player
-    pPlayer->vPosition.x += sinf(pPlayer->fCurrentPlayerYaw) * pPlayer->fVelocity * fElapsedTime;
-    pPlayer->vPosition.z += cosf(pPlayer->fCurrentPlayerYaw) * pPlayer->fVelocity * fElapsedTime;
-
-    // Decay the player's velocity
-    pPlayer->fVelocity *= 1.0f - (fElapsedTime * 8.0f);
+    // Move the player with what the controls are doing
+    pPlayer->Prediction.Predict( fElapsedTime, pPlayer->dwState, pPlayer->fTargetPlayerYaw );
+    const MovementState * pMovement = pPlayer->Prediction.GetMovement();
+    pPlayer->vPosition = D3DXVECTOR3( pMovement->fPosition[0], pMovement->fPosition[1], pMovement->fPosition[2] );
 
     // Set up the player's position matrix
     D3DXMATRIXA16 matScale, matTransform, matRotation;
     D3DXMatrixScaling( &matScale, 0.0015f, 0.0015f, 0.0015f );
     D3DXMatrixTranslation( &matTransform, pPlayer->vPosition.x, pPlayer->vPosition.y, pPlayer->vPosition.z );
-    D3DXMatrixRotationYawPitchRoll( &matRotation, pPlayer->fCurrentPlayerYaw + D3DX_PI, -D3DX_PI/2, 0.0f );
+    D3DXMatrixRotationYawPitchRoll( &matRotation, pMovement->fYaw + D3DX_PI, -D3DX_PI/2, 0.0f );
     D3DXMatrixMultiply( &pPlayer->matPosition, &matScale, &matRotation );
     D3DXMatrixMultiply( &pPlayer->matPosition, &pPlayer->matPosition, &matTransform );
 }
@@ -729,7 +709,9 @@ VOID SetPlayerCamera( LPDIRECT3DDEVICE9 pDevice, const Player * pPlayer )
  */
 struct OtherPlayer
 {
-    // Animation information
+    // Animation information.  These are only created while the player is being drawn, and an
+    // entry that's moved within the table takes them along with it.
+    AnimatedMeshInstance * pInstance;
     LPD3DXANIMATIONCONTROLLER pController;
     LPD3DXANIMATIONSET pWalkAnimation;
     LPD3DXANIMATIONSET pIdleAnimation;
@@ -737,99 +719,37 @@ struct OtherPlayer
     DWORD dwCurrentTrack;
 
     // Internal data
+    DWORD dwPlayerID;
     BOOL bActive;
+    DWORD dwLastSnapshot;           // Sequence number of the newest snapshot that had this player
     D3DXVECTOR3 vRenderPos;
     FLOAT fRenderYaw;
 
-    // Data updated by server messages
-    D3DXVECTOR3 vOldPos, vNewPos;
-    D3DXVECTOR3 vOldVel, vNewVel;
-    FLOAT fOldTime, fNewTime;
+    // Snapshots of this player, which are interpolated to find where to draw it
+    PlayoutBuffer Snapshots;
+
+    // State at the time being drawn
     DWORD dwState;
     FLOAT fYaw;
 };
 
 /**
- * List of message IDs that are transacted with the server
- *   @author Karl Gluck
- */
-enum Message
-{
-    MSG_LOGON,
-    MSG_LOGOFF,
-    MSG_UPDATEPLAYER,
-    MSG_CONFIRMLOGON,
-    MSG_PLAYERLOGGEDOFF,
-};
-
-/**
- * First structure in every message
- *   @author Karl Gluck
- */
-struct MessageHeader
-{
-    Message MsgID;
-};
-
-/**
- * Message sent to let the server know we want to log on
- *   @author Karl Gluck
- */
-struct LogOnMessage
-{
-    MessageHeader   Header;
-
-    LogOnMessage() { Header.MsgID = MSG_LOGON; }
-};
-
-/**
- * Client wants to disconnect from the server
- *   @author Karl Gluck
- */
-struct LogOffMessage
-{
-    MessageHeader   Header;
-
-    LogOffMessage() { Header.MsgID = MSG_LOGOFF; }
-};
-
-/**
- * Sent between the server and client to update player information
- *   @author Karl Gluck
- */
-struct UpdatePlayerMessage
-{
-    MessageHeader   Header;
-    DWORD           dwPlayerID;
-    FLOAT           fVelocity[3];       // Expressed in meters / second
-    FLOAT           fPosition[3];
-    DWORD           dwState;
-    FLOAT           fYaw;
-
-    UpdatePlayerMessage() { Header.MsgID = MSG_UPDATEPLAYER; }
-};
-
-/**
- * Sent by the server to tell the client that it has successfully logged on
+ * Everything the client knows about the other players.  The list is indexed by the slot part of
+ * their player IDs, and it grows whenever the server hands out a slot beyond the end, so there's
+ * no fixed limit on the number of players the client can see.
  *   @author Karl Gluck
  */
-struct ConfirmLogOnMessage
+struct OtherPlayerTable
 {
-    MessageHeader   Header;
-
-    ConfirmLogOnMessage() { Header.MsgID = MSG_CONFIRMLOGON; }
-};
-
-/**
- * Another player has logged off
- *   @author Karl Gluck
- */
-struct PlayerLoggedOffMessage
-{
-    MessageHeader   Header;
-    DWORD           dwPlayerID;
-
-    PlayerLoggedOffMessage() { Header.MsgID = MSG_PLAYERLOGGEDOFF; }
+    AnimatedMesh * pMesh;           // Mesh that every player is an instance of
+    OtherPlayer * pPlayers;
+    DWORD dwCapacity;
+
+    // Snapshots from the server are encoded against earlier ones, so they're kept around
+    SnapshotHistory History;
+    DWORD dwLastSequence;           // Newest snapshot that has been applied
+    PlayoutClock Clock;             // Time that the other players are drawn at
+    FLOAT fWorldBound;              // Edge of the world that the server quantizes positions to
 };
 
 /**
@@ -957,9 +877,12 @@ DWORD GetServerAddress()
  * Attempts to establish a connection with the server
  *   @param sSocket Socket to connect with
  *   @param hRecvEvent Event that is set when data is received
+ *   @param pLocalPlayerID Receives the ID the server assigned to this client's player
+ *   @param pWorldBound Receives the world bound the server uses to decode compact updates
+ *   @param pFlags Receives the server's LOGON_ flags
  *   @return Success code
  */
-HRESULT ConnectToServer( SOCKET sSocket, HANDLE hRecvEvent )
+HRESULT ConnectToServer( SOCKET sSocket, HANDLE hRecvEvent, DWORD * pLocalPlayerID, FLOAT * pWorldBound, DWORD * pFlags )
 {
     // Let the user enter the server's IP address
     DWORD dwAddr = GetServerAddress();
@@ -974,24 +897,43 @@ HRESULT ConnectToServer( SOCKET sSocket, HANDLE hRecvEvent )
     addr.sin_port   = htons(SERVER_COMM_PORT);
     addr.sin_addr   = *((LPIN_ADDR)*pTargetAddress->h_addr_list);
 
-    // Send the log on message
+    // The server answers the first log on message with a cookie, and only gives us a player
+    // once we send the cookie back
     LogOnMessage packet;
-    if( SOCKET_ERROR == sendto( sSocket, (CHAR*)&packet, sizeof(packet), 0,
-                                (LPSOCKADDR)&addr, sizeof(SOCKADDR_IN) ) )
-        return E_FAIL;
-
-    // Wait for a reply or for a few seconds to pass
-    if( WAIT_TIMEOUT == WSAWaitForMultipleEvents( 1, &hRecvEvent, TRUE, 3000, FALSE ) )
-        return E_FAIL;
-
-    // Recieve the result
     CHAR buffer[MAX_PACKET_SIZE];
     int length;
     SOCKADDR_IN src;
-    ZeroMemory( &src, sizeof(src) );
-    int fromlen = sizeof(SOCKADDR_IN);
-    if( SOCKET_ERROR == (length = recvfrom( sSocket, buffer, sizeof(buffer), 0, (LPSOCKADDR)&src, &fromlen )) )
+    for( int attempt = 0; attempt < 2; ++attempt )
+    {
+        // Send the log on message
+        WSAResetEvent( hRecvEvent );
+        if( SOCKET_ERROR == sendto( sSocket, (CHAR*)&packet, sizeof(packet), 0,
+                                    (LPSOCKADDR)&addr, sizeof(SOCKADDR_IN) ) )
+            return E_FAIL;
+
+        // Wait for a reply or for a few seconds to pass
+        if( WAIT_TIMEOUT == WSAWaitForMultipleEvents( 1, &hRecvEvent, TRUE, 3000, FALSE ) )
+            return E_FAIL;
+
+        // Recieve the result
+        ZeroMemory( &src, sizeof(src) );
+        int fromlen = sizeof(SOCKADDR_IN);
+        if( SOCKET_ERROR == (length = recvfrom( sSocket, buffer, sizeof(buffer), 0, (LPSOCKADDR)&src, &fromlen )) )
+            return E_FAIL;
+
+        // Anything but a challenge is the answer
+        if( length < (int)sizeof(LogOnChallengeMessage) || GetMessageID( buffer ) != MSG_LOGONCHALLENGE )
+            break;
+        packet.dwCookie = ((LogOnChallengeMessage*)buffer)->dwCookie;
+    }
+
+    // Make sure this is the confirmation, and find out who we are
+    ConfirmLogOnMessage * pClm = (ConfirmLogOnMessage*)buffer;
+    if( length < (int)sizeof(ConfirmLogOnMessage) || pClm->Header.MsgID != MSG_CONFIRMLOGON )
         return E_FAIL;
+    *pLocalPlayerID = pClm->dwPlayerID;
+    *pWorldBound = pClm->fWorldBound;
+    *pFlags = pClm->dwFlags;
 
     // Connect to this address
     connect( sSocket, (LPSOCKADDR)&src, sizeof(SOCKADDR_IN) );
@@ -1035,34 +977,19 @@ VOID TransitionOtherPlayerToAnimation( OtherPlayer * pPlayer, LPD3DXANIMATIONSET
 /**
  * Updates a player structure
  *   @param pPlayer Player to update
- *   @param pUpm Message to use for updating player
+ *   @param pUpm State of the player at the time being drawn
  *   @return Success code
  */
-HRESULT UpdateOtherPlayer( OtherPlayer * pPlayer, UpdatePlayerMessage * pUpm )
+HRESULT UpdateOtherPlayer( OtherPlayer * pPlayer, const PlayerState * pUpm )
 {
-    // If this player is inactive, activate it
-    if( !pPlayer->bActive )
-    {
-        pPlayer->fNewTime = GetTickCount() / 1000.0f;
-        pPlayer->vNewPos = D3DXVECTOR3( pUpm->fPosition[0], pUpm->fPosition[1], pUpm->fPosition[2] );
-        pPlayer->vNewVel = D3DXVECTOR3( pUpm->fVelocity[0], pUpm->fVelocity[1], pUpm->fVelocity[2] );
-        pPlayer->bActive = TRUE;
-
-        pPlayer->vRenderPos = pPlayer->vNewPos;
-        pPlayer->fRenderYaw = pPlayer->fYaw;
-    }
-
-    // Move old stuff backward
-    pPlayer->vOldPos = pPlayer->vNewPos;
-    pPlayer->vOldVel = pPlayer->vNewVel;
-    pPlayer->fOldTime = pPlayer->fNewTime;
-
-    // Update
-    pPlayer->fNewTime = GetTickCount() / 1000.0f;
-    pPlayer->vNewPos = D3DXVECTOR3( pUpm->fPosition[0], pUpm->fPosition[1], pUpm->fPosition[2] );
-    pPlayer->vNewVel = D3DXVECTOR3( pUpm->fVelocity[0], pUpm->fVelocity[1], pUpm->fVelocity[2] );
+    pPlayer->vRenderPos = D3DXVECTOR3( pUpm->fPosition[0], pUpm->fPosition[1], pUpm->fPosition[2] );
     pPlayer->fYaw = pUpm->fYaw;
 
+    // The yaw comes in wrapped to [0, 2pi), so keep it on the same side of the circle as the yaw
+    // being rendered; otherwise the player would spin around when it crosses zero
+    while( pPlayer->fYaw - pPlayer->fRenderYaw >  D3DX_PI ) pPlayer->fYaw -= D3DX_PI*2.0f;
+    while( pPlayer->fYaw - pPlayer->fRenderYaw < -D3DX_PI ) pPlayer->fYaw += D3DX_PI*2.0f;
+
     // Change the new state
     if( pUpm->dwState != pPlayer->dwState )
     {
@@ -1087,29 +1014,300 @@ HRESULT UpdateOtherPlayer( OtherPlayer * pPlayer, UpdatePlayerMessage * pUpm )
 }
 
 
+/**
+ * Sets up a player's animation instance and controller, so that it can be drawn
+ *   @param pAm Source animated mesh
+ *   @param pPlayer Player to set up
+ *   @return Success/error code
+ */
+HRESULT CreateOtherPlayerAnimation( AnimatedMesh * pAm, OtherPlayer * pPlayer )
+{
+    pPlayer->pInstance = new AnimatedMeshInstance;
+    if( !pPlayer->pInstance ||
+        FAILED( pPlayer->pInstance->Create( pAm, 2 ) ) ||
+        FAILED( pPlayer->pInstance->GetAnimationController( &pPlayer->pController ) ) )
+    {
+        delete pPlayer->pInstance;
+        pPlayer->pInstance = NULL;
+        return E_FAIL;
+    }
+
+    pPlayer->pController->GetAnimationSet( TINYTRACK_WALK,        &pPlayer->pWalkAnimation );
+    pPlayer->pController->GetAnimationSet( TINYTRACK_IDLE,        &pPlayer->pIdleAnimation );
+    pPlayer->pController->GetAnimationSet( TINYTRACK_RUN,         &pPlayer->pRunAnimation );
+
+    // Set up an initial state
+    pPlayer->pController->SetTrackAnimationSet( 0, pPlayer->pIdleAnimation );
+    pPlayer->pController->SetTrackEnable( 0, TRUE );
+    pPlayer->dwCurrentTrack = 0;
+    pPlayer->dwState = 0;
+
+    // Success
+    return S_OK;
+}
+
+
+/**
+ * Gets rid of a player's animation objects
+ *   @param pPlayer Player to free
+ */
+VOID ReleaseOtherPlayerAnimation( OtherPlayer * pPlayer )
+{
+    if( pPlayer->pWalkAnimation )
+        pPlayer->pWalkAnimation->Release();
+    if( pPlayer->pIdleAnimation )
+        pPlayer->pIdleAnimation->Release();
+    if( pPlayer->pRunAnimation )
+        pPlayer->pRunAnimation->Release();
+    if( pPlayer->pController )
+        pPlayer->pController->Release();
+    delete pPlayer->pInstance;
+
+    pPlayer->pWalkAnimation = NULL;
+    pPlayer->pIdleAnimation = NULL;
+    pPlayer->pRunAnimation = NULL;
+    pPlayer->pController = NULL;
+    pPlayer->pInstance = NULL;
+}
+
+
+/**
+ * Starts drawing a player that the server says has come into view
+ *   @param pAm Mesh to draw the player with
+ *   @param pPlayer Player that entered
+ *   @param pUpm State of the player when it entered
+ *   @return Success code
+ */
+HRESULT EnterOtherPlayer( AnimatedMesh * pAm, OtherPlayer * pPlayer, const PlayerState * pUpm )
+{
+    // Players only get animation objects while they're being drawn
+    if( !pPlayer->pInstance && FAILED( CreateOtherPlayerAnimation( pAm, pPlayer ) ) )
+        return E_FAIL;
+
+    // Forget the snapshots from the last time it was in view, so that it doesn't slide in from
+    // wherever it was then
+    pPlayer->Snapshots.Reset();
+    pPlayer->bActive = TRUE;
+    pPlayer->fRenderYaw = pUpm->fYaw;
+
+    // Now treat it like any other update
+    return UpdateOtherPlayer( pPlayer, pUpm );
+}
+
+
+/**
+ * Stops drawing a player that has gone out of view or logged off, and frees its animation
+ *   @param pPlayer Player that left
+ */
+VOID LeaveOtherPlayer( OtherPlayer * pPlayer )
+{
+    pPlayer->bActive = FALSE;
+    ReleaseOtherPlayerAnimation( pPlayer );
+}
+
+
+/**
+ * Clears the entries in the table from dwFirst on.  Used after the table grows.
+ *   @param pTable Table to initialize
+ *   @param dwFirst Index of the first player to set up
+ */
+VOID InitOtherPlayers( OtherPlayerTable * pTable, DWORD dwFirst )
+{
+    for( DWORD i = dwFirst; i < pTable->dwCapacity; ++i )
+        ZeroMemory( &pTable->pPlayers[i], sizeof(OtherPlayer) );
+}
+
+
+/**
+ * Stops drawing every player and frees their device objects.  Players still in view come back
+ * with the next snapshot.
+ *   @param pTable Table to release
+ */
+VOID ReleaseOtherPlayers( OtherPlayerTable * pTable )
+{
+    for( DWORD i = 0; i < pTable->dwCapacity; ++i )
+        LeaveOtherPlayer( &pTable->pPlayers[i] );
+}
+
+
+/**
+ * Gets the entry for a player, growing the table if the server has assigned a slot past the
+ * end.  If the slot used to belong to a different player, the entry is reset first.
+ *   @param pTable Table of other players
+ *   @param dwPlayerID ID of the player to get
+ *   @return Player entry, or NULL if the table couldn't grow
+ */
+OtherPlayer * GetOtherPlayer( OtherPlayerTable * pTable, DWORD dwPlayerID )
+{
+    DWORD dwSlot = PLAYER_SLOT( dwPlayerID );
+
+    // Grow the table to fit this slot
+    if( dwSlot >= pTable->dwCapacity )
+    {
+        DWORD dwNewCapacity = max( 16, pTable->dwCapacity * 2 );
+        while( dwNewCapacity <= dwSlot )
+            dwNewCapacity *= 2;
+
+        OtherPlayer * pNewPlayers = new OtherPlayer[dwNewCapacity];
+        if( !pNewPlayers )
+            return NULL;
+
+        // Move the existing players over.  Their animation objects go with them, and the old
+        // entries give them up so that each one only ever has a single owner.
+        for( DWORD i = 0; i < pTable->dwCapacity; ++i )
+        {
+            OtherPlayer * pOld = &pTable->pPlayers[i];
+            pNewPlayers[i] = *pOld;
+            pOld->pInstance = NULL;
+            pOld->pController = NULL;
+            pOld->pWalkAnimation = NULL;
+            pOld->pIdleAnimation = NULL;
+            pOld->pRunAnimation = NULL;
+        }
+        if( pTable->pPlayers )
+            delete [] pTable->pPlayers;
+
+        // Set up the new entries
+        DWORD dwOldCapacity = pTable->dwCapacity;
+        pTable->pPlayers = pNewPlayers;
+        pTable->dwCapacity = dwNewCapacity;
+        InitOtherPlayers( pTable, dwOldCapacity );
+    }
+
+    // A different generation means that the slot has been given to someone new, so whoever had
+    // it before has logged off
+    OtherPlayer * pPlayer = &pTable->pPlayers[dwSlot];
+    if( pPlayer->dwPlayerID != dwPlayerID )
+    {
+        LeaveOtherPlayer( pPlayer );
+        pPlayer->dwPlayerID = dwPlayerID;
+    }
+
+    return pPlayer;
+}
+
+
+/**
+ * Looks up a player without creating it
+ *   @param pTable Table of other players
+ *   @param dwPlayerID ID of the player to find
+ *   @return Player entry, or NULL if the table has never heard of this player
+ */
+OtherPlayer * FindOtherPlayer( OtherPlayerTable * pTable, DWORD dwPlayerID )
+{
+    DWORD dwSlot = PLAYER_SLOT( dwPlayerID );
+    if( dwSlot >= pTable->dwCapacity || pTable->pPlayers[dwSlot].dwPlayerID != dwPlayerID )
+        return NULL;
+
+    return &pTable->pPlayers[dwSlot];
+}
+
+
+/**
+ * Frees the table's memory.  ReleaseOtherPlayers should be called first.
+ *   @param pTable Table to free
+ */
+VOID FreeOtherPlayerTable( OtherPlayerTable * pTable )
+{
+    if( pTable->pPlayers )
+        delete [] pTable->pPlayers;
+    pTable->pPlayers = NULL;
+    pTable->dwCapacity = 0;
+    pTable->History.Destroy();
+}
+
+
+/**
+ * Brings the other players up to date with a snapshot.  Players in the snapshot that weren't
+ * being drawn have come into view, and players missing from it have gone out of view.
+ *   @param pPlayers Table of other players
+ *   @param dwLocalPlayerID ID of this client's own player
+ *   @param pFrame Snapshot that was just decoded
+ */
+VOID ApplySnapshot( OtherPlayerTable * pPlayers, DWORD dwLocalPlayerID, const SnapshotFrame * pFrame )
+{
+    for( DWORD i = 0; i < pFrame->dwNumPlayers; ++i )
+    {
+        const QuantizedState * pQuantized = &pFrame->pPlayers[i];
+        if( pQuantized->dwPlayerID == dwLocalPlayerID )
+            continue;
+
+        OtherPlayer * pPlayer = GetOtherPlayer( pPlayers, pQuantized->dwPlayerID );
+        if( !pPlayer )
+            continue;
+
+        // Every player in the snapshot is stored, even if it didn't change, so that players who
+        // stopped moving don't keep being extrapolated.  They're drawn once the playout clock
+        // gets to this snapshot.
+        PlayerState state;
+        DequantizeState( pQuantized, pPlayers->fWorldBound, &state );
+        if( !pPlayer->bActive && FAILED( EnterOtherPlayer( pPlayers->pMesh, pPlayer, &state ) ) )
+            continue;
+        pPlayer->Snapshots.Add( pFrame->dwSequence, &state );
+        pPlayer->dwLastSnapshot = pFrame->dwSequence;
+    }
+
+    // Stop drawing players that have gone out of view
+    for( DWORD i = 0; i < pPlayers->dwCapacity; ++i )
+    {
+        OtherPlayer * pPlayer = &pPlayers->pPlayers[i];
+        if( pPlayer->bActive && pPlayer->dwLastSnapshot != pFrame->dwSequence )
+            LeaveOtherPlayer( pPlayer );
+    }
+}
+
+
 /**
  * Handles a packet from the server
- *   @param pPlayers List of players
+ *   @param pPlayers Table of other players
+ *   @param dwLocalPlayerID ID of this client's own player, which is never drawn as another player
+ *   @param pPrediction Local player's movement, which an authoritative server corrects
  *   @param pBuffer Data packet received
  *   @param dwSize How larget the packet is
  *   @return Success code
  */
-HRESULT ProcessPacket( OtherPlayer * pPlayers, const CHAR * pBuffer, DWORD dwSize )
+HRESULT ProcessPacket( OtherPlayerTable * pPlayers, DWORD dwLocalPlayerID, InputPrediction * pPrediction,
+                       const CHAR * pBuffer, DWORD dwSize )
 {
-    MessageHeader * pMh = (MessageHeader*)pBuffer;
-
-    switch( pMh->MsgID )
+    switch( GetMessageID( pBuffer ) )
     {
-        case MSG_UPDATEPLAYER:
+        case MSG_DELTASNAPSHOT:
             {
-                UpdatePlayerMessage * pUpm = (UpdatePlayerMessage*)pBuffer;
-                return UpdateOtherPlayer( &pPlayers[pUpm->dwPlayerID], pUpm );
-            }
+                // Snapshots that are out of date or whose baseline we've lost are skipped; the
+                // server will send another one next tick
+                SnapshotFrame * pFrame = DecodeDeltaSnapshot( (const BYTE*)pBuffer, dwSize,
+                                                              pPlayers->dwLastSequence,
+                                                              &pPlayers->History );
+                if( pFrame )
+                {
+                    pPlayers->dwLastSequence = pFrame->dwSequence;
+                    pPlayers->Clock.Arrived( pFrame->dwSequence, GetTickCount() );
+                    ApplySnapshot( pPlayers, dwLocalPlayerID, pFrame );
+                }
+            } break;
 
         case MSG_PLAYERLOGGEDOFF:
             {
+                if( dwSize < sizeof(PlayerLoggedOffMessage) )
+                    return E_FAIL;
+
                 PlayerLoggedOffMessage * pPlom = (PlayerLoggedOffMessage*)pBuffer;
-                pPlayers[pPlom->dwPlayerID].bActive = FALSE;
+
+                // Ignore this if the slot has already been given to someone else
+                OtherPlayer * pPlayer = FindOtherPlayer( pPlayers, pPlom->dwPlayerID );
+                if( pPlayer )
+                    LeaveOtherPlayer( pPlayer );
+            } break;
+
+        case MSG_INPUTACK:
+            {
+                if( dwSize < sizeof(InputAckMessage) )
+                    return E_FAIL;
+
+                // Start over from where the server has the player, and redo the inputs it
+                // hasn't seen yet.  The player only moves if the server disagreed.
+                FLOAT fCorrection;
+                pPrediction->Reconcile( (const InputAckMessage*)pBuffer, &fCorrection );
             } break;
     }
 
@@ -1120,12 +1318,15 @@ HRESULT ProcessPacket( OtherPlayer * pPlayers, const CHAR * pBuffer, DWORD dwSiz
 
 /**
  * Handles messages from the network
- *   @param pPlayers List of players
+ *   @param pPlayers Table of other players
+ *   @param dwLocalPlayerID ID of this client's own player
+ *   @param pPrediction Local player's movement
  *   @param sSocket Socket to get data from
  *   @param hRecvEvent Event triggered when a packet is received
  *   @return Success code
  */
-HRESULT ProcessNetworkMessages( OtherPlayer * pPlayers, SOCKET sSocket, HANDLE hRecvEvent )
+HRESULT ProcessNetworkMessages( OtherPlayerTable * pPlayers, DWORD dwLocalPlayerID, InputPrediction * pPrediction,
+                                SOCKET sSocket, HANDLE hRecvEvent )
 {
     if( WAIT_OBJECT_0 == WaitForSingleObject( hRecvEvent, 0 ) )
     {
@@ -1138,13 +1339,24 @@ HRESULT ProcessNetworkMessages( OtherPlayer * pPlayers, SOCKET sSocket, HANDLE h
         // Stores return codes
         HRESULT hr;
 
+        // Used to tell whether a new snapshot arrived
+        DWORD dwLastSequence = pPlayers->dwLastSequence;
+
         // Get the packet
         while( SOCKET_ERROR != (size = recvfrom( sSocket, buffer, sizeof(buffer), 0, (LPSOCKADDR)&addr, &fromlen )) )
         {
             // Process information from the packet
-            if( FAILED( hr = ProcessPacket( pPlayers, buffer, size ) ) )
+            if( FAILED( hr = ProcessPacket( pPlayers, dwLocalPlayerID, pPrediction, buffer, size ) ) )
                 return hr;
         }
+
+        // Let the server know which snapshot to encode against next
+        if( pPlayers->dwLastSequence != dwLastSequence )
+        {
+            SnapshotAckMessage sam;
+            sam.dwSequence = pPlayers->dwLastSequence;
+            send( sSocket, (CHAR*)&sam, sizeof(sam), 0 );
+        }
     }
 
     // Success
@@ -1153,46 +1365,43 @@ HRESULT ProcessNetworkMessages( OtherPlayer * pPlayers, SOCKET sSocket, HANDLE h
 
 
 /**
- * Sets up a player structure
- *   @param pAm Source animated mesh
- *   @param pPlayer Player structure to initialize
- *   @return Success/error code
+ * Gets the local player's state the way it's sent to the server.  The velocity is the direction
+ * the player is moving in, so that everyone can extrapolate its position the same way.
+ *   @param dwLocalPlayerID ID the server assigned to this client's player
+ *   @param pPlayer Local player
+ *   @param pState State to fill in
  */
-HRESULT InitOtherPlayer( AnimatedMesh * pAm, OtherPlayer * pPlayer )
+VOID GetPlayerState( DWORD dwLocalPlayerID, const Player * pPlayer, PlayerState * pState )
 {
-    ZeroMemory( pPlayer, sizeof(OtherPlayer) );
-
-    if( FAILED( pAm->CloneAnimationController( 2, &pPlayer->pController ) ) )
-        return E_FAIL;
-
-    pPlayer->pController->GetAnimationSet( TINYTRACK_WALK,        &pPlayer->pWalkAnimation );
-    pPlayer->pController->GetAnimationSet( TINYTRACK_IDLE,        &pPlayer->pIdleAnimation );
-    pPlayer->pController->GetAnimationSet( TINYTRACK_RUN,         &pPlayer->pRunAnimation );
-
-    // Set up an initial state
-    pPlayer->pController->SetTrackAnimationSet( 0, pPlayer->pIdleAnimation );
-    pPlayer->pController->SetTrackEnable( 0, TRUE );
-
-    // Success
-    return S_OK;
+    GetMovementPlayerState( pPlayer->Prediction.GetMovement(), dwLocalPlayerID, pState );
 }
 
+/**
+ * Tells the server where the local player is, using the compact encoding
+ *   @param sSocket Socket connected to the server
+ *   @param fWorldBound World bound that the server sent when we logged on
+ *   @param pState Local player's state
+ */
+VOID SendPlayerUpdate( SOCKET sSocket, FLOAT fWorldBound, const PlayerState * pState )
+{
+    // Pack it down and send off the packet
+    BYTE buffer[MAX_COMPACT_UPDATE_SIZE];
+    DWORD dwSize = EncodeCompactUpdate( pState, fWorldBound, buffer, sizeof(buffer) );
+    if( dwSize )
+        send( sSocket, (CHAR*)buffer, dwSize, 0 );
+}
 
 /**
- * Gets rid of data in a player structure
- *   @param pPlayer Player to free
+ * Sends an authoritative server the local player's inputs that it hasn't applied yet
+ *   @param sSocket Socket connected to the server
+ *   @param pPrediction Local player's movement
  */
-VOID ReleaseOtherPlayer( OtherPlayer * pPlayer )
+VOID SendPlayerInputs( SOCKET sSocket, const InputPrediction * pPrediction )
 {
-    if( pPlayer->pWalkAnimation )
-        pPlayer->pWalkAnimation->Release();
-    if( pPlayer->pIdleAnimation )
-        pPlayer->pIdleAnimation->Release();
-    if( pPlayer->pRunAnimation )
-        pPlayer->pRunAnimation->Release();
-    if( pPlayer->pController )
-        pPlayer->pController->Release();
-    ZeroMemory( pPlayer, sizeof(OtherPlayer) );
+    BYTE buffer[MAX_PLAYER_INPUT_SIZE];
+    DWORD dwSize = pPrediction->EncodeInputs( buffer, sizeof(buffer), NULL );
+    if( dwSize )
+        send( sSocket, (CHAR*)buffer, dwSize, 0 );
 }
 
 
@@ -1212,15 +1421,19 @@ VOID DisconnectFromServer( SOCKET sSocket )
  * the provided parameters.  Called after a lost device has been detected and all device-
  * dependant resources are unloaded.
  *   @param sSocket Socket to update server on
+ *   @param dwLocalPlayerID ID the server assigned to this client's player
+ *   @param fWorldBound World bound used to encode updates
+ *   @param bAuthoritative Whether the server moves the player from its inputs
  *   @param pPlayer Player object being updated
  *   @param pd3dDevice Lost device to monitor for usable state
  *   @param pD3DParams Parameters structure to reset the device with
  *   @return Success or failure code
  */
-HRESULT WaitForLostDevice( SOCKET sSocket, Player * pPlayer, LPDIRECT3DDEVICE9 pd3dDevice, D3DPRESENT_PARAMETERS * pD3DParams )
+HRESULT WaitForLostDevice( SOCKET sSocket, DWORD dwLocalPlayerID, FLOAT fWorldBound, BOOL bAuthoritative, Player * pPlayer, LPDIRECT3DDEVICE9 pd3dDevice, D3DPRESENT_PARAMETERS * pD3DParams )
 {
     // Server hasn't been updated yet
     FLOAT fLastUpdate = 0.0f;
+    DWORD dwLastInput = GetTickCount();
     FLOAT fElapsedTime;
 
     // Set the player state
@@ -1260,19 +1473,20 @@ HRESULT WaitForLostDevice( SOCKET sSocket, Player * pPlayer, LPDIRECT3DDEVICE9 p
             // Update the server periodically
             if( (1.0f / IDLE_UPDATE_FREQUENCY) < (fTime - fLastUpdate) )
             {
-                UpdatePlayerMessage upm;
-                upm.dwPlayerID = 0;
-                upm.fVelocity[0] = pPlayer->fVelocity;
-                upm.fVelocity[1] = 0.0f;
-                upm.fVelocity[2] = 0.0f;
-                upm.fPosition[0] = pPlayer->vPosition.x;
-                upm.fPosition[1] = pPlayer->vPosition.y;
-                upm.fPosition[2] = pPlayer->vPosition.z;
-                upm.dwState = pPlayer->dwState;
-                upm.fYaw = pPlayer->fTargetPlayerYaw;
-
-                // Send off the packet
-                send( sSocket, (CHAR*)&upm, sizeof(upm), 0 );
+                // An authoritative server needs to be told that the player is standing still
+                if( bAuthoritative )
+                {
+                    DWORD dwTime = GetTickCount();
+                    pPlayer->Prediction.Predict( (dwTime - dwLastInput) / 1000.0f, TINYTRACK_IDLE, pPlayer->fTargetPlayerYaw );
+                    SendPlayerInputs( sSocket, &pPlayer->Prediction );
+                    dwLastInput = dwTime;
+                }
+                else
+                {
+                    PlayerState state;
+                    GetPlayerState( dwLocalPlayerID, pPlayer, &state );
+                    SendPlayerUpdate( sSocket, fWorldBound, &state );
+                }
 
                 // Store the last update time
                 fLastUpdate = fTime;
@@ -1292,7 +1506,7 @@ HRESULT WaitForLostDevice( SOCKET sSocket, Player * pPlayer, LPDIRECT3DDEVICE9 p
  *   @param hInstance Instance of the application
  *   @return Result code
  */
-int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE, LPSTR, int )
+int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE, LPSTR lpCmdLine, int )
 {
     // Structures used in the program
     HWND hWnd;
@@ -1324,6 +1538,11 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE, LPSTR, int )
     // Player management information
     Player player;
     ZeroMemory( &player, sizeof(player) );
+    MovementState start;
+    ZeroMemory( &start, sizeof(start) );
+    start.dwState = MOVEMENT_IDLE;
+    player.Prediction.Reset( &start );
+    player.dwState = TINYTRACK_IDLE;
     player.fCameraZoom = 4.0f;
     player.fCurrentCameraHeight = player.fTargetCameraHeight = 2.0f;
     BasicAllocateHierarchy allocHierarchy( d3dCaps.MaxVertexBlendMatrices );
@@ -1331,8 +1550,26 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE, LPSTR, int )
     // Networking structures
     SOCKET sSocket;
     HANDLE hRecvEvent;
-    OtherPlayer players[MAX_USERS];
-    ZeroMemory( players, sizeof(players) );
+    DWORD dwLocalPlayerID;
+    DWORD dwLogOnFlags = 0;
+    OtherPlayerTable players;
+    players.pMesh = &player.mesh;
+    players.pPlayers = NULL;
+    players.dwCapacity = 0;
+    players.dwLastSequence = 0;
+    players.fWorldBound = DEFAULT_WORLD_BOUND;
+
+    // Updates are only sent when the other clients' prediction of where we are drifts too far.
+    // "-error E" on the command line sets how far, in units.
+    FLOAT fPositionError = DEFAULT_POSITION_ERROR;
+    const CHAR * strError = strstr( lpCmdLine, "-error " );
+    if( strError )
+        fPositionError = (FLOAT)atof( strError + 7 );
+    DeadReckoning reckoning;
+    reckoning.Create( fPositionError, DEFAULT_YAW_ERROR, 1000 / UPDATE_FREQUENCY );
+
+    // An authoritative server is sent inputs instead, several times a second
+    DWORD dwLastInputSend = 0;
 
     // This identity matrix is used to render the terrain
     D3DXMATRIXA16 mxIdentity;
@@ -1348,21 +1585,17 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE, LPSTR, int )
 
     // Create a window
     if( SUCCEEDED(InitializeWinsock( &sSocket, &hRecvEvent )) &&
-        SUCCEEDED(ConnectToServer( sSocket, hRecvEvent )) &&
+        SUCCEEDED(players.History.Create( SNAPSHOT_HISTORY_SIZE )) &&
+        SUCCEEDED(ConnectToServer( sSocket, hRecvEvent, &dwLocalPlayerID, &players.fWorldBound, &dwLogOnFlags )) &&
         NULL != (hWnd = CreateFullscreenWindow( hInstance, wc.lpszClassName, "NetGame Skeleton by Unseen Studios" )) &&
         NULL != (pd3dDevice = CreateD3DDevice( hWnd, pD3D, &d3dpp )) &&
         SUCCEEDED(LoadTerrain( pd3dDevice, &pGrassTexture, &pGrassVB )) &&
         NULL != (pDI = CreateDirectInput()) &&
         SUCCEEDED(CreateInputDevices( pDI, hWnd, &pMouse, &pKeyboard)) &&
         SUCCEEDED(player.mesh.LoadMeshFromX( pd3dDevice, "tiny/tiny_4anim.x", &allocHierarchy )) &&
-        SUCCEEDED(player.mesh.CloneAnimationController( 2, &player.pController )) )
+        SUCCEEDED(player.instance.Create( &player.mesh, 2 )) &&
+        SUCCEEDED(player.instance.GetAnimationController( &player.pController )) )
     {
-        // Initialize the other player array
-        {
-            for( int i = 0; i < MAX_USERS; ++i )
-                InitOtherPlayer( &player.mesh, &players[i] );
-        }
-
         // Acquire the mouse and keyboard
         pMouse->Acquire();
         pKeyboard->Acquire();
@@ -1387,7 +1620,7 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE, LPSTR, int )
                                BACKGROUND_COLOR, 1.0f, 0 );
 
             // Update the messages from the server
-            ProcessNetworkMessages( players, sSocket, hRecvEvent );
+            ProcessNetworkMessages( &players, dwLocalPlayerID, &player.Prediction, sSocket, hRecvEvent );
 
             // These variables are used to update input
             BYTE keys[256];
@@ -1407,30 +1640,26 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE, LPSTR, int )
                 UpdatePlayer( fElapsedTime, &player );
             }
 
-            // Tell the server what settings have changed
+            // Tell the server what has changed, if the other clients couldn't have predicted it.
+            // An authoritative server gets every input instead, and moves the player itself.
+            if( dwLogOnFlags & LOGON_AUTHORITATIVE )
             {
-                FLOAT fTime = GetTickCount() / 1000.0f;
-                static FLOAT fLastUpdate = fTime;
-
-                // Update the server periodically
-                if( (1.0f / UPDATE_FREQUENCY) < (fTime - fLastUpdate) )
+                DWORD dwTime = GetTickCount();
+                if( dwTime - dwLastInputSend >= 1000 / INPUT_SEND_FREQUENCY )
+                {
+                    SendPlayerInputs( sSocket, &player.Prediction );
+                    dwLastInputSend = dwTime;
+                }
+            }
+            else
+            {
+                DWORD dwTime = GetTickCount();
+                PlayerState state;
+                GetPlayerState( dwLocalPlayerID, &player, &state );
+                if( reckoning.NeedsUpdate( &state, dwTime ) )
                 {
-                    UpdatePlayerMessage upm;
-                    upm.dwPlayerID = 0;
-                    upm.fVelocity[0] = player.fVelocity;
-                    upm.fVelocity[1] = 0.0f;
-                    upm.fVelocity[2] = 0.0f;
-                    upm.fPosition[0] = player.vPosition.x;
-                    upm.fPosition[1] = player.vPosition.y;
-                    upm.fPosition[2] = player.vPosition.z;
-                    upm.dwState = player.dwState;
-                    upm.fYaw = player.fTargetPlayerYaw;
-
-                    // Send off the packet
-                    send( sSocket, (CHAR*)&upm, sizeof(upm), 0 );
-
-                    // Store the last update time
-                    fLastUpdate = fTime;
+                    SendPlayerUpdate( sSocket, players.fWorldBound, &state );
+                    reckoning.Sent( &state, players.fWorldBound, dwTime );
                 }
             }
             
@@ -1441,49 +1670,44 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE, LPSTR, int )
                 SetPlayerCamera( pd3dDevice, &player );
 
                 // Draw the Stan model
-                player.pController->AdvanceTime( max( fElapsedTime, 0.0f ), NULL );
-                player.mesh.Render( &player.matPosition );
+                player.instance.Update( max( fElapsedTime, 0.0f ), &player.matPosition );
+                player.instance.Render();
 
                 // Draw the other players
                 {
+                    // Everyone is drawn a little in the past, so that there's a snapshot on
+                    // either side of the time being drawn
+                    players.Clock.Advance( GetTickCount() );
+
                     // Run through the list of players
-                    for( int i = 0; i < MAX_USERS; ++i )
+                    for( DWORD i = 0; i < players.dwCapacity; ++i )
                     {
                         // If the player is active, render it
-                        if( players[i].bActive )
+                        OtherPlayer * pOther = &players.pPlayers[i];
+                        if( pOther->bActive && pOther->pInstance )
                         {
-                            // Advance the controller's time step
-                            players[i].pController->AdvanceTime( max( fElapsedTime, 0.0f ), NULL );
-
-                            // Extract render positions
+                            // Find where the player is at the time being drawn.  The yaw is where
+                            // the player is turning toward, so it's still eased in.
                             {
-                                FLOAT fTime = GetTickCount() / 1000.0f;
-                                FLOAT fTimeToNew = fTime - players[i].fNewTime;
-                                FLOAT fTimeDelta = players[i].fNewTime - players[i].fOldTime;
-                                D3DXVECTOR3 vPosDiff = players[i].vNewPos - players[i].vOldPos;
-
-                                D3DXVECTOR3 vNewRenderPos;
-                                if( fTimeDelta > 0.0f )
-                                    vNewRenderPos = players[i].vNewPos + (fTimeToNew / fTimeDelta) * vPosDiff;
-                                else
-                                    vNewRenderPos = players[i].vNewPos;
-
-                                D3DXVec3Lerp( &players[i].vRenderPos, &players[i].vRenderPos, &vNewRenderPos, 0.5f );
-                                players[i].fRenderYaw = players[i].fRenderYaw + 0.5f * (players[i].fYaw - players[i].fRenderYaw);
+                                PlayerState state;
+                                if( pOther->Snapshots.Sample( &players.Clock, &state ) )
+                                    UpdateOtherPlayer( pOther, &state );
+                                pOther->fRenderYaw = pOther->fRenderYaw + 0.5f * (pOther->fYaw - pOther->fRenderYaw);
                             }
 
                             // Use the interpolated position to generate a matrix
                             D3DXMATRIXA16 matScale, matTransform, matRotation, matPosition;
                             D3DXMatrixScaling( &matScale, 0.0015f, 0.0015f, 0.0015f );
-                            D3DXMatrixTranslation( &matTransform, players[i].vRenderPos.x,
-                                                                  players[i].vRenderPos.y,
-                                                                  players[i].vRenderPos.z );
-                            D3DXMatrixRotationYawPitchRoll( &matRotation, players[i].fRenderYaw + D3DX_PI, -D3DX_PI/2, 0.0f );
+                            D3DXMatrixTranslation( &matTransform, pOther->vRenderPos.x,
+                                                                  pOther->vRenderPos.y,
+                                                                  pOther->vRenderPos.z );
+                            D3DXMatrixRotationYawPitchRoll( &matRotation, pOther->fRenderYaw + D3DX_PI, -D3DX_PI/2, 0.0f );
                             D3DXMatrixMultiply( &matPosition, &matScale, &matRotation );
                             D3DXMatrixMultiply( &matPosition, &matPosition, &matTransform );
 
-                            // Render the player matrix
-                            player.mesh.Render( &matPosition );
+                            // Pose the player there and draw it
+                            pOther->pInstance->Update( max( fElapsedTime, 0.0f ), &matPosition );
+                            pOther->pInstance->Render();
                         }
                     }
                 }
@@ -1511,10 +1735,7 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE, LPSTR, int )
                 pKeyboard->Unacquire();
 
                 // Erase other players' device objects
-                {
-                    for( int i = 0; i < MAX_USERS; ++i )
-                        ReleaseOtherPlayer( &players[i] );
-                }
+                ReleaseOtherPlayers( &players );
 
                 // Free the device-dependant objects
                 player.pController->Release();
@@ -1522,6 +1743,7 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE, LPSTR, int )
                 player.pIdleAnimation->Release();
                 player.pRunAnimation->Release();
 
+                player.instance.Release();
                 player.mesh.Release();
                 pGrassTexture->Release();
                 pGrassVB->Release();
@@ -1535,7 +1757,7 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE, LPSTR, int )
                 pGrassVB = NULL;
 
                 // Wait for the device to return
-                if( FAILED( WaitForLostDevice( sSocket, &player, pd3dDevice, &d3dpp ) ) )
+                if( FAILED( WaitForLostDevice( sSocket, dwLocalPlayerID, players.fWorldBound, (dwLogOnFlags & LOGON_AUTHORITATIVE) != 0, &player, pd3dDevice, &d3dpp ) ) )
                     break;
 
                 // Initialize D3D settings for this scene
@@ -1544,15 +1766,10 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE, LPSTR, int )
                 // Reload the device objects
                 if( FAILED( LoadTerrain( pd3dDevice, &pGrassTexture, &pGrassVB ) ) ||
                     FAILED(player.mesh.LoadMeshFromX( pd3dDevice, "tiny/tiny_4anim.x", &allocHierarchy )) ||
-                    FAILED(player.mesh.CloneAnimationController( 2, &player.pController )) )
+                    FAILED(player.instance.Create( &player.mesh, 2 )) ||
+                    FAILED(player.instance.GetAnimationController( &player.pController )) )
                     break;
 
-                // Bring other players back
-                {
-                    for( int i = 0; i < MAX_USERS; ++i )
-                        InitOtherPlayer( &player.mesh, &players[i] );
-                }
-
                 // Set up the animation sets
                 player.pController->GetAnimationSet( TINYTRACK_WALK,        &player.pWalkAnimation );
                 player.pController->GetAnimationSet( TINYTRACK_IDLE,        &player.pIdleAnimation );
@@ -1562,8 +1779,14 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE, LPSTR, int )
                 player.pController->SetTrackAnimationSet( 0, player.pIdleAnimation );
                 player.pController->SetTrackEnable( 0, TRUE );
 
-                // Reset motion
-                player.fVelocity = 0.0f;
+                // Reset motion.  An authoritative server keeps its own, and the prediction has to
+                // keep counting inputs from where it left off.
+                if( !(dwLogOnFlags & LOGON_AUTHORITATIVE) )
+                {
+                    MovementState stopped = *player.Prediction.GetMovement();
+                    stopped.fVelocity = 0.0f;
+                    player.Prediction.Reset( &stopped );
+                }
 
                 // Re-acquire input
                 pMouse->Acquire();
@@ -1598,10 +1821,8 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE, LPSTR, int )
         pDI->Release();
 
     // Release all of the other players
-    {
-        for( int i = 0; i < MAX_USERS; ++i )
-            ReleaseOtherPlayer( &players[i] );
-    }
+    ReleaseOtherPlayers( &players );
+    FreeOtherPlayerTable( &players );
 
     // Get rid of animation stuff
     if( player.pWalkAnimation )
@@ -1612,6 +1833,7 @@ int WINAPI WinMain( HINSTANCE hInstance, HINSTANCE, LPSTR, int )
         player.pRunAnimation->Release();
     if( player.pController )
         player.pController->Release();
+    player.instance.Release();
     player.mesh.Release();
 
     // Release Direct3D resources
@@ -0,0 +1,98 @@
+//------------------------------------------------------------------------------------------------
+// File:    skinning.cpp
+//
+// Desc:    Builds the matrix palette that skinned meshes are drawn with
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "skinning.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#define SKINNING_SSE
+#endif
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ComputeSkinningPalette
+// Desc:  Multiplies each bone's offset by its frame's world matrix.  Every row of the product is
+//        the offset row's four elements spread across the four rows of the world matrix.
+//------------------------------------------------------------------------------------------------
+VOID ComputeSkinningPalette( const FLOAT * pOffsets, const DWORD * pdwBoneFrames,
+                             const FLOAT * pWorldMatrices, DWORD dwNumBones, FLOAT * pPalette )
+{
+#ifdef SKINNING_SSE
+    for( DWORD i = 0; i < dwNumBones; ++i )
+    {
+        const FLOAT * pWorld = &pWorldMatrices[pdwBoneFrames[i] * 16];
+        __m128 w0 = _mm_load_ps( pWorld + 0 );
+        __m128 w1 = _mm_load_ps( pWorld + 4 );
+        __m128 w2 = _mm_load_ps( pWorld + 8 );
+        __m128 w3 = _mm_load_ps( pWorld + 12 );
+        const FLOAT * pOffset = &pOffsets[i * 16];
+        FLOAT * pFinal = &pPalette[i * 16];
+        for( DWORD r = 0; r < 16; r += 4 )
+        {
+            __m128 o = _mm_load_ps( pOffset + r );
+            __m128 row = _mm_mul_ps( _mm_shuffle_ps( o, o, _MM_SHUFFLE(0,0,0,0) ), w0 );
+            row = _mm_add_ps( row, _mm_mul_ps( _mm_shuffle_ps( o, o, _MM_SHUFFLE(1,1,1,1) ), w1 ) );
+            row = _mm_add_ps( row, _mm_mul_ps( _mm_shuffle_ps( o, o, _MM_SHUFFLE(2,2,2,2) ), w2 ) );
+            row = _mm_add_ps( row, _mm_mul_ps( _mm_shuffle_ps( o, o, _MM_SHUFFLE(3,3,3,3) ), w3 ) );
+            _mm_store_ps( pFinal + r, row );
+        }
+    }
+#else
+    ComputeSkinningPaletteReference( pOffsets, pdwBoneFrames, pWorldMatrices, dwNumBones, pPalette );
+#endif
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ComputeSkinningPaletteReference
+// Desc:  
+//------------------------------------------------------------------------------------------------
+VOID ComputeSkinningPaletteReference( const FLOAT * pOffsets, const DWORD * pdwBoneFrames,
+                                      const FLOAT * pWorldMatrices, DWORD dwNumBones,
+                                      FLOAT * pPalette )
+{
+    for( DWORD i = 0; i < dwNumBones; ++i )
+    {
+        const FLOAT * pWorld = &pWorldMatrices[pdwBoneFrames[i] * 16];
+        const FLOAT * pOffset = &pOffsets[i * 16];
+        FLOAT * pFinal = &pPalette[i * 16];
+        for( DWORD r = 0; r < 4; ++r )
+        {
+            for( DWORD c = 0; c < 4; ++c )
+            {
+                pFinal[r*4 + c] = pOffset[r*4 + 0] * pWorld[0*4 + c] +
+                                  pOffset[r*4 + 1] * pWorld[1*4 + c] +
+                                  pOffset[r*4 + 2] * pWorld[2*4 + c] +
+                                  pOffset[r*4 + 3] * pWorld[3*4 + c];
+            }
+        }
+    }
+}
@@ -0,0 +1,61 @@
+//------------------------------------------------------------------------------------------------
+// File:    skinning.h
+//
+// Desc:    Builds the matrix palette that skinned meshes are drawn with.  Nothing here depends on
+//          Direct3D, so it can be checked and timed on the CPU alone.
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __SKINNING_H__
+#define __SKINNING_H__
+
+// Include files required to compile this header
+#include "../common/platform.h"
+
+
+/**
+ * Computes the final matrix of every bone:  its offset matrix times the world matrix of the
+ * frame it follows.  Matrices are 16 floats laid out like a D3DXMATRIX, and every array of
+ * them has to be 16-byte aligned.  Uses SSE where the compiler has it.
+ *   @param pOffsets Each bone's offset matrix
+ *   @param pdwBoneFrames Index of the frame that each bone follows
+ *   @param pWorldMatrices World matrix of each frame
+ *   @param dwNumBones How many bones there are
+ *   @param pPalette Receives one matrix per bone
+ */
+VOID ComputeSkinningPalette( const FLOAT * pOffsets, const DWORD * pdwBoneFrames,
+                             const FLOAT * pWorldMatrices, DWORD dwNumBones, FLOAT * pPalette );
+
+/**
+ * Plain C++ version of ComputeSkinningPalette to check it against
+ */
+VOID ComputeSkinningPaletteReference( const FLOAT * pOffsets, const DWORD * pdwBoneFrames,
+                                      const FLOAT * pWorldMatrices, DWORD dwNumBones,
+                                      FLOAT * pPalette );
+
+
+#endif // __SKINNING_H__
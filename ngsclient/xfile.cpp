@@ -0,0 +1,1897 @@
+//------------------------------------------------------------------------------------------------
+// File:    xfile.cpp
+//
+// Desc:    Native reader for text X files:  frames, skinned meshes and animation sets
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "xfile.h"
+#include <stdlib.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Arenas hand out memory from blocks at least this big
+#define ARENA_BLOCK_SIZE        (256 * 1024)
+
+// Frames can't be nested deeper than this
+#define MAX_FRAME_DEPTH         256
+
+// Numbers with more digits than fit in 64 bits are left to strtod
+#define MAX_FAST_DIGITS         19
+
+// Eight copies of a byte, for working on eight characters at once
+#define BYTES( b )              (0x0101010101010101ULL * (BYTE)(b))
+
+// Exact powers of ten.  Doubles can hold them without rounding up to 10^22.
+static const QWORD s_qwPowersOfTen[9] = { 1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL,
+                                          1000000ULL, 10000000ULL, 100000000ULL };
+static const DOUBLE s_dPowersOfTen[23] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                           1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+                                           1e20, 1e21, 1e22 };
+
+
+/**
+ * Hands out memory from large blocks and frees it all at once.  Each parsing job has its own.
+ *   @author Karl Gluck
+ */
+class XArena
+{
+    public:
+
+        XArena();
+        ~XArena();
+
+        VOID * Allocate( DWORD dwCount, DWORD dwElementSize );
+        VOID Release();
+
+    protected:
+
+        struct Block
+        {
+            Block * pNext;
+            size_t stSize;
+            size_t stUsed;
+        };
+
+        Block * m_pBlocks;
+};
+
+
+/**
+ * Reads tokens straight out of the mapped file.  Commas and semicolons are treated as
+ * whitespace, since every list in the file says up front how long it is.  Errors are sticky:
+ * once something fails to parse, every read after it fails as well.
+ *   @author Karl Gluck
+ */
+class XTokenizer
+{
+    public:
+
+        XTokenizer( const CHAR * pStart, const CHAR * pEnd );
+
+        VOID SkipSpace();
+        BOOL AtEnd();
+        BOOL Peek( CHAR c );
+        BOOL Expect( CHAR c );
+        BOOL ReadName( XString * pName );
+        BOOL ReadString( XString * pString );
+        DWORD ReadDword();
+        DWORD ReadCount();
+        FLOAT ReadFloat();
+        VOID ReadFloats( FLOAT * pValues, DWORD dwCount );
+        BOOL ReadObjectStart( XString * pName );
+        BOOL SkipBlock();
+        BOOL SkipObject();
+        BOOL SkipReference( XString * pName );
+
+        BOOL Failed() const         { return m_bFailed; }
+        VOID Fail()                 { m_bFailed = TRUE; m_pCur = m_pEnd; }
+        const CHAR * GetPosition() const { return m_pCur; }
+
+    protected:
+
+        VOID SkipLine();
+        DWORD ReadDigits( QWORD * pqwValue );
+        FLOAT ReadFloatSlowly( const CHAR * pStart );
+
+    protected:
+
+        const CHAR * m_pCur;
+        const CHAR * m_pEnd;
+        BOOL m_bFailed;
+};
+
+
+/**
+ * Turns the objects in one job's range of the file into frames, meshes or an animation set
+ *   @author Karl Gluck
+ */
+class XParser
+{
+    public:
+
+        XParser( const CHAR * pStart, const CHAR * pEnd, XArena * pArena );
+
+        HRESULT ParseScene();
+        HRESULT ParseAnimationSet( XAnimationSet * pSet );
+
+        XFrame * m_pFrames;
+        DWORD m_dwNumFrames;
+        XMesh * m_pMeshes;
+        DWORD m_dwNumMeshes;
+        XMaterial * m_pMaterials;
+        DWORD m_dwNumMaterials;
+
+    protected:
+
+        BOOL ParseFrame( DWORD dwParent, DWORD dwDepth );
+        BOOL ParseMesh( DWORD dwFrame, XMesh * pMesh );
+        BOOL ParseMaterialList( XMesh * pMesh, DWORD ** ppFaceMaterials, DWORD * pdwNumFaceMaterials );
+        BOOL ParseMaterial( XMaterial * pMaterial );
+        BOOL ParseSkinWeights( XSkinWeights * pBone );
+        BOOL ParseAnimation( XAnimation * pAnimation );
+        BOOL ParseAnimationKey( XAnimation * pAnimation );
+        BOOL SplitVertices( XMesh * pMesh, const DWORD * pNormalIndices, const FLOAT * pNormals,
+                            DWORD dwNumNormals );
+        const XMaterial * FindMaterial( const XString * pName ) const;
+        VOID * Allocate( DWORD dwCount, DWORD dwElementSize );
+        VOID * Grow( VOID * pArray, DWORD dwCount, DWORD * pdwCapacity, DWORD dwElementSize );
+
+    protected:
+
+        XTokenizer m_Tokens;
+        XArena * m_pArena;
+        BOOL m_bOutOfMemory;
+        DWORD m_dwFrameCapacity;
+        DWORD m_dwMeshCapacity;
+        DWORD m_dwMaterialCapacity;
+};
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CountTrailingZeros
+// Desc:  Index of the lowest set bit.  The value can't be zero.
+//------------------------------------------------------------------------------------------------
+static inline DWORD CountTrailingZeros( QWORD qwValue )
+{
+#if defined(_MSC_VER)
+    unsigned long ulIndex;
+    if( _BitScanForward( &ulIndex, (unsigned long)qwValue ) )
+        return ulIndex;
+    _BitScanForward( &ulIndex, (unsigned long)(qwValue >> 32) );
+    return 32 + ulIndex;
+#else
+    return (DWORD)__builtin_ctzll( qwValue );
+#endif
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  LoadEightCharacters
+// Desc:  Reads eight characters as one little-endian word, so the first character is in the
+//        low byte.  Past the end of the file it reads spaces.
+//------------------------------------------------------------------------------------------------
+static inline QWORD LoadEightCharacters( const CHAR * pCur, const CHAR * pEnd )
+{
+    QWORD qwWord;
+    if( pEnd - pCur >= 8 )
+        memcpy( &qwWord, pCur, 8 );
+    else
+    {
+        qwWord = BYTES(' ');
+        memcpy( &qwWord, pCur, pEnd - pCur );
+    }
+    return qwWord;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CountLeadingDigits
+// Desc:  How many of the characters in a word, starting from the first, are decimal digits
+//------------------------------------------------------------------------------------------------
+static inline DWORD CountLeadingDigits( QWORD qwWord )
+{
+    // A byte is a digit if its high nibble is 3 both before and after adding 6
+    QWORD qwNotDigit = ((qwWord & BYTES(0xF0)) ^ BYTES(0x30)) |
+                       (((qwWord + BYTES(0x06)) & BYTES(0xF0)) ^ BYTES(0x30));
+    return qwNotDigit ? CountTrailingZeros( qwNotDigit ) / 8 : 8;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ConvertEightDigits
+// Desc:  Turns eight digit characters into their value with three multiplies, by combining
+//        neighbouring digits, then pairs, then quads.
+//------------------------------------------------------------------------------------------------
+static inline DWORD ConvertEightDigits( QWORD qwWord )
+{
+    qwWord = ((qwWord & BYTES(0x0F)) * 2561) >> 8;
+    qwWord = ((qwWord & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+    return (DWORD)(((qwWord & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  FindSpecialCharacter
+// Desc:  Returns a mask with the high bit set in the first byte of the word that starts a
+//        block, ends one, starts a string or might start a comment.  Bytes after the first
+//        match may be set when they shouldn't be.
+//------------------------------------------------------------------------------------------------
+static inline QWORD FindSpecialCharacter( QWORD qwWord )
+{
+    QWORD qwOpen = qwWord ^ BYTES('{');
+    QWORD qwClose = qwWord ^ BYTES('}');
+    QWORD qwQuote = qwWord ^ BYTES('"');
+    QWORD qwSlash = qwWord ^ BYTES('/');
+    QWORD qwHash = qwWord ^ BYTES('#');
+    return (((qwOpen - BYTES(1)) & ~qwOpen) | ((qwClose - BYTES(1)) & ~qwClose) |
+            ((qwQuote - BYTES(1)) & ~qwQuote) | ((qwSlash - BYTES(1)) & ~qwSlash) |
+            ((qwHash - BYTES(1)) & ~qwHash)) & BYTES(0x80);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  IsSeparator
+// Desc:  Whitespace, commas and semicolons
+//------------------------------------------------------------------------------------------------
+static inline BOOL IsSeparator( CHAR c )
+{
+    return (BYTE)c <= ' ' || c == ',' || c == ';';
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  IsNameCharacter
+// Desc:  Anything that isn't a separator or punctuation can be part of a name
+//------------------------------------------------------------------------------------------------
+static inline BOOL IsNameCharacter( CHAR c )
+{
+    return !IsSeparator( c ) && c != '{' && c != '}' && c != '"' && c != '<' && c != '>';
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SetIdentity
+// Desc:  Sets a row-major 4x4 matrix to the identity
+//------------------------------------------------------------------------------------------------
+static VOID SetIdentity( FLOAT * pMatrix )
+{
+    for( DWORD i = 0; i < 16; ++i )
+        pMatrix[i] = (i % 5) == 0 ? 1.0f : 0.0f;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  XArena
+// Desc:  
+//------------------------------------------------------------------------------------------------
+XArena::XArena()
+{
+    m_pBlocks = NULL;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~XArena
+// Desc:  
+//------------------------------------------------------------------------------------------------
+XArena::~XArena()
+{
+    Release();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Allocate
+// Desc:  Gets zeroed, 16-byte aligned memory for an array.  Returns NULL if there isn't enough.
+//------------------------------------------------------------------------------------------------
+VOID * XArena::Allocate( DWORD dwCount, DWORD dwElementSize )
+{
+    // Guard against the size overflowing; no file is big enough to need that much
+    QWORD qwSize = ((QWORD)dwCount * dwElementSize + 15) & ~15ULL;
+    if( qwSize > 0x40000000 )
+        return NULL;
+    size_t stSize = (size_t)qwSize;
+    if( stSize == 0 )
+        stSize = 16;
+
+    // The header is padded so that malloc's alignment carries over to the rest of the block
+    const size_t stHeaderSize = (sizeof(Block) + 15) & ~(size_t)15;
+    if( !m_pBlocks || m_pBlocks->stUsed + stSize > m_pBlocks->stSize )
+    {
+        size_t stBlockSize = stSize > ARENA_BLOCK_SIZE ? stSize : ARENA_BLOCK_SIZE;
+        BYTE * pMemory = (BYTE*)malloc( stHeaderSize + stBlockSize );
+        if( !pMemory )
+            return NULL;
+        Block * pBlock = (Block*)pMemory;
+        pBlock->pNext = m_pBlocks;
+        pBlock->stSize = stBlockSize;
+        pBlock->stUsed = 0;
+        m_pBlocks = pBlock;
+    }
+
+    BYTE * pData = (BYTE*)m_pBlocks + stHeaderSize + m_pBlocks->stUsed;
+    m_pBlocks->stUsed += stSize;
+    memset( pData, 0, stSize );
+    return pData;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Release
+// Desc:  Frees everything the arena has handed out
+//------------------------------------------------------------------------------------------------
+VOID XArena::Release()
+{
+    while( m_pBlocks )
+    {
+        Block * pNext = m_pBlocks->pNext;
+        free( m_pBlocks );
+        m_pBlocks = pNext;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  XTokenizer
+// Desc:  
+//------------------------------------------------------------------------------------------------
+XTokenizer::XTokenizer( const CHAR * pStart, const CHAR * pEnd )
+{
+    m_pCur = pStart;
+    m_pEnd = pEnd;
+    m_bFailed = FALSE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SkipSpace
+// Desc:  Moves past separators and comments
+//------------------------------------------------------------------------------------------------
+VOID XTokenizer::SkipSpace()
+{
+    for( ;; )
+    {
+        while( m_pCur < m_pEnd && IsSeparator( *m_pCur ) )
+            ++m_pCur;
+        if( m_pCur < m_pEnd && (*m_pCur == '#' || (*m_pCur == '/' && m_pCur + 1 < m_pEnd && m_pCur[1] == '/')) )
+        {
+            SkipLine();
+            continue;
+        }
+        break;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SkipLine
+// Desc:  Moves to the end of the line, for comments
+//------------------------------------------------------------------------------------------------
+VOID XTokenizer::SkipLine()
+{
+    const CHAR * pLineEnd = (const CHAR*)memchr( m_pCur, '\n', m_pEnd - m_pCur );
+    m_pCur = pLineEnd ? pLineEnd : m_pEnd;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  AtEnd
+// Desc:  Whether there's nothing left but separators and comments
+//------------------------------------------------------------------------------------------------
+BOOL XTokenizer::AtEnd()
+{
+    SkipSpace();
+    return m_pCur >= m_pEnd;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Peek
+// Desc:  Whether the next token starts with the given character, without reading it
+//------------------------------------------------------------------------------------------------
+BOOL XTokenizer::Peek( CHAR c )
+{
+    SkipSpace();
+    return m_pCur < m_pEnd && *m_pCur == c;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Expect
+// Desc:  Reads a punctuation character, failing if it's something else
+//------------------------------------------------------------------------------------------------
+BOOL XTokenizer::Expect( CHAR c )
+{
+    if( !Peek( c ) )
+    {
+        Fail();
+        return FALSE;
+    }
+    ++m_pCur;
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ReadName
+// Desc:  Reads an identifier, such as a template or frame name
+//------------------------------------------------------------------------------------------------
+BOOL XTokenizer::ReadName( XString * pName )
+{
+    SkipSpace();
+    const CHAR * pStart = m_pCur;
+    while( m_pCur < m_pEnd && IsNameCharacter( *m_pCur ) )
+        ++m_pCur;
+    if( m_pCur == pStart )
+    {
+        Fail();
+        return FALSE;
+    }
+    pName->pText = pStart;
+    pName->dwLength = (DWORD)(m_pCur - pStart);
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ReadString
+// Desc:  Reads a quoted string, leaving out the quotes
+//------------------------------------------------------------------------------------------------
+BOOL XTokenizer::ReadString( XString * pString )
+{
+    if( !Expect( '"' ) )
+        return FALSE;
+    const CHAR * pQuote = (const CHAR*)memchr( m_pCur, '"', m_pEnd - m_pCur );
+    if( !pQuote )
+    {
+        Fail();
+        return FALSE;
+    }
+    pString->pText = m_pCur;
+    pString->dwLength = (DWORD)(pQuote - m_pCur);
+    m_pCur = pQuote + 1;
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ReadDigits
+// Desc:  Reads a run of decimal digits, up to eight at a time.  Returns how many there were;
+//        the value is only meaningful if there were no more than MAX_FAST_DIGITS.
+//------------------------------------------------------------------------------------------------
+DWORD XTokenizer::ReadDigits( QWORD * pqwValue )
+{
+    QWORD qwValue = *pqwValue;
+    DWORD dwDigits = 0;
+    for( ;; )
+    {
+        QWORD qwWord = LoadEightCharacters( m_pCur, m_pEnd );
+        DWORD dwCount = CountLeadingDigits( qwWord );
+        if( dwCount == 0 )
+            break;
+
+        // Pad the digits with leading zeroes to make eight
+        if( dwCount < 8 )
+            qwWord = (qwWord << (8 * (8 - dwCount))) | (BYTES('0') >> (8 * dwCount));
+        if( dwDigits + dwCount <= MAX_FAST_DIGITS )
+            qwValue = qwValue * s_qwPowersOfTen[dwCount] + ConvertEightDigits( qwWord );
+
+        dwDigits += dwCount;
+        m_pCur += dwCount;
+        if( dwCount < 8 )
+            break;
+    }
+    *pqwValue = qwValue;
+    return dwDigits;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ReadDword
+// Desc:  Reads an unsigned integer
+//------------------------------------------------------------------------------------------------
+DWORD XTokenizer::ReadDword()
+{
+    SkipSpace();
+    QWORD qwValue = 0;
+    DWORD dwDigits = ReadDigits( &qwValue );
+    if( dwDigits == 0 || dwDigits > 10 || qwValue > 0xFFFFFFFF )
+    {
+        Fail();
+        return 0;
+    }
+    return (DWORD)qwValue;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ReadCount
+// Desc:  Reads the length of a list.  Every entry takes at least two characters, so a count
+//        bigger than what's left of the file is an error.  This keeps a damaged file from
+//        asking for more memory than it could possibly fill.
+//------------------------------------------------------------------------------------------------
+DWORD XTokenizer::ReadCount()
+{
+    DWORD dwCount = ReadDword();
+    if( dwCount > (DWORD)(m_pEnd - m_pCur) / 2 )
+    {
+        Fail();
+        return 0;
+    }
+    return dwCount;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ReadFloat
+// Desc:  Reads a number.  The digits are gathered into a 64-bit integer and scaled by an exact
+//        power of ten, which rounds the same way strtod would.  Anything that doesn't fit goes
+//        to strtod.
+//------------------------------------------------------------------------------------------------
+FLOAT XTokenizer::ReadFloat()
+{
+    SkipSpace();
+    const CHAR * pStart = m_pCur;
+
+    BOOL bNegative = FALSE;
+    if( m_pCur < m_pEnd && (*m_pCur == '-' || *m_pCur == '+') )
+        bNegative = *m_pCur++ == '-';
+
+    QWORD qwMantissa = 0;
+    DWORD dwDigits = ReadDigits( &qwMantissa );
+    int iExponent = 0;
+    if( m_pCur < m_pEnd && *m_pCur == '.' )
+    {
+        ++m_pCur;
+        DWORD dwFraction = ReadDigits( &qwMantissa );
+        dwDigits += dwFraction;
+        iExponent = -(int)dwFraction;
+    }
+    if( dwDigits == 0 )
+    {
+        Fail();
+        return 0.0f;
+    }
+    if( m_pCur < m_pEnd && (*m_pCur == 'e' || *m_pCur == 'E') )
+    {
+        ++m_pCur;
+        BOOL bNegativeExponent = FALSE;
+        if( m_pCur < m_pEnd && (*m_pCur == '-' || *m_pCur == '+') )
+            bNegativeExponent = *m_pCur++ == '-';
+        int iValue = 0;
+        const CHAR * pDigits = m_pCur;
+        while( m_pCur < m_pEnd && *m_pCur >= '0' && *m_pCur <= '9' && iValue < 10000 )
+            iValue = iValue * 10 + (*m_pCur++ - '0');
+        if( m_pCur == pDigits )
+        {
+            Fail();
+            return 0.0f;
+        }
+        iExponent += bNegativeExponent ? -iValue : iValue;
+    }
+
+    // Exact when both the mantissa and the power of ten fit in a double
+    if( dwDigits > MAX_FAST_DIGITS || qwMantissa > (1ULL << 53) || iExponent < -22 || iExponent > 22 )
+        return ReadFloatSlowly( pStart );
+    DOUBLE dValue = (DOUBLE)(long long)qwMantissa;
+    dValue = iExponent < 0 ? dValue / s_dPowersOfTen[-iExponent] : dValue * s_dPowersOfTen[iExponent];
+    return (FLOAT)(bNegative ? -dValue : dValue);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ReadFloatSlowly
+// Desc:  Converts a number that ReadFloat has already found the end of with strtod
+//------------------------------------------------------------------------------------------------
+FLOAT XTokenizer::ReadFloatSlowly( const CHAR * pStart )
+{
+    CHAR strNumber[64];
+    DWORD dwLength = (DWORD)(m_pCur - pStart);
+    if( dwLength >= sizeof(strNumber) )
+    {
+        Fail();
+        return 0.0f;
+    }
+    memcpy( strNumber, pStart, dwLength );
+    strNumber[dwLength] = '\0';
+    return (FLOAT)strtod( strNumber, NULL );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ReadFloats
+// Desc:  Reads a list of numbers whose length is already known
+//------------------------------------------------------------------------------------------------
+VOID XTokenizer::ReadFloats( FLOAT * pValues, DWORD dwCount )
+{
+    for( DWORD i = 0; i < dwCount; ++i )
+        pValues[i] = ReadFloat();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ReadObjectStart
+// Desc:  Reads the optional name and the opening brace of an object whose type has been read,
+//        along with the optional GUID after the brace.  The name is left empty if there isn't one.
+//------------------------------------------------------------------------------------------------
+BOOL XTokenizer::ReadObjectStart( XString * pName )
+{
+    pName->pText = NULL;
+    pName->dwLength = 0;
+    if( !Peek( '{' ) && !ReadName( pName ) )
+        return FALSE;
+    if( !Expect( '{' ) )
+        return FALSE;
+    if( Peek( '<' ) )
+    {
+        const CHAR * pClose = (const CHAR*)memchr( m_pCur, '>', m_pEnd - m_pCur );
+        if( !pClose )
+        {
+            Fail();
+            return FALSE;
+        }
+        m_pCur = pClose + 1;
+    }
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SkipBlock
+// Desc:  Moves past the brace that closes the current block, and everything nested in it.
+//        The text is searched eight characters at a time for anything that could matter.
+//------------------------------------------------------------------------------------------------
+BOOL XTokenizer::SkipBlock()
+{
+    DWORD dwDepth = 1;
+    while( m_pCur < m_pEnd )
+    {
+        QWORD qwMatch = FindSpecialCharacter( LoadEightCharacters( m_pCur, m_pEnd ) );
+        if( !qwMatch )
+        {
+            m_pCur += 8;
+            continue;
+        }
+        m_pCur += CountTrailingZeros( qwMatch ) / 8;
+        if( m_pCur >= m_pEnd )
+            break;
+
+        switch( *m_pCur )
+        {
+            case '{':
+                ++dwDepth;
+                ++m_pCur;
+                break;
+
+            case '}':
+                ++m_pCur;
+                if( --dwDepth == 0 )
+                    return TRUE;
+                break;
+
+            case '"':
+            {
+                const CHAR * pQuote = (const CHAR*)memchr( m_pCur + 1, '"', m_pEnd - m_pCur - 1 );
+                m_pCur = pQuote ? pQuote + 1 : m_pEnd;
+            } break;
+
+            case '/':
+                if( m_pCur + 1 < m_pEnd && m_pCur[1] == '/' )
+                    SkipLine();
+                else
+                    ++m_pCur;
+                break;
+
+            default:
+                SkipLine();
+                break;
+        }
+    }
+
+    m_pCur = m_pEnd;
+    Fail();
+    return FALSE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SkipObject
+// Desc:  Moves past an object whose type has been read and which isn't needed
+//------------------------------------------------------------------------------------------------
+BOOL XTokenizer::SkipObject()
+{
+    XString name;
+    return ReadObjectStart( &name ) && SkipBlock();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SkipReference
+// Desc:  Reads a reference to another object, "{ Name }", once the brace has been seen
+//------------------------------------------------------------------------------------------------
+BOOL XTokenizer::SkipReference( XString * pName )
+{
+    XString name;
+    if( !pName )
+        pName = &name;
+    if( !Expect( '{' ) )
+        return FALSE;
+    if( Peek( '<' ) )
+    {
+        pName->pText = NULL;
+        pName->dwLength = 0;
+    }
+    else if( !ReadName( pName ) )
+        return FALSE;
+    return SkipBlock();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SameName
+// Desc:  Compares two names from the file
+//------------------------------------------------------------------------------------------------
+static BOOL SameName( const XString * pA, const XString * pB )
+{
+    return pA->dwLength == pB->dwLength && 0 == memcmp( pA->pText, pB->pText, pA->dwLength );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  XParser
+// Desc:  
+//------------------------------------------------------------------------------------------------
+XParser::XParser( const CHAR * pStart, const CHAR * pEnd, XArena * pArena ) : m_Tokens( pStart, pEnd )
+{
+    m_pArena = pArena;
+    m_bOutOfMemory = FALSE;
+    m_pFrames = NULL;
+    m_dwNumFrames = 0;
+    m_dwFrameCapacity = 0;
+    m_pMeshes = NULL;
+    m_dwNumMeshes = 0;
+    m_dwMeshCapacity = 0;
+    m_pMaterials = NULL;
+    m_dwNumMaterials = 0;
+    m_dwMaterialCapacity = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ParseScene
+// Desc:  Reads the frames, meshes and materials at the top level of the file, skipping the
+//        animation sets, which other jobs read
+//------------------------------------------------------------------------------------------------
+HRESULT XParser::ParseScene()
+{
+    while( !m_Tokens.AtEnd() )
+    {
+        XString type;
+        if( !m_Tokens.ReadName( &type ) )
+            break;
+
+        if( XStringEquals( &type, "Frame" ) )
+            ParseFrame( XFILE_NONE, 0 );
+        else if( XStringEquals( &type, "Mesh" ) )
+        {
+            XMesh mesh;
+            if( ParseMesh( XFILE_NONE, &mesh ) )
+            {
+                XMesh * pMeshes = (XMesh*)Grow( m_pMeshes, m_dwNumMeshes, &m_dwMeshCapacity, sizeof(XMesh) );
+                if( pMeshes )
+                {
+                    m_pMeshes = pMeshes;
+                    m_pMeshes[m_dwNumMeshes++] = mesh;
+                }
+            }
+        }
+        else if( XStringEquals( &type, "Material" ) )
+        {
+            XMaterial material;
+            if( ParseMaterial( &material ) )
+            {
+                XMaterial * pMaterials = (XMaterial*)Grow( m_pMaterials, m_dwNumMaterials, &m_dwMaterialCapacity,
+                                                           sizeof(XMaterial) );
+                if( pMaterials )
+                {
+                    m_pMaterials = pMaterials;
+                    m_pMaterials[m_dwNumMaterials++] = material;
+                }
+            }
+        }
+        else
+            m_Tokens.SkipObject();
+
+        if( m_Tokens.Failed() )
+            break;
+    }
+
+    if( m_bOutOfMemory )
+        return E_OUTOFMEMORY;
+    return m_Tokens.Failed() ? E_FAIL : S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ParseAnimationSet
+// Desc:  Reads the animation set that the job starts at
+//------------------------------------------------------------------------------------------------
+HRESULT XParser::ParseAnimationSet( XAnimationSet * pSet )
+{
+    ZeroMemory( pSet, sizeof(XAnimationSet) );
+
+    XString type;
+    if( !m_Tokens.ReadName( &type ) || !XStringEquals( &type, "AnimationSet" ) ||
+        !m_Tokens.ReadObjectStart( &pSet->Name ) )
+        return E_FAIL;
+
+    DWORD dwCapacity = 0;
+    while( !m_Tokens.Peek( '}' ) )
+    {
+        XString child;
+        if( m_Tokens.Peek( '{' ) )
+            m_Tokens.SkipReference( NULL );
+        else if( !m_Tokens.ReadName( &child ) )
+            break;
+        else if( XStringEquals( &child, "Animation" ) )
+        {
+            XAnimation * pAnimations = (XAnimation*)Grow( pSet->pAnimations, pSet->dwNumAnimations, &dwCapacity,
+                                                          sizeof(XAnimation) );
+            if( !pAnimations )
+                break;
+            pSet->pAnimations = pAnimations;
+            if( ParseAnimation( &pSet->pAnimations[pSet->dwNumAnimations] ) )
+                ++pSet->dwNumAnimations;
+        }
+        else
+            m_Tokens.SkipObject();
+
+        if( m_Tokens.Failed() )
+            break;
+    }
+    m_Tokens.Expect( '}' );
+
+    if( m_bOutOfMemory )
+        return E_OUTOFMEMORY;
+    if( m_Tokens.Failed() )
+        return E_FAIL;
+
+    // The set lasts until its last key
+    for( DWORD i = 0; i < pSet->dwNumAnimations; ++i )
+    {
+        for( DWORD j = 0; j < XKEY_TYPES; ++j )
+        {
+            const XAnimationKeys * pKeys = &pSet->pAnimations[i].Keys[j];
+            if( pKeys->dwNumKeys > 0 && pKeys->pTimes[pKeys->dwNumKeys - 1] > pSet->dwLength )
+                pSet->dwLength = pKeys->pTimes[pKeys->dwNumKeys - 1];
+        }
+    }
+
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ParseFrame
+// Desc:  Reads a frame and everything in it, once its type has been read
+//------------------------------------------------------------------------------------------------
+BOOL XParser::ParseFrame( DWORD dwParent, DWORD dwDepth )
+{
+    XString name;
+    if( dwDepth >= MAX_FRAME_DEPTH )
+        m_Tokens.Fail();
+    if( !m_Tokens.ReadObjectStart( &name ) )
+        return FALSE;
+
+    // Add the frame before its children so that parents always come first
+    XFrame * pFrames = (XFrame*)Grow( m_pFrames, m_dwNumFrames, &m_dwFrameCapacity, sizeof(XFrame) );
+    if( !pFrames )
+        return FALSE;
+    m_pFrames = pFrames;
+    DWORD dwIndex = m_dwNumFrames++;
+    m_pFrames[dwIndex].Name = name;
+    m_pFrames[dwIndex].dwParent = dwParent;
+    SetIdentity( m_pFrames[dwIndex].fTransform );
+
+    while( !m_Tokens.Peek( '}' ) )
+    {
+        XString child;
+        if( m_Tokens.Peek( '{' ) )
+            m_Tokens.SkipReference( NULL );
+        else if( !m_Tokens.ReadName( &child ) )
+            return FALSE;
+        else if( XStringEquals( &child, "FrameTransformMatrix" ) )
+        {
+            XString matrix;
+            if( m_Tokens.ReadObjectStart( &matrix ) )
+            {
+                // Children may have moved the array
+                m_Tokens.ReadFloats( m_pFrames[dwIndex].fTransform, 16 );
+                m_Tokens.Expect( '}' );
+            }
+        }
+        else if( XStringEquals( &child, "Frame" ) )
+            ParseFrame( dwIndex, dwDepth + 1 );
+        else if( XStringEquals( &child, "Mesh" ) )
+        {
+            XMesh mesh;
+            if( ParseMesh( dwIndex, &mesh ) )
+            {
+                XMesh * pMeshes = (XMesh*)Grow( m_pMeshes, m_dwNumMeshes, &m_dwMeshCapacity, sizeof(XMesh) );
+                if( pMeshes )
+                {
+                    m_pMeshes = pMeshes;
+                    m_pMeshes[m_dwNumMeshes++] = mesh;
+                }
+            }
+        }
+        else
+            m_Tokens.SkipObject();
+
+        if( m_Tokens.Failed() )
+            return FALSE;
+    }
+
+    return m_Tokens.Expect( '}' );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ParseMesh
+// Desc:  Reads a mesh and its normals, texture coordinates, materials and skin
+//------------------------------------------------------------------------------------------------
+BOOL XParser::ParseMesh( DWORD dwFrame, XMesh * pMesh )
+{
+    ZeroMemory( pMesh, sizeof(XMesh) );
+    pMesh->dwFrame = dwFrame;
+    if( !m_Tokens.ReadObjectStart( &pMesh->Name ) )
+        return FALSE;
+
+    // Positions
+    DWORD dwNumPositions = m_Tokens.ReadCount();
+    FLOAT * pPositions = (FLOAT*)Allocate( dwNumPositions * 3, sizeof(FLOAT) );
+    if( !pPositions )
+        return FALSE;
+    m_Tokens.ReadFloats( pPositions, dwNumPositions * 3 );
+
+    // Faces, split into fans of triangles
+    DWORD dwNumFaces = m_Tokens.ReadCount();
+    DWORD * pFaceTriangles = (DWORD*)Allocate( dwNumFaces, sizeof(DWORD) );
+    DWORD dwCapacity = dwNumFaces;
+    DWORD * pIndices = (DWORD*)Allocate( dwCapacity, 3 * sizeof(DWORD) );
+    DWORD dwNumTriangles = 0;
+    if( !pFaceTriangles || !pIndices )
+        return FALSE;
+    for( DWORD i = 0; i < dwNumFaces && !m_Tokens.Failed(); ++i )
+    {
+        DWORD dwCorners = m_Tokens.ReadCount();
+        DWORD dwFirst = m_Tokens.ReadDword();
+        DWORD dwPrevious = m_Tokens.ReadDword();
+        if( dwCorners < 3 || dwFirst >= dwNumPositions || dwPrevious >= dwNumPositions )
+            m_Tokens.Fail();
+        for( DWORD j = 2; j < dwCorners && !m_Tokens.Failed(); ++j )
+        {
+            DWORD dwNext = m_Tokens.ReadDword();
+            if( dwNext >= dwNumPositions || NULL == (pIndices = (DWORD*)Grow( pIndices, dwNumTriangles, &dwCapacity, 3 * sizeof(DWORD) )) )
+            {
+                m_Tokens.Fail();
+                break;
+            }
+            pIndices[dwNumTriangles * 3 + 0] = dwFirst;
+            pIndices[dwNumTriangles * 3 + 1] = dwPrevious;
+            pIndices[dwNumTriangles * 3 + 2] = dwNext;
+            ++dwNumTriangles;
+            dwPrevious = dwNext;
+        }
+        pFaceTriangles[i] = dwCorners - 2;
+    }
+
+    pMesh->dwNumVertices = dwNumPositions;
+    pMesh->pPositions = pPositions;
+    pMesh->dwNumTriangles = dwNumTriangles;
+    pMesh->pIndices = pIndices;
+
+    // Everything else is optional
+    DWORD * pNormalIndices = NULL;
+    FLOAT * pNormals = NULL;
+    DWORD dwNumNormals = 0;
+    DWORD * pFaceMaterials = NULL;
+    DWORD dwNumFaceMaterials = 0;
+    DWORD dwBoneCapacity = 0;
+    while( !m_Tokens.Peek( '}' ) )
+    {
+        XString child;
+        if( m_Tokens.Failed() )
+            return FALSE;
+        if( m_Tokens.Peek( '{' ) )
+            m_Tokens.SkipReference( NULL );
+        else if( !m_Tokens.ReadName( &child ) )
+            return FALSE;
+        else if( XStringEquals( &child, "MeshNormals" ) )
+        {
+            // Normals have their own faces, which have to match the mesh's
+            XString name;
+            if( !m_Tokens.ReadObjectStart( &name ) )
+                return FALSE;
+            dwNumNormals = m_Tokens.ReadCount();
+            if( NULL == (pNormals = (FLOAT*)Allocate( dwNumNormals * 3, sizeof(FLOAT) )) )
+                return FALSE;
+            m_Tokens.ReadFloats( pNormals, dwNumNormals * 3 );
+            if( m_Tokens.ReadCount() != dwNumFaces ||
+                NULL == (pNormalIndices = (DWORD*)Allocate( dwNumTriangles, 3 * sizeof(DWORD) )) )
+                return FALSE;
+            DWORD dwTriangle = 0;
+            for( DWORD i = 0; i < dwNumFaces && !m_Tokens.Failed(); ++i )
+            {
+                DWORD dwCorners = m_Tokens.ReadCount();
+                DWORD dwFirst = m_Tokens.ReadDword();
+                DWORD dwPrevious = m_Tokens.ReadDword();
+                if( dwCorners != pFaceTriangles[i] + 2 || dwFirst >= dwNumNormals || dwPrevious >= dwNumNormals )
+                    m_Tokens.Fail();
+                for( DWORD j = 2; j < dwCorners && !m_Tokens.Failed(); ++j )
+                {
+                    DWORD dwNext = m_Tokens.ReadDword();
+                    if( dwNext >= dwNumNormals )
+                        m_Tokens.Fail();
+                    pNormalIndices[dwTriangle * 3 + 0] = dwFirst;
+                    pNormalIndices[dwTriangle * 3 + 1] = dwPrevious;
+                    pNormalIndices[dwTriangle * 3 + 2] = dwNext;
+                    ++dwTriangle;
+                    dwPrevious = dwNext;
+                }
+            }
+            m_Tokens.Expect( '}' );
+        }
+        else if( XStringEquals( &child, "MeshTextureCoords" ) )
+        {
+            XString name;
+            if( !m_Tokens.ReadObjectStart( &name ) )
+                return FALSE;
+            if( m_Tokens.ReadCount() != dwNumPositions ||
+                NULL == (pMesh->pTexCoords = (FLOAT*)Allocate( dwNumPositions * 2, sizeof(FLOAT) )) )
+                return FALSE;
+            m_Tokens.ReadFloats( pMesh->pTexCoords, dwNumPositions * 2 );
+            m_Tokens.Expect( '}' );
+        }
+        else if( XStringEquals( &child, "MeshMaterialList" ) )
+            ParseMaterialList( pMesh, &pFaceMaterials, &dwNumFaceMaterials );
+        else if( XStringEquals( &child, "XSkinMeshHeader" ) )
+        {
+            XString name;
+            if( !m_Tokens.ReadObjectStart( &name ) )
+                return FALSE;
+            pMesh->wMaxSkinWeightsPerVertex = (WORD)m_Tokens.ReadDword();
+            pMesh->wMaxSkinWeightsPerFace = (WORD)m_Tokens.ReadDword();
+            m_Tokens.ReadDword();
+            m_Tokens.Expect( '}' );
+        }
+        else if( XStringEquals( &child, "SkinWeights" ) )
+        {
+            XSkinWeights * pBones = (XSkinWeights*)Grow( pMesh->pBones, pMesh->dwNumBones, &dwBoneCapacity,
+                                                         sizeof(XSkinWeights) );
+            if( !pBones || !ParseSkinWeights( &pBones[pMesh->dwNumBones] ) )
+                return FALSE;
+            pMesh->pBones = pBones;
+            for( DWORD i = 0; i < pBones[pMesh->dwNumBones].dwNumWeights; ++i )
+            {
+                if( pBones[pMesh->dwNumBones].pVertices[i] >= dwNumPositions )
+                    m_Tokens.Fail();
+            }
+            ++pMesh->dwNumBones;
+        }
+        else
+            m_Tokens.SkipObject();
+    }
+    if( !m_Tokens.Expect( '}' ) )
+        return FALSE;
+
+    // Give each triangle the material of the face it came from.  Faces past the end of the
+    // list use the last material in it.
+    if( pMesh->dwNumMaterials > 0 )
+    {
+        if( NULL == (pMesh->pAttributes = (DWORD*)Allocate( dwNumTriangles, sizeof(DWORD) )) )
+            return FALSE;
+        DWORD dwTriangle = 0;
+        for( DWORD i = 0; i < dwNumFaces; ++i )
+        {
+            DWORD dwMaterial = 0;
+            if( dwNumFaceMaterials > 0 )
+                dwMaterial = pFaceMaterials[i < dwNumFaceMaterials ? i : dwNumFaceMaterials - 1];
+            if( dwMaterial >= pMesh->dwNumMaterials )
+            {
+                m_Tokens.Fail();
+                return FALSE;
+            }
+            for( DWORD j = 0; j < pFaceTriangles[i]; ++j )
+                pMesh->pAttributes[dwTriangle++] = dwMaterial;
+        }
+    }
+
+    if( pNormals && !SplitVertices( pMesh, pNormalIndices, pNormals, dwNumNormals ) )
+        return FALSE;
+
+    return !m_Tokens.Failed();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ParseMaterialList
+// Desc:  Reads which material each face uses, and the materials
+//------------------------------------------------------------------------------------------------
+BOOL XParser::ParseMaterialList( XMesh * pMesh, DWORD ** ppFaceMaterials, DWORD * pdwNumFaceMaterials )
+{
+    XString name;
+    if( !m_Tokens.ReadObjectStart( &name ) )
+        return FALSE;
+
+    DWORD dwNumMaterials = m_Tokens.ReadCount();
+    DWORD dwNumFaceMaterials = m_Tokens.ReadCount();
+    DWORD * pFaceMaterials = (DWORD*)Allocate( dwNumFaceMaterials, sizeof(DWORD) );
+    XMaterial * pMaterials = (XMaterial*)Allocate( dwNumMaterials, sizeof(XMaterial) );
+    if( !pFaceMaterials || !pMaterials )
+        return FALSE;
+    for( DWORD i = 0; i < dwNumFaceMaterials; ++i )
+        pFaceMaterials[i] = m_Tokens.ReadDword();
+
+    // Materials are either written out here or refer to ones at the top level
+    DWORD dwMaterial = 0;
+    while( !m_Tokens.Peek( '}' ) )
+    {
+        XString child;
+        if( m_Tokens.Failed() )
+            return FALSE;
+        if( m_Tokens.Peek( '{' ) )
+        {
+            if( !m_Tokens.SkipReference( &child ) )
+                return FALSE;
+            const XMaterial * pMaterial = FindMaterial( &child );
+            if( !pMaterial )
+            {
+                m_Tokens.Fail();
+                return FALSE;
+            }
+            if( dwMaterial < dwNumMaterials )
+                pMaterials[dwMaterial++] = *pMaterial;
+        }
+        else if( !m_Tokens.ReadName( &child ) )
+            return FALSE;
+        else if( XStringEquals( &child, "Material" ) )
+        {
+            XMaterial material;
+            if( !ParseMaterial( &material ) )
+                return FALSE;
+            if( dwMaterial < dwNumMaterials )
+                pMaterials[dwMaterial++] = material;
+        }
+        else
+            m_Tokens.SkipObject();
+    }
+
+    pMesh->dwNumMaterials = dwNumMaterials;
+    pMesh->pMaterials = pMaterials;
+    *ppFaceMaterials = pFaceMaterials;
+    *pdwNumFaceMaterials = dwNumFaceMaterials;
+    return m_Tokens.Expect( '}' );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ParseMaterial
+// Desc:  Reads a material and the name of its texture, once its type has been read
+//------------------------------------------------------------------------------------------------
+BOOL XParser::ParseMaterial( XMaterial * pMaterial )
+{
+    ZeroMemory( pMaterial, sizeof(XMaterial) );
+    if( !m_Tokens.ReadObjectStart( &pMaterial->Name ) )
+        return FALSE;
+
+    m_Tokens.ReadFloats( pMaterial->fDiffuse, 4 );
+    pMaterial->fPower = m_Tokens.ReadFloat();
+    m_Tokens.ReadFloats( pMaterial->fSpecular, 3 );
+    m_Tokens.ReadFloats( pMaterial->fEmissive, 3 );
+
+    while( !m_Tokens.Peek( '}' ) )
+    {
+        XString child;
+        if( m_Tokens.Failed() )
+            return FALSE;
+        if( m_Tokens.Peek( '{' ) )
+            m_Tokens.SkipReference( NULL );
+        else if( !m_Tokens.ReadName( &child ) )
+            return FALSE;
+        else if( XStringEquals( &child, "TextureFilename" ) || XStringEquals( &child, "TextureFileName" ) )
+        {
+            XString name;
+            if( !m_Tokens.ReadObjectStart( &name ) || !m_Tokens.ReadString( &pMaterial->TextureFilename ) )
+                return FALSE;
+            m_Tokens.Expect( '}' );
+        }
+        else
+            m_Tokens.SkipObject();
+    }
+
+    return m_Tokens.Expect( '}' );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ParseSkinWeights
+// Desc:  Reads the vertices one bone moves and its offset matrix
+//------------------------------------------------------------------------------------------------
+BOOL XParser::ParseSkinWeights( XSkinWeights * pBone )
+{
+    XString name;
+    ZeroMemory( pBone, sizeof(XSkinWeights) );
+    if( !m_Tokens.ReadObjectStart( &name ) || !m_Tokens.ReadString( &pBone->BoneName ) )
+        return FALSE;
+
+    pBone->dwNumWeights = m_Tokens.ReadCount();
+    pBone->pVertices = (DWORD*)Allocate( pBone->dwNumWeights, sizeof(DWORD) );
+    pBone->pWeights = (FLOAT*)Allocate( pBone->dwNumWeights, sizeof(FLOAT) );
+    if( !pBone->pVertices || !pBone->pWeights )
+        return FALSE;
+    for( DWORD i = 0; i < pBone->dwNumWeights; ++i )
+        pBone->pVertices[i] = m_Tokens.ReadDword();
+    m_Tokens.ReadFloats( pBone->pWeights, pBone->dwNumWeights );
+    m_Tokens.ReadFloats( pBone->fOffset, 16 );
+
+    return m_Tokens.Expect( '}' );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ParseAnimation
+// Desc:  Reads the keys for one frame, and which frame they're for
+//------------------------------------------------------------------------------------------------
+BOOL XParser::ParseAnimation( XAnimation * pAnimation )
+{
+    XString name;
+    ZeroMemory( pAnimation, sizeof(XAnimation) );
+    pAnimation->dwFrame = XFILE_NONE;
+    if( !m_Tokens.ReadObjectStart( &name ) )
+        return FALSE;
+
+    while( !m_Tokens.Peek( '}' ) )
+    {
+        XString child;
+        if( m_Tokens.Failed() )
+            return FALSE;
+        if( m_Tokens.Peek( '{' ) )
+            m_Tokens.SkipReference( &pAnimation->FrameName );
+        else if( !m_Tokens.ReadName( &child ) )
+            return FALSE;
+        else if( XStringEquals( &child, "AnimationKey" ) )
+            ParseAnimationKey( pAnimation );
+        else
+            m_Tokens.SkipObject();
+    }
+
+    return m_Tokens.Expect( '}' );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ParseAnimationKey
+// Desc:  Reads a list of keys of one type
+//------------------------------------------------------------------------------------------------
+BOOL XParser::ParseAnimationKey( XAnimation * pAnimation )
+{
+    XString name;
+    if( !m_Tokens.ReadObjectStart( &name ) )
+        return FALSE;
+
+    DWORD dwType = m_Tokens.ReadDword();
+    DWORD dwValuesPerKey;
+    switch( dwType )
+    {
+        case XKEY_ROTATION: dwValuesPerKey = 4; break;
+        case XKEY_SCALE:
+        case XKEY_POSITION: dwValuesPerKey = 3; break;
+        case XKEY_MATRIX:   dwValuesPerKey = 16; break;
+        default:
+            m_Tokens.Fail();
+            return FALSE;
+    }
+
+    XAnimationKeys * pKeys = &pAnimation->Keys[dwType];
+    pKeys->dwNumKeys = m_Tokens.ReadCount();
+    pKeys->dwValuesPerKey = dwValuesPerKey;
+    pKeys->pTimes = (DWORD*)Allocate( pKeys->dwNumKeys, sizeof(DWORD) );
+    pKeys->pValues = (FLOAT*)Allocate( pKeys->dwNumKeys * dwValuesPerKey, sizeof(FLOAT) );
+    if( !pKeys->pTimes || !pKeys->pValues )
+        return FALSE;
+    for( DWORD i = 0; i < pKeys->dwNumKeys && !m_Tokens.Failed(); ++i )
+    {
+        pKeys->pTimes[i] = m_Tokens.ReadDword();
+        if( m_Tokens.ReadDword() != dwValuesPerKey )
+            m_Tokens.Fail();
+        m_Tokens.ReadFloats( &pKeys->pValues[i * dwValuesPerKey], dwValuesPerKey );
+    }
+
+    return m_Tokens.Expect( '}' );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SplitVertices
+// Desc:  Gives every vertex one normal.  The first normal a position is used with stays with
+//        the original vertex; each different one gets a copy of the vertex at the end, and the
+//        bones that move the original move the copies as well.
+//------------------------------------------------------------------------------------------------
+BOOL XParser::SplitVertices( XMesh * pMesh, const DWORD * pNormalIndices, const FLOAT * pNormals,
+                             DWORD dwNumNormals )
+{
+    DWORD dwNumPositions = pMesh->dwNumVertices;
+    DWORD dwNumCorners = pMesh->dwNumTriangles * 3;
+    DWORD dwMaxVertices = dwNumPositions + dwNumCorners;
+    DWORD * pNormalOf = (DWORD*)Allocate( dwMaxVertices, sizeof(DWORD) );
+    DWORD * pNextCopy = (DWORD*)Allocate( dwMaxVertices, sizeof(DWORD) );
+    DWORD * pOriginal = (DWORD*)Allocate( dwMaxVertices, sizeof(DWORD) );
+    if( !pNormalOf || !pNextCopy || !pOriginal )
+        return FALSE;
+    for( DWORD i = 0; i < dwNumPositions; ++i )
+    {
+        pNormalOf[i] = XFILE_NONE;
+        pNextCopy[i] = XFILE_NONE;
+        pOriginal[i] = i;
+    }
+
+    // Copies of a position are chained after it
+    DWORD dwNumVertices = dwNumPositions;
+    for( DWORD i = 0; i < dwNumCorners; ++i )
+    {
+        DWORD dwVertex = pMesh->pIndices[i];
+        DWORD dwNormal = pNormalIndices[i];
+        if( pNormalOf[dwVertex] == XFILE_NONE )
+            pNormalOf[dwVertex] = dwNormal;
+        else
+        {
+            DWORD dwPosition = dwVertex;
+            while( dwVertex != XFILE_NONE && pNormalOf[dwVertex] != dwNormal )
+                dwVertex = pNextCopy[dwVertex];
+            if( dwVertex == XFILE_NONE )
+            {
+                dwVertex = dwNumVertices++;
+                pNormalOf[dwVertex] = dwNormal;
+                pOriginal[dwVertex] = dwPosition;
+                pNextCopy[dwVertex] = pNextCopy[dwPosition];
+                pNextCopy[dwPosition] = dwVertex;
+            }
+        }
+        pMesh->pIndices[i] = dwVertex;
+    }
+
+    // Gather each vertex's normal
+    FLOAT * pVertexNormals = (FLOAT*)Allocate( dwNumVertices * 3, sizeof(FLOAT) );
+    if( !pVertexNormals )
+        return FALSE;
+    for( DWORD i = 0; i < dwNumVertices; ++i )
+    {
+        if( pNormalOf[i] != XFILE_NONE && pNormalOf[i] < dwNumNormals )
+            memcpy( &pVertexNormals[i * 3], &pNormals[pNormalOf[i] * 3], 3 * sizeof(FLOAT) );
+    }
+    pMesh->pNormals = pVertexNormals;
+    if( dwNumVertices == dwNumPositions )
+        return TRUE;
+
+    // Copy the positions and texture coordinates out to the new vertices
+    FLOAT * pPositions = (FLOAT*)Allocate( dwNumVertices * 3, sizeof(FLOAT) );
+    FLOAT * pTexCoords = pMesh->pTexCoords ? (FLOAT*)Allocate( dwNumVertices * 2, sizeof(FLOAT) ) : NULL;
+    if( !pPositions || (pMesh->pTexCoords && !pTexCoords) )
+        return FALSE;
+    for( DWORD i = 0; i < dwNumVertices; ++i )
+    {
+        memcpy( &pPositions[i * 3], &pMesh->pPositions[pOriginal[i] * 3], 3 * sizeof(FLOAT) );
+        if( pTexCoords )
+            memcpy( &pTexCoords[i * 2], &pMesh->pTexCoords[pOriginal[i] * 2], 2 * sizeof(FLOAT) );
+    }
+    pMesh->dwNumVertices = dwNumVertices;
+    pMesh->pPositions = pPositions;
+    pMesh->pTexCoords = pTexCoords;
+
+    // Weight the copies the same as the vertices they came from
+    for( DWORD i = 0; i < pMesh->dwNumBones; ++i )
+    {
+        XSkinWeights * pBone = &pMesh->pBones[i];
+        DWORD dwNumWeights = 0;
+        for( DWORD j = 0; j < pBone->dwNumWeights; ++j )
+        {
+            for( DWORD dwVertex = pBone->pVertices[j]; dwVertex != XFILE_NONE; dwVertex = pNextCopy[dwVertex] )
+                ++dwNumWeights;
+        }
+        if( dwNumWeights == pBone->dwNumWeights )
+            continue;
+
+        DWORD * pVertices = (DWORD*)Allocate( dwNumWeights, sizeof(DWORD) );
+        FLOAT * pWeights = (FLOAT*)Allocate( dwNumWeights, sizeof(FLOAT) );
+        if( !pVertices || !pWeights )
+            return FALSE;
+        DWORD dwWeight = 0;
+        for( DWORD j = 0; j < pBone->dwNumWeights; ++j )
+        {
+            for( DWORD dwVertex = pBone->pVertices[j]; dwVertex != XFILE_NONE; dwVertex = pNextCopy[dwVertex] )
+            {
+                pVertices[dwWeight] = dwVertex;
+                pWeights[dwWeight] = pBone->pWeights[j];
+                ++dwWeight;
+            }
+        }
+        pBone->dwNumWeights = dwNumWeights;
+        pBone->pVertices = pVertices;
+        pBone->pWeights = pWeights;
+    }
+
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  FindMaterial
+// Desc:  Looks up a material defined at the top level of the file by name
+//------------------------------------------------------------------------------------------------
+const XMaterial * XParser::FindMaterial( const XString * pName ) const
+{
+    for( DWORD i = 0; i < m_dwNumMaterials; ++i )
+    {
+        if( SameName( &m_pMaterials[i].Name, pName ) )
+            return &m_pMaterials[i];
+    }
+    return NULL;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Allocate
+// Desc:  Gets memory from the job's arena, stopping the parse if there isn't any
+//------------------------------------------------------------------------------------------------
+VOID * XParser::Allocate( DWORD dwCount, DWORD dwElementSize )
+{
+    VOID * pMemory = m_pArena->Allocate( dwCount, dwElementSize );
+    if( !pMemory )
+    {
+        m_bOutOfMemory = TRUE;
+        m_Tokens.Fail();
+    }
+    return pMemory;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Grow
+// Desc:  Makes sure an array has room for one more element, doubling it if it's full.  The
+//        old copy stays in the arena until the file is released.
+//------------------------------------------------------------------------------------------------
+VOID * XParser::Grow( VOID * pArray, DWORD dwCount, DWORD * pdwCapacity, DWORD dwElementSize )
+{
+    if( dwCount < *pdwCapacity )
+        return pArray;
+
+    DWORD dwCapacity = *pdwCapacity < 8 ? 16 : *pdwCapacity * 2;
+    VOID * pNewArray = Allocate( dwCapacity, dwElementSize );
+    if( !pNewArray )
+        return NULL;
+    if( dwCount > 0 )
+        memcpy( pNewArray, pArray, (size_t)dwCount * dwElementSize );
+    *pdwCapacity = dwCapacity;
+    return pNewArray;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  XFile
+// Desc:  
+//------------------------------------------------------------------------------------------------
+XFile::XFile()
+{
+    m_pData = NULL;
+    m_dwSize = 0;
+    m_pJobs = NULL;
+    m_dwNumJobs = 0;
+    m_lNextJob = 0;
+    m_pArenas = NULL;
+    m_pResults = NULL;
+    m_dwTicksPerSecond = XFILE_DEFAULT_TICKS_PER_SECOND;
+    m_pFrames = NULL;
+    m_dwNumFrames = 0;
+    m_pMeshes = NULL;
+    m_dwNumMeshes = 0;
+    m_pAnimationSets = NULL;
+    m_dwNumAnimationSets = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~XFile
+// Desc:  
+//------------------------------------------------------------------------------------------------
+XFile::~XFile()
+{
+    Release();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Load
+// Desc:  Maps a file and reads it, using up to dwThreads threads, including the calling one.
+//        Everything read stays valid until Release is called.
+//------------------------------------------------------------------------------------------------
+HRESULT XFile::Load( const CHAR * strFile, DWORD dwThreads )
+{
+    Release();
+
+    // Only text files can be read
+    if( m_File.Open( strFile ) )
+    {
+        m_pData = (const CHAR*)m_File.GetData();
+        m_dwSize = m_File.GetSize();
+    }
+    if( m_dwSize < 16 || 0 != memcmp( m_pData, "xof ", 4 ) || 0 != memcmp( m_pData + 8, "txt ", 4 ) )
+    {
+        Release();
+        return E_FAIL;
+    }
+
+    HRESULT hr = FindObjects();
+    if( FAILED( hr ) )
+    {
+        Release();
+        return hr;
+    }
+
+    // Every job gets its own allocator and result
+    m_pArenas = new XArena[m_dwNumJobs > 0 ? m_dwNumJobs : 1];
+    m_pResults = new HRESULT[m_dwNumJobs > 0 ? m_dwNumJobs : 1];
+    ParseObjects( dwThreads );
+    for( DWORD i = 0; i < m_dwNumJobs; ++i )
+    {
+        if( FAILED( m_pResults[i] ) )
+        {
+            hr = m_pResults[i];
+            Release();
+            return hr;
+        }
+    }
+
+    ResolveAnimations();
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Release
+// Desc:  Frees everything that was read and unmaps the file
+//------------------------------------------------------------------------------------------------
+VOID XFile::Release()
+{
+    if( m_pArenas )
+    {
+        delete [] m_pArenas;
+        m_pArenas = NULL;
+    }
+    if( m_pResults )
+    {
+        delete [] m_pResults;
+        m_pResults = NULL;
+    }
+    if( m_pJobs )
+    {
+        delete [] m_pJobs;
+        m_pJobs = NULL;
+    }
+    if( m_pAnimationSets )
+    {
+        delete [] m_pAnimationSets;
+        m_pAnimationSets = NULL;
+    }
+    m_dwNumJobs = 0;
+    m_dwTicksPerSecond = XFILE_DEFAULT_TICKS_PER_SECOND;
+    m_pFrames = NULL;
+    m_dwNumFrames = 0;
+    m_pMeshes = NULL;
+    m_dwNumMeshes = 0;
+    m_dwNumAnimationSets = 0;
+
+    m_File.Close();
+    m_pData = NULL;
+    m_dwSize = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetTicksPerSecond
+// Desc:  How many animation key ticks make a second
+//------------------------------------------------------------------------------------------------
+DWORD XFile::GetTicksPerSecond() const
+{
+    return m_dwTicksPerSecond;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetFileSize
+// Desc:  Size of the loaded file in bytes
+//------------------------------------------------------------------------------------------------
+DWORD XFile::GetFileSize() const
+{
+    return m_dwSize;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetNumFrames
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DWORD XFile::GetNumFrames() const
+{
+    return m_dwNumFrames;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetFrame
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const XFrame * XFile::GetFrame( DWORD dwIndex ) const
+{
+    return &m_pFrames[dwIndex];
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  FindFrame
+// Desc:  Looks up a frame by name, returning XFILE_NONE if there isn't one
+//------------------------------------------------------------------------------------------------
+DWORD XFile::FindFrame( const CHAR * strName ) const
+{
+    for( DWORD i = 0; i < m_dwNumFrames; ++i )
+    {
+        if( XStringEquals( &m_pFrames[i].Name, strName ) )
+            return i;
+    }
+    return XFILE_NONE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetNumMeshes
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DWORD XFile::GetNumMeshes() const
+{
+    return m_dwNumMeshes;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetMesh
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const XMesh * XFile::GetMesh( DWORD dwIndex ) const
+{
+    return &m_pMeshes[dwIndex];
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetNumAnimationSets
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DWORD XFile::GetNumAnimationSets() const
+{
+    return m_dwNumAnimationSets;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetAnimationSet
+// Desc:  Animation sets are numbered in the order they appear in the file
+//------------------------------------------------------------------------------------------------
+const XAnimationSet * XFile::GetAnimationSet( DWORD dwIndex ) const
+{
+    return &m_pAnimationSets[dwIndex];
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  FindObjects
+// Desc:  Finds where each top-level object starts and ends without reading it.  Each animation
+//        set becomes a job of its own, and everything else goes into one job, in order, so that
+//        frames keep their order and meshes can refer to materials defined before them.
+//------------------------------------------------------------------------------------------------
+HRESULT XFile::FindObjects()
+{
+    XTokenizer tokens( m_pData + 16, m_pData + m_dwSize );
+    DWORD dwCapacity = 0;
+    DWORD dwSceneJob = XFILE_NONE;
+
+    while( !tokens.AtEnd() )
+    {
+        const CHAR * pStart = tokens.GetPosition();
+        XString type;
+        if( !tokens.ReadName( &type ) )
+            break;
+
+        // This one is small enough to read right away
+        if( XStringEquals( &type, "AnimTicksPerSecond" ) )
+        {
+            XString name;
+            if( tokens.ReadObjectStart( &name ) )
+            {
+                m_dwTicksPerSecond = tokens.ReadDword();
+                tokens.Expect( '}' );
+            }
+            continue;
+        }
+
+        BOOL bAnimationSet = XStringEquals( &type, "AnimationSet" );
+        BOOL bTemplate = XStringEquals( &type, "template" );
+        if( !tokens.SkipObject() )
+            break;
+        if( bTemplate )
+            continue;
+        if( !bAnimationSet && dwSceneJob != XFILE_NONE )
+        {
+            m_pJobs[dwSceneJob].pEnd = tokens.GetPosition();
+            continue;
+        }
+
+        if( m_dwNumJobs == dwCapacity )
+        {
+            dwCapacity = dwCapacity < 8 ? 16 : dwCapacity * 2;
+            Job * pJobs = new Job[dwCapacity];
+            if( !pJobs )
+                return E_OUTOFMEMORY;
+            if( m_pJobs )
+            {
+                memcpy( pJobs, m_pJobs, m_dwNumJobs * sizeof(Job) );
+                delete [] m_pJobs;
+            }
+            m_pJobs = pJobs;
+        }
+
+        Job * pJob = &m_pJobs[m_dwNumJobs];
+        pJob->pStart = pStart;
+        pJob->pEnd = tokens.GetPosition();
+        pJob->dwAnimationSet = bAnimationSet ? m_dwNumAnimationSets++ : XFILE_NONE;
+        if( !bAnimationSet )
+            dwSceneJob = m_dwNumJobs;
+        ++m_dwNumJobs;
+    }
+
+    if( tokens.Failed() || m_dwTicksPerSecond == 0 )
+        return E_FAIL;
+
+    if( m_dwNumAnimationSets > 0 )
+    {
+        m_pAnimationSets = new XAnimationSet[m_dwNumAnimationSets];
+        if( !m_pAnimationSets )
+            return E_OUTOFMEMORY;
+        ZeroMemory( m_pAnimationSets, m_dwNumAnimationSets * sizeof(XAnimationSet) );
+    }
+
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ParseObjects
+// Desc:  Runs every job, spreading them over the threads.  The calling thread takes jobs too.
+//------------------------------------------------------------------------------------------------
+VOID XFile::ParseObjects( DWORD dwThreads )
+{
+    m_lNextJob = 0;
+    DWORD dwExtraThreads = (dwThreads < m_dwNumJobs ? dwThreads : m_dwNumJobs);
+    dwExtraThreads = dwExtraThreads > 1 ? dwExtraThreads - 1 : 0;
+
+    HANDLE * phThreads = dwExtraThreads > 0 ? new HANDLE[dwExtraThreads] : NULL;
+    if( !phThreads )
+        dwExtraThreads = 0;
+    for( DWORD i = 0; i < dwExtraThreads; ++i )
+        phThreads[i] = CreateThread( NULL, 0, ParseThread, this, 0, NULL );
+
+    ParseThread( this );
+
+    for( DWORD i = 0; i < dwExtraThreads; ++i )
+    {
+        if( phThreads[i] )
+        {
+            WaitForSingleObject( phThreads[i], INFINITE );
+            CloseHandle( phThreads[i] );
+        }
+    }
+    if( phThreads )
+        delete [] phThreads;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ParseThread
+// Desc:  Takes jobs until there are none left
+//------------------------------------------------------------------------------------------------
+DWORD WINAPI XFile::ParseThread( LPVOID pParam )
+{
+    XFile * pFile = (XFile*)pParam;
+    for( ;; )
+    {
+        DWORD dwJob = (DWORD)(InterlockedIncrement( &pFile->m_lNextJob ) - 1);
+        if( dwJob >= pFile->m_dwNumJobs )
+            break;
+        pFile->m_pResults[dwJob] = pFile->ParseJob( dwJob );
+    }
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ParseJob
+// Desc:  Reads one animation set, or all of the frames and meshes
+//------------------------------------------------------------------------------------------------
+HRESULT XFile::ParseJob( DWORD dwJob )
+{
+    const Job * pJob = &m_pJobs[dwJob];
+    XParser parser( pJob->pStart, pJob->pEnd, &m_pArenas[dwJob] );
+    if( pJob->dwAnimationSet != XFILE_NONE )
+        return parser.ParseAnimationSet( &m_pAnimationSets[pJob->dwAnimationSet] );
+
+    HRESULT hr = parser.ParseScene();
+    m_pFrames = parser.m_pFrames;
+    m_dwNumFrames = parser.m_dwNumFrames;
+    m_pMeshes = parser.m_pMeshes;
+    m_dwNumMeshes = parser.m_dwNumMeshes;
+    return hr;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ResolveAnimations
+// Desc:  Finds the frame each animation moves, once all of the jobs are done
+//------------------------------------------------------------------------------------------------
+VOID XFile::ResolveAnimations()
+{
+    for( DWORD i = 0; i < m_dwNumAnimationSets; ++i )
+    {
+        for( DWORD j = 0; j < m_pAnimationSets[i].dwNumAnimations; ++j )
+        {
+            XAnimation * pAnimation = &m_pAnimationSets[i].pAnimations[j];
+            pAnimation->dwFrame = XFILE_NONE;
+            for( DWORD k = 0; k < m_dwNumFrames; ++k )
+            {
+                if( SameName( &m_pFrames[k].Name, &pAnimation->FrameName ) )
+                {
+                    pAnimation->dwFrame = k;
+                    break;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,265 @@
+//------------------------------------------------------------------------------------------------
+// File:    xfile.h
+//
+// Desc:    Native reader for text X files:  frames, skinned meshes and animation sets
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __XFILE_H__
+#define __XFILE_H__
+
+
+// Include files required to compile this header
+#include "../common/platform.h"
+#include "mappedfile.h"
+
+// Marks a frame with no parent, or a mesh that isn't attached to a frame
+#define XFILE_NONE              0xFFFFFFFF
+
+// Animation key types, as they're numbered in the file
+#define XKEY_ROTATION           0   /* Quaternion, stored w, x, y, z */
+#define XKEY_SCALE              1
+#define XKEY_POSITION           2
+#define XKEY_MATRIX             4
+#define XKEY_TYPES              5
+
+// What D3DX assumes when a file doesn't have an AnimTicksPerSecond object
+#define XFILE_DEFAULT_TICKS_PER_SECOND  4800
+
+class XArena;
+
+/**
+ * Text that points into the mapped file instead of being copied out of it.  It isn't
+ * terminated; use dwLength.
+ */
+struct XString
+{
+    const CHAR * pText;
+    DWORD dwLength;
+};
+
+/**
+ * A frame of the hierarchy.  Frames are stored in the order they appear in the file, so a
+ * parent always comes before its children.
+ */
+struct XFrame
+{
+    XString Name;
+    DWORD dwParent;             // Index of the parent frame, or XFILE_NONE
+    FLOAT fTransform[16];       // FrameTransformMatrix, row-major like a D3DXMATRIX
+};
+
+/**
+ * A material of a mesh and the texture it names, if any
+ */
+struct XMaterial
+{
+    XString Name;
+    FLOAT fDiffuse[4];
+    FLOAT fPower;
+    FLOAT fSpecular[3];
+    FLOAT fEmissive[3];
+    XString TextureFilename;    // Empty if the material has no texture
+};
+
+/**
+ * The vertices one bone moves, how much, and the matrix that takes the mesh into the bone's
+ * space.  Vertex indices refer to the mesh's final vertices.
+ */
+struct XSkinWeights
+{
+    XString BoneName;
+    DWORD dwNumWeights;
+    DWORD * pVertices;
+    FLOAT * pWeights;
+    FLOAT fOffset[16];
+};
+
+/**
+ * A triangle mesh, ready to go into a vertex buffer.  Polygons are split into fans and, where
+ * the file gives a corner a different normal than the other corners sharing its position, the
+ * vertex is duplicated so that every vertex has exactly one position, normal and texture
+ * coordinate.
+ */
+struct XMesh
+{
+    XString Name;
+    DWORD dwFrame;              // Frame the mesh hangs from, or XFILE_NONE
+
+    DWORD dwNumVertices;
+    FLOAT * pPositions;         // 3 per vertex
+    FLOAT * pNormals;           // 3 per vertex, or NULL
+    FLOAT * pTexCoords;         // 2 per vertex, or NULL
+
+    DWORD dwNumTriangles;
+    DWORD * pIndices;           // 3 per triangle
+    DWORD * pAttributes;        // Material of each triangle, or NULL
+
+    DWORD dwNumMaterials;
+    XMaterial * pMaterials;
+
+    WORD wMaxSkinWeightsPerVertex;
+    WORD wMaxSkinWeightsPerFace;
+    DWORD dwNumBones;
+    XSkinWeights * pBones;
+};
+
+/**
+ * The keys of one type for one animation.  Each key is a time in ticks and dwValuesPerKey
+ * floats:  4 for rotations, 3 for scales and positions, 16 for matrices.
+ */
+struct XAnimationKeys
+{
+    DWORD dwNumKeys;
+    DWORD dwValuesPerKey;
+    DWORD * pTimes;
+    FLOAT * pValues;
+};
+
+/**
+ * The keys that move one frame during an animation set
+ */
+struct XAnimation
+{
+    XString FrameName;
+    DWORD dwFrame;              // Index of the frame, or XFILE_NONE if there's no such frame
+    XAnimationKeys Keys[XKEY_TYPES];
+};
+
+/**
+ * A named animation, such as a walk cycle
+ */
+struct XAnimationSet
+{
+    XString Name;
+    DWORD dwLength;             // Time of the last key, in ticks
+    DWORD dwNumAnimations;
+    XAnimation * pAnimations;
+};
+
+
+/**
+ * Reads the parts of a text X file ("xof 0303txt") that an animated character needs:  the frame
+ * hierarchy, the meshes with their materials and skin weights, and the animation sets.  It works
+ * straight out of a memory-mapped view of the file; names are left pointing into the view, and
+ * numbers are converted eight digits at a time.  A first pass only finds where each top-level
+ * object starts and ends, and then the frames and each animation set are read on their own
+ * threads.  Binary and compressed X files aren't supported.
+ *   @author Karl Gluck
+ */
+class XFile
+{
+    public:
+
+        XFile();
+        ~XFile();
+
+        HRESULT Load( const CHAR * strFile, DWORD dwThreads );
+        VOID Release();
+
+        DWORD GetTicksPerSecond() const;
+        DWORD GetFileSize() const;
+
+        DWORD GetNumFrames() const;
+        const XFrame * GetFrame( DWORD dwIndex ) const;
+        DWORD FindFrame( const CHAR * strName ) const;
+
+        DWORD GetNumMeshes() const;
+        const XMesh * GetMesh( DWORD dwIndex ) const;
+
+        DWORD GetNumAnimationSets() const;
+        const XAnimationSet * GetAnimationSet( DWORD dwIndex ) const;
+
+    protected:
+
+        HRESULT FindObjects();
+        VOID ParseObjects( DWORD dwThreads );
+        VOID ResolveAnimations();
+
+        static DWORD WINAPI ParseThread( LPVOID pParam );
+        HRESULT ParseJob( DWORD dwJob );
+
+    protected:
+
+        /**
+         * A top-level object found by FindObjects
+         */
+        struct Job
+        {
+            const CHAR * pStart;
+            const CHAR * pEnd;
+            DWORD dwAnimationSet;   // Which set this is, or XFILE_NONE for frames and meshes
+        };
+
+        MappedFile m_File;
+        const CHAR * m_pData;       // Start of the mapped file
+        DWORD m_dwSize;
+
+        Job * m_pJobs;
+        DWORD m_dwNumJobs;
+        volatile LONG m_lNextJob;   // Handed out to the parsing threads with InterlockedIncrement
+        XArena * m_pArenas;         // One per job, so that threads never share an allocator
+        HRESULT * m_pResults;       // One per job
+
+        DWORD m_dwTicksPerSecond;
+
+        XFrame * m_pFrames;
+        DWORD m_dwNumFrames;
+        XMesh * m_pMeshes;
+        DWORD m_dwNumMeshes;
+        XAnimationSet * m_pAnimationSets;
+        DWORD m_dwNumAnimationSets;
+};
+
+
+/**
+ * Compares text from the file with a terminated string
+ *   @param pString Text from the file
+ *   @param strText What to compare it with
+ *   @return TRUE if they're the same
+ */
+inline BOOL XStringEquals( const XString * pString, const CHAR * strText )
+{
+    DWORD dwLength = (DWORD)strlen( strText );
+    return pString->dwLength == dwLength && 0 == memcmp( pString->pText, strText, dwLength );
+}
+
+/**
+ * Copies text from the file into a terminated buffer, cutting it short if it doesn't fit
+ *   @param pString Text from the file
+ *   @param strBuffer Destination
+ *   @param dwBufferSize Size of the destination, including the terminator
+ */
+inline VOID XStringCopy( const XString * pString, CHAR * strBuffer, DWORD dwBufferSize )
+{
+    DWORD dwLength = pString->dwLength < dwBufferSize - 1 ? pString->dwLength : dwBufferSize - 1;
+    memcpy( strBuffer, pString->pText, dwLength );
+    strBuffer[dwLength] = '\0';
+}
+
+
+#endif // __XFILE_H__
@@ -0,0 +1,264 @@
+//------------------------------------------------------------------------------------------------
+// File:    ngsreplay.cpp
+//
+// Desc:    Feeds a capture recorded by the server back through the server's packet handling
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "../ngsserver/server.h"
+#include "../ngsserver/capturelog.h"
+#include "../ngsserver/eventlog.h"
+
+// FNV-1a hash of everything the server sent, so two builds can be checked for identical output
+#define FNV_OFFSET_BASIS        0xCBF29CE484222325ULL
+#define FNV_PRIME               0x100000001B3ULL
+
+
+/**
+ * Stands in for the server's sockets.  Nothing is sent; the packets are only counted and hashed.
+ */
+struct ReplayOutput
+{
+    QWORD qwPackets;
+    QWORD qwBytes;
+    QWORD qwHash;
+};
+
+/**
+ * Where the time went during the replay
+ */
+struct ReplayStatistics
+{
+    QWORD qwDatagrams;
+    QWORD qwTicks;
+    QWORD qwUnknown;
+    DOUBLE dDatagramNs;
+    DOUBLE dTickNs;
+    DOUBLE dMaxTickNs;
+};
+
+
+// Global variables
+CaptureLog g_Capture;
+ReplayOutput g_Output;
+ReplayStatistics g_Stats;
+Room g_Room;
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetNanosecondCount
+// Desc:  Reads the high-resolution counter in nanoseconds
+//------------------------------------------------------------------------------------------------
+DOUBLE GetNanosecondCount()
+{
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter( &count );
+    QueryPerformanceFrequency( &frequency );
+    return (DOUBLE)count.QuadPart * 1.0e9 / (DOUBLE)frequency.QuadPart;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ReplaySend
+// Desc:  The send function given to every user
+//------------------------------------------------------------------------------------------------
+int ReplaySend( LPVOID pContext, const SOCKADDR_IN * pAddress, const CHAR * pBuffer, int length )
+{
+    ReplayOutput * pOutput = (ReplayOutput*)pContext;
+    pOutput->qwPackets++;
+    pOutput->qwBytes += length;
+
+    // Hash the destination along with the contents, so misrouted packets show up too
+    QWORD qwHash = pOutput->qwHash;
+    const BYTE * pAddressBytes = (const BYTE*)&pAddress->sin_addr;
+    for( DWORD i = 0; i < 4; ++i )
+        qwHash = (qwHash ^ pAddressBytes[i]) * FNV_PRIME;
+    for( int i = 0; i < length; ++i )
+        qwHash = (qwHash ^ (BYTE)pBuffer[i]) * FNV_PRIME;
+    pOutput->qwHash = qwHash;
+
+    return length;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  WaitUntil
+// Desc:  Sleeps until qwTime microseconds after qwStart, then spins for the last millisecond
+//------------------------------------------------------------------------------------------------
+VOID WaitUntil( QWORD qwStart, QWORD qwTime )
+{
+    QWORD qwNow;
+    while( (qwNow = GetMicrosecondCount() - qwStart) + 1000 < qwTime )
+        Sleep( (DWORD)((qwTime - qwNow) / 1000) - 1 );
+    while( GetMicrosecondCount() - qwStart < qwTime ) {}
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ReplayRecord
+// Desc:  Does what the server did when this record was captured
+//------------------------------------------------------------------------------------------------
+VOID ReplayRecord( const CaptureRecord * pRecord, DWORD dwStartTime )
+{
+    DWORD dwTime = dwStartTime + (DWORD)(pRecord->qwTime / 1000);
+    DOUBLE dStart = GetNanosecondCount();
+
+    switch( pRecord->dwType )
+    {
+        case CAPTURE_TICK:
+        {
+            g_Room.Advance( dwTime );
+
+            DOUBLE dNs = GetNanosecondCount() - dStart;
+            g_Stats.qwTicks++;
+            g_Stats.dTickNs += dNs;
+            if( dNs > g_Stats.dMaxTickNs )
+                g_Stats.dMaxTickNs = dNs;
+        } break;
+
+        case CAPTURE_SERVER_DATAGRAM:
+        {
+            g_Room.ProcessServerPacket( &pRecord->Address, (const CHAR*)pRecord->pData, pRecord->dwSize );
+            g_Stats.qwDatagrams++;
+            g_Stats.dDatagramNs += GetNanosecondCount() - dStart;
+        } break;
+
+        default:
+        {
+            // A datagram on one user's own socket, handled the way UserReadable does it
+            DWORD dwSlot = pRecord->dwType - CAPTURE_USER_DATAGRAM;
+            if( dwSlot >= g_Room.GetMaxUsers() )
+            {
+                g_Stats.qwUnknown++;
+                break;
+            }
+
+            User * pUser = g_Room.GetUserBySlot( dwSlot );
+            if( pUser->IsConnected() )
+                g_Room.ProcessUserPacket( pUser, (const CHAR*)pRecord->pData, pRecord->dwSize );
+            g_Stats.qwDatagrams++;
+            g_Stats.dDatagramNs += GetNanosecondCount() - dStart;
+        } break;
+    }
+}
+
+
+int main( int argc, char * argv[] )
+{
+    // Read the command line.  The first argument is the capture file.  It's replayed as fast as
+    // possible unless "-realtime" is given, in which case each record waits for its recorded time.
+    // "-verbose" prints the server's logon and disconnect messages.  Nothing else is accepted,
+    // since the server's settings all come from the capture.
+    const CHAR * strCaptureFile = NULL;
+    const CHAR * strUnknown = NULL;
+    BOOL bRealTime = FALSE;
+    g_bLogEvents = FALSE;
+    for( int i = 1; i < argc; ++i )
+    {
+        if( 0 == strcmp( argv[i], "-realtime" ) )
+            bRealTime = TRUE;
+        else if( 0 == strcmp( argv[i], "-verbose" ) )
+            g_bLogEvents = TRUE;
+        else if( argv[i][0] == '-' || strCaptureFile )
+        {
+            if( !strUnknown )
+                strUnknown = argv[i];
+        }
+        else
+            strCaptureFile = argv[i];
+    }
+
+    if( strUnknown && strUnknown[0] == '-' )
+        printf( "'%s' isn't supported; the server's settings come from the capture\n", strUnknown );
+    else if( strUnknown )
+        printf( "Only one capture file can be replayed at a time\n" );
+    if( !strCaptureFile || strUnknown )
+    {
+        printf( "Usage: ngsreplay <file> [-realtime] [-verbose]\n" );
+        return -1;
+    }
+
+    if( FAILED( g_Capture.Open( strCaptureFile ) ) )
+    {
+        printf( "'%s' isn't a capture file\n", strCaptureFile );
+        return -1;
+    }
+
+    // Set the server up the way it was when the capture was made
+    const CaptureHeader * pHeader = g_Capture.GetHeader();
+    g_bSharedPort = pHeader->bSharedPort;
+    g_bAuthoritative = pHeader->bAuthoritative;
+    g_fWorldBound = pHeader->fWorldBound;
+    if( FAILED( g_Room.Create( pHeader->dwMaxUsers, pHeader->fViewRadius, pHeader->dwStartTime, &pHeader->Secret ) ) )
+    {
+        printf( "The capture's settings are invalid\n" );
+        return -1;
+    }
+    g_Output.qwHash = FNV_OFFSET_BASIS;
+    g_Room.SetReplySend( ReplaySend, &g_Output );
+    for( DWORD i = 0; i < g_Room.GetMaxUsers(); ++i )
+        g_Room.GetUserBySlot( i )->Create( ReplaySend, &g_Output );
+
+    printf( "Replaying %s: %u users, view radius %.0f, bound %.0f%s%s\n", strCaptureFile, pHeader->dwMaxUsers,
+            pHeader->fViewRadius, pHeader->fWorldBound, pHeader->bSharedPort ? "" : ", one port per user",
+            pHeader->bAuthoritative ? ", authoritative" : "" );
+
+    // The server's messages go through its event log
+    if( g_bLogEvents )
+        EventLog::Start( NULL );
+
+    // Run every record through the server
+    CaptureRecord record;
+    record.qwTime = 0;
+    QWORD qwStart = GetMicrosecondCount();
+    while( g_Capture.Next( &record ) )
+    {
+        if( bRealTime )
+            WaitUntil( qwStart, record.qwTime );
+        ReplayRecord( &record, pHeader->dwStartTime );
+    }
+    DOUBLE dElapsed = (GetMicrosecondCount() - qwStart) / 1.0e6;
+    DOUBLE dRecorded = record.qwTime / 1.0e6;
+    EventLog::Stop();
+
+    printf( "\nRecorded time:   %.3f s\n", dRecorded );
+    printf( "Replay time:     %.3f s (%.1fx)\n", dElapsed, dElapsed > 0.0 ? dRecorded / dElapsed : 0.0 );
+    printf( "Datagrams:       %llu (%.0f ns each)\n", (unsigned long long)g_Stats.qwDatagrams,
+            g_Stats.qwDatagrams ? g_Stats.dDatagramNs / g_Stats.qwDatagrams : 0.0 );
+    printf( "Timer passes:    %llu (%.1f us each, %.1f us worst)\n", (unsigned long long)g_Stats.qwTicks,
+            g_Stats.qwTicks ? g_Stats.dTickNs / g_Stats.qwTicks / 1000.0 : 0.0, g_Stats.dMaxTickNs / 1000.0 );
+    if( g_Stats.qwUnknown )
+        printf( "Skipped:         %llu records for slots past the user count\n", (unsigned long long)g_Stats.qwUnknown );
+    printf( "Packets sent:    %llu (%llu bytes)\n", (unsigned long long)g_Output.qwPackets, (unsigned long long)g_Output.qwBytes );
+    printf( "Output hash:     %016llx\n", (unsigned long long)g_Output.qwHash );
+
+    g_Room.Destroy();
+    g_Capture.Close();
+
+    // Success
+    return 0;
+}
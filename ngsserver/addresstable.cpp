@@ -0,0 +1,236 @@
+//------------------------------------------------------------------------------------------------
+// File:    addresstable.cpp
+//
+// Desc:    Maps client addresses to session slots
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "addresstable.h"
+
+// A key that no IPv4 address/port pair can produce, used to mark empty slots
+#define EMPTY_KEY   ((QWORD)-1)
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  AddressTable
+// Desc:  
+//------------------------------------------------------------------------------------------------
+AddressTable::AddressTable()
+{
+    m_pSlots = NULL;
+    m_dwMask = 0;
+    m_dwCount = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~AddressTable
+// Desc:  
+//------------------------------------------------------------------------------------------------
+AddressTable::~AddressTable()
+{
+    Destroy();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Create
+// Desc:  Allocates a table that keeps the load factor at or below one half when it holds
+//        dwMaxEntries addresses
+//------------------------------------------------------------------------------------------------
+HRESULT AddressTable::Create( DWORD dwMaxEntries )
+{
+    Destroy();
+
+    // Round the slot count up to a power of two so that the home slot is a simple mask
+    DWORD dwSlots = 16;
+    while( dwSlots < dwMaxEntries * 2 )
+        dwSlots <<= 1;
+
+    if( NULL == (m_pSlots = new Slot[dwSlots]) )
+        return E_OUTOFMEMORY;
+
+    for( DWORD i = 0; i < dwSlots; ++i )
+        m_pSlots[i].qwKey = EMPTY_KEY;
+
+    m_dwMask = dwSlots - 1;
+    m_dwCount = 0;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Destroy
+// Desc:  
+//------------------------------------------------------------------------------------------------
+VOID AddressTable::Destroy()
+{
+    if( m_pSlots != NULL )
+    {
+        delete [] m_pSlots;
+        m_pSlots = NULL;
+    }
+
+    m_dwMask = 0;
+    m_dwCount = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Insert
+// Desc:  Adds an address, or replaces the value if the address is already in the table
+//------------------------------------------------------------------------------------------------
+HRESULT AddressTable::Insert( const SOCKADDR_IN * pAddress, DWORD dwValue )
+{
+    QWORD qwKey = MakeKey( pAddress );
+
+    // Never let the table fill past half, or probe sequences get long
+    if( (m_dwCount + 1) * 2 > m_dwMask + 1 )
+        return E_FAIL;
+
+    // Walk from the home slot until we find the key or a hole
+    for( DWORD i = Home( qwKey ); ; i = (i + 1) & m_dwMask )
+    {
+        if( m_pSlots[i].qwKey == qwKey )
+        {
+            m_pSlots[i].dwValue = dwValue;
+            return S_OK;
+        }
+
+        if( m_pSlots[i].qwKey == EMPTY_KEY )
+        {
+            m_pSlots[i].qwKey = qwKey;
+            m_pSlots[i].dwValue = dwValue;
+            ++m_dwCount;
+            return S_OK;
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Find
+// Desc:  Returns the value stored for an address, or ADDRESS_NOT_FOUND
+//------------------------------------------------------------------------------------------------
+DWORD AddressTable::Find( const SOCKADDR_IN * pAddress ) const
+{
+    QWORD qwKey = MakeKey( pAddress );
+
+    for( DWORD i = Home( qwKey ); ; i = (i + 1) & m_dwMask )
+    {
+        if( m_pSlots[i].qwKey == qwKey )
+            return m_pSlots[i].dwValue;
+
+        if( m_pSlots[i].qwKey == EMPTY_KEY )
+            return ADDRESS_NOT_FOUND;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Remove
+// Desc:  Deletes an address.  Entries after the hole are shifted back into it so that lookups
+//        never need tombstones.
+//------------------------------------------------------------------------------------------------
+VOID AddressTable::Remove( const SOCKADDR_IN * pAddress )
+{
+    QWORD qwKey = MakeKey( pAddress );
+
+    // Find the slot
+    DWORD dwHole;
+    for( dwHole = Home( qwKey ); ; dwHole = (dwHole + 1) & m_dwMask )
+    {
+        if( m_pSlots[dwHole].qwKey == qwKey )
+            break;
+
+        if( m_pSlots[dwHole].qwKey == EMPTY_KEY )
+            return;
+    }
+
+    // Pull following members of the probe run back over the hole
+    for( DWORD i = (dwHole + 1) & m_dwMask; m_pSlots[i].qwKey != EMPTY_KEY; i = (i + 1) & m_dwMask )
+    {
+        // An entry may only move if its home slot isn't between the hole and where it sits now
+        DWORD dwHome = Home( m_pSlots[i].qwKey );
+        if( ((i - dwHome) & m_dwMask) >= ((i - dwHole) & m_dwMask) )
+        {
+            m_pSlots[dwHole] = m_pSlots[i];
+            dwHole = i;
+        }
+    }
+
+    m_pSlots[dwHole].qwKey = EMPTY_KEY;
+    --m_dwCount;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Clear
+// Desc:  Removes every address
+//------------------------------------------------------------------------------------------------
+VOID AddressTable::Clear()
+{
+    if( m_pSlots != NULL )
+    {
+        for( DWORD i = 0; i <= m_dwMask; ++i )
+            m_pSlots[i].qwKey = EMPTY_KEY;
+    }
+
+    m_dwCount = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetCount
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DWORD AddressTable::GetCount() const
+{
+    return m_dwCount;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  MakeKey
+// Desc:  Packs the IPv4 address and port into one integer
+//------------------------------------------------------------------------------------------------
+QWORD AddressTable::MakeKey( const SOCKADDR_IN * pAddress )
+{
+    return ((QWORD)pAddress->sin_addr.s_addr << 16) | (QWORD)pAddress->sin_port;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Home
+// Desc:  Fibonacci hash of the key, which spreads out clients behind the same NAT
+//------------------------------------------------------------------------------------------------
+DWORD AddressTable::Home( QWORD qwKey ) const
+{
+    return (DWORD)((qwKey * 0x9E3779B97F4A7C15ULL) >> 32) & m_dwMask;
+}
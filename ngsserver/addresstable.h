@@ -0,0 +1,81 @@
+//------------------------------------------------------------------------------------------------
+// File:    addresstable.h
+//
+// Desc:    Maps client addresses to session slots
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __ADDRESSTABLE_H__
+#define __ADDRESSTABLE_H__
+
+
+// Include files required to compile this header
+#include "../common/platform.h"
+
+// Returned by Find when an address has no session
+#define ADDRESS_NOT_FOUND   0xFFFFFFFF
+
+/**
+ * Open-addressed hash table from a client's IP address and port to the index of the session
+ * that owns it.  Lookups cost one hash and, at the load factor used here, usually one probe, so
+ * every datagram on the shared server socket can be routed without searching the user list.
+ *   @author Karl Gluck
+ */
+class AddressTable
+{
+    public:
+
+        AddressTable();
+        ~AddressTable();
+        HRESULT Create( DWORD dwMaxEntries );
+        VOID Destroy();
+
+        HRESULT Insert( const SOCKADDR_IN * pAddress, DWORD dwValue );
+        DWORD Find( const SOCKADDR_IN * pAddress ) const;
+        VOID Remove( const SOCKADDR_IN * pAddress );
+        VOID Clear();
+        DWORD GetCount() const;
+
+    protected:
+
+        struct Slot
+        {
+            QWORD qwKey;
+            DWORD dwValue;
+        };
+
+        static QWORD MakeKey( const SOCKADDR_IN * pAddress );
+        DWORD Home( QWORD qwKey ) const;
+
+    protected:
+
+        Slot * m_pSlots;
+        DWORD m_dwMask;
+        DWORD m_dwCount;
+};
+
+#endif // __ADDRESSTABLE_H__
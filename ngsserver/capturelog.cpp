@@ -0,0 +1,455 @@
+//------------------------------------------------------------------------------------------------
+// File:    capturelog.cpp
+//
+// Desc:    Memory-mapped, append-only record of the datagrams and ticks the server handled
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "capturelog.h"
+
+#if !defined(WIN32) && !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// The file grows this much at a time while capturing
+#define CAPTURE_CHUNK           (16 * 1024 * 1024)
+
+// Most bytes a varint can take, and the most a datagram record adds to its payload
+#define MAX_VARINT_SIZE         10
+#define MAX_RECORD_OVERHEAD     (MAX_VARINT_SIZE * 3 + 6)
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  WriteVarint
+// Desc:  Writes seven bits per byte, low bits first.  Returns the number of bytes written.
+//------------------------------------------------------------------------------------------------
+static DWORD WriteVarint( BYTE * pBuffer, QWORD qwValue )
+{
+    DWORD dwSize = 0;
+    while( qwValue >= 0x80 )
+    {
+        pBuffer[dwSize++] = (BYTE)(qwValue | 0x80);
+        qwValue >>= 7;
+    }
+    pBuffer[dwSize++] = (BYTE)qwValue;
+    return dwSize;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ReadVarint
+// Desc:  Reads a value written by WriteVarint.  Returns the number of bytes read, or 0 if the
+//        value runs past pEnd.
+//------------------------------------------------------------------------------------------------
+static DWORD ReadVarint( const BYTE * pBuffer, const BYTE * pEnd, QWORD * pValue )
+{
+    QWORD qwValue = 0;
+    for( DWORD i = 0; i < MAX_VARINT_SIZE && pBuffer + i < pEnd; ++i )
+    {
+        qwValue |= (QWORD)(pBuffer[i] & 0x7F) << (7 * i);
+        if( !(pBuffer[i] & 0x80) )
+        {
+            *pValue = qwValue;
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CaptureLog
+// Desc:  
+//------------------------------------------------------------------------------------------------
+CaptureLog::CaptureLog()
+{
+    m_pData = NULL;
+    m_qwMapped = 0;
+    m_qwPosition = 0;
+    m_qwStartTime = 0;
+    m_qwLastTime = 0;
+    m_bWriting = FALSE;
+#if defined(WIN32) || defined(_WIN32)
+    m_hFile = INVALID_HANDLE_VALUE;
+    m_hMapping = NULL;
+#else
+    m_iFile = -1;
+#endif
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~CaptureLog
+// Desc:  
+//------------------------------------------------------------------------------------------------
+CaptureLog::~CaptureLog()
+{
+    Close();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Create
+// Desc:  Starts a new capture, replacing strFile if it exists.  The settings are saved in the
+//        header for the replay.
+//------------------------------------------------------------------------------------------------
+HRESULT CaptureLog::Create( const CHAR * strFile, DWORD dwMaxUsers, FLOAT fViewRadius, FLOAT fWorldBound, BOOL bSharedPort,
+                            BOOL bAuthoritative, const CookieSecret * pCookieSecret )
+{
+    Close();
+
+#if defined(WIN32) || defined(_WIN32)
+    m_hFile = CreateFileA( strFile, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+    if( m_hFile == INVALID_HANDLE_VALUE )
+        return E_FAIL;
+#else
+    m_iFile = open( strFile, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if( m_iFile < 0 )
+        return E_FAIL;
+#endif
+
+    m_bWriting = TRUE;
+    if( !Map( CAPTURE_CHUNK, TRUE ) )
+    {
+        Close();
+        return E_FAIL;
+    }
+
+    CaptureHeader * pHeader = (CaptureHeader*)m_pData;
+    pHeader->dwMagic = CAPTURE_MAGIC;
+    pHeader->dwVersion = CAPTURE_VERSION;
+    pHeader->dwMaxUsers = dwMaxUsers;
+    pHeader->fViewRadius = fViewRadius;
+    pHeader->fWorldBound = fWorldBound;
+    pHeader->bSharedPort = bSharedPort;
+    pHeader->bAuthoritative = bAuthoritative;
+    pHeader->dwStartTime = GetTickCount();
+    pHeader->Secret = *pCookieSecret;
+    pHeader->qwLength = sizeof(CaptureHeader);
+
+    m_qwPosition = sizeof(CaptureHeader);
+    m_qwStartTime = m_qwLastTime = GetMicrosecondCount();
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  AppendEvent
+// Desc:  Records that a timer ran
+//------------------------------------------------------------------------------------------------
+VOID CaptureLog::AppendEvent( DWORD dwType )
+{
+    BYTE * pRecord = Reserve( MAX_VARINT_SIZE * 2 );
+    if( !pRecord )
+        return;
+
+    QWORD qwNow = GetMicrosecondCount();
+    DWORD dwSize = WriteVarint( pRecord, qwNow - m_qwLastTime );
+    dwSize += WriteVarint( pRecord + dwSize, dwType );
+    m_qwLastTime = qwNow;
+
+    // Only count the record once it's complete, so a crash never leaves half of one
+    m_qwPosition += dwSize;
+    ((CaptureHeader*)m_pData)->qwLength = m_qwPosition;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  AppendDatagram
+// Desc:  Records a datagram and where it came from
+//------------------------------------------------------------------------------------------------
+VOID CaptureLog::AppendDatagram( DWORD dwType, const SOCKADDR_IN * pAddress, const CHAR * pBuffer, DWORD dwSize )
+{
+    BYTE * pRecord = Reserve( MAX_RECORD_OVERHEAD + dwSize );
+    if( !pRecord )
+        return;
+
+    QWORD qwNow = GetMicrosecondCount();
+    DWORD dwPos = WriteVarint( pRecord, qwNow - m_qwLastTime );
+    dwPos += WriteVarint( pRecord + dwPos, dwType );
+    memcpy( pRecord + dwPos, &pAddress->sin_addr, 4 );
+    memcpy( pRecord + dwPos + 4, &pAddress->sin_port, 2 );
+    dwPos += 6;
+    dwPos += WriteVarint( pRecord + dwPos, dwSize );
+    memcpy( pRecord + dwPos, pBuffer, dwSize );
+    dwPos += dwSize;
+    m_qwLastTime = qwNow;
+
+    m_qwPosition += dwPos;
+    ((CaptureHeader*)m_pData)->qwLength = m_qwPosition;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Open
+// Desc:  Maps an existing capture for reading
+//------------------------------------------------------------------------------------------------
+HRESULT CaptureLog::Open( const CHAR * strFile )
+{
+    Close();
+
+    QWORD qwSize;
+#if defined(WIN32) || defined(_WIN32)
+    m_hFile = CreateFileA( strFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+    if( m_hFile == INVALID_HANDLE_VALUE )
+        return E_FAIL;
+    LARGE_INTEGER size;
+    if( !GetFileSizeEx( m_hFile, &size ) )
+    {
+        Close();
+        return E_FAIL;
+    }
+    qwSize = (QWORD)size.QuadPart;
+#else
+    m_iFile = open( strFile, O_RDONLY );
+    if( m_iFile < 0 )
+        return E_FAIL;
+    struct stat info;
+    if( 0 != fstat( m_iFile, &info ) )
+    {
+        Close();
+        return E_FAIL;
+    }
+    qwSize = (QWORD)info.st_size;
+#endif
+
+    // Make sure this is a capture we can read
+    if( qwSize < sizeof(CaptureHeader) || !Map( qwSize, FALSE ) )
+    {
+        Close();
+        return E_FAIL;
+    }
+    const CaptureHeader * pHeader = GetHeader();
+    if( pHeader->dwMagic != CAPTURE_MAGIC || pHeader->dwVersion != CAPTURE_VERSION ||
+        pHeader->qwLength < sizeof(CaptureHeader) || pHeader->qwLength > qwSize )
+    {
+        Close();
+        return E_FAIL;
+    }
+
+    m_qwPosition = sizeof(CaptureHeader);
+    m_qwLastTime = 0;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetHeader
+// Desc:  
+//------------------------------------------------------------------------------------------------
+const CaptureHeader * CaptureLog::GetHeader() const
+{
+    return (const CaptureHeader*)m_pData;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Next
+// Desc:  Reads the next record of a capture opened with Open.  Returns FALSE at the end, or if
+//        the rest of the file is damaged.
+//------------------------------------------------------------------------------------------------
+BOOL CaptureLog::Next( CaptureRecord * pRecord )
+{
+    if( !m_pData || m_bWriting )
+        return FALSE;
+
+    const BYTE * pEnd = m_pData + GetHeader()->qwLength;
+    const BYTE * pCur = m_pData + m_qwPosition;
+    QWORD qwDelta, qwType, qwSize;
+    DWORD dwRead;
+
+    if( 0 == (dwRead = ReadVarint( pCur, pEnd, &qwDelta )) )
+        return FALSE;
+    pCur += dwRead;
+    if( 0 == (dwRead = ReadVarint( pCur, pEnd, &qwType )) )
+        return FALSE;
+    pCur += dwRead;
+
+    m_qwLastTime += qwDelta;
+    pRecord->qwTime = m_qwLastTime;
+    pRecord->dwType = (DWORD)qwType;
+    pRecord->pData = NULL;
+    pRecord->dwSize = 0;
+    ZeroMemory( &pRecord->Address, sizeof(SOCKADDR_IN) );
+
+    if( qwType >= CAPTURE_SERVER_DATAGRAM )
+    {
+        if( pEnd - pCur < 6 )
+            return FALSE;
+        pRecord->Address.sin_family = AF_INET;
+        memcpy( &pRecord->Address.sin_addr, pCur, 4 );
+        memcpy( &pRecord->Address.sin_port, pCur + 4, 2 );
+        pCur += 6;
+
+        if( 0 == (dwRead = ReadVarint( pCur, pEnd, &qwSize )) || qwSize > (QWORD)(pEnd - pCur - dwRead) )
+            return FALSE;
+        pCur += dwRead;
+        pRecord->pData = pCur;
+        pRecord->dwSize = (DWORD)qwSize;
+        pCur += qwSize;
+    }
+
+    m_qwPosition = pCur - m_pData;
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Close
+// Desc:  Finishes a capture, trimming the file to what was written, or releases one being read
+//------------------------------------------------------------------------------------------------
+VOID CaptureLog::Close()
+{
+    // The header's length always matches m_qwPosition while writing
+    QWORD qwLength = m_qwPosition;
+    Unmap();
+
+#if defined(WIN32) || defined(_WIN32)
+    if( m_hFile != INVALID_HANDLE_VALUE )
+    {
+        if( m_bWriting )
+        {
+            LARGE_INTEGER length;
+            length.QuadPart = qwLength;
+            SetFilePointerEx( m_hFile, length, NULL, FILE_BEGIN );
+            SetEndOfFile( m_hFile );
+        }
+        CloseHandle( m_hFile );
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+#else
+    if( m_iFile >= 0 )
+    {
+        if( m_bWriting && 0 != ftruncate( m_iFile, qwLength ) )
+            printf( "\nCouldn't trim the capture file" );
+        close( m_iFile );
+        m_iFile = -1;
+    }
+#endif
+
+    m_qwPosition = 0;
+    m_bWriting = FALSE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  IsOpen
+// Desc:  
+//------------------------------------------------------------------------------------------------
+BOOL CaptureLog::IsOpen() const
+{
+    return m_pData != NULL;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Reserve
+// Desc:  Makes sure that dwSize more bytes can be written, growing the file if needed.  Returns
+//        where they go, or NULL if the capture has stopped.
+//------------------------------------------------------------------------------------------------
+BYTE * CaptureLog::Reserve( DWORD dwSize )
+{
+    if( !m_pData || !m_bWriting )
+        return NULL;
+
+    if( m_qwPosition + dwSize > m_qwMapped )
+    {
+        QWORD qwLength = m_qwPosition;
+        if( !Map( m_qwMapped + (dwSize > CAPTURE_CHUNK ? dwSize : CAPTURE_CHUNK), TRUE ) )
+        {
+            // Out of disk or address space; keep what has been captured so far
+            printf( "\nThe capture file couldn't grow past %llu bytes; capturing stopped", (unsigned long long)qwLength );
+            Close();
+            return NULL;
+        }
+    }
+
+    return m_pData + m_qwPosition;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Map
+// Desc:  Maps the first qwSize bytes of the file, extending it first if it's being written
+//------------------------------------------------------------------------------------------------
+BOOL CaptureLog::Map( QWORD qwSize, BOOL bWritable )
+{
+    Unmap();
+
+#if defined(WIN32) || defined(_WIN32)
+    // Creating a writable mapping bigger than the file extends it
+    m_hMapping = CreateFileMapping( m_hFile, NULL, bWritable ? PAGE_READWRITE : PAGE_READONLY,
+                                    (DWORD)(qwSize >> 32), (DWORD)qwSize, NULL );
+    if( !m_hMapping )
+        return FALSE;
+    m_pData = (BYTE*)MapViewOfFile( m_hMapping, bWritable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, (SIZE_T)qwSize );
+    if( !m_pData )
+    {
+        CloseHandle( m_hMapping );
+        m_hMapping = NULL;
+        return FALSE;
+    }
+#else
+    if( bWritable && 0 != ftruncate( m_iFile, qwSize ) )
+        return FALSE;
+    void * pData = mmap( NULL, qwSize, bWritable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, m_iFile, 0 );
+    if( pData == MAP_FAILED )
+        return FALSE;
+    m_pData = (BYTE*)pData;
+#endif
+
+    m_qwMapped = qwSize;
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Unmap
+// Desc:  
+//------------------------------------------------------------------------------------------------
+VOID CaptureLog::Unmap()
+{
+    if( !m_pData )
+        return;
+
+#if defined(WIN32) || defined(_WIN32)
+    UnmapViewOfFile( m_pData );
+    CloseHandle( m_hMapping );
+    m_hMapping = NULL;
+#else
+    munmap( m_pData, m_qwMapped );
+#endif
+
+    m_pData = NULL;
+    m_qwMapped = 0;
+}
@@ -0,0 +1,129 @@
+//------------------------------------------------------------------------------------------------
+// File:    capturelog.h
+//
+// Desc:    Memory-mapped, append-only record of the datagrams and ticks the server handled
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __CAPTURELOG_H__
+#define __CAPTURELOG_H__
+
+
+// Include files required to compile this header
+#include "../common/platform.h"
+#include "logoncookies.h"
+
+// Identifies a capture file, and the version of the format
+#define CAPTURE_MAGIC           0x4353474E      /* "NGSC" */
+#define CAPTURE_VERSION         5
+
+// What each record holds.  A datagram that arrived on a user's own socket (when the server is
+// run with -ports) is CAPTURE_USER_DATAGRAM plus the slot number.
+#define CAPTURE_TICK            0               /* Room::Advance ran */
+#define CAPTURE_SERVER_DATAGRAM 2               /* Datagram arrived on the shared server socket */
+#define CAPTURE_USER_DATAGRAM   3
+
+/**
+ * Start of every capture file.  Holds the settings the server was started with, so the replay
+ * can build the same tables.
+ */
+struct CaptureHeader
+{
+    DWORD dwMagic;
+    DWORD dwVersion;
+    DWORD dwMaxUsers;
+    FLOAT fViewRadius;
+    FLOAT fWorldBound;
+    DWORD bSharedPort;
+    DWORD bAuthoritative;       // Players were moved by their inputs
+    DWORD dwStartTime;          // GetTickCount() when the capture started
+    CookieSecret Secret;        // Key the server made logon cookies with
+    QWORD qwLength;             // Bytes of the file in use, including this header
+};
+
+/**
+ * One entry read back from a capture
+ */
+struct CaptureRecord
+{
+    QWORD qwTime;               // Microseconds since the capture started
+    DWORD dwType;               // One of the CAPTURE_ values
+    SOCKADDR_IN Address;        // Where a datagram came from
+    const BYTE * pData;         // Points into the mapped file
+    DWORD dwSize;
+};
+
+/**
+ * Writes every datagram the server receives, and every tick it runs, to a file that is mapped
+ * into memory so that recording costs a copy rather than a system call.  Records are a varint
+ * time delta in microseconds, a varint type and, for datagrams, the IPv4 source address and port
+ * followed by the varint length and the payload.  The same class reads a capture back.
+ *   @author Karl Gluck
+ */
+class CaptureLog
+{
+    public:
+
+        CaptureLog();
+        ~CaptureLog();
+
+        HRESULT Create( const CHAR * strFile, DWORD dwMaxUsers, FLOAT fViewRadius, FLOAT fWorldBound, BOOL bSharedPort,
+                        BOOL bAuthoritative, const CookieSecret * pCookieSecret );
+        VOID AppendEvent( DWORD dwType );
+        VOID AppendDatagram( DWORD dwType, const SOCKADDR_IN * pAddress, const CHAR * pBuffer, DWORD dwSize );
+
+        HRESULT Open( const CHAR * strFile );
+        const CaptureHeader * GetHeader() const;
+        BOOL Next( CaptureRecord * pRecord );
+
+        VOID Close();
+        BOOL IsOpen() const;
+
+    protected:
+
+        BYTE * Reserve( DWORD dwSize );
+        BOOL Map( QWORD qwSize, BOOL bWritable );
+        VOID Unmap();
+
+    protected:
+
+        BYTE * m_pData;             // Start of the mapped file
+        QWORD m_qwMapped;           // How many bytes are mapped
+        QWORD m_qwPosition;         // Where the next record goes, or is read from
+        QWORD m_qwStartTime;        // GetMicrosecondCount() when the capture started
+        QWORD m_qwLastTime;         // Time of the last record, which the next one is relative to
+        BOOL m_bWriting;
+
+#if defined(WIN32) || defined(_WIN32)
+        HANDLE m_hFile;
+        HANDLE m_hMapping;
+#else
+        int m_iFile;
+#endif
+};
+
+#endif // __CAPTURELOG_H__
@@ -0,0 +1,396 @@
+//------------------------------------------------------------------------------------------------
+// File:    datagrambatch.cpp
+//
+// Desc:    Moves datagrams through a UDP socket many at a time
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "datagrambatch.h"
+#include "metrics.h"
+#include "../common/protocol.h"
+
+#if !defined(WIN32) && !defined(_WIN32)
+#include <netinet/udp.h>
+#include <sys/uio.h>
+#endif
+
+// The kernel won't build a UDP datagram any larger than this
+#define MAX_GSO_PAYLOAD     65507
+
+// Room for the arrival stamp on each received datagram
+#define RECEIVE_CONTROL_SIZE    CMSG_SPACE(sizeof(struct timespec))
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  DatagramBatch
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DatagramBatch::DatagramBatch()
+{
+    m_sSocket = INVALID_SOCKET;
+    m_bUseGso = FALSE;
+    m_dwMaxReceives = 0;
+    m_pReceiveData = NULL;
+    m_pReceiveAddresses = NULL;
+    m_pReceiveHeaders = NULL;
+    m_pReceiveVectors = NULL;
+    m_pReceiveControl = NULL;
+    m_dwMaxQueued = 0;
+    m_dwNumQueued = 0;
+    m_pQueueData = NULL;
+    m_pQueueAddresses = NULL;
+    m_pQueueVectors = NULL;
+    m_pSendHeaders = NULL;
+    m_pSendControl = NULL;
+    m_qwDatagrams = 0;
+    m_qwSystemCalls = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~DatagramBatch
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DatagramBatch::~DatagramBatch()
+{
+    Destroy();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Create
+// Desc:  Up to dwMaxReceives datagrams are pulled out of the socket per call, and up to
+//        dwMaxQueued can wait to be sent before the queue flushes itself.
+//------------------------------------------------------------------------------------------------
+HRESULT DatagramBatch::Create( SOCKET sSocket, DWORD dwMaxReceives, DWORD dwMaxQueued )
+{
+    Destroy();
+
+    if( dwMaxReceives == 0 || dwMaxQueued == 0 )
+        return E_FAIL;
+
+    m_sSocket = sSocket;
+    m_dwMaxReceives = dwMaxReceives;
+    m_dwMaxQueued = dwMaxQueued;
+    m_pReceiveData = new CHAR[dwMaxReceives * MAX_PACKET_SIZE];
+    m_pReceiveAddresses = new SOCKADDR_IN[dwMaxReceives];
+
+#if !defined(WIN32) && !defined(_WIN32)
+    // Each received datagram lands in its own slot
+    struct mmsghdr * pReceiveHeaders = new struct mmsghdr[dwMaxReceives];
+    struct iovec * pReceiveVectors = new struct iovec[dwMaxReceives];
+    ZeroMemory( pReceiveHeaders, dwMaxReceives * sizeof(struct mmsghdr) );
+
+    // Ask for the time each datagram arrived, to see how long it sat in the socket.  Without
+    // the stamps the batch works the same; it just doesn't record the delay.
+    int iTimestamps = 1;
+    if( 0 == setsockopt( sSocket, SOL_SOCKET, SO_TIMESTAMPNS, &iTimestamps, sizeof(iTimestamps) ) )
+        m_pReceiveControl = new BYTE[dwMaxReceives * RECEIVE_CONTROL_SIZE];
+
+    for( DWORD i = 0; i < dwMaxReceives; ++i )
+    {
+        pReceiveVectors[i].iov_base = m_pReceiveData + i * MAX_PACKET_SIZE;
+        pReceiveVectors[i].iov_len = MAX_PACKET_SIZE;
+        pReceiveHeaders[i].msg_hdr.msg_name = &m_pReceiveAddresses[i];
+        pReceiveHeaders[i].msg_hdr.msg_namelen = sizeof(SOCKADDR_IN);
+        pReceiveHeaders[i].msg_hdr.msg_iov = &pReceiveVectors[i];
+        pReceiveHeaders[i].msg_hdr.msg_iovlen = 1;
+        if( m_pReceiveControl )
+        {
+            pReceiveHeaders[i].msg_hdr.msg_control = m_pReceiveControl + i * RECEIVE_CONTROL_SIZE;
+            pReceiveHeaders[i].msg_hdr.msg_controllen = RECEIVE_CONTROL_SIZE;
+        }
+    }
+    m_pReceiveHeaders = pReceiveHeaders;
+    m_pReceiveVectors = pReceiveVectors;
+
+    // Queued datagrams are sent straight out of their slots.  A message can gather several of
+    // them, and a GSO message needs room for the segment size.
+    m_pQueueData = new CHAR[dwMaxQueued * MAX_PACKET_SIZE];
+    m_pQueueAddresses = new SOCKADDR_IN[dwMaxQueued];
+    m_pQueueVectors = new struct iovec[dwMaxQueued];
+    m_pSendHeaders = new struct mmsghdr[dwMaxQueued];
+    m_pSendControl = new BYTE[dwMaxQueued * CMSG_SPACE(sizeof(uint16_t))];
+
+#if defined(UDP_SEGMENT)
+    // Kernels that know about GSO will report the socket's segment size
+    int iSegmentSize = 0;
+    socklen_t iLength = sizeof(iSegmentSize);
+    m_bUseGso = 0 == getsockopt( sSocket, SOL_UDP, UDP_SEGMENT, &iSegmentSize, &iLength );
+#endif
+#endif
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Destroy
+// Desc:  Anything still queued is thrown away
+//------------------------------------------------------------------------------------------------
+VOID DatagramBatch::Destroy()
+{
+#if !defined(WIN32) && !defined(_WIN32)
+    delete [] (struct mmsghdr*)m_pReceiveHeaders;
+    delete [] (struct iovec*)m_pReceiveVectors;
+    delete [] (struct iovec*)m_pQueueVectors;
+    delete [] (struct mmsghdr*)m_pSendHeaders;
+#endif
+    delete [] m_pReceiveData;
+    delete [] m_pReceiveAddresses;
+    delete [] m_pReceiveControl;
+    delete [] m_pQueueData;
+    delete [] m_pQueueAddresses;
+    delete [] m_pSendControl;
+
+    m_pReceiveHeaders = NULL;
+    m_pReceiveVectors = NULL;
+    m_pQueueVectors = NULL;
+    m_pSendHeaders = NULL;
+    m_pReceiveData = NULL;
+    m_pReceiveAddresses = NULL;
+    m_pReceiveControl = NULL;
+    m_pQueueData = NULL;
+    m_pQueueAddresses = NULL;
+    m_pSendControl = NULL;
+    m_dwMaxReceives = 0;
+    m_dwMaxQueued = 0;
+    m_dwNumQueued = 0;
+    m_bUseGso = FALSE;
+    m_sSocket = INVALID_SOCKET;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Receive
+// Desc:  Calls pfnCallback with every datagram waiting on the socket and returns how many
+//        there were.  Datagrams the callback queues aren't sent until Flush.
+//------------------------------------------------------------------------------------------------
+DWORD DatagramBatch::Receive( DatagramCallback pfnCallback, LPVOID pContext )
+{
+    DWORD dwReceived = 0;
+
+#if defined(WIN32) || defined(_WIN32)
+    // Get data until the operation would block
+    int len;
+    int iFromLen = sizeof(SOCKADDR_IN);
+    while( SOCKET_ERROR != (len = recvfrom( m_sSocket, m_pReceiveData, MAX_PACKET_SIZE, 0,
+                                            (LPSOCKADDR)m_pReceiveAddresses, &iFromLen )) )
+    {
+        m_qwSystemCalls++;
+        pfnCallback( pContext, m_pReceiveAddresses, m_pReceiveData, (DWORD)len );
+        iFromLen = sizeof(SOCKADDR_IN);
+        dwReceived++;
+        m_qwDatagrams++;
+    }
+    m_qwSystemCalls++;
+#else
+    struct mmsghdr * pHeaders = (struct mmsghdr*)m_pReceiveHeaders;
+    for( ;; )
+    {
+        int iCount = recvmmsg( m_sSocket, pHeaders, m_dwMaxReceives, MSG_DONTWAIT, NULL );
+        m_qwSystemCalls++;
+        if( iCount <= 0 )
+            break;
+
+        // Everything in the batch is compared against when it came out of the socket.  The
+        // kernel stamps datagrams with the wall clock.
+        struct timespec now;
+        if( m_pReceiveControl )
+            clock_gettime( CLOCK_REALTIME, &now );
+
+        for( int i = 0; i < iCount; ++i )
+        {
+            if( m_pReceiveControl )
+            {
+                struct msghdr * pMessage = &pHeaders[i].msg_hdr;
+                for( struct cmsghdr * pControl = CMSG_FIRSTHDR( pMessage ); pControl; pControl = CMSG_NXTHDR( pMessage, pControl ) )
+                {
+                    if( pControl->cmsg_level != SOL_SOCKET || pControl->cmsg_type != SCM_TIMESTAMPNS )
+                        continue;
+                    struct timespec arrived;
+                    memcpy( &arrived, CMSG_DATA( pControl ), sizeof(arrived) );
+                    long long llWaited = (long long)(now.tv_sec - arrived.tv_sec) * 1000000 +
+                                         (now.tv_nsec - arrived.tv_nsec) / 1000;
+                    Metrics::Record( METRIC_QUEUE_DELAY, llWaited > 0 ? (DWORD)llWaited : 0 );
+                }
+
+                // The kernel shrinks this to the size of what it wrote, too
+                pMessage->msg_controllen = RECEIVE_CONTROL_SIZE;
+            }
+
+            pfnCallback( pContext, &m_pReceiveAddresses[i], m_pReceiveData + i * MAX_PACKET_SIZE,
+                         pHeaders[i].msg_len );
+
+            // The kernel shrinks this to the size of the address it wrote
+            pHeaders[i].msg_hdr.msg_namelen = sizeof(SOCKADDR_IN);
+        }
+        dwReceived += iCount;
+        m_qwDatagrams += iCount;
+
+        // A short batch means the socket is empty, so don't spend a call finding that out
+        if( (DWORD)iCount < m_dwMaxReceives )
+            break;
+    }
+#endif
+
+    return dwReceived;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Queue
+// Desc:  Copies a datagram into the queue.  If the queue is full it's flushed first.
+//------------------------------------------------------------------------------------------------
+int DatagramBatch::Queue( const SOCKADDR_IN * pAddress, const CHAR * pBuffer, int length )
+{
+    if( length < 0 || length > MAX_PACKET_SIZE )
+        return SOCKET_ERROR;
+
+#if defined(WIN32) || defined(_WIN32)
+    // There's no batched send, so it might as well go now
+    m_qwDatagrams++;
+    m_qwSystemCalls++;
+    return sendto( m_sSocket, pBuffer, length, 0, (const SOCKADDR*)pAddress, sizeof(SOCKADDR_IN) );
+#else
+    if( m_dwNumQueued >= m_dwMaxQueued )
+        Flush();
+
+    DWORD dwSlot = m_dwNumQueued++;
+    struct iovec * pVector = &((struct iovec*)m_pQueueVectors)[dwSlot];
+    pVector->iov_base = m_pQueueData + dwSlot * MAX_PACKET_SIZE;
+    pVector->iov_len = length;
+    memcpy( pVector->iov_base, pBuffer, length );
+    m_pQueueAddresses[dwSlot] = *pAddress;
+    m_qwDatagrams++;
+
+    return length;
+#endif
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Flush
+// Desc:  Sends everything in the queue.  Datagrams the kernel won't take are dropped, the same
+//        as if they had been lost on the way.
+//------------------------------------------------------------------------------------------------
+VOID DatagramBatch::Flush()
+{
+#if !defined(WIN32) && !defined(_WIN32)
+    if( !m_dwNumQueued )
+        return;
+
+    struct iovec * pVectors = (struct iovec*)m_pQueueVectors;
+    struct mmsghdr * pHeaders = (struct mmsghdr*)m_pSendHeaders;
+    DWORD dwNumMessages = 0;
+
+    for( DWORD i = 0; i < m_dwNumQueued; )
+    {
+        // Gather the run of datagrams that can be sent as one GSO message.  Every segment but the
+        // last has to be the same size, and they all have to go to the same place.
+        DWORD dwEnd = i + 1;
+        if( m_bUseGso )
+        {
+            size_t segment = pVectors[i].iov_len;
+            size_t total = segment;
+            const SOCKADDR_IN * pAddress = &m_pQueueAddresses[i];
+            while( dwEnd < m_dwNumQueued && dwEnd - i < BATCH_MAX_SEGMENTS &&
+                   pVectors[dwEnd - 1].iov_len == segment &&
+                   pVectors[dwEnd].iov_len <= segment &&
+                   total + pVectors[dwEnd].iov_len <= MAX_GSO_PAYLOAD &&
+                   m_pQueueAddresses[dwEnd].sin_addr.s_addr == pAddress->sin_addr.s_addr &&
+                   m_pQueueAddresses[dwEnd].sin_port == pAddress->sin_port )
+            {
+                total += pVectors[dwEnd].iov_len;
+                dwEnd++;
+            }
+        }
+
+        struct msghdr * pMessage = &pHeaders[dwNumMessages].msg_hdr;
+        ZeroMemory( pMessage, sizeof(*pMessage) );
+        pMessage->msg_name = &m_pQueueAddresses[i];
+        pMessage->msg_namelen = sizeof(SOCKADDR_IN);
+        pMessage->msg_iov = &pVectors[i];
+        pMessage->msg_iovlen = dwEnd - i;
+
+#if defined(UDP_SEGMENT)
+        // Tell the kernel where to cut the message back up into datagrams
+        if( dwEnd - i > 1 )
+        {
+            pMessage->msg_control = m_pSendControl + dwNumMessages * CMSG_SPACE(sizeof(uint16_t));
+            pMessage->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            struct cmsghdr * pControl = CMSG_FIRSTHDR( pMessage );
+            pControl->cmsg_level = SOL_UDP;
+            pControl->cmsg_type = UDP_SEGMENT;
+            pControl->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            *(uint16_t*)CMSG_DATA( pControl ) = (uint16_t)pVectors[i].iov_len;
+        }
+#endif
+
+        dwNumMessages++;
+        i = dwEnd;
+    }
+
+    // Hand the messages over.  If one fails, skip it and keep going with the rest, unless the
+    // socket's buffer is full, in which case nothing else will fit either.
+    for( DWORD dwSent = 0; dwSent < dwNumMessages; )
+    {
+        int iCount = sendmmsg( m_sSocket, pHeaders + dwSent, dwNumMessages - dwSent, 0 );
+        m_qwSystemCalls++;
+        if( iCount > 0 )
+            dwSent += iCount;
+        else if( errno == EAGAIN || errno == EWOULDBLOCK )
+        {
+            for( ; dwSent < dwNumMessages; ++dwSent )
+                Metrics::Count( METRIC_DROPPED_SEND, (DWORD)pHeaders[dwSent].msg_hdr.msg_iovlen );
+        }
+        else if( errno == EIO && pHeaders[dwSent].msg_hdr.msg_iovlen > 1 )
+        {
+            // The route's device can't segment after all (GSO was only checked on the socket), so
+            // stop using it and send this run the slow way
+            m_bUseGso = FALSE;
+            const struct msghdr * pMessage = &pHeaders[dwSent].msg_hdr;
+            for( size_t j = 0; j < pMessage->msg_iovlen; ++j )
+            {
+                m_qwSystemCalls++;
+                if( SOCKET_ERROR == sendto( m_sSocket, (const CHAR*)pMessage->msg_iov[j].iov_base, pMessage->msg_iov[j].iov_len, 0,
+                                            (const SOCKADDR*)pMessage->msg_name, pMessage->msg_namelen ) )
+                    Metrics::Count( METRIC_DROPPED_SEND, 1 );
+            }
+            dwSent++;
+        }
+        else
+        {
+            Metrics::Count( METRIC_DROPPED_SEND, (DWORD)pHeaders[dwSent].msg_hdr.msg_iovlen );
+            dwSent++;
+        }
+    }
+
+    m_dwNumQueued = 0;
+#endif
+}
@@ -0,0 +1,99 @@
+//------------------------------------------------------------------------------------------------
+// File:    datagrambatch.h
+//
+// Desc:    Moves datagrams through a UDP socket many at a time
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __DATAGRAMBATCH_H__
+#define __DATAGRAMBATCH_H__
+
+
+// Include files required to compile this header
+#include "../common/platform.h"
+#include "reactor.h"
+
+// Datagrams pulled out of the kernel with each receive call
+#define BATCH_DEFAULT_RECEIVES  64
+
+// Most segments the kernel will split one GSO send into
+#define BATCH_MAX_SEGMENTS      64
+
+/**
+ * Wraps the server's shared socket so that receiving and sending cost one system call per batch
+ * instead of one per datagram.  Receive() drains the socket with recvmmsg, and Queue() holds
+ * outgoing datagrams until Flush() hands them all to sendmmsg.  Runs of same-size datagrams to
+ * one address go out as a single UDP GSO send when the kernel supports it.  On Linux, the
+ * kernel stamps each datagram as it arrives, and Receive() records how long it waited.
+ * On Windows, each datagram is received and sent with its own call.
+ *   @author Karl Gluck
+ */
+class DatagramBatch
+{
+    public:
+
+        DatagramBatch();
+        ~DatagramBatch();
+        HRESULT Create( SOCKET sSocket, DWORD dwMaxReceives, DWORD dwMaxQueued );
+        VOID Destroy();
+
+        DWORD Receive( DatagramCallback pfnCallback, LPVOID pContext );
+        int Queue( const SOCKADDR_IN * pAddress, const CHAR * pBuffer, int length );
+        VOID Flush();
+
+        DWORD GetQueuedCount() const { return m_dwNumQueued; }
+        QWORD GetDatagrams() const { return m_qwDatagrams; }
+        QWORD GetSystemCalls() const { return m_qwSystemCalls; }
+
+    protected:
+
+        SOCKET m_sSocket;
+        BOOL m_bUseGso;
+
+        // Receive side: one buffer, address and arrival stamp for each datagram in a batch
+        DWORD m_dwMaxReceives;
+        CHAR * m_pReceiveData;
+        SOCKADDR_IN * m_pReceiveAddresses;
+        LPVOID m_pReceiveHeaders;
+        LPVOID m_pReceiveVectors;
+        BYTE * m_pReceiveControl;
+
+        // Send side: datagrams waiting for the next Flush
+        DWORD m_dwMaxQueued;
+        DWORD m_dwNumQueued;
+        CHAR * m_pQueueData;
+        SOCKADDR_IN * m_pQueueAddresses;
+        LPVOID m_pQueueVectors;
+        LPVOID m_pSendHeaders;
+        BYTE * m_pSendControl;
+
+        // Datagrams moved, and the recvmmsg, sendmmsg, recvfrom and sendto calls it took
+        QWORD m_qwDatagrams;
+        QWORD m_qwSystemCalls;
+};
+
+#endif // __DATAGRAMBATCH_H__
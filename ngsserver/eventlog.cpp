@@ -0,0 +1,320 @@
+//------------------------------------------------------------------------------------------------
+// File:    eventlog.cpp
+//
+// Desc:    Log of server events that threads can write to without waiting on each other
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "eventlog.h"
+
+
+// The ring indices are handed between threads.  The writer of an index releases it after filling
+// in what it covers, and the reader acquires it before looking.  Visual C++ gives volatile
+// accesses these semantics already.
+#if defined(WIN32) || defined(_WIN32)
+#define LOAD_ACQUIRE( p )       (*(p))
+#define STORE_RELEASE( p, v )   (*(p) = (v))
+#else
+#define LOAD_ACQUIRE( p )       __atomic_load_n( (p), __ATOMIC_ACQUIRE )
+#define STORE_RELEASE( p, v )   __atomic_store_n( (p), (v), __ATOMIC_RELEASE )
+#endif
+
+// Keeps the indices that different threads write off of each other's cache lines
+#define CACHE_LINE_SIZE     64
+
+
+/**
+ * One thing that happened, waiting to be formatted
+ */
+struct EventLog::Event
+{
+    QWORD qwTime;               // High-resolution counter when it happened
+    const CHAR * strFormat;
+    DWORD dwArgs[3];
+};
+
+/**
+ * The events one thread has logged.  Only that thread moves the head, and only the writer moves
+ * the tail.
+ */
+struct EventLog::Ring
+{
+    volatile DWORD dwHead;
+    DWORD dwDropped;
+    BYTE Padding[CACHE_LINE_SIZE - 2 * sizeof(DWORD)];
+    volatile DWORD dwTail;
+    BYTE Padding2[CACHE_LINE_SIZE - sizeof(DWORD)];
+    Event Events[EVENTLOG_RING_SIZE];
+};
+
+
+// Each thread's ring
+#if defined(WIN32) || defined(_WIN32)
+static __declspec(thread) EventLog::Ring * t_pRing = NULL;
+#else
+static __thread EventLog::Ring * t_pRing = NULL;
+#endif
+
+// Every ring that's been handed out.  Rings last as long as the process does.
+static EventLog::Ring * volatile g_pRings[EVENTLOG_MAX_RINGS];
+static volatile LONG g_lNumRings = 0;
+
+// Set while the writer thread is running
+static volatile BOOL g_bRunning = FALSE;
+static HANDLE g_hWriterThread = NULL;
+
+// Where events go.  The console gets them just as they were formatted; a file gets a time on
+// each line.
+static FILE * g_pOutput = NULL;
+static BOOL g_bOwnsOutput = FALSE;
+static QWORD g_qwStartTime;
+static QWORD g_qwFrequency;
+
+// Events dropped so far, and how many of those have been reported
+static QWORD g_qwDroppedReported = 0;
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Start
+// Desc:  Starts writing events to strFile, or to the console if it's NULL.  Nothing is logged
+//        until this has been called.
+//------------------------------------------------------------------------------------------------
+HRESULT EventLog::Start( const CHAR * strFile )
+{
+    if( g_bRunning )
+        return E_FAIL;
+
+    if( strFile )
+    {
+        if( NULL == (g_pOutput = fopen( strFile, "a" )) )
+            return E_FAIL;
+        g_bOwnsOutput = TRUE;
+    }
+    else
+    {
+        g_pOutput = stdout;
+        g_bOwnsOutput = FALSE;
+    }
+
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter( &count );
+    QueryPerformanceFrequency( &frequency );
+    g_qwStartTime = (QWORD)count.QuadPart;
+    g_qwFrequency = (QWORD)frequency.QuadPart;
+
+    g_bRunning = TRUE;
+    if( NULL == (g_hWriterThread = CreateThread( NULL, 0, WriterThread, NULL, 0, NULL )) )
+    {
+        g_bRunning = FALSE;
+        if( g_bOwnsOutput )
+            fclose( g_pOutput );
+        g_pOutput = NULL;
+        return E_FAIL;
+    }
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Stop
+// Desc:  Writes everything that's been logged and stops the writer thread.  Events logged after
+//        this are thrown away.
+//------------------------------------------------------------------------------------------------
+VOID EventLog::Stop()
+{
+    if( !g_hWriterThread )
+        return;
+
+    g_bRunning = FALSE;
+    WaitForSingleObject( g_hWriterThread, INFINITE );
+    CloseHandle( g_hWriterThread );
+    g_hWriterThread = NULL;
+
+    if( g_bOwnsOutput )
+        fclose( g_pOutput );
+    else
+        fflush( g_pOutput );
+    g_pOutput = NULL;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Write
+// Desc:  Logs an event.  Never waits: if the calling thread's ring is full, the event is dropped.
+//------------------------------------------------------------------------------------------------
+VOID EventLog::Write( const CHAR * strFormat, DWORD dwArg0, DWORD dwArg1, DWORD dwArg2 )
+{
+    if( !g_bRunning )
+        return;
+
+    Ring * pRing = t_pRing;
+    if( !pRing && NULL == (pRing = CreateRing()) )
+        return;
+
+    DWORD dwHead = pRing->dwHead;
+    if( dwHead - LOAD_ACQUIRE( &pRing->dwTail ) >= EVENTLOG_RING_SIZE )
+    {
+        pRing->dwDropped++;
+        return;
+    }
+
+    LARGE_INTEGER count;
+    QueryPerformanceCounter( &count );
+    Event * pEvent = &pRing->Events[dwHead & (EVENTLOG_RING_SIZE - 1)];
+    pEvent->qwTime = (QWORD)count.QuadPart;
+    pEvent->strFormat = strFormat;
+    pEvent->dwArgs[0] = dwArg0;
+    pEvent->dwArgs[1] = dwArg1;
+    pEvent->dwArgs[2] = dwArg2;
+
+    // Let the writer see it
+    STORE_RELEASE( &pRing->dwHead, dwHead + 1 );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CreateRing
+// Desc:  Gives the calling thread a ring of its own.  Returns NULL if there aren't any left.
+//------------------------------------------------------------------------------------------------
+EventLog::Ring * EventLog::CreateRing()
+{
+    LONG lIndex = InterlockedIncrement( &g_lNumRings ) - 1;
+    if( lIndex >= EVENTLOG_MAX_RINGS )
+        return NULL;
+
+    Ring * pRing = (Ring*)calloc( 1, sizeof(Ring) );
+    if( !pRing )
+        return NULL;
+
+    STORE_RELEASE( &g_pRings[lIndex], pRing );
+    t_pRing = pRing;
+    return pRing;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Drain
+// Desc:  Writer thread.  Formats every event that's been logged so far, oldest first, and
+//        returns how many there were.
+//------------------------------------------------------------------------------------------------
+DWORD EventLog::Drain()
+{
+    // Take a snapshot of how far each ring has been filled.  Anything logged after this waits
+    // for the next pass.
+    Ring * pRings[EVENTLOG_MAX_RINGS];
+    DWORD dwEnds[EVENTLOG_MAX_RINGS];
+    DWORD dwNumRings = 0;
+    QWORD qwDropped = 0;
+    LONG lClaimed = g_lNumRings;
+    for( LONG i = 0; i < lClaimed && i < EVENTLOG_MAX_RINGS; ++i )
+    {
+        Ring * pRing = LOAD_ACQUIRE( &g_pRings[i] );
+        if( !pRing )
+            continue;
+        pRings[dwNumRings] = pRing;
+        dwEnds[dwNumRings] = LOAD_ACQUIRE( &pRing->dwHead );
+        qwDropped += pRing->dwDropped;
+        dwNumRings++;
+    }
+
+    // Merge the rings by time.  Each ring is already in order, so the next event overall is the
+    // oldest of the ones at the front of each ring.
+    DWORD dwWritten = 0;
+    for( ;; )
+    {
+        Ring * pOldest = NULL;
+        const Event * pEvent = NULL;
+        for( DWORD i = 0; i < dwNumRings; ++i )
+        {
+            Ring * pRing = pRings[i];
+            if( pRing->dwTail == dwEnds[i] )
+                continue;
+            const Event * pFront = &pRing->Events[pRing->dwTail & (EVENTLOG_RING_SIZE - 1)];
+            if( !pEvent || pFront->qwTime < pEvent->qwTime )
+            {
+                pOldest = pRing;
+                pEvent = pFront;
+            }
+        }
+        if( !pEvent )
+            break;
+
+        if( g_bOwnsOutput )
+        {
+            // Files get one event to a line, with the seconds since the log started.  The
+            // formats start with a line break for the console, which isn't wanted here.
+            const CHAR * strFormat = pEvent->strFormat;
+            while( *strFormat == '\n' )
+                strFormat++;
+            QWORD qwTicks = pEvent->qwTime - g_qwStartTime;
+            fprintf( g_pOutput, "%10.3f  ", (DOUBLE)qwTicks / (DOUBLE)g_qwFrequency );
+            fprintf( g_pOutput, strFormat, pEvent->dwArgs[0], pEvent->dwArgs[1], pEvent->dwArgs[2] );
+            fputc( '\n', g_pOutput );
+        }
+        else
+        {
+            fprintf( g_pOutput, pEvent->strFormat, pEvent->dwArgs[0], pEvent->dwArgs[1], pEvent->dwArgs[2] );
+        }
+
+        // Give the slot back to the thread that logged it
+        STORE_RELEASE( &pOldest->dwTail, pOldest->dwTail + 1 );
+        dwWritten++;
+    }
+
+    // Say how many were lost since the last time
+    if( qwDropped > g_qwDroppedReported )
+    {
+        fprintf( g_pOutput, g_bOwnsOutput ? "%llu events were dropped\n" : "\n%llu events were dropped",
+                 (unsigned long long)(qwDropped - g_qwDroppedReported) );
+        g_qwDroppedReported = qwDropped;
+    }
+
+    if( dwWritten )
+        fflush( g_pOutput );
+    return dwWritten;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  WriterThread
+// Desc:  Writes events until Stop is called, and then writes whatever is left
+//------------------------------------------------------------------------------------------------
+DWORD WINAPI EventLog::WriterThread( LPVOID pParam )
+{
+    while( g_bRunning )
+    {
+        if( !Drain() )
+            Sleep( EVENTLOG_DRAIN_PERIOD );
+    }
+    Drain();
+
+    // Success
+    return S_OK;
+}
@@ -0,0 +1,79 @@
+//------------------------------------------------------------------------------------------------
+// File:    eventlog.h
+//
+// Desc:    Log of server events that threads can write to without waiting on each other
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __EVENTLOG_H__
+#define __EVENTLOG_H__
+
+
+// Include files required to compile this header
+#include "../common/platform.h"
+
+// Events each thread can have waiting to be written.  Must be a power of two.
+#define EVENTLOG_RING_SIZE      1024
+
+// How long the writer thread sleeps when there's nothing to write, in milliseconds
+#define EVENTLOG_DRAIN_PERIOD   10
+
+// Threads past this many can't log
+#define EVENTLOG_MAX_RINGS      256
+
+/**
+ * Writes out the server's logons, disconnects and other events from a thread of its own, so the
+ * threads handling packets never wait on the console or a file.  Each thread that logs gets a
+ * ring of its own the first time it does, and an event is just the format string's address, the
+ * time and a few numbers copied into the next slot.  The writer thread formats them later, in
+ * the order they happened.  When a ring is full, new events are dropped rather than waiting;
+ * the writer says how many were lost.
+ * Formats have to be string literals, since only their addresses are kept, and can have up to
+ * three 32-bit arguments.
+ *   @author Karl Gluck
+ */
+class EventLog
+{
+    public:
+
+        static HRESULT Start( const CHAR * strFile );
+        static VOID Stop();
+
+        static VOID Write( const CHAR * strFormat, DWORD dwArg0 = 0, DWORD dwArg1 = 0, DWORD dwArg2 = 0 );
+
+        // Each thread's events, and the events in them; see eventlog.cpp
+        struct Event;
+        struct Ring;
+
+    protected:
+
+        static Ring * CreateRing();
+        static DWORD Drain();
+        static DWORD WINAPI WriterThread( LPVOID pParam );
+};
+
+#endif // __EVENTLOG_H__
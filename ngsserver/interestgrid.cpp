@@ -0,0 +1,451 @@
+//------------------------------------------------------------------------------------------------
+// File:    interestgrid.cpp
+//
+// Desc:    Spatial hash that decides which players each user can see
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "interestgrid.h"
+#include <math.h>
+
+// Marks the end of a bucket's list of slots
+#define NO_SLOT         ((DWORD)-1)
+
+// Positions are clamped to this range so that a bad packet can't overflow the cell coordinates
+#define MAX_COORDINATE  1.0e6f
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  InterestGrid
+// Desc:  
+//------------------------------------------------------------------------------------------------
+InterestGrid::InterestGrid()
+{
+    m_dwCapacity = 0;
+    m_pEntries = NULL;
+    m_pBuckets = NULL;
+    m_dwBucketMask = 0;
+    m_fCellSize = 1.0f;
+    m_iCellRadius = 0;
+    m_fEnterRadiusSq = 0.0f;
+    m_fLeaveRadiusSq = 0.0f;
+    m_dwStamp = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~InterestGrid
+// Desc:  
+//------------------------------------------------------------------------------------------------
+InterestGrid::~InterestGrid()
+{
+    Destroy();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Create
+// Desc:  Sets up a grid for dwCapacity player slots.  Players come into view within fEnterRadius
+//        and go out of view past fLeaveRadius, which must be at least as large.
+//------------------------------------------------------------------------------------------------
+HRESULT InterestGrid::Create( DWORD dwCapacity, FLOAT fCellSize, FLOAT fEnterRadius, FLOAT fLeaveRadius )
+{
+    Destroy();
+
+    if( dwCapacity == 0 || fCellSize <= 0.0f || fEnterRadius <= 0.0f || fLeaveRadius < fEnterRadius )
+        return E_FAIL;
+
+    // Use about two buckets per player so that most buckets hold a single cell
+    DWORD dwBuckets = 64;
+    while( dwBuckets < dwCapacity * 2 )
+        dwBuckets <<= 1;
+
+    m_pEntries = new Entry[dwCapacity];
+    m_pBuckets = new DWORD[dwBuckets];
+    if( !m_pEntries || !m_pBuckets )
+    {
+        Destroy();
+        return E_OUTOFMEMORY;
+    }
+
+    ZeroMemory( m_pEntries, sizeof(Entry) * dwCapacity );
+    for( DWORD i = 0; i < dwBuckets; ++i )
+        m_pBuckets[i] = NO_SLOT;
+
+    m_dwCapacity = dwCapacity;
+    m_dwBucketMask = dwBuckets - 1;
+    m_fCellSize = fCellSize;
+    m_iCellRadius = (int)ceilf( fEnterRadius / fCellSize );
+    m_fEnterRadiusSq = fEnterRadius * fEnterRadius;
+    m_fLeaveRadiusSq = fLeaveRadius * fLeaveRadius;
+    m_dwStamp = 0;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Destroy
+// Desc:  
+//------------------------------------------------------------------------------------------------
+VOID InterestGrid::Destroy()
+{
+    if( m_pEntries != NULL )
+    {
+        for( DWORD i = 0; i < m_dwCapacity; ++i )
+        {
+            if( m_pEntries[i].pVisible )
+                delete [] m_pEntries[i].pVisible;
+            if( m_pEntries[i].pViewers )
+                delete [] m_pEntries[i].pViewers;
+        }
+
+        delete [] m_pEntries;
+        m_pEntries = NULL;
+    }
+
+    if( m_pBuckets != NULL )
+    {
+        delete [] m_pBuckets;
+        m_pBuckets = NULL;
+    }
+
+    m_dwCapacity = 0;
+    m_dwBucketMask = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Move
+// Desc:  Places a player at a new position, adding it to the grid if it wasn't there already
+//------------------------------------------------------------------------------------------------
+VOID InterestGrid::Move( DWORD dwPlayerID, FLOAT fX, FLOAT fZ )
+{
+    DWORD dwSlot = PLAYER_SLOT( dwPlayerID );
+    if( dwSlot >= m_dwCapacity )
+        return;
+
+    // Keep garbage out of the cell math; NaN fails both comparisons and ends up at the origin
+    if( !(fX > -MAX_COORDINATE) ) fX = (fX != fX) ? 0.0f : -MAX_COORDINATE;
+    if( !(fX <  MAX_COORDINATE) ) fX = MAX_COORDINATE;
+    if( !(fZ > -MAX_COORDINATE) ) fZ = (fZ != fZ) ? 0.0f : -MAX_COORDINATE;
+    if( !(fZ <  MAX_COORDINATE) ) fZ = MAX_COORDINATE;
+
+    Entry * pEntry = &m_pEntries[dwSlot];
+    int iCellX = (int)floorf( fX / m_fCellSize );
+    int iCellZ = (int)floorf( fZ / m_fCellSize );
+
+    // A new player in this slot starts out seeing nobody, and seen by nobody
+    if( pEntry->dwPlayerID != dwPlayerID )
+    {
+        if( pEntry->dwPlayerID != INVALID_PLAYER_ID )
+        {
+            ClearViews( dwSlot );
+            Unlink( dwSlot );
+        }
+
+        pEntry->dwPlayerID = dwPlayerID;
+        pEntry->iCellX = iCellX;
+        pEntry->iCellZ = iCellZ;
+        Link( dwSlot );
+    }
+    else if( iCellX != pEntry->iCellX || iCellZ != pEntry->iCellZ )
+    {
+        Unlink( dwSlot );
+        pEntry->iCellX = iCellX;
+        pEntry->iCellZ = iCellZ;
+        Link( dwSlot );
+    }
+
+    pEntry->fX = fX;
+    pEntry->fZ = fZ;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Remove
+// Desc:  Takes a player off of the grid.  Users that could see it drop it straight away,
+//        without a leave callback, since they're told about logoffs separately.
+//------------------------------------------------------------------------------------------------
+VOID InterestGrid::Remove( DWORD dwPlayerID )
+{
+    DWORD dwSlot = PLAYER_SLOT( dwPlayerID );
+    if( dwSlot >= m_dwCapacity || m_pEntries[dwSlot].dwPlayerID != dwPlayerID )
+        return;
+
+    ClearViews( dwSlot );
+    Unlink( dwSlot );
+    m_pEntries[dwSlot].dwPlayerID = INVALID_PLAYER_ID;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Update
+// Desc:  Brings a user's view up to date with everyone's current positions, calling pfnEnter
+//        for each player that came into view and pfnLeave for each one that went out of it.
+//        Either callback can be NULL.
+//------------------------------------------------------------------------------------------------
+VOID InterestGrid::Update( DWORD dwPlayerID, InterestCallback pfnEnter, InterestCallback pfnLeave,
+                           LPVOID pContext )
+{
+    DWORD dwSlot = PLAYER_SLOT( dwPlayerID );
+    if( dwSlot >= m_dwCapacity || m_pEntries[dwSlot].dwPlayerID != dwPlayerID )
+        return;
+
+    Entry * pEntry = &m_pEntries[dwSlot];
+
+    // Start a new mark so we can tell who is already in view without searching the list
+    if( ++m_dwStamp == 0 )
+    {
+        for( DWORD i = 0; i < m_dwCapacity; ++i )
+            m_pEntries[i].dwMark = 0;
+        m_dwStamp = 1;
+    }
+    pEntry->dwMark = m_dwStamp;
+
+    // Keep the players that are still inside the leave radius
+    DWORD dwKept = 0;
+    for( DWORD i = 0; i < pEntry->dwNumVisible; ++i )
+    {
+        DWORD dwOtherID = pEntry->pVisible[i];
+        Entry * pOther = &m_pEntries[PLAYER_SLOT( dwOtherID )];
+
+        FLOAT fDX = pOther->fX - pEntry->fX;
+        FLOAT fDZ = pOther->fZ - pEntry->fZ;
+        if( fDX * fDX + fDZ * fDZ > m_fLeaveRadiusSq )
+        {
+            RemoveID( pOther->pViewers, &pOther->dwNumViewers, dwPlayerID );
+            if( pfnLeave )
+                pfnLeave( pContext, dwOtherID );
+            continue;
+        }
+
+        pOther->dwMark = m_dwStamp;
+        pEntry->pVisible[dwKept++] = dwOtherID;
+    }
+    pEntry->dwNumVisible = dwKept;
+
+    // Look through the cells around the user for players inside the enter radius
+    for( int iCellZ = pEntry->iCellZ - m_iCellRadius; iCellZ <= pEntry->iCellZ + m_iCellRadius; ++iCellZ )
+    {
+        for( int iCellX = pEntry->iCellX - m_iCellRadius; iCellX <= pEntry->iCellX + m_iCellRadius; ++iCellX )
+        {
+            for( DWORD j = m_pBuckets[HashCell( iCellX, iCellZ )]; j != NO_SLOT; j = m_pEntries[j].dwNext )
+            {
+                Entry * pOther = &m_pEntries[j];
+
+                // Skip players from other cells that share this bucket, and ones already in view
+                if( pOther->iCellX != iCellX || pOther->iCellZ != iCellZ || pOther->dwMark == m_dwStamp )
+                    continue;
+
+                FLOAT fDX = pOther->fX - pEntry->fX;
+                FLOAT fDZ = pOther->fZ - pEntry->fZ;
+                if( fDX * fDX + fDZ * fDZ > m_fEnterRadiusSq )
+                    continue;
+
+                if( !AddID( &pEntry->pVisible, &pEntry->dwNumVisible, &pEntry->dwMaxVisible, pOther->dwPlayerID ) )
+                    return;
+                if( !AddID( &pOther->pViewers, &pOther->dwNumViewers, &pOther->dwMaxViewers, dwPlayerID ) )
+                {
+                    pEntry->dwNumVisible--;
+                    return;
+                }
+
+                pOther->dwMark = m_dwStamp;
+                if( pfnEnter )
+                    pfnEnter( pContext, pOther->dwPlayerID );
+            }
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetVisibleCount
+// Desc:  Returns how many players the user could see as of its last update
+//------------------------------------------------------------------------------------------------
+DWORD InterestGrid::GetVisibleCount( DWORD dwPlayerID ) const
+{
+    DWORD dwSlot = PLAYER_SLOT( dwPlayerID );
+    if( dwSlot >= m_dwCapacity || m_pEntries[dwSlot].dwPlayerID != dwPlayerID )
+        return 0;
+
+    return m_pEntries[dwSlot].dwNumVisible;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetVisible
+// Desc:  Returns the ID of a player in the user's view
+//------------------------------------------------------------------------------------------------
+DWORD InterestGrid::GetVisible( DWORD dwPlayerID, DWORD i ) const
+{
+    return m_pEntries[PLAYER_SLOT( dwPlayerID )].pVisible[i];
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetViewerCount
+// Desc:  Returns how many users had the player in view as of their last updates
+//------------------------------------------------------------------------------------------------
+DWORD InterestGrid::GetViewerCount( DWORD dwPlayerID ) const
+{
+    DWORD dwSlot = PLAYER_SLOT( dwPlayerID );
+    if( dwSlot >= m_dwCapacity || m_pEntries[dwSlot].dwPlayerID != dwPlayerID )
+        return 0;
+
+    return m_pEntries[dwSlot].dwNumViewers;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetViewer
+// Desc:  Returns the ID of a user that has the player in view
+//------------------------------------------------------------------------------------------------
+DWORD InterestGrid::GetViewer( DWORD dwPlayerID, DWORD i ) const
+{
+    return m_pEntries[PLAYER_SLOT( dwPlayerID )].pViewers[i];
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  HashCell
+// Desc:  Finds the bucket that holds a cell
+//------------------------------------------------------------------------------------------------
+DWORD InterestGrid::HashCell( int iCellX, int iCellZ ) const
+{
+    // Mix the two coordinates with large odd constants so neighboring cells spread out
+    DWORD dwHash = (DWORD)iCellX * 0x9E3779B1UL + (DWORD)iCellZ * 0x85EBCA77UL;
+    return (dwHash ^ (dwHash >> 15)) & m_dwBucketMask;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Link
+// Desc:  Adds a slot to the front of its cell's bucket
+//------------------------------------------------------------------------------------------------
+VOID InterestGrid::Link( DWORD dwSlot )
+{
+    Entry * pEntry = &m_pEntries[dwSlot];
+    DWORD dwBucket = HashCell( pEntry->iCellX, pEntry->iCellZ );
+
+    pEntry->dwPrev = NO_SLOT;
+    pEntry->dwNext = m_pBuckets[dwBucket];
+    if( pEntry->dwNext != NO_SLOT )
+        m_pEntries[pEntry->dwNext].dwPrev = dwSlot;
+    m_pBuckets[dwBucket] = dwSlot;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Unlink
+// Desc:  Takes a slot out of its cell's bucket
+//------------------------------------------------------------------------------------------------
+VOID InterestGrid::Unlink( DWORD dwSlot )
+{
+    Entry * pEntry = &m_pEntries[dwSlot];
+
+    if( pEntry->dwPrev != NO_SLOT )
+        m_pEntries[pEntry->dwPrev].dwNext = pEntry->dwNext;
+    else
+        m_pBuckets[HashCell( pEntry->iCellX, pEntry->iCellZ )] = pEntry->dwNext;
+
+    if( pEntry->dwNext != NO_SLOT )
+        m_pEntries[pEntry->dwNext].dwPrev = pEntry->dwPrev;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ClearViews
+// Desc:  Takes a slot's player out of the views it's in, and out of the viewer lists of the
+//        players it can see, so that the slot can be emptied or given to someone else
+//------------------------------------------------------------------------------------------------
+VOID InterestGrid::ClearViews( DWORD dwSlot )
+{
+    Entry * pEntry = &m_pEntries[dwSlot];
+
+    for( DWORD i = 0; i < pEntry->dwNumVisible; ++i )
+    {
+        Entry * pOther = &m_pEntries[PLAYER_SLOT( pEntry->pVisible[i] )];
+        RemoveID( pOther->pViewers, &pOther->dwNumViewers, pEntry->dwPlayerID );
+    }
+
+    for( DWORD i = 0; i < pEntry->dwNumViewers; ++i )
+    {
+        Entry * pOther = &m_pEntries[PLAYER_SLOT( pEntry->pViewers[i] )];
+        RemoveID( pOther->pVisible, &pOther->dwNumVisible, pEntry->dwPlayerID );
+    }
+
+    pEntry->dwNumVisible = 0;
+    pEntry->dwNumViewers = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  AddID
+// Desc:  Appends a player to a list of IDs, growing the list if it's full
+//------------------------------------------------------------------------------------------------
+BOOL InterestGrid::AddID( DWORD ** ppList, DWORD * pdwCount, DWORD * pdwMax, DWORD dwPlayerID )
+{
+    if( *pdwCount == *pdwMax )
+    {
+        DWORD dwNewMax = *pdwMax ? *pdwMax * 2 : 16;
+        DWORD * pNewList = new DWORD[dwNewMax];
+        if( !pNewList )
+            return FALSE;
+
+        if( *ppList )
+        {
+            memcpy( pNewList, *ppList, sizeof(DWORD) * *pdwCount );
+            delete [] *ppList;
+        }
+
+        *ppList = pNewList;
+        *pdwMax = dwNewMax;
+    }
+
+    (*ppList)[(*pdwCount)++] = dwPlayerID;
+    return TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RemoveID
+// Desc:  Takes a player out of a list of IDs.  The last ID fills the gap, so the order changes.
+//------------------------------------------------------------------------------------------------
+VOID InterestGrid::RemoveID( DWORD * pList, DWORD * pdwCount, DWORD dwPlayerID )
+{
+    for( DWORD i = 0; i < *pdwCount; ++i )
+    {
+        if( pList[i] == dwPlayerID )
+        {
+            pList[i] = pList[--(*pdwCount)];
+            return;
+        }
+    }
+}
@@ -0,0 +1,112 @@
+//------------------------------------------------------------------------------------------------
+// File:    interestgrid.h
+//
+// Desc:    Spatial hash that decides which players each user can see
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __INTERESTGRID_H__
+#define __INTERESTGRID_H__
+
+
+// Include files required to compile this header
+#include "../common/platform.h"
+#include "../common/protocol.h"
+
+/// Called when a player enters or leaves the view of the user passed to InterestGrid::Update
+typedef VOID (*InterestCallback)( LPVOID pContext, DWORD dwPlayerID );
+
+/**
+ * Tracks player positions on the ground plane in a spatial hash and keeps a list of the players
+ * that each user can see.  A player comes into view inside the enter radius but doesn't leave it
+ * until it is past the larger leave radius, so players standing at the edge don't flicker in and
+ * out.  Finding the players near a user only touches the cells around it, so the cost of an
+ * update depends on how crowded the area is rather than on how many users are logged on.  Each
+ * player also keeps the reverse list, of the users that have it in view, so the users that have
+ * to hear about a player can be found just as cheaply.
+ *   @author Karl Gluck
+ */
+class InterestGrid
+{
+    public:
+
+        InterestGrid();
+        ~InterestGrid();
+        HRESULT Create( DWORD dwCapacity, FLOAT fCellSize, FLOAT fEnterRadius, FLOAT fLeaveRadius );
+        VOID Destroy();
+
+        VOID Move( DWORD dwPlayerID, FLOAT fX, FLOAT fZ );
+        VOID Remove( DWORD dwPlayerID );
+
+        VOID Update( DWORD dwPlayerID, InterestCallback pfnEnter, InterestCallback pfnLeave,
+                     LPVOID pContext );
+        DWORD GetVisibleCount( DWORD dwPlayerID ) const;
+        DWORD GetVisible( DWORD dwPlayerID, DWORD i ) const;
+        DWORD GetViewerCount( DWORD dwPlayerID ) const;
+        DWORD GetViewer( DWORD dwPlayerID, DWORD i ) const;
+
+    protected:
+
+        /**
+         * Everything the grid knows about one player slot
+         */
+        struct Entry
+        {
+            DWORD dwPlayerID;       // Player in this slot, or INVALID_PLAYER_ID if it isn't placed
+            FLOAT fX, fZ;
+            int iCellX, iCellZ;
+            DWORD dwNext, dwPrev;   // Other slots hashed to the same bucket
+            DWORD dwMark;           // Equal to m_dwStamp if already in the current user's view
+            DWORD * pVisible;       // IDs of the players this one can see
+            DWORD dwNumVisible;
+            DWORD dwMaxVisible;
+            DWORD * pViewers;       // IDs of the players that can see this one
+            DWORD dwNumViewers;
+            DWORD dwMaxViewers;
+        };
+
+        DWORD HashCell( int iCellX, int iCellZ ) const;
+        VOID Link( DWORD dwSlot );
+        VOID Unlink( DWORD dwSlot );
+        VOID ClearViews( DWORD dwSlot );
+        static BOOL AddID( DWORD ** ppList, DWORD * pdwCount, DWORD * pdwMax, DWORD dwPlayerID );
+        static VOID RemoveID( DWORD * pList, DWORD * pdwCount, DWORD dwPlayerID );
+
+    protected:
+
+        DWORD m_dwCapacity;
+        Entry * m_pEntries;
+        DWORD * m_pBuckets;         // First slot in each bucket of the spatial hash
+        DWORD m_dwBucketMask;
+        FLOAT m_fCellSize;
+        int m_iCellRadius;          // How many cells out from a user's own cell can come into view
+        FLOAT m_fEnterRadiusSq;
+        FLOAT m_fLeaveRadiusSq;
+        DWORD m_dwStamp;
+};
+
+#endif // __INTERESTGRID_H__
@@ -0,0 +1,200 @@
+//------------------------------------------------------------------------------------------------
+// File:    logoncookies.cpp
+//
+// Desc:    Stateless cookies that a client has to echo before it gets a player slot
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "logoncookies.h"
+
+#if defined(WIN32) || defined(_WIN32)
+#include <wincrypt.h>
+#endif
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Rotate
+// Desc:  Rotates a 64-bit value left
+//------------------------------------------------------------------------------------------------
+static inline QWORD Rotate( QWORD qwValue, int iBits )
+{
+    return (qwValue << iBits) | (qwValue >> (64 - iBits));
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SipRound
+// Desc:  One round of SipHash over its four words of state
+//------------------------------------------------------------------------------------------------
+static inline VOID SipRound( QWORD * v )
+{
+    v[0] += v[1]; v[1] = Rotate( v[1], 13 ); v[1] ^= v[0]; v[0] = Rotate( v[0], 32 );
+    v[2] += v[3]; v[3] = Rotate( v[3], 16 ); v[3] ^= v[2];
+    v[0] += v[3]; v[3] = Rotate( v[3], 21 ); v[3] ^= v[0];
+    v[2] += v[1]; v[1] = Rotate( v[1], 17 ); v[1] ^= v[2]; v[2] = Rotate( v[2], 32 );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SipHash24
+// Desc:  SipHash-2-4 of dwSize bytes under the 128-bit key.  Words are read little-endian, so
+//        the result is the same on any machine.
+//------------------------------------------------------------------------------------------------
+static QWORD SipHash24( const CookieSecret * pKey, const BYTE * pData, DWORD dwSize )
+{
+    QWORD v[4] = { pKey->qwKey[0] ^ 0x736F6D6570736575ULL, pKey->qwKey[1] ^ 0x646F72616E646F6DULL,
+                   pKey->qwKey[0] ^ 0x6C7967656E657261ULL, pKey->qwKey[1] ^ 0x7465646279746573ULL };
+
+    DWORD dwEnd = dwSize & ~7;
+    for( DWORD i = 0; i < dwEnd; i += 8 )
+    {
+        QWORD m = 0;
+        for( int b = 7; b >= 0; --b )
+            m = (m << 8) | pData[i + b];
+        v[3] ^= m;
+        SipRound( v );
+        SipRound( v );
+        v[0] ^= m;
+    }
+
+    // The last word holds the leftover bytes and the length in its top byte
+    QWORD m = (QWORD)(dwSize & 0xFF) << 56;
+    for( DWORD i = dwEnd; i < dwSize; ++i )
+        m |= (QWORD)pData[i] << (8 * (i - dwEnd));
+    v[3] ^= m;
+    SipRound( v );
+    SipRound( v );
+    v[0] ^= m;
+
+    v[2] ^= 0xFF;
+    for( int r = 0; r < 4; ++r )
+        SipRound( v );
+
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  LogOnCookies
+// Desc:  
+//------------------------------------------------------------------------------------------------
+LogOnCookies::LogOnCookies()
+{
+    ZeroMemory( &m_Secret, sizeof(m_Secret) );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Create
+// Desc:  Sets the key that every cookie is made with.  A replay has to use the same one as the
+//        server it recorded.
+//------------------------------------------------------------------------------------------------
+VOID LogOnCookies::Create( const CookieSecret * pSecret )
+{
+    m_Secret = *pSecret;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Make
+// Desc:  Gets the cookie to send to the client at pAddress.  Never returns zero, since that's
+//        what a client sends before it has a cookie.
+//------------------------------------------------------------------------------------------------
+DWORD LogOnCookies::Make( const SOCKADDR_IN * pAddress, DWORD dwTime ) const
+{
+    return Hash( pAddress, dwTime / COOKIE_PERIOD );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Check
+// Desc:  Determines whether dwCookie was made for this address in this period or the last one
+//------------------------------------------------------------------------------------------------
+BOOL LogOnCookies::Check( const SOCKADDR_IN * pAddress, DWORD dwCookie, DWORD dwTime ) const
+{
+    DWORD dwPeriod = dwTime / COOKIE_PERIOD;
+    return dwCookie != 0 &&
+           (dwCookie == Hash( pAddress, dwPeriod ) || dwCookie == Hash( pAddress, dwPeriod - 1 ));
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  MakeSecret
+// Desc:  Fills the whole key from the system's random source.  Only if that can't be read is it
+//        made from whatever changes from run to run, which a determined client could guess.
+//------------------------------------------------------------------------------------------------
+VOID LogOnCookies::MakeSecret( CookieSecret * pSecret )
+{
+    BOOL bRandom = FALSE;
+
+#if defined(WIN32) || defined(_WIN32)
+    HCRYPTPROV hProvider;
+    if( CryptAcquireContext( &hProvider, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT ) )
+    {
+        bRandom = CryptGenRandom( hProvider, sizeof(CookieSecret), (BYTE*)pSecret );
+        CryptReleaseContext( hProvider, 0 );
+    }
+#else
+    FILE * pFile = fopen( "/dev/urandom", "rb" );
+    if( pFile )
+    {
+        bRandom = 1 == fread( pSecret, sizeof(CookieSecret), 1, pFile );
+        fclose( pFile );
+    }
+#endif
+
+    if( !bRandom )
+    {
+        LARGE_INTEGER count;
+        QueryPerformanceCounter( &count );
+        CookieSecret seed = { { (QWORD)count.QuadPart, ((QWORD)GetTickCount() << 32) ^ (QWORD)(DWORD_PTR)&count } };
+        BYTE bIndex;
+        for( bIndex = 0; bIndex < 2; ++bIndex )
+            pSecret->qwKey[bIndex] = SipHash24( &seed, &bIndex, sizeof(bIndex) );
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Hash
+// Desc:  Runs the address, port and period through SipHash, and folds the result down to the
+//        32 bits a cookie has on the wire
+//------------------------------------------------------------------------------------------------
+DWORD LogOnCookies::Hash( const SOCKADDR_IN * pAddress, DWORD dwPeriod ) const
+{
+    BYTE pMessage[10];
+    memcpy( &pMessage[0], &pAddress->sin_addr.s_addr, 4 );
+    memcpy( &pMessage[4], &pAddress->sin_port, 2 );
+    pMessage[6] = (BYTE)(dwPeriod);
+    pMessage[7] = (BYTE)(dwPeriod >> 8);
+    pMessage[8] = (BYTE)(dwPeriod >> 16);
+    pMessage[9] = (BYTE)(dwPeriod >> 24);
+
+    QWORD qwHash = SipHash24( &m_Secret, pMessage, sizeof(pMessage) );
+    DWORD dwCookie = (DWORD)(qwHash ^ (qwHash >> 32));
+    return dwCookie ? dwCookie : 1;
+}
@@ -0,0 +1,79 @@
+//------------------------------------------------------------------------------------------------
+// File:    logoncookies.h
+//
+// Desc:    Stateless cookies that a client has to echo before it gets a player slot
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __LOGONCOOKIES_H__
+#define __LOGONCOOKIES_H__
+
+
+// Include files required to compile this header
+#include "../common/platform.h"
+
+// A cookie is good for the period it was made in and the one after it
+#define COOKIE_PERIOD       5000
+
+/**
+ * The 128-bit key that cookies are made with
+ */
+struct CookieSecret
+{
+    QWORD qwKey[2];
+};
+
+/**
+ * Makes and checks the cookies in the logon handshake.  A cookie is SipHash-2-4 of the client's
+ * address, port and the current period under a secret key, so the server doesn't have to remember which ones it gave out,
+ * and only a client that really receives datagrams at its address can answer with the right one.
+ * Nothing is allocated for a logon until it comes back with a good cookie, so a flood of logons
+ * from forged addresses costs one hash and one small reply each.
+ *   @author Karl Gluck
+ */
+class LogOnCookies
+{
+    public:
+
+        LogOnCookies();
+        VOID Create( const CookieSecret * pSecret );
+
+        DWORD Make( const SOCKADDR_IN * pAddress, DWORD dwTime ) const;
+        BOOL Check( const SOCKADDR_IN * pAddress, DWORD dwCookie, DWORD dwTime ) const;
+
+        static VOID MakeSecret( CookieSecret * pSecret );
+
+    protected:
+
+        DWORD Hash( const SOCKADDR_IN * pAddress, DWORD dwPeriod ) const;
+
+    protected:
+
+        CookieSecret m_Secret;
+};
+
+#endif // __LOGONCOOKIES_H__
@@ -0,0 +1,424 @@
+//------------------------------------------------------------------------------------------------
+// File:    metrics.cpp
+//
+// Desc:    Counters and latency histograms that are cheap enough to leave on
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "metrics.h"
+#include "../common/protocol.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+
+
+/**
+ * A distribution, recorded into buckets that get wider as the values get bigger
+ */
+struct Metrics::Histogram
+{
+    QWORD qwBuckets[METRIC_BUCKETS];
+    QWORD qwCount;
+    QWORD qwSum;
+    DWORD dwMax;
+};
+
+/**
+ * Everything one thread has recorded
+ */
+struct Metrics::Shard
+{
+    QWORD qwCounters[METRIC_NUM_COUNTERS];
+    QWORD qwPacketsIn[METRIC_MESSAGE_TYPES];
+    QWORD qwBytesIn[METRIC_MESSAGE_TYPES];
+    QWORD qwPacketsOut[METRIC_MESSAGE_TYPES];
+    QWORD qwBytesOut[METRIC_MESSAGE_TYPES];
+    Histogram Histograms[METRIC_NUM_HISTOGRAMS];
+};
+
+// Each thread's shard
+#if defined(WIN32) || defined(_WIN32)
+static __declspec(thread) Metrics::Shard * t_pShard = NULL;
+#else
+static __thread Metrics::Shard * t_pShard = NULL;
+#endif
+
+// Every shard that's been handed out.  Shards last as long as the process does; the threads
+// that record things are created once at startup.
+static Metrics::Shard * g_pShards[METRIC_MAX_SHARDS];
+static volatile LONG g_lNumShards = 0;
+
+// How each counter appears in the text
+static const CHAR * g_pCounterNames[METRIC_NUM_COUNTERS] =
+{
+    "ngs_sessions_opened_total",
+    "ngs_sessions_closed_total",
+    "ngs_sessions_timed_out_total",
+    "ngs_logon_challenges_total",
+    "ngs_dropped_malformed_total",
+    "ngs_dropped_unknown_sender_total",
+    "ngs_dropped_server_full_total",
+    "ngs_dropped_send_total",
+};
+
+// How each histogram appears in the text
+static const CHAR * g_pHistogramNames[METRIC_NUM_HISTOGRAMS] =
+{
+    "ngs_relay_fanout_players",
+    "ngs_tick_time_microseconds",
+    "ngs_queue_delay_microseconds",
+};
+
+// Labels for the message IDs; the last entry covers everything past the end of the list
+static const CHAR * g_pMessageNames[METRIC_MESSAGE_TYPES] =
+{
+    "logon", "logoff", "update", "confirm_logon", "player_logged_off", "compact_update",
+    "delta_snapshot", "snapshot_ack", "logon_challenge", "player_input", "input_ack", "other",
+};
+
+// The quantiles written for every histogram
+static const DOUBLE g_dQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetShard
+// Desc:  Gets the calling thread's shard, creating it the first time
+//------------------------------------------------------------------------------------------------
+inline Metrics::Shard * Metrics::GetShard()
+{
+    Shard * pShard = t_pShard;
+    return pShard ? pShard : CreateShard();
+}
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetMessageIndex
+// Desc:  Gets the traffic slot for the message in a datagram
+//------------------------------------------------------------------------------------------------
+static inline DWORD GetMessageIndex( const CHAR * pBuffer, DWORD dwSize )
+{
+    DWORD dwID = dwSize > 0 ? (DWORD)GetMessageID( pBuffer ) : METRIC_MESSAGE_TYPES - 1;
+    return dwID < METRIC_MESSAGE_TYPES ? dwID : METRIC_MESSAGE_TYPES - 1;
+}
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Count
+// Desc:  Adds to one of the counters
+//------------------------------------------------------------------------------------------------
+VOID Metrics::Count( MetricCounter counter, DWORD dwAmount )
+{
+    GetShard()->qwCounters[counter] += dwAmount;
+}
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CountReceived
+// Desc:  Counts a datagram that arrived, by its message ID
+//------------------------------------------------------------------------------------------------
+VOID Metrics::CountReceived( const CHAR * pBuffer, DWORD dwSize )
+{
+    Shard * pShard = GetShard();
+    DWORD dwIndex = GetMessageIndex( pBuffer, dwSize );
+    pShard->qwPacketsIn[dwIndex]++;
+    pShard->qwBytesIn[dwIndex] += dwSize;
+}
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CountSent
+// Desc:  Counts a datagram that was sent, by its message ID
+//------------------------------------------------------------------------------------------------
+VOID Metrics::CountSent( const CHAR * pBuffer, DWORD dwSize )
+{
+    Shard * pShard = GetShard();
+    DWORD dwIndex = GetMessageIndex( pBuffer, dwSize );
+    pShard->qwPacketsOut[dwIndex]++;
+    pShard->qwBytesOut[dwIndex] += dwSize;
+}
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Record
+// Desc:  Adds a value to one of the histograms
+//------------------------------------------------------------------------------------------------
+VOID Metrics::Record( MetricHistogram histogram, DWORD dwValue )
+{
+    Histogram * pHistogram = &GetShard()->Histograms[histogram];
+    pHistogram->qwBuckets[GetBucket( dwValue )]++;
+    pHistogram->qwCount++;
+    pHistogram->qwSum += dwValue;
+    if( dwValue > pHistogram->dwMax )
+        pHistogram->dwMax = dwValue;
+}
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Append
+// Desc:  Formats onto the end of the text, as long as there's room
+//------------------------------------------------------------------------------------------------
+static VOID Append( CHAR * pBuffer, DWORD dwSize, DWORD * pdwLength, const CHAR * pFormat, ... )
+{
+    if( *pdwLength + 1 >= dwSize )
+        return;
+
+    va_list args;
+    va_start( args, pFormat );
+#if defined(WIN32) || defined(_WIN32)
+    int iWritten = _vsnprintf( pBuffer + *pdwLength, dwSize - *pdwLength - 1, pFormat, args );
+#else
+    int iWritten = vsnprintf( pBuffer + *pdwLength, dwSize - *pdwLength, pFormat, args );
+#endif
+    va_end( args );
+
+    // Text that didn't fit is cut off where the buffer ends
+    if( iWritten < 0 || (DWORD)iWritten >= dwSize - *pdwLength )
+        *pdwLength = dwSize - 1;
+    else
+        *pdwLength += iWritten;
+    pBuffer[*pdwLength] = '\0';
+}
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Write
+// Desc:  Adds up every shard and writes the totals as plain text, in the format Prometheus
+//        scrapes.  Returns the length of the text.
+//------------------------------------------------------------------------------------------------
+DWORD Metrics::Write( CHAR * pBuffer, DWORD dwSize )
+{
+    if( !dwSize )
+        return 0;
+
+    // Add up the shards.  The totals are big enough that they're kept off the stack.
+    Shard * pTotal = (Shard*)calloc( 1, sizeof(Shard) );
+    if( !pTotal )
+    {
+        pBuffer[0] = '\0';
+        return 0;
+    }
+    DWORD dwNumShards = (DWORD)g_lNumShards;
+    if( dwNumShards > METRIC_MAX_SHARDS )
+        dwNumShards = METRIC_MAX_SHARDS;
+    for( DWORD s = 0; s < dwNumShards; ++s )
+    {
+        const Shard * pShard = g_pShards[s];
+        if( !pShard )
+            continue;   // Claimed, but not filled in yet
+
+        for( DWORD i = 0; i < METRIC_NUM_COUNTERS; ++i )
+            pTotal->qwCounters[i] += pShard->qwCounters[i];
+        for( DWORD i = 0; i < METRIC_MESSAGE_TYPES; ++i )
+        {
+            pTotal->qwPacketsIn[i] += pShard->qwPacketsIn[i];
+            pTotal->qwBytesIn[i] += pShard->qwBytesIn[i];
+            pTotal->qwPacketsOut[i] += pShard->qwPacketsOut[i];
+            pTotal->qwBytesOut[i] += pShard->qwBytesOut[i];
+        }
+        for( DWORD h = 0; h < METRIC_NUM_HISTOGRAMS; ++h )
+        {
+            const Histogram * pFrom = &pShard->Histograms[h];
+            Histogram * pTo = &pTotal->Histograms[h];
+            for( DWORD b = 0; b < METRIC_BUCKETS; ++b )
+                pTo->qwBuckets[b] += pFrom->qwBuckets[b];
+            pTo->qwCount += pFrom->qwCount;
+            pTo->qwSum += pFrom->qwSum;
+            if( pFrom->dwMax > pTo->dwMax )
+                pTo->dwMax = pFrom->dwMax;
+        }
+    }
+
+    DWORD dwLength = 0;
+    pBuffer[0] = '\0';
+
+    // Counters
+    for( DWORD i = 0; i < METRIC_NUM_COUNTERS; ++i )
+    {
+        Append( pBuffer, dwSize, &dwLength, "# TYPE %s counter\n%s %llu\n",
+                g_pCounterNames[i], g_pCounterNames[i], (unsigned long long)pTotal->qwCounters[i] );
+    }
+
+    // Sessions that are open right now.  The two counters can be read a moment apart, so
+    // don't let the difference go below zero.
+    QWORD qwOpened = pTotal->qwCounters[METRIC_SESSIONS_OPENED];
+    QWORD qwClosed = pTotal->qwCounters[METRIC_SESSIONS_CLOSED];
+    Append( pBuffer, dwSize, &dwLength, "# TYPE ngs_sessions_active gauge\nngs_sessions_active %llu\n",
+            (unsigned long long)(qwOpened > qwClosed ? qwOpened - qwClosed : 0) );
+
+    // Traffic, for the message types that have had any
+    const CHAR * pTrafficNames[] = { "ngs_packets_received_total", "ngs_bytes_received_total",
+                                     "ngs_packets_sent_total", "ngs_bytes_sent_total" };
+    const QWORD * pTraffic[] = { pTotal->qwPacketsIn, pTotal->qwBytesIn,
+                                 pTotal->qwPacketsOut, pTotal->qwBytesOut };
+    for( DWORD t = 0; t < 4; ++t )
+    {
+        Append( pBuffer, dwSize, &dwLength, "# TYPE %s counter\n", pTrafficNames[t] );
+        for( DWORD i = 0; i < METRIC_MESSAGE_TYPES; ++i )
+        {
+            if( pTraffic[t & ~1][i] )
+                Append( pBuffer, dwSize, &dwLength, "%s{type=\"%s\"} %llu\n",
+                        pTrafficNames[t], g_pMessageNames[i], (unsigned long long)pTraffic[t][i] );
+        }
+    }
+
+    // Histograms, as summaries
+    for( DWORD h = 0; h < METRIC_NUM_HISTOGRAMS; ++h )
+    {
+        const Histogram * pHistogram = &pTotal->Histograms[h];
+        const CHAR * pName = g_pHistogramNames[h];
+        Append( pBuffer, dwSize, &dwLength, "# TYPE %s summary\n", pName );
+        for( DWORD q = 0; q < sizeof(g_dQuantiles) / sizeof(g_dQuantiles[0]); ++q )
+        {
+            Append( pBuffer, dwSize, &dwLength, "%s{quantile=\"%g\"} %lu\n",
+                    pName, g_dQuantiles[q], (unsigned long)GetPercentile( pHistogram, g_dQuantiles[q] ) );
+        }
+        Append( pBuffer, dwSize, &dwLength, "%s_sum %llu\n%s_count %llu\n# TYPE %s_max gauge\n%s_max %lu\n",
+                pName, (unsigned long long)pHistogram->qwSum, pName, (unsigned long long)pHistogram->qwCount,
+                pName, pName, (unsigned long)pHistogram->dwMax );
+    }
+
+    free( pTotal );
+    return dwLength;
+}
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  CreateShard
+// Desc:  Gives the calling thread a shard of its own
+//------------------------------------------------------------------------------------------------
+Metrics::Shard * Metrics::CreateShard()
+{
+    LONG lIndex = InterlockedIncrement( &g_lNumShards ) - 1;
+    if( lIndex >= METRIC_MAX_SHARDS )
+    {
+        // Out of shards, so share the last one.  Its counts can come up short when two threads
+        // write at once, but nothing breaks.
+        t_pShard = g_pShards[METRIC_MAX_SHARDS - 1];
+        if( t_pShard )
+            return t_pShard;
+
+        // The thread that claimed it hasn't filled it in yet
+        static Shard overflow;
+        return &overflow;
+    }
+
+    Shard * pShard = (Shard*)calloc( 1, sizeof(Shard) );
+    if( !pShard )
+    {
+        static Shard lost;
+        return &lost;
+    }
+
+    g_pShards[lIndex] = pShard;
+    t_pShard = pShard;
+    return pShard;
+}
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetBucket
+// Desc:  Finds the histogram bucket for a value.  Values below twice the number of sub-buckets
+//        get a bucket each; past that, every power of two is split evenly.
+//------------------------------------------------------------------------------------------------
+DWORD Metrics::GetBucket( DWORD dwValue )
+{
+    if( dwValue < 2 * METRIC_SUB_BUCKETS )
+        return dwValue;
+
+    // Find the highest set bit
+#if defined(WIN32) || defined(_WIN32)
+    unsigned long ulHighBit;
+    _BitScanReverse( &ulHighBit, dwValue );
+    DWORD dwHighBit = (DWORD)ulHighBit;
+#else
+    DWORD dwHighBit = 31 - (DWORD)__builtin_clz( dwValue );
+#endif
+
+    // Keep the top bits under the highest one to pick the bucket within this power of two
+    DWORD dwShift = dwHighBit - METRIC_SUB_BUCKET_BITS;
+    return dwShift * METRIC_SUB_BUCKETS + (dwValue >> dwShift);
+}
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetBucketLimit
+// Desc:  Gets the largest value that goes into a bucket
+//------------------------------------------------------------------------------------------------
+DWORD Metrics::GetBucketLimit( DWORD dwBucket )
+{
+    if( dwBucket < 2 * METRIC_SUB_BUCKETS )
+        return dwBucket;
+
+    DWORD dwShift = dwBucket / METRIC_SUB_BUCKETS - 1;
+    QWORD qwSubBucket = dwBucket - dwShift * METRIC_SUB_BUCKETS;
+    return (DWORD)(((qwSubBucket + 1) << dwShift) - 1);
+}
+
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetPercentile
+// Desc:  Gets the value that the given fraction of the recorded values are at or below.  This
+//        is the top of the bucket it lands in, so it can be high by the width of a bucket, but
+//        it's never more than the largest value recorded.
+//------------------------------------------------------------------------------------------------
+DWORD Metrics::GetPercentile( const Histogram * pHistogram, DOUBLE dFraction )
+{
+    if( !pHistogram->qwCount )
+        return 0;
+
+    // The rank of the value we're looking for, counting from one
+    QWORD qwRank = (QWORD)(dFraction * pHistogram->qwCount + 0.999999);
+    if( qwRank < 1 )
+        qwRank = 1;
+
+    QWORD qwSeen = 0;
+    for( DWORD b = 0; b < METRIC_BUCKETS; ++b )
+    {
+        qwSeen += pHistogram->qwBuckets[b];
+        if( qwSeen >= qwRank )
+        {
+            DWORD dwLimit = GetBucketLimit( b );
+            return dwLimit < pHistogram->dwMax ? dwLimit : pHistogram->dwMax;
+        }
+    }
+
+    // The count was read before some of the buckets were
+    return pHistogram->dwMax;
+}
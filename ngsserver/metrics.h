@@ -0,0 +1,114 @@
+//------------------------------------------------------------------------------------------------
+// File:    metrics.h
+//
+// Desc:    Counters and latency histograms that are cheap enough to leave on
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+
+// Include files required to compile this header
+#include "../common/platform.h"
+#include "../common/protocol.h"
+
+// Traffic is counted per message ID, with one more slot that every ID past the last message
+// shares
+#define METRIC_MESSAGE_TYPES    (MSG_INPUTACK + 2)
+
+// Histogram buckets are exact below 2^METRIC_SUB_BUCKET_BITS, and above that each power of two
+// is split into that many buckets, so a value is never off by more than about 3%
+#define METRIC_SUB_BUCKET_BITS  5
+#define METRIC_SUB_BUCKETS      (1 << METRIC_SUB_BUCKET_BITS)
+#define METRIC_BUCKETS          ((32 - METRIC_SUB_BUCKET_BITS + 1) * METRIC_SUB_BUCKETS)
+
+// Threads past this many share the last shard, and their counts may be a little low
+#define METRIC_MAX_SHARDS       256
+
+// Enough room for everything Write produces
+#define METRIC_TEXT_SIZE        32768
+
+/**
+ * Events the server counts, other than traffic
+ */
+enum MetricCounter
+{
+    METRIC_SESSIONS_OPENED,
+    METRIC_SESSIONS_CLOSED,
+    METRIC_SESSIONS_TIMED_OUT,
+    METRIC_LOGON_CHALLENGES,
+    METRIC_DROPPED_MALFORMED,       // Datagrams from a player that couldn't be processed
+    METRIC_DROPPED_UNKNOWN,         // Datagrams from an address without a player
+    METRIC_DROPPED_SERVER_FULL,     // Logons with a good cookie that had nowhere to go
+    METRIC_DROPPED_SEND,            // Datagrams the kernel wouldn't take
+    METRIC_NUM_COUNTERS
+};
+
+/**
+ * Distributions the server records
+ */
+enum MetricHistogram
+{
+    METRIC_RELAY_FANOUT,            // Players in each snapshot
+    METRIC_TICK_TIME,               // Microseconds spent on each pass over a room's timers
+    METRIC_QUEUE_DELAY,             // Microseconds datagrams waited in the socket
+    METRIC_NUM_HISTOGRAMS
+};
+
+/**
+ * The server's counters and histograms.  Every thread that records something gets a shard of
+ * its own the first time it does, and only ever writes to that shard, so recording is a plain
+ * add with no locks or atomic operations.  Write adds the shards up while they're being written;
+ * a total can be a moment behind, but it never goes backwards.
+ *   @author Karl Gluck
+ */
+class Metrics
+{
+    public:
+
+        static VOID Count( MetricCounter counter, DWORD dwAmount );
+        static VOID CountReceived( const CHAR * pBuffer, DWORD dwSize );
+        static VOID CountSent( const CHAR * pBuffer, DWORD dwSize );
+        static VOID Record( MetricHistogram histogram, DWORD dwValue );
+
+        static DWORD Write( CHAR * pBuffer, DWORD dwSize );
+
+        // Each thread's counts, and the histograms in them; see metrics.cpp
+        struct Histogram;
+        struct Shard;
+
+    protected:
+
+        static Shard * GetShard();
+        static Shard * CreateShard();
+        static DWORD GetBucket( DWORD dwValue );
+        static DWORD GetBucketLimit( DWORD dwBucket );
+        static DWORD GetPercentile( const Histogram * pHistogram, DOUBLE dFraction );
+};
+
+#endif // __METRICS_H__
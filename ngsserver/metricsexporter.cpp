@@ -0,0 +1,269 @@
+//------------------------------------------------------------------------------------------------
+// File:    metricsexporter.cpp
+//
+// Desc:    Serves the server's metrics to scrapers and copies them to a file
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "metricsexporter.h"
+#include "metrics.h"
+
+#if !defined(WIN32) && !defined(_WIN32)
+#include <sys/select.h>
+#endif
+
+// Connections that can be waiting to be answered
+#define METRICS_BACKLOG     16
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  MetricsExporter
+// Desc:  
+//------------------------------------------------------------------------------------------------
+MetricsExporter::MetricsExporter()
+{
+    m_hThread = NULL;
+    m_sListener = INVALID_SOCKET;
+    m_strFile = NULL;
+    m_pText = NULL;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~MetricsExporter
+// Desc:  
+//------------------------------------------------------------------------------------------------
+MetricsExporter::~MetricsExporter()
+{
+    Stop();
+    Destroy();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Create
+// Desc:  Listens on the loopback address at wPort, unless it's zero, and rewrites strFile every
+//        dwPeriod milliseconds, unless it's NULL
+//------------------------------------------------------------------------------------------------
+HRESULT MetricsExporter::Create( WORD wPort, const CHAR * strFile, DWORD dwPeriod )
+{
+    if( FAILED( m_Reactor.Create( 1 ) ) )
+        return E_FAIL;
+    m_pText = new CHAR[METRIC_TEXT_SIZE];
+
+    if( wPort )
+    {
+        // Only this machine can scrape; the metrics aren't for the players to see
+        m_sListener = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+        if( m_sListener == INVALID_SOCKET )
+        {
+            Destroy();
+            return E_FAIL;
+        }
+        int iReuse = 1;
+        setsockopt( m_sListener, SOL_SOCKET, SO_REUSEADDR, (const char*)&iReuse, sizeof(iReuse) );
+
+        SOCKADDR_IN addr;
+        ZeroMemory( &addr, sizeof(addr) );
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons( wPort );
+        addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+        if( SOCKET_ERROR == bind( m_sListener, (LPSOCKADDR)&addr, sizeof(addr) ) ||
+            SOCKET_ERROR == listen( m_sListener, METRICS_BACKLOG ) ||
+            !SetSocketNonBlocking( m_sListener ) ||
+            FAILED( m_Reactor.Register( m_sListener, ListenerReadable, this ) ) )
+        {
+            Destroy();
+            return E_FAIL;
+        }
+    }
+
+    m_strFile = strFile;
+    if( m_strFile && FAILED( m_Reactor.AddTimer( dwPeriod, DumpTimer, this ) ) )
+    {
+        Destroy();
+        return E_FAIL;
+    }
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Destroy
+// Desc:  Closes the port.  Stop() has to be called first if the exporter started.
+//------------------------------------------------------------------------------------------------
+VOID MetricsExporter::Destroy()
+{
+    if( m_sListener != INVALID_SOCKET )
+    {
+        m_Reactor.Unregister( m_sListener );
+        closesocket( m_sListener );
+        m_sListener = INVALID_SOCKET;
+    }
+    m_Reactor.Destroy();
+
+    if( m_pText )
+    {
+        delete [] m_pText;
+        m_pText = NULL;
+    }
+    m_strFile = NULL;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Start
+// Desc:  Starts answering scrapes
+//------------------------------------------------------------------------------------------------
+HRESULT MetricsExporter::Start()
+{
+    if( NULL == (m_hThread = CreateThread( NULL, 0, ExporterThread, this, 0, NULL )) )
+        return E_FAIL;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Stop
+// Desc:  Stops the thread and writes the file one last time, so it has the final totals
+//------------------------------------------------------------------------------------------------
+VOID MetricsExporter::Stop()
+{
+    if( !m_hThread )
+        return;
+
+    m_Reactor.Stop();
+    WaitForSingleObject( m_hThread, INFINITE );
+    CloseHandle( m_hThread );
+    m_hThread = NULL;
+
+    if( m_strFile )
+        Dump();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ListenerReadable
+// Desc:  Answers every scraper that has connected
+//------------------------------------------------------------------------------------------------
+VOID MetricsExporter::ListenerReadable( LPVOID pContext )
+{
+    MetricsExporter * pThis = (MetricsExporter*)pContext;
+    SOCKET sClient;
+    while( INVALID_SOCKET != (sClient = accept( pThis->m_sListener, NULL, NULL )) )
+    {
+        pThis->Answer( sClient );
+        closesocket( sClient );
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  DumpTimer
+// Desc:  
+//------------------------------------------------------------------------------------------------
+VOID MetricsExporter::DumpTimer( LPVOID pContext, DWORD dwTime )
+{
+    ((MetricsExporter*)pContext)->Dump();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ExporterThread
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DWORD WINAPI MetricsExporter::ExporterThread( LPVOID pParam )
+{
+    ((MetricsExporter*)pParam)->m_Reactor.Run();
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Answer
+// Desc:  Sends the metrics to a scraper.  Whatever it asked for, it gets the same text; the
+//        request is only read so that closing the connection doesn't reset it.
+//------------------------------------------------------------------------------------------------
+VOID MetricsExporter::Answer( SOCKET sClient )
+{
+    // Wait briefly for the request.  Answering takes a moment at most, so holding up the next
+    // scraper is fine.
+    fd_set readSet;
+    FD_ZERO( &readSet );
+    FD_SET( sClient, &readSet );
+    timeval timeout = { 0, METRICS_REQUEST_TIMEOUT * 1000 };
+    if( 0 < select( (int)sClient + 1, &readSet, NULL, NULL, &timeout ) )
+    {
+        CHAR request[1024];
+        recv( sClient, request, sizeof(request), 0 );
+    }
+
+    DWORD dwLength = Metrics::Write( m_pText, METRIC_TEXT_SIZE );
+    CHAR header[128];
+    int iHeader = sprintf( header, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                   "Content-Length: %lu\r\n\r\n", (unsigned long)dwLength );
+
+    // The text is far smaller than a socket's send buffer, so it goes in one call each
+    send( sClient, header, iHeader, 0 );
+    send( sClient, m_pText, (int)dwLength, 0 );
+    shutdown( sClient, SD_SEND );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Dump
+// Desc:  Rewrites the metrics file.  The text goes to a temporary file that then replaces the
+//        old one, so anything reading the file never sees half of it.
+//------------------------------------------------------------------------------------------------
+VOID MetricsExporter::Dump()
+{
+    CHAR strTemporary[512];
+    if( strlen( m_strFile ) + 5 > sizeof(strTemporary) )
+        return;
+    strcpy( strTemporary, m_strFile );
+    strcat( strTemporary, ".tmp" );
+
+    FILE * pFile = fopen( strTemporary, "wb" );
+    if( !pFile )
+        return;
+    DWORD dwLength = Metrics::Write( m_pText, METRIC_TEXT_SIZE );
+    BOOL bWritten = dwLength == fwrite( m_pText, 1, dwLength, pFile );
+    if( fclose( pFile ) || !bWritten )
+        return;
+
+#if defined(WIN32) || defined(_WIN32)
+    MoveFileExA( strTemporary, m_strFile, MOVEFILE_REPLACE_EXISTING );
+#else
+    rename( strTemporary, m_strFile );
+#endif
+}
@@ -0,0 +1,82 @@
+//------------------------------------------------------------------------------------------------
+// File:    metricsexporter.h
+//
+// Desc:    Serves the server's metrics to scrapers and copies them to a file
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __METRICSEXPORTER_H__
+#define __METRICSEXPORTER_H__
+
+
+// Include files required to compile this header
+#include "reactor.h"
+
+// How often the metrics file is rewritten, in milliseconds
+#define METRICS_DUMP_PERIOD     10000
+
+// Longest a scraper gets to send its request before it's answered anyway, in milliseconds
+#define METRICS_REQUEST_TIMEOUT 100
+
+/**
+ * Makes Metrics readable from outside the process.  A TCP port on the loopback address answers
+ * every connection with the current text as an HTTP response, and a file can be rewritten with
+ * the same text every so often.  All of this runs on a reactor thread of its own, so scrapes
+ * never hold up the threads that record the metrics.
+ *   @author Karl Gluck
+ */
+class MetricsExporter
+{
+    public:
+
+        MetricsExporter();
+        ~MetricsExporter();
+        HRESULT Create( WORD wPort, const CHAR * strFile, DWORD dwPeriod );
+        VOID Destroy();
+
+        HRESULT Start();
+        VOID Stop();
+
+    protected:
+
+        static VOID ListenerReadable( LPVOID pContext );
+        static VOID DumpTimer( LPVOID pContext, DWORD dwTime );
+        static DWORD WINAPI ExporterThread( LPVOID pParam );
+
+        VOID Answer( SOCKET sClient );
+        VOID Dump();
+
+    protected:
+
+        Reactor m_Reactor;
+        HANDLE m_hThread;
+        SOCKET m_sListener;
+        const CHAR * m_strFile;
+        CHAR * m_pText;
+};
+
+#endif // __METRICSEXPORTER_H__
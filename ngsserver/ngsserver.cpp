@@ -29,298 +29,261 @@
 //  authors and should not be interpreted as representing official policies, either expressed
 //  or implied, of Karl Gluck.
 //------------------------------------------------------------------------------------------------
-#include <winsock2.h>
-#include <stdio.h>
-#include <conio.h>
-#include "user.h"
+#include "reactor.h"
+#include "datagrambatch.h"
+#include "roomscheduler.h"
+#include "uringengine.h"
+#include "capturelog.h"
+#include "metricsexporter.h"
+#include "metrics.h"
+#include "eventlog.h"
+#include "server.h"
 
 // Settings that define how the server operates
 #define WINSOCK_VERSION     MAKEWORD(2,2)
-#define SERVER_COMM_PORT    27192
-#define MAX_PACKET_SIZE     1024
-#define MAX_USERS           16
 
 
 // Global variables used in the server program.  These variables are global because they are used
 // by the server thread and initialized in the main thread.  It would be inefficient and
 // duplicative to find an object-oriented workaround.
-HANDLE g_hExitEvent;    // Set when the server shuts down
 HANDLE g_hCommThread;   // Thread processing object
-WSAEVENT g_hRecvEvent;  // Event triggered when data is received
+Reactor g_Reactor;      // Dispatches every socket's packets on the comm thread
+UringEngine g_Uring;    // Takes the reactor's place when "-uring" was given and it's available
+BOOL g_bUseUring;       // Whether g_Uring is running the server
+DatagramBatch g_Batch;  // Moves the shared socket's datagrams in batches when the reactor runs it
 SOCKET g_sSocket;       // Socket to send and receive on
+CaptureLog g_Capture;   // Records everything the server handles, if "-capture" was given
+Room g_Room;            // The world everyone logs on to when there's only one
 
-// Global variables for client management
-//HANDLE g_hUserSemaphore;    // Allows only a certain number of users to process simultaneously
-User g_Users[MAX_USERS];    // List of all of the users
-
-enum Message
-{
-    MSG_LOGON,
-    MSG_LOGOFF,
-    MSG_UPDATEPLAYER,
-    MSG_CONFIRMLOGON,
-    MSG_PLAYERLOGGEDOFF,
-};
-
-struct MessageHeader
+int SendPacket( const LPSOCKADDR_IN pAddress, const CHAR * pBuffer, int length )
 {
-    Message MsgID;
-};
+    return sendto( g_sSocket, pBuffer, length, 0, (LPSOCKADDR)pAddress, sizeof(SOCKADDR_IN) );
+}
 
-struct LogOnMessage
+VOID UserReadable( LPVOID pContext )
 {
-    MessageHeader   Header;
+    // Get a pointer to the user structure
+    User * pUser = (User*)pContext;
 
-    LogOnMessage() { Header.MsgID = MSG_LOGON; }
-};
+    // Buffers used to recieve data
+    CHAR buffer[MAX_PACKET_SIZE];
+    int size;
 
-struct LogOffMessage
-{
-    MessageHeader   Header;
+    // Get packets until the socket would block
+    while( SOCKET_ERROR != (size = pUser->RecvPacket( buffer, sizeof(buffer) )) )
+    {
+        if( g_Capture.IsOpen() )
+            g_Capture.AppendDatagram( CAPTURE_USER_DATAGRAM + (DWORD)(pUser - g_Room.GetUserBySlot( 0 )), pUser->GetAddress(), buffer, size );
+
+        // Nobody is logged on through this slot, so throw the data away
+        if( !pUser->IsConnected() )
+            continue;
+
+        // Process information from the packet
+        HRESULT hr = g_Room.ProcessUserPacket( pUser, buffer, size );
+        if( FAILED( hr ) )
+            Metrics::Count( METRIC_DROPPED_MALFORMED, 1 );
+        else if( S_FALSE == hr )
+        {
+            if( g_bLogEvents )
+                EventLog::Write( "\n[%u] disconnected", pUser->GetId() );
+            break;
+        }
+    }
+}
 
-    LogOffMessage() { Header.MsgID = MSG_LOGOFF; }
-};
 
-struct UpdatePlayerMessage
+VOID ServerDatagram( LPVOID pContext, const SOCKADDR_IN * pFrom, const CHAR * pBuffer, DWORD dwSize )
 {
-    MessageHeader   Header;
-    DWORD           dwPlayerID;
-    FLOAT           fVelocity[3];       // Expressed in meters / second
-    FLOAT           fPosition[3];
-    DWORD           dwState;
-    FLOAT           fYaw;
+    // The data is still in the loop's receive buffer, which is reused once this returns
+    if( g_Capture.IsOpen() )
+        g_Capture.AppendDatagram( CAPTURE_SERVER_DATAGRAM, pFrom, pBuffer, dwSize );
+
+    g_Room.ProcessServerPacket( pFrom, pBuffer, dwSize );
+}
 
-    UpdatePlayerMessage() { Header.MsgID = MSG_UPDATEPLAYER; }
-};
 
-struct ConfirmLogOnMessage
+VOID ServerSocketReadable( LPVOID pContext )
 {
-    MessageHeader   Header;
+    // Handle everything that has arrived, then send the replies together
+    g_Batch.Receive( ServerDatagram, NULL );
+    g_Batch.Flush();
+}
 
-    ConfirmLogOnMessage() { Header.MsgID = MSG_CONFIRMLOGON; }
-};
 
-struct PlayerLoggedOff
+int BatchSend( LPVOID pContext, const SOCKADDR_IN * pAddress, const CHAR * pBuffer, int length )
 {
-    MessageHeader   Header;
-    DWORD           dwPlayerID;
-
-    PlayerLoggedOff() { Header.MsgID = MSG_PLAYERLOGGEDOFF; }
-};
+    return ((DatagramBatch*)pContext)->Queue( pAddress, pBuffer, length );
+}
 
 
-BOOL WaitForPackets()
+int UringSend( LPVOID pContext, const SOCKADDR_IN * pAddress, const CHAR * pBuffer, int length )
 {
-    WSAEVENT hEvents[] = { g_hRecvEvent, g_hExitEvent };
-    return WAIT_OBJECT_0 == WSAWaitForMultipleEvents( 2, hEvents, FALSE, INFINITE, FALSE );
+    return ((UringEngine*)pContext)->Send( g_sSocket, pAddress, pBuffer, length );
 }
 
 
-int RecvPacket( char * pBuffer, int length, SOCKADDR_IN * pAddress  )
+VOID RunTimers( LPVOID pContext, DWORD dwTime )
 {
-    // CHEAP TRICK!!  Force the receive event to reset.  Find out why this doesn't usually work!!
-    ResetEvent( g_hRecvEvent );
-
-    // Size of the address structure
-    int iFromLen = sizeof(SOCKADDR_IN);
+    // Timer passes are captured too, so a replay sends snapshots and times users out between
+    // the same datagrams
+    if( g_Capture.IsOpen() )
+        g_Capture.AppendEvent( CAPTURE_TICK );
 
-    // Perform the operation
-    return recvfrom( g_sSocket, pBuffer, length, 0, (LPSOCKADDR)pAddress, &iFromLen );
+    g_Room.Advance( dwTime );
+    g_Batch.Flush();
 }
 
 
-int SendPacket( const LPSOCKADDR_IN pAddress, const CHAR * pBuffer, int length )
-{
-    return sendto( g_sSocket, pBuffer, length, 0, (LPSOCKADDR)&pAddress, sizeof(SOCKADDR_IN) );
-}
 
-HRESULT ProcessUserPacket( User * pUser, const CHAR * pBuffer, DWORD dwSize )
+DWORD WINAPI CommThread( LPVOID pParam )
 {
-    // Get the message header so we can determine the type of the packet
-    MessageHeader * mh = (MessageHeader*)pBuffer;
-
-    // Process the message
-    switch( mh->MsgID )
-    {
-        case MSG_LOGOFF:
-            {
-                // Get this user's ID number
-                DWORD dwId = pUser->GetId();
-
-                // Build a disconnect message
-                PlayerLoggedOff packet;
-                packet.dwPlayerID = dwId;
-
-                // Tell all of the other users that this player disconnected
-                for( DWORD i = 0; i < MAX_USERS; ++i )
-                {
-                    // Send to all connected users except the source
-                    if( (i != dwId) && (g_Users[i].IsConnected()) )
-                        g_Users[i].SendPacket( (CHAR*)&packet, sizeof(packet) );
-                }
-
-                // Disconnect the user
-                pUser->Disconnect();
-
-                // Return a success message, but the recieve loop can't continue
-                return S_FALSE;
-            }
-
-        case MSG_UPDATEPLAYER:
-            {
-                // Get this user's ID number
-                DWORD dwId = pUser->GetId();
-
-                // Set the message's ID component
-                UpdatePlayerMessage upm;
-                memcpy( &upm, pBuffer, dwSize );
-                upm.dwPlayerID = dwId;
-
-                // Re-broadcast this message
-                for( DWORD i = 0; i < MAX_USERS; ++i )
-                {
-                    // Send to all connected users except the source
-                    if( (i != dwId) && (g_Users[i].IsConnected()) )
-                        g_Users[i].SendPacket( (CHAR*)&upm, dwSize );
-                }
-
-            } break;
-
-        default:
-            {
-                // This message type couldn't be processed
-                return E_FAIL;
-            }
-    }
+    // Every socket in the server is handled from here until shutdown
+    if( g_bUseUring )
+        g_Uring.Run();
+    else
+        g_Reactor.Run();
 
     // Success
     return S_OK;
 }
 
-DWORD WINAPI UserProcessor( LPVOID pParam )
-{
-    // Get a pointer to the user structure
-    User * pUser = (User*)pParam;
 
-    // Send a message to the user telling them that they have successfully logged on
+int HostRooms( DWORD dwNumRooms, DWORD dwUsersPerRoom, FLOAT fViewRadius, DWORD dwNumWorkers )
+{
+    // Set up every room before any of them start
+    RoomScheduler scheduler;
+    if( FAILED( scheduler.Create( SERVER_COMM_PORT, dwNumRooms, dwUsersPerRoom, fViewRadius, dwNumWorkers ) ) )
     {
-        // Build a packet
-        ConfirmLogOnMessage packet;
-
-        // Send the packet
-        pUser->SendPacket( (CHAR*)&packet, sizeof(packet) );
+        printf( "Couldn't set up %u rooms\n", dwNumRooms );
+        return -1;
     }
+    if( FAILED( scheduler.Start() ) )
+        return -1;
 
-    // Activity flag
-    BOOL bUserActive = TRUE;
-
-    // Enter the processing loop
-    while( bUserActive )
-    {
-        // Wait for something to happen or for 5 seconds to expire
-        switch( pUser->WaitForPackets( 5000 ) )
-        {
-            // When a packet is recieved, process it
-            case EWR_RECVPACKET:
-                {
-                    OutputDebugString( "." );
-
-                    // Buffers used to recieve data
-                    CHAR buffer[MAX_PACKET_SIZE];
-                    int size;
-
-                    // Get the packet
-                    while( SOCKET_ERROR != (size = pUser->RecvPacket( buffer, sizeof(buffer) )) )
-                    {
-                        // Process information from the packet
-                        if( S_FALSE == ProcessUserPacket( pUser, buffer, size ) )
-                            break;
-                    }
-
-                } break;
-
-            // If the user hasn't sent a message in a while, determine if the program wants to
-            // exit.  If it does, break the loop.
-            case EWR_TIMEOUT:
-                {
-                    // Output message
-                    printf( "\n[%u] lagged out", pUser->GetId() );
-
-                    // If the global termination event is set, exit
-                    if( WAIT_OBJECT_0 == WaitForSingleObject( g_hExitEvent, 0 ) )
-                        break;
-
-                    // Log this player out
-                    //pUser->Disconnect();
-
-                } break;
-
-            // This user has been forcibly disconnected by the server, usually by shutting down.
-            case EWR_DISCONNECT:
-                {
-                    // Output message
-                    printf( "\n[%u] disconnected", pUser->GetId() );
-
-                    // No longer active
-                    bUserActive = FALSE;
-
-                } break;
-        }
-    }
+    // Tell the user that the server has been initialized
+    printf( "Hosting %u rooms of %u users on %u worker threads.  Press any key to exit...",
+            dwNumRooms, dwUsersPerRoom, dwNumWorkers );
 
-    pUser->ThreadFinished();
+    // Wait for a key to exit
+    _getch();
+    scheduler.Stop();
+    printf( "\nMoved rooms between workers %u times\n", scheduler.GetNumMoves() );
+    scheduler.Destroy();
 
     // Success
-    return S_OK;
+    return 0;
 }
 
 
-HRESULT LogOnNewPlayer( const SOCKADDR_IN * pAddr )
+int main( int argc, char * argv[] )
 {
-    // Look through the list
-    for( int i = 0; i < MAX_USERS; ++i )
+    // Read the command line.  "-users N" sets how many players can be logged on at once,
+    // "-view R" sets how close players have to be to see each other, "-bound B" sets the edge of
+    // the world for compact updates, "-ports" gives every user its own bound socket, like
+    // older versions of the server, "-capture F" records all traffic to the file F, and "-uring"
+    // runs the shared socket on io_uring instead of the reactor where the system supports it.
+    // "-rooms N" hosts N separate worlds of "-users" players each, run by "-workers W" threads
+    // (one per processor by default).  "-metrics P" serves the server's metrics on local TCP
+    // port P, and "-metricsfile F" rewrites the file F with them every few seconds.  "-log F"
+    // writes logons, disconnects and other events to the file F instead of the console.
+    // "-authority" has players send their inputs and moves them on the server, instead of
+    // trusting the positions they report.
+    g_bSharedPort = TRUE;
+    DWORD dwMaxUsers = DEFAULT_MAX_USERS;
+    g_fWorldBound = DEFAULT_WORLD_BOUND;
+    FLOAT fViewRadius = VIEW_RADIUS;
+    const CHAR * strCaptureFile = NULL;
+    BOOL bWantUring = FALSE;
+    DWORD dwNumRooms = 1;
+    DWORD dwNumWorkers = 0;
+    WORD wMetricsPort = 0;
+    const CHAR * strMetricsFile = NULL;
+    const CHAR * strLogFile = NULL;
+    for( int i = 1; i < argc; ++i )
     {
-        // If this user structure isn't already handling someone, set up the connection
-        if( g_Users[i].IsConnected() == FALSE )
-        {
-            printf( "\nLogged on user %i", i );
-            return g_Users[i].Connect( pAddr, UserProcessor );
-        }
+        if( 0 == strcmp( argv[i], "-ports" ) )
+            g_bSharedPort = FALSE;
+        else if( 0 == strcmp( argv[i], "-users" ) && i + 1 < argc )
+            dwMaxUsers = (DWORD)atoi( argv[++i] );
+        else if( 0 == strcmp( argv[i], "-view" ) && i + 1 < argc )
+            fViewRadius = (FLOAT)atof( argv[++i] );
+        else if( 0 == strcmp( argv[i], "-bound" ) && i + 1 < argc )
+            g_fWorldBound = (FLOAT)atof( argv[++i] );
+        else if( 0 == strcmp( argv[i], "-capture" ) && i + 1 < argc )
+            strCaptureFile = argv[++i];
+        else if( 0 == strcmp( argv[i], "-uring" ) )
+            bWantUring = TRUE;
+        else if( 0 == strcmp( argv[i], "-rooms" ) && i + 1 < argc )
+            dwNumRooms = (DWORD)atoi( argv[++i] );
+        else if( 0 == strcmp( argv[i], "-workers" ) && i + 1 < argc )
+            dwNumWorkers = (DWORD)atoi( argv[++i] );
+        else if( 0 == strcmp( argv[i], "-metrics" ) && i + 1 < argc )
+            wMetricsPort = (WORD)atoi( argv[++i] );
+        else if( 0 == strcmp( argv[i], "-metricsfile" ) && i + 1 < argc )
+            strMetricsFile = argv[++i];
+        else if( 0 == strcmp( argv[i], "-log" ) && i + 1 < argc )
+            strLogFile = argv[++i];
+        else if( 0 == strcmp( argv[i], "-authority" ) )
+            g_bAuthoritative = TRUE;
     }
 
-    // Couldn't find a place for the player
-    return E_FAIL;
-}
+    // Each room needs a port of its own, after the lobby's
+    if( dwNumRooms < 1 || dwNumRooms > 0xFFFF - SERVER_COMM_PORT )
+    {
+        printf( "The server can host between 1 and %u rooms\n", 0xFFFF - SERVER_COMM_PORT );
+        return -1;
+    }
+    if( dwNumRooms > 1 && (!g_bSharedPort || bWantUring || strCaptureFile) )
+    {
+        printf( "Multiple rooms can't be combined with -ports, -uring or -capture\n" );
+        return -1;
+    }
 
+    // Every worker should have a processor and a room to itself
+    if( dwNumWorkers == 0 )
+        dwNumWorkers = GetProcessorCount();
+    if( dwNumWorkers > dwNumRooms )
+        dwNumWorkers = dwNumRooms;
 
-DWORD WINAPI CommThread( LPVOID pParam )
-{
-    // Wait for things to happen
-    while( WaitForPackets() )
+    if( bWantUring && !g_bSharedPort )
     {
-        // Holds incoming data values
-        char buffer[MAX_PACKET_SIZE];
-        SOCKADDR_IN address;
-        int len;
-    
-        ZeroMemory( buffer, sizeof(buffer) );
-
-        // Get data until the operation would block
-        while( SOCKET_ERROR != (len = RecvPacket( buffer, sizeof(buffer), &address )) )
-        {
-            MessageHeader * pMh = (MessageHeader*)buffer;
-            if( pMh->MsgID == MSG_LOGON )
-                LogOnNewPlayer( &address );
-        }
+        printf( "io_uring can only be used with the shared port\n" );
+        return -1;
     }
 
-    // Success
-    return S_OK;
-}
+    if( !(g_fWorldBound > 0.0f) )
+    {
+        printf( "The world bound must be greater than zero\n" );
+        return -1;
+    }
+
+    if( dwMaxUsers < 1 || dwMaxUsers > MAX_PLAYER_SLOTS )
+    {
+        printf( "The server can host between 1 and %u users\n", MAX_PLAYER_SLOTS );
+        return -1;
+    }
+    if( !(fViewRadius > 0.0f) )
+    {
+        printf( "The view radius must be greater than zero\n" );
+        return -1;
+    }
 
+    // Allocate the per-player tables
+    CookieSecret secret;
+    LogOnCookies::MakeSecret( &secret );
+    if( dwNumRooms == 1 && FAILED( g_Room.Create( dwMaxUsers, fViewRadius, GetTickCount(), &secret ) ) )
+        return -1;
 
-int main()
-{
+    // Start recording before anything can arrive
+    if( strCaptureFile &&
+        FAILED( g_Capture.Create( strCaptureFile, dwMaxUsers, fViewRadius, g_fWorldBound, g_bSharedPort, g_bAuthoritative, &secret ) ) )
+    {
+        printf( "Couldn't create the capture file '%s'\n", strCaptureFile );
+        return -1;
+    }
+
+#if defined(WIN32) || defined(_WIN32)
     // Start up Winsock
     {
         // Stores information about Winsock
@@ -331,6 +294,7 @@ int main()
                     wsaData.wVersion != WINSOCK_VERSION )
             return -1;
     }
+#endif
 
     // Tell the user the local IP address and host information
     {
@@ -351,69 +315,157 @@ int main()
         printf( "Server '%s' is operating at %s\n", strHostName, inet_ntoa(addr) );
     }
 
+    // Events are written out by a thread of their own, so logging never holds up a packet
+    if( FAILED( EventLog::Start( strLogFile ) ) )
+    {
+        printf( "Couldn't open the log file '%s'\n", strLogFile );
+        return -1;
+    }
+
+    // Metrics are recorded either way; this just makes them visible
+    MetricsExporter exporter;
+    if( wMetricsPort || strMetricsFile )
+    {
+        if( FAILED( exporter.Create( wMetricsPort, strMetricsFile, METRICS_DUMP_PERIOD ) ) ||
+            FAILED( exporter.Start() ) )
+        {
+            printf( "Couldn't serve metrics on port %u\n", wMetricsPort );
+            return -1;
+        }
+        if( wMetricsPort )
+            printf( "Metrics are at http://127.0.0.1:%u/metrics\n", wMetricsPort );
+    }
+
+    // Many rooms are run by the scheduler's threads instead of the loop below
+    if( dwNumRooms > 1 )
+    {
+        int iResult = HostRooms( dwNumRooms, dwMaxUsers, fViewRadius, dwNumWorkers );
+        exporter.Stop();
+        exporter.Destroy();
+        EventLog::Stop();
+#if defined(WIN32) || defined(_WIN32)
+        WSACleanup();
+#endif
+        return iResult;
+    }
+
     // Set up server data
     {
-        // Initialize the exit event
-        g_hExitEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+        // Every user can have a logon reply and a snapshot in flight each tick
+        if( bWantUring )
+        {
+            g_bUseUring = SUCCEEDED( g_Uring.Create( URING_DEFAULT_BUFFERS, 2 * dwMaxUsers + 64 ) );
+            if( !g_bUseUring )
+                printf( "io_uring isn't available; using the reactor instead\n" );
+        }
+
+        // Set up the reactor with room for the server socket and every user
+        if( !g_bUseUring && FAILED( g_Reactor.Create( g_bSharedPort ? 1 : dwMaxUsers + 1 ) ) )
+            return -1;
 
         // Set up the main socket to accept and send UDP packets
         g_sSocket = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
 
         // Generate the address to bind to
         SOCKADDR_IN addr;
+        ZeroMemory( &addr, sizeof(addr) );
         addr.sin_family = AF_INET;
         addr.sin_port = htons( SERVER_COMM_PORT );
-        addr.sin_addr.S_un.S_addr = INADDR_ANY;
+        addr.sin_addr.s_addr = INADDR_ANY;
 
         // Bind it to a port
         if( SOCKET_ERROR == bind( g_sSocket, (LPSOCKADDR)&addr, sizeof(SOCKADDR_IN) ) )
             return -1;
 
-        // Create the event
-        g_hRecvEvent = WSACreateEvent();
-        if( SOCKET_ERROR == WSAEventSelect( g_sSocket, g_hRecvEvent, FD_READ ) )
+        // Listen for logons, and for user packets if the port is shared
+        if( g_bUseUring )
+        {
+            if( FAILED( g_Uring.Register( g_sSocket, ServerDatagram, NULL ) ) )
+                return -1;
+        }
+        else if( FAILED( g_Reactor.Register( g_sSocket, ServerSocketReadable, NULL ) ) )
             return -1;
 
-        // Create the processor thread
-        if( NULL == (g_hCommThread = CreateThread( NULL, 0, CommThread, NULL, 0, NULL )) )
-            return -1;
+        // The room's timers send each user's snapshots and log off users that stop sending
+        if( g_bUseUring )
+            g_Uring.AddTimer( TIMER_RESOLUTION, RunTimers, NULL );
+        else
+            g_Reactor.AddTimer( TIMER_RESOLUTION, RunTimers, NULL );
     }
 
-    // Initialize all of the clients
+    // Initialize all of the clients.  With io_uring, packets are queued on the engine instead
+    // of being sent right away.
+    if( g_bUseUring )
+    {
+        g_Room.SetReplySend( UringSend, &g_Uring );
+        for( DWORD i = 0; i < dwMaxUsers; ++i )
+            g_Room.GetUserBySlot( i )->Create( UringSend, &g_Uring );
+    }
+    else
     {
-        WORD wBasePort = SERVER_COMM_PORT + 1;
-        for( int i = 0; i < MAX_USERS; ++i )
-            while( !g_Users[i].Create( i, wBasePort + i ) ) { wBasePort++; }
+        // Everything sent on the server socket is queued and flushed once per pass of the loop.
+        // With a port per user, that's only the logon handshake.
+        if( FAILED( g_Batch.Create( g_sSocket, BATCH_DEFAULT_RECEIVES, dwMaxUsers + 64 ) ) )
+            return -1;
+        g_Room.SetReplySend( BatchSend, &g_Batch );
+
+        if( g_bSharedPort )
+        {
+            for( DWORD i = 0; i < dwMaxUsers; ++i )
+                g_Room.GetUserBySlot( i )->Create( BatchSend, &g_Batch );
+        }
+        else
+        {
+            WORD wBasePort = SERVER_COMM_PORT + 1;
+            for( DWORD i = 0; i < dwMaxUsers; ++i )
+                while( FAILED( g_Room.GetUserBySlot( i )->Create( wBasePort + i, &g_Reactor, UserReadable ) ) ) { wBasePort++; }
+        }
     }
 
+    // Create the processor thread
+    if( NULL == (g_hCommThread = CreateThread( NULL, 0, CommThread, NULL, 0, NULL )) )
+        return -1;
+
     // Tell the user that the server has been initialized
     printf( "Server successfully initialized.  Press any key to exit..." );
 
-    // Repeat until the termination event is set
-    while( WAIT_OBJECT_0 != WaitForSingleObject( g_hExitEvent, 0 ) )
-    {
-        // Wait for 10 seconds to exit
-        _getch();
-        SetEvent( g_hExitEvent );
-    }
+    // Wait for a key to exit
+    _getch();
+    if( g_bUseUring )
+        g_Uring.Stop();
+    else
+        g_Reactor.Stop();
 
     // Wait for the main thread to terminate
     WaitForSingleObject( g_hCommThread, INFINITE );
+    CloseHandle( g_hCommThread );
 
-    // Shut down all of the clients
-    {
-        for( int i = 0; i < MAX_USERS; ++i )
-            g_Users[i].Destroy();
-    }
+    // Say how well the shared socket's traffic was batched
+    if( g_Batch.GetDatagrams() )
+        printf( "\nMoved %llu datagrams with %llu system calls\n",
+                (unsigned long long)g_Batch.GetDatagrams(), (unsigned long long)g_Batch.GetSystemCalls() );
+
+    // The file gets the final totals, and the log gets the last events
+    exporter.Stop();
+    exporter.Destroy();
+    EventLog::Stop();
 
-    // Delete the receive event
-    WSACloseEvent( g_hRecvEvent );
+    // Shut down all of the clients
+    g_Room.Destroy();
+    g_Capture.Close();
 
     // Close the socket
+    if( !g_bUseUring )
+        g_Reactor.Unregister( g_sSocket );
+    g_Uring.Destroy();
+    g_Batch.Destroy();
     closesocket( g_sSocket );
+    g_Reactor.Destroy();
 
+#if defined(WIN32) || defined(_WIN32)
     // Shut down Winsock
     WSACleanup();
+#endif
 
     // Success
     return 0;
@@ -0,0 +1,473 @@
+//------------------------------------------------------------------------------------------------
+// File:    reactor.cpp
+//
+// Desc:    Single-threaded readiness loop that multiplexes every server socket
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "reactor.h"
+
+#if !defined(WIN32) && !defined(_WIN32)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+// Marks the end of the free entry list
+#define END_OF_LIST     0xFFFFFFFF
+
+// Most events that are pulled out of the kernel in one pass
+#define MAX_EVENTS      256
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Reactor
+// Desc:  
+//------------------------------------------------------------------------------------------------
+Reactor::Reactor()
+{
+    m_pEntries = NULL;
+    m_dwMaxEntries = 0;
+    m_dwFirstFree = END_OF_LIST;
+    m_dwHighWater = 0;
+    m_dwNumTimers = 0;
+    m_bRunning = FALSE;
+    m_pPosted = NULL;
+    m_pRunning = NULL;
+    m_dwNumPosted = 0;
+    InitializeCriticalSection( &m_PostLock );
+#if !defined(WIN32) && !defined(_WIN32)
+    m_iEpoll = -1;
+    m_iWakeEvent = -1;
+#endif
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~Reactor
+// Desc:  
+//------------------------------------------------------------------------------------------------
+Reactor::~Reactor()
+{
+    Destroy();
+    DeleteCriticalSection( &m_PostLock );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Create
+// Desc:  Allocates room for the given number of sockets and sets up the kernel wait object
+//------------------------------------------------------------------------------------------------
+HRESULT Reactor::Create( DWORD dwMaxSockets )
+{
+#if defined(WIN32) || defined(_WIN32)
+    // select() can't watch more than FD_SETSIZE sockets
+    if( dwMaxSockets > FD_SETSIZE )
+        return E_FAIL;
+#else
+    // Create the epoll set
+    if( -1 == (m_iEpoll = epoll_create1( 0 )) )
+        return E_FAIL;
+
+    // This event is written by Stop() to break out of epoll_wait
+    if( -1 == (m_iWakeEvent = eventfd( 0, EFD_NONBLOCK )) )
+    {
+        Destroy();
+        return E_FAIL;
+    }
+
+    // The wake event is the only descriptor that isn't in the entry table
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = END_OF_LIST;
+    if( -1 == epoll_ctl( m_iEpoll, EPOLL_CTL_ADD, m_iWakeEvent, &ev ) )
+    {
+        Destroy();
+        return E_FAIL;
+    }
+#endif
+
+    // Allocate the entry table
+    if( NULL == (m_pEntries = new Entry[dwMaxSockets]) )
+    {
+        Destroy();
+        return E_OUTOFMEMORY;
+    }
+    m_dwMaxEntries = dwMaxSockets;
+    m_dwHighWater = 0;
+    m_dwFirstFree = END_OF_LIST;
+
+    // Allocate room for calls from other threads
+    m_pPosted = new PostedCall[REACTOR_MAX_POSTS];
+    m_pRunning = new PostedCall[REACTOR_MAX_POSTS];
+    m_dwNumPosted = 0;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Destroy
+// Desc:  
+//------------------------------------------------------------------------------------------------
+VOID Reactor::Destroy()
+{
+#if !defined(WIN32) && !defined(_WIN32)
+    if( m_iWakeEvent != -1 )
+    {
+        close( m_iWakeEvent );
+        m_iWakeEvent = -1;
+    }
+
+    if( m_iEpoll != -1 )
+    {
+        close( m_iEpoll );
+        m_iEpoll = -1;
+    }
+#endif
+
+    if( m_pEntries != NULL )
+    {
+        delete [] m_pEntries;
+        m_pEntries = NULL;
+    }
+
+    delete [] m_pPosted;
+    delete [] m_pRunning;
+    m_pPosted = NULL;
+    m_pRunning = NULL;
+    m_dwNumPosted = 0;
+
+    m_dwMaxEntries = 0;
+    m_dwNumTimers = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Register
+// Desc:  Starts watching a socket.  The socket is switched to non-blocking mode so that the
+//        callback can read until SOCKET_ERROR without stalling the loop.
+//------------------------------------------------------------------------------------------------
+HRESULT Reactor::Register( SOCKET sSocket, ReactorCallback pfnCallback, LPVOID pContext )
+{
+    // Take an entry off of the free list, or from the end of the table
+    DWORD dwIndex;
+    if( m_dwFirstFree != END_OF_LIST )
+    {
+        dwIndex = m_dwFirstFree;
+        m_dwFirstFree = m_pEntries[dwIndex].dwNextFree;
+    }
+    else if( m_dwHighWater < m_dwMaxEntries )
+        dwIndex = m_dwHighWater++;
+    else
+        return E_FAIL;
+
+    // Fill in the entry
+    Entry * pEntry = &m_pEntries[dwIndex];
+    pEntry->sSocket = sSocket;
+    pEntry->pfnCallback = pfnCallback;
+    pEntry->pContext = pContext;
+
+    // Make sure reads don't block
+    if( !SetSocketNonBlocking( sSocket ) )
+    {
+        Unregister( sSocket );
+        return E_FAIL;
+    }
+
+#if !defined(WIN32) && !defined(_WIN32)
+    // Add the socket to the epoll set.  This is level-triggered so that a callback which stops
+    // reading early will simply be called again.
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = dwIndex;
+    if( -1 == epoll_ctl( m_iEpoll, EPOLL_CTL_ADD, sSocket, &ev ) )
+    {
+        Unregister( sSocket );
+        return E_FAIL;
+    }
+#endif
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Unregister
+// Desc:  Stops watching a socket.  Any event for it that is still in the current batch is
+//        dropped, since its callback pointer is cleared here.
+//------------------------------------------------------------------------------------------------
+VOID Reactor::Unregister( SOCKET sSocket )
+{
+    Entry * pEntry = FindEntry( sSocket );
+    if( !pEntry )
+        return;
+
+#if !defined(WIN32) && !defined(_WIN32)
+    epoll_ctl( m_iEpoll, EPOLL_CTL_DEL, sSocket, NULL );
+#endif
+
+    // Return the entry to the free list
+    pEntry->sSocket = INVALID_SOCKET;
+    pEntry->pfnCallback = NULL;
+    pEntry->pContext = NULL;
+    pEntry->dwNextFree = m_dwFirstFree;
+    m_dwFirstFree = (DWORD)(pEntry - m_pEntries);
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  AddTimer
+// Desc:  Calls pfnCallback every dwPeriod milliseconds from inside Run()
+//------------------------------------------------------------------------------------------------
+HRESULT Reactor::AddTimer( DWORD dwPeriod, ReactorTimerCallback pfnCallback, LPVOID pContext )
+{
+    if( m_dwNumTimers >= REACTOR_MAX_TIMERS )
+        return E_FAIL;
+
+    Timer * pTimer = &m_Timers[m_dwNumTimers++];
+    pTimer->dwPeriod = dwPeriod;
+    pTimer->dwNextTime = GetTickCount() + dwPeriod;
+    pTimer->pfnCallback = pfnCallback;
+    pTimer->pContext = pContext;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Post
+// Desc:  Has the reactor thread call pfnCallback the next time around its loop.  Calls run in
+//        the order they were posted.  This can be called from any thread, and fails if too many
+//        calls are already waiting.
+//------------------------------------------------------------------------------------------------
+HRESULT Reactor::Post( ReactorCallback pfnCallback, LPVOID pContext )
+{
+    EnterCriticalSection( &m_PostLock );
+    BOOL bPosted = m_pPosted && m_dwNumPosted < REACTOR_MAX_POSTS;
+    if( bPosted )
+    {
+        m_pPosted[m_dwNumPosted].pfnCallback = pfnCallback;
+        m_pPosted[m_dwNumPosted].pContext = pContext;
+        m_dwNumPosted++;
+    }
+    LeaveCriticalSection( &m_PostLock );
+
+    if( !bPosted )
+        return E_FAIL;
+
+    // Success
+    Wake();
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Run
+// Desc:  Dispatches socket and timer callbacks until Stop() is called
+//------------------------------------------------------------------------------------------------
+VOID Reactor::Run()
+{
+    m_bRunning = TRUE;
+
+    while( m_bRunning )
+    {
+        // Fire any timers that are due and find out how long we can sleep
+        DWORD dwTimeout = RunTimers();
+
+        // Wait for something to happen
+        WaitForEvents( dwTimeout );
+
+        // Pick up whatever other threads have handed over
+        RunPostedCalls();
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Stop
+// Desc:  Makes Run() return.  This can be called from any thread.
+//------------------------------------------------------------------------------------------------
+VOID Reactor::Stop()
+{
+    m_bRunning = FALSE;
+    Wake();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  FindEntry
+// Desc:  Looks up the table entry for a registered socket
+//------------------------------------------------------------------------------------------------
+Reactor::Entry * Reactor::FindEntry( SOCKET sSocket )
+{
+    for( DWORD i = 0; i < m_dwHighWater; ++i )
+    {
+        if( m_pEntries[i].pfnCallback && m_pEntries[i].sSocket == sSocket )
+            return &m_pEntries[i];
+    }
+
+    // Not registered
+    return NULL;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RunTimers
+// Desc:  Calls every timer that has come due and returns the milliseconds until the next one
+//------------------------------------------------------------------------------------------------
+DWORD Reactor::RunTimers()
+{
+    DWORD dwTime = GetTickCount();
+    DWORD dwTimeout = INFINITE;
+
+    for( DWORD i = 0; i < m_dwNumTimers; ++i )
+    {
+        Timer * pTimer = &m_Timers[i];
+
+        // The signed difference handles wraparound of the tick count
+        if( (int)(dwTime - pTimer->dwNextTime) >= 0 )
+        {
+            pTimer->pfnCallback( pTimer->pContext, dwTime );
+
+            // Schedule the next call.  If we fell far behind, don't try to catch up.
+            pTimer->dwNextTime += pTimer->dwPeriod;
+            if( (int)(dwTime - pTimer->dwNextTime) >= 0 )
+                pTimer->dwNextTime = dwTime + pTimer->dwPeriod;
+        }
+
+        // Keep track of the soonest timer
+        DWORD dwUntil = pTimer->dwNextTime - dwTime;
+        if( dwUntil < dwTimeout )
+            dwTimeout = dwUntil;
+    }
+
+    return dwTimeout;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  WaitForEvents
+// Desc:  Blocks until a socket is readable or the timeout passes, then runs the callbacks
+//------------------------------------------------------------------------------------------------
+VOID Reactor::WaitForEvents( DWORD dwTimeout )
+{
+#if defined(WIN32) || defined(_WIN32)
+
+    // Windows can't be woken out of select(), so never sleep for long
+    if( dwTimeout > 100 )
+        dwTimeout = 100;
+
+    // Build the set of sockets to watch
+    FD_ZERO( &m_ReadSet );
+    for( DWORD i = 0; i < m_dwHighWater; ++i )
+    {
+        if( m_pEntries[i].pfnCallback )
+            FD_SET( m_pEntries[i].sSocket, &m_ReadSet );
+    }
+
+    // select() fails on an empty set, so just sleep instead
+    if( m_ReadSet.fd_count == 0 )
+    {
+        Sleep( dwTimeout );
+        return;
+    }
+
+    // Wait for data
+    timeval tv = { dwTimeout / 1000, (dwTimeout % 1000) * 1000 };
+    if( SOCKET_ERROR == select( 0, &m_ReadSet, NULL, NULL, &tv ) )
+        return;
+
+    // The Winsock fd_set is a list of the sockets that are ready
+    for( u_int i = 0; i < m_ReadSet.fd_count; ++i )
+    {
+        Entry * pEntry = FindEntry( m_ReadSet.fd_array[i] );
+        if( pEntry )
+            pEntry->pfnCallback( pEntry->pContext );
+    }
+
+#else
+
+    struct epoll_event events[MAX_EVENTS];
+    int iCount = epoll_wait( m_iEpoll, events, MAX_EVENTS,
+                             dwTimeout == INFINITE ? -1 : (int)dwTimeout );
+
+    for( int i = 0; i < iCount; ++i )
+    {
+        // The wake event only needs to be cleared
+        if( events[i].data.u32 == END_OF_LIST )
+        {
+            uint64_t qwValue;
+            ssize_t iRead = read( m_iWakeEvent, &qwValue, sizeof(qwValue) );
+            (void)iRead;
+            continue;
+        }
+
+        // Run the callback unless the socket was unregistered earlier in this batch
+        Entry * pEntry = &m_pEntries[events[i].data.u32];
+        if( pEntry->pfnCallback )
+            pEntry->pfnCallback( pEntry->pContext );
+    }
+
+#endif
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RunPostedCalls
+// Desc:  Runs every call posted since the last time through the loop
+//------------------------------------------------------------------------------------------------
+VOID Reactor::RunPostedCalls()
+{
+    EnterCriticalSection( &m_PostLock );
+    DWORD dwNumCalls = m_dwNumPosted;
+    PostedCall * pCalls = m_pPosted;
+    m_pPosted = m_pRunning;
+    m_pRunning = pCalls;
+    m_dwNumPosted = 0;
+    LeaveCriticalSection( &m_PostLock );
+
+    for( DWORD i = 0; i < dwNumCalls; ++i )
+        pCalls[i].pfnCallback( pCalls[i].pContext );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Wake
+// Desc:  Kicks the loop out of epoll_wait.  Windows doesn't sleep in select() for long, so
+//        there's nothing to do there.
+//------------------------------------------------------------------------------------------------
+VOID Reactor::Wake()
+{
+#if !defined(WIN32) && !defined(_WIN32)
+    uint64_t qwValue = 1;
+    ssize_t iWritten = write( m_iWakeEvent, &qwValue, sizeof(qwValue) );
+    (void)iWritten;
+#endif
+}
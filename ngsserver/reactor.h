@@ -0,0 +1,136 @@
+//------------------------------------------------------------------------------------------------
+// File:    reactor.h
+//
+// Desc:    Single-threaded readiness loop that multiplexes every server socket
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+
+// Include files required to compile this header
+#include "../common/platform.h"
+
+// Called on the reactor thread when a registered socket has data waiting
+typedef VOID (*ReactorCallback)( LPVOID pContext );
+
+// Called on the reactor thread each time a periodic timer comes due
+typedef VOID (*ReactorTimerCallback)( LPVOID pContext, DWORD dwTime );
+
+// Called with each datagram by the loops that receive on the caller's behalf.  pBuffer belongs
+// to the loop and is only valid until the callback returns.
+typedef VOID (*DatagramCallback)( LPVOID pContext, const SOCKADDR_IN * pFrom, const CHAR * pBuffer, DWORD dwSize );
+
+#define REACTOR_MAX_TIMERS  8
+
+// Calls that can be waiting for the reactor thread to pick them up
+#define REACTOR_MAX_POSTS   4096
+
+/**
+ * Waits on every registered socket at once and runs the socket's callback on this thread when it
+ * becomes readable.  The backend is epoll on Linux and select() on Windows.  Callbacks must
+ * drain their socket, since the loop may not report it again until new data arrives.
+ * Other threads hand work to the reactor thread with Post(); that's the only method besides
+ * Stop() that is safe to call from another thread.
+ *   @author Karl Gluck
+ */
+class Reactor
+{
+    public:
+
+        Reactor();
+        ~Reactor();
+        HRESULT Create( DWORD dwMaxSockets );
+        VOID Destroy();
+
+        HRESULT Register( SOCKET sSocket, ReactorCallback pfnCallback, LPVOID pContext );
+        VOID Unregister( SOCKET sSocket );
+        HRESULT AddTimer( DWORD dwPeriod, ReactorTimerCallback pfnCallback, LPVOID pContext );
+        HRESULT Post( ReactorCallback pfnCallback, LPVOID pContext );
+
+        VOID Run();
+        VOID Stop();
+
+    protected:
+
+        struct Entry
+        {
+            SOCKET sSocket;
+            ReactorCallback pfnCallback;
+            LPVOID pContext;
+            DWORD dwNextFree;
+        };
+
+        struct Timer
+        {
+            DWORD dwPeriod;
+            DWORD dwNextTime;
+            ReactorTimerCallback pfnCallback;
+            LPVOID pContext;
+        };
+
+        struct PostedCall
+        {
+            ReactorCallback pfnCallback;
+            LPVOID pContext;
+        };
+
+        Entry * FindEntry( SOCKET sSocket );
+        DWORD RunTimers();
+        VOID WaitForEvents( DWORD dwTimeout );
+        VOID RunPostedCalls();
+        VOID Wake();
+
+    protected:
+
+        Entry * m_pEntries;
+        DWORD m_dwMaxEntries;
+        DWORD m_dwFirstFree;
+        DWORD m_dwHighWater;
+
+        Timer m_Timers[REACTOR_MAX_TIMERS];
+        DWORD m_dwNumTimers;
+
+        volatile BOOL m_bRunning;
+
+        // Calls posted from other threads.  They're swapped into m_pRunning under the lock and
+        // run after it's released, so a call can post another one.
+        CRITICAL_SECTION m_PostLock;
+        PostedCall * m_pPosted;
+        PostedCall * m_pRunning;
+        DWORD m_dwNumPosted;
+
+#if defined(WIN32) || defined(_WIN32)
+        fd_set m_ReadSet;
+#else
+        int m_iEpoll;
+        int m_iWakeEvent;
+#endif
+};
+
+#endif // __REACTOR_H__
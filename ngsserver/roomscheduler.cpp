@@ -0,0 +1,693 @@
+//------------------------------------------------------------------------------------------------
+// File:    roomscheduler.cpp
+//
+// Desc:    Runs many rooms on a set of worker threads
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "roomscheduler.h"
+#include "metrics.h"
+#include "eventlog.h"
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  BindUdpSocket
+// Desc:  Creates a UDP socket bound to the given port on every interface
+//------------------------------------------------------------------------------------------------
+static SOCKET BindUdpSocket( WORD wPort )
+{
+    SOCKET sSocket = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP );
+    if( sSocket == INVALID_SOCKET )
+        return INVALID_SOCKET;
+
+    SOCKADDR_IN addr;
+    ZeroMemory( &addr, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( wPort );
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if( SOCKET_ERROR == bind( sSocket, (LPSOCKADDR)&addr, sizeof(SOCKADDR_IN) ) )
+    {
+        closesocket( sSocket );
+        return INVALID_SOCKET;
+    }
+
+    return sSocket;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RoomScheduler
+// Desc:  
+//------------------------------------------------------------------------------------------------
+RoomScheduler::RoomScheduler()
+{
+    m_pRooms = NULL;
+    m_dwNumRooms = 0;
+    m_pWorkers = NULL;
+    m_dwNumWorkers = 0;
+    m_sLobbySocket = INVALID_SOCKET;
+    m_hLobbyThread = NULL;
+    m_pMoving = NULL;
+    m_dwSettleRounds = 0;
+    m_dwNumMoves = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~RoomScheduler
+// Desc:  
+//------------------------------------------------------------------------------------------------
+RoomScheduler::~RoomScheduler()
+{
+    Destroy();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Create
+// Desc:  Sets up the lobby on wPort and every room on the ports after it, and spreads the
+//        rooms evenly over the workers.  Nothing runs until Start().
+//------------------------------------------------------------------------------------------------
+HRESULT RoomScheduler::Create( WORD wPort, DWORD dwNumRooms, DWORD dwUsersPerRoom, FLOAT fViewRadius, DWORD dwNumWorkers )
+{
+    Destroy();
+
+    if( dwNumRooms == 0 || dwNumWorkers == 0 )
+        return E_FAIL;
+
+    // Set up the lobby, which only ever has its own socket
+    CookieSecret secret;
+    LogOnCookies::MakeSecret( &secret );
+    m_Cookies.Create( &secret );
+    if( FAILED( m_Lobby.Create( 1 ) ) ||
+        FAILED( m_LogOnRooms.Create( dwNumRooms * dwUsersPerRoom ) ) ||
+        INVALID_SOCKET == (m_sLobbySocket = BindUdpSocket( wPort )) ||
+        FAILED( m_Lobby.Register( m_sLobbySocket, LobbyReadable, this ) ) ||
+        FAILED( m_Lobby.AddTimer( SCHEDULER_REBALANCE_PERIOD, RebalanceTimer, this ) ) )
+    {
+        Destroy();
+        return E_FAIL;
+    }
+
+    // Any worker might end up with every room
+    m_dwNumWorkers = dwNumWorkers;
+    m_pWorkers = new Worker[dwNumWorkers];
+    for( DWORD i = 0; i < dwNumWorkers; ++i )
+    {
+        Worker * pWorker = &m_pWorkers[i];
+        pWorker->pScheduler = this;
+        pWorker->dwIndex = i;
+        pWorker->hThread = NULL;
+        pWorker->ppRooms = new HostedRoom*[dwNumRooms];
+        pWorker->dwNumRooms = 0;
+        pWorker->dwWindowStart = GetTickCount();
+        pWorker->dwLoad = 0;
+        if( FAILED( pWorker->reactor.Create( dwNumRooms ) ) ||
+            FAILED( pWorker->reactor.AddTimer( TIMER_RESOLUTION, WorkerTick, pWorker ) ) )
+        {
+            Destroy();
+            return E_FAIL;
+        }
+    }
+
+    // Set up the rooms, each on the first free port after the last one
+    m_dwNumRooms = dwNumRooms;
+    m_pRooms = new HostedRoom[dwNumRooms];
+    for( DWORD i = 0; i < dwNumRooms; ++i )
+        m_pRooms[i].sSocket = INVALID_SOCKET;
+
+    WORD wRoomPort = wPort + 1;
+    for( DWORD i = 0; i < dwNumRooms; ++i )
+    {
+        HostedRoom * pRoom = &m_pRooms[i];
+        pRoom->pScheduler = this;
+        pRoom->dwIndex = i;
+        pRoom->pDestination = NULL;
+        pRoom->lPendingLogOns = 0;
+        pRoom->dwPlayers = 0;
+        pRoom->dwLoad = 0;
+        pRoom->qwBusy = 0;
+
+        while( INVALID_SOCKET == (pRoom->sSocket = BindUdpSocket( wRoomPort )) && wRoomPort < 0xFFFF )
+            wRoomPort++;
+        wRoomPort++;
+
+        LogOnCookies::MakeSecret( &secret );
+        if( pRoom->sSocket == INVALID_SOCKET ||
+            FAILED( pRoom->room.Create( dwUsersPerRoom, fViewRadius, GetTickCount(), &secret ) ) ||
+            FAILED( pRoom->batch.Create( pRoom->sSocket, BATCH_DEFAULT_RECEIVES, dwUsersPerRoom + 64 ) ) )
+        {
+            Destroy();
+            return E_FAIL;
+        }
+
+        // Everything the room sends goes out through its own socket
+        pRoom->room.SetReplySend( RoomSend, &pRoom->batch );
+        for( DWORD j = 0; j < dwUsersPerRoom; ++j )
+            pRoom->room.GetUserBySlot( j )->Create( RoomSend, &pRoom->batch );
+
+        // Deal the rooms out to the workers in turn
+        pRoom->pWorker = &m_pWorkers[i % dwNumWorkers];
+        pRoom->pWorker->ppRooms[pRoom->pWorker->dwNumRooms++] = pRoom;
+        if( FAILED( pRoom->pWorker->reactor.Register( pRoom->sSocket, RoomReadable, pRoom ) ) )
+        {
+            Destroy();
+            return E_FAIL;
+        }
+    }
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Destroy
+// Desc:  Frees the rooms and workers.  Stop() has to be called first if the scheduler started.
+//------------------------------------------------------------------------------------------------
+VOID RoomScheduler::Destroy()
+{
+    if( m_pRooms )
+    {
+        for( DWORD i = 0; i < m_dwNumRooms; ++i )
+        {
+            m_pRooms[i].batch.Destroy();
+            m_pRooms[i].room.Destroy();
+            if( m_pRooms[i].sSocket != INVALID_SOCKET )
+                closesocket( m_pRooms[i].sSocket );
+        }
+        delete [] m_pRooms;
+        m_pRooms = NULL;
+    }
+    m_dwNumRooms = 0;
+
+    if( m_pWorkers )
+    {
+        for( DWORD i = 0; i < m_dwNumWorkers; ++i )
+        {
+            m_pWorkers[i].reactor.Destroy();
+            delete [] m_pWorkers[i].ppRooms;
+        }
+        delete [] m_pWorkers;
+        m_pWorkers = NULL;
+    }
+    m_dwNumWorkers = 0;
+
+    m_Lobby.Destroy();
+    m_LogOnRooms.Destroy();
+    if( m_sLobbySocket != INVALID_SOCKET )
+    {
+        closesocket( m_sLobbySocket );
+        m_sLobbySocket = INVALID_SOCKET;
+    }
+
+    m_pMoving = NULL;
+    m_dwSettleRounds = 0;
+    m_dwNumMoves = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Start
+// Desc:  Starts the workers, each pinned to its own processor, and then the lobby
+//------------------------------------------------------------------------------------------------
+HRESULT RoomScheduler::Start()
+{
+    DWORD dwProcessors = GetProcessorCount();
+    for( DWORD i = 0; i < m_dwNumWorkers; ++i )
+    {
+        Worker * pWorker = &m_pWorkers[i];
+        if( NULL == (pWorker->hThread = CreateThread( NULL, 0, ReactorThread, &pWorker->reactor, 0, NULL )) )
+        {
+            Stop();
+            return E_FAIL;
+        }
+
+        // Pinning is only a hint, so carry on without it if it fails
+        DWORD dwProcessor = i % dwProcessors;
+        if( dwProcessor < sizeof(DWORD_PTR) * 8 )
+            SetThreadAffinityMask( pWorker->hThread, (DWORD_PTR)1 << dwProcessor );
+    }
+
+    if( NULL == (m_hLobbyThread = CreateThread( NULL, 0, ReactorThread, &m_Lobby, 0, NULL )) )
+    {
+        Stop();
+        return E_FAIL;
+    }
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Stop
+// Desc:  Stops every thread and waits for them to finish
+//------------------------------------------------------------------------------------------------
+VOID RoomScheduler::Stop()
+{
+    if( m_hLobbyThread )
+    {
+        m_Lobby.Stop();
+        WaitForSingleObject( m_hLobbyThread, INFINITE );
+        CloseHandle( m_hLobbyThread );
+        m_hLobbyThread = NULL;
+    }
+
+    for( DWORD i = 0; i < m_dwNumWorkers; ++i )
+    {
+        Worker * pWorker = &m_pWorkers[i];
+        if( pWorker->hThread )
+        {
+            pWorker->reactor.Stop();
+            WaitForSingleObject( pWorker->hThread, INFINITE );
+            CloseHandle( pWorker->hThread );
+            pWorker->hThread = NULL;
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ReactorThread
+// Desc:  Runs a worker's or the lobby's reactor until it's stopped
+//------------------------------------------------------------------------------------------------
+DWORD WINAPI RoomScheduler::ReactorThread( LPVOID pParameter )
+{
+    ((Reactor*)pParameter)->Run();
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  LobbyReadable
+// Desc:  Lobby thread.  The lobby port only takes logons; everything else goes to the rooms.
+//------------------------------------------------------------------------------------------------
+VOID RoomScheduler::LobbyReadable( LPVOID pContext )
+{
+    RoomScheduler * pScheduler = (RoomScheduler*)pContext;
+
+    CHAR buffer[MAX_PACKET_SIZE];
+    SOCKADDR_IN address;
+    socklen_t iFromLen = sizeof(address);
+    int len;
+    while( SOCKET_ERROR != (len = recvfrom( pScheduler->m_sLobbySocket, buffer, sizeof(buffer), 0,
+                                            (LPSOCKADDR)&address, &iFromLen )) )
+    {
+        Metrics::CountReceived( buffer, (DWORD)len );
+        if( len >= (int)sizeof(MessageHeader) && GetMessageID( buffer ) == MSG_LOGON )
+            pScheduler->ProcessLogOn( &address, buffer, (DWORD)len );
+        else
+            Metrics::Count( METRIC_DROPPED_UNKNOWN, 1 );
+        iFromLen = sizeof(address);
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  PickRoom
+// Desc:  Lobby thread.  Finds the fullest room with space left, so that rooms fill up one at a
+//        time instead of spreading players thinly.  Returns NULL if every room is full.
+//------------------------------------------------------------------------------------------------
+RoomScheduler::HostedRoom * RoomScheduler::PickRoom()
+{
+    HostedRoom * pBest = NULL;
+    DWORD dwBestPlayers = 0;
+    for( DWORD i = 0; i < m_dwNumRooms; ++i )
+    {
+        HostedRoom * pRoom = &m_pRooms[i];
+
+        // A room that's changing hands can't take logons until it arrives
+        if( pRoom->pDestination )
+            continue;
+
+        DWORD dwPlayers = pRoom->dwPlayers + (DWORD)pRoom->lPendingLogOns;
+        if( dwPlayers >= pRoom->room.GetMaxUsers() )
+            continue;
+
+        if( !pBest || dwPlayers > dwBestPlayers )
+        {
+            pBest = pRoom;
+            dwBestPlayers = dwPlayers;
+        }
+    }
+
+    return pBest;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ProcessLogOn
+// Desc:  Lobby thread.  Places a logon that came back with its cookie, and answers any other
+//        logon with the cookie for its address.
+//------------------------------------------------------------------------------------------------
+VOID RoomScheduler::ProcessLogOn( const SOCKADDR_IN * pAddress, const CHAR * pBuffer, DWORD dwSize )
+{
+    const LogOnMessage * pLom = (const LogOnMessage*)pBuffer;
+    DWORD dwTime = GetTickCount();
+    if( dwSize >= sizeof(LogOnMessage) && m_Cookies.Check( pAddress, pLom->dwCookie, dwTime ) )
+    {
+        PlaceLogOn( pAddress );
+        return;
+    }
+
+    LogOnChallengeMessage packet;
+    packet.dwCookie = m_Cookies.Make( pAddress, dwTime );
+    if( SOCKET_ERROR == sendto( m_sLobbySocket, (const CHAR*)&packet, sizeof(packet), 0, (LPSOCKADDR)pAddress, sizeof(SOCKADDR_IN) ) )
+        Metrics::Count( METRIC_DROPPED_SEND, 1 );
+    else
+        Metrics::CountSent( (const CHAR*)&packet, sizeof(packet) );
+    Metrics::Count( METRIC_LOGON_CHALLENGES, 1 );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  PlaceLogOn
+// Desc:  Lobby thread.  Hands a logon to the worker running the room it was put in.  A client
+//        that asks again goes back to the same room, which already knows it and just confirms
+//        it again.
+//------------------------------------------------------------------------------------------------
+VOID RoomScheduler::PlaceLogOn( const SOCKADDR_IN * pAddress )
+{
+    HostedRoom * pRoom;
+    DWORD dwRoom = m_LogOnRooms.Find( pAddress );
+    if( dwRoom != ADDRESS_NOT_FOUND )
+    {
+        // Ask again after the move rather than risk a second session somewhere else
+        pRoom = &m_pRooms[dwRoom];
+        if( pRoom->pDestination )
+            return;
+    }
+    else
+    {
+        pRoom = PickRoom();
+        if( !pRoom )
+        {
+            Metrics::Count( METRIC_DROPPED_SERVER_FULL, 1 );
+            return;
+        }
+
+        // The table only holds as many addresses as there are slots, and is just a hint, so
+        // start it over when it fills up with players who have left
+        if( FAILED( m_LogOnRooms.Insert( pAddress, pRoom->dwIndex ) ) )
+        {
+            m_LogOnRooms.Clear();
+            m_LogOnRooms.Insert( pAddress, pRoom->dwIndex );
+        }
+    }
+
+    PendingLogOn * pLogOn = new PendingLogOn;
+    pLogOn->pRoom = pRoom;
+    pLogOn->Address = *pAddress;
+
+    // Count it against the room right away, so the next logon sees it
+    InterlockedIncrement( &pRoom->lPendingLogOns );
+    if( FAILED( pRoom->pWorker->reactor.Post( WorkerLogOn, pLogOn ) ) )
+    {
+        InterlockedDecrement( &pRoom->lPendingLogOns );
+        delete pLogOn;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RebalanceTimer
+// Desc:  Lobby thread
+//------------------------------------------------------------------------------------------------
+VOID RoomScheduler::RebalanceTimer( LPVOID pContext, DWORD dwTime )
+{
+    ((RoomScheduler*)pContext)->Rebalance();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Rebalance
+// Desc:  Lobby thread.  Moves one room from the busiest worker to the idlest, choosing the room
+//        that brings them closest to even.  Only one room moves at a time, and the loads have
+//        to settle after a move before the next one, or rooms would bounce back and forth.
+//------------------------------------------------------------------------------------------------
+VOID RoomScheduler::Rebalance()
+{
+    if( m_dwSettleRounds )
+    {
+        m_dwSettleRounds--;
+        return;
+    }
+    if( m_pMoving || m_dwNumWorkers < 2 )
+        return;
+
+    Worker * pBusiest = &m_pWorkers[0];
+    Worker * pIdlest = &m_pWorkers[0];
+    for( DWORD i = 1; i < m_dwNumWorkers; ++i )
+    {
+        if( m_pWorkers[i].dwLoad > pBusiest->dwLoad )
+            pBusiest = &m_pWorkers[i];
+        if( m_pWorkers[i].dwLoad < pIdlest->dwLoad )
+            pIdlest = &m_pWorkers[i];
+    }
+
+    DWORD dwGap = pBusiest->dwLoad - pIdlest->dwLoad;
+    if( dwGap < SCHEDULER_MIN_IMBALANCE )
+        return;
+
+    // The best room costs half the gap.  Anything up to three quarters of it still narrows the
+    // gap by enough to be worth the move.
+    HostedRoom * pBest = NULL;
+    DWORD dwBestError = 0;
+    for( DWORD i = 0; i < m_dwNumRooms; ++i )
+    {
+        HostedRoom * pRoom = &m_pRooms[i];
+        DWORD dwLoad = pRoom->dwLoad;
+        if( pRoom->pWorker != pBusiest || dwLoad == 0 || dwLoad > dwGap / 4 * 3 )
+            continue;
+
+        DWORD dwError = dwLoad > dwGap / 2 ? dwLoad - dwGap / 2 : dwGap / 2 - dwLoad;
+        if( !pBest || dwError < dwBestError )
+        {
+            pBest = pRoom;
+            dwBestError = dwError;
+        }
+    }
+    if( !pBest )
+        return;
+
+    // The room's current worker lets go of it first, then hands it on
+    pBest->pDestination = pIdlest;
+    m_pMoving = pBest;
+    if( FAILED( pBusiest->reactor.Post( ReleaseRoom, pBest ) ) )
+    {
+        pBest->pDestination = NULL;
+        m_pMoving = NULL;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RoomMoved
+// Desc:  Lobby thread.  The room has been taken in by pDestination.
+//------------------------------------------------------------------------------------------------
+VOID RoomScheduler::RoomMoved( LPVOID pContext )
+{
+    HostedRoom * pRoom = (HostedRoom*)pContext;
+    RoomScheduler * pScheduler = pRoom->pScheduler;
+
+    if( g_bLogEvents && pRoom->pWorker != pRoom->pDestination )
+        EventLog::Write( "\nMoved room %u from worker %u to %u", pRoom->dwIndex, pRoom->pWorker->dwIndex,
+                         pRoom->pDestination->dwIndex );
+
+    pRoom->pWorker = pRoom->pDestination;
+    pRoom->pDestination = NULL;
+    pScheduler->m_pMoving = NULL;
+    pScheduler->m_dwSettleRounds = SCHEDULER_SETTLE_ROUNDS;
+    pScheduler->m_dwNumMoves++;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  WorkerLogOn
+// Desc:  Worker thread.  Logs on a player the lobby put in one of this worker's rooms.
+//------------------------------------------------------------------------------------------------
+VOID RoomScheduler::WorkerLogOn( LPVOID pContext )
+{
+    PendingLogOn * pLogOn = (PendingLogOn*)pContext;
+    HostedRoom * pRoom = pLogOn->pRoom;
+
+    QWORD qwStart = GetMicrosecondCount();
+    HRESULT hr = pRoom->room.LogOnNewPlayer( &pLogOn->Address );
+    pRoom->batch.Flush();
+    pRoom->qwBusy += GetMicrosecondCount() - qwStart;
+
+    // Publish the new count before the logon stops being pending, so the lobby never sees the
+    // room emptier than it is
+    pRoom->dwPlayers = pRoom->room.GetPlayerCount();
+    InterlockedDecrement( &pRoom->lPendingLogOns );
+
+    // If the room filled up, the lobby has to find the client another one next time
+    if( FAILED( hr ) && SUCCEEDED( pRoom->pScheduler->m_Lobby.Post( LogOnFailed, pLogOn ) ) )
+        return;
+    delete pLogOn;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  LogOnFailed
+// Desc:  Lobby thread.  A room couldn't take the client it was given.
+//------------------------------------------------------------------------------------------------
+VOID RoomScheduler::LogOnFailed( LPVOID pContext )
+{
+    PendingLogOn * pLogOn = (PendingLogOn*)pContext;
+    RoomScheduler * pScheduler = pLogOn->pRoom->pScheduler;
+
+    if( pScheduler->m_LogOnRooms.Find( &pLogOn->Address ) == pLogOn->pRoom->dwIndex )
+        pScheduler->m_LogOnRooms.Remove( &pLogOn->Address );
+    delete pLogOn;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RoomReadable
+// Desc:  Worker thread.  Handles everything that has arrived on a room's socket.
+//------------------------------------------------------------------------------------------------
+VOID RoomScheduler::RoomReadable( LPVOID pContext )
+{
+    HostedRoom * pRoom = (HostedRoom*)pContext;
+
+    QWORD qwStart = GetMicrosecondCount();
+    pRoom->batch.Receive( RoomDatagram, pRoom );
+    pRoom->batch.Flush();
+    pRoom->qwBusy += GetMicrosecondCount() - qwStart;
+
+    pRoom->dwPlayers = pRoom->room.GetPlayerCount();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RoomDatagram
+// Desc:  Worker thread
+//------------------------------------------------------------------------------------------------
+VOID RoomScheduler::RoomDatagram( LPVOID pContext, const SOCKADDR_IN * pFrom, const CHAR * pBuffer, DWORD dwSize )
+{
+    ((HostedRoom*)pContext)->room.ProcessServerPacket( pFrom, pBuffer, dwSize );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RoomSend
+// Desc:  Worker thread.  Queues a datagram on a room's socket.
+//------------------------------------------------------------------------------------------------
+int RoomScheduler::RoomSend( LPVOID pContext, const SOCKADDR_IN * pAddress, const CHAR * pBuffer, int length )
+{
+    return ((DatagramBatch*)pContext)->Queue( pAddress, pBuffer, length );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  WorkerTick
+// Desc:  Worker thread.  Runs every room's timers, and once a second tells the lobby how much
+//        time each room has been taking.
+//------------------------------------------------------------------------------------------------
+VOID RoomScheduler::WorkerTick( LPVOID pContext, DWORD dwTime )
+{
+    Worker * pWorker = (Worker*)pContext;
+
+    for( DWORD i = 0; i < pWorker->dwNumRooms; ++i )
+    {
+        HostedRoom * pRoom = pWorker->ppRooms[i];
+        QWORD qwStart = GetMicrosecondCount();
+        pRoom->room.Advance( dwTime );
+        pRoom->batch.Flush();
+        pRoom->qwBusy += GetMicrosecondCount() - qwStart;
+    }
+
+    // Publish the load over the last window, scaled to a second
+    DWORD dwWindow = dwTime - pWorker->dwWindowStart;
+    if( dwWindow >= SCHEDULER_REBALANCE_PERIOD )
+    {
+        DWORD dwLoad = 0;
+        for( DWORD i = 0; i < pWorker->dwNumRooms; ++i )
+        {
+            HostedRoom * pRoom = pWorker->ppRooms[i];
+            pRoom->dwLoad = (DWORD)(pRoom->qwBusy * 1000 / dwWindow);
+            pRoom->qwBusy = 0;
+            dwLoad += pRoom->dwLoad;
+        }
+        pWorker->dwLoad = dwLoad;
+        pWorker->dwWindowStart = dwTime;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ReleaseRoom
+// Desc:  Worker thread, on the room's current worker.  Stops running the room and passes it
+//        to the destination the lobby chose.
+//------------------------------------------------------------------------------------------------
+VOID RoomScheduler::ReleaseRoom( LPVOID pContext )
+{
+    HostedRoom * pRoom = (HostedRoom*)pContext;
+    Worker * pWorker = pRoom->pWorker;
+
+    pWorker->reactor.Unregister( pRoom->sSocket );
+    for( DWORD i = 0; i < pWorker->dwNumRooms; ++i )
+    {
+        if( pWorker->ppRooms[i] == pRoom )
+        {
+            pWorker->ppRooms[i] = pWorker->ppRooms[--pWorker->dwNumRooms];
+            break;
+        }
+    }
+
+    // Its share of this worker's load goes with it
+    pWorker->dwLoad -= pRoom->dwLoad < pWorker->dwLoad ? pRoom->dwLoad : pWorker->dwLoad;
+
+    // If the destination can't take it, adopt it back so the room keeps running
+    if( FAILED( pRoom->pDestination->reactor.Post( AdoptRoom, pRoom ) ) )
+    {
+        pRoom->pDestination = pWorker;
+        AdoptRoom( pRoom );
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  AdoptRoom
+// Desc:  Worker thread, on the room's new worker.  Starts running the room and lets the lobby
+//        know the move is done.
+//------------------------------------------------------------------------------------------------
+VOID RoomScheduler::AdoptRoom( LPVOID pContext )
+{
+    HostedRoom * pRoom = (HostedRoom*)pContext;
+    Worker * pWorker = pRoom->pDestination;
+
+    pWorker->ppRooms[pWorker->dwNumRooms++] = pRoom;
+    pWorker->reactor.Register( pRoom->sSocket, RoomReadable, pRoom );
+    pWorker->dwLoad += pRoom->dwLoad;
+
+    pRoom->pScheduler->m_Lobby.Post( RoomMoved, pRoom );
+}
@@ -0,0 +1,158 @@
+//------------------------------------------------------------------------------------------------
+// File:    roomscheduler.h
+//
+// Desc:    Runs many rooms on a set of worker threads
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __ROOMSCHEDULER_H__
+#define __ROOMSCHEDULER_H__
+
+
+// Include files required to compile this header
+#include "../common/platform.h"
+#include "reactor.h"
+#include "datagrambatch.h"
+#include "server.h"
+
+// How often the lobby looks for a worker to take load off of
+#define SCHEDULER_REBALANCE_PERIOD  1000
+
+// Workers closer than this many microseconds per second of work are left alone
+#define SCHEDULER_MIN_IMBALANCE     50000
+
+// Rebalances skipped after a move, so both workers report a full second with the new rooms
+#define SCHEDULER_SETTLE_ROUNDS     2
+
+/**
+ * Hosts many independent rooms in one process.  Each room has its own socket and is owned by
+ * exactly one worker thread at a time, and each worker is pinned to its own processor and runs
+ * its rooms' packets and ticks from its own Reactor.  A lobby thread listens on the server port:
+ * it challenges each logon with a cookie, puts the ones that answer in the fullest room that
+ * still has space and hands them to the room's worker, which replies from the room's socket so
+ * the client talks to the room from then on.
+ * Once a second the lobby compares how busy the workers are and moves a room from the busiest
+ * to the idlest if they're far enough apart.  Rooms change hands by posting to the reactors, so
+ * no room is ever touched by two threads at once.
+ *   @author Karl Gluck
+ */
+class RoomScheduler
+{
+    public:
+
+        RoomScheduler();
+        ~RoomScheduler();
+        HRESULT Create( WORD wPort, DWORD dwNumRooms, DWORD dwUsersPerRoom, FLOAT fViewRadius, DWORD dwNumWorkers );
+        VOID Destroy();
+
+        HRESULT Start();
+        VOID Stop();
+
+        DWORD GetNumWorkers() const { return m_dwNumWorkers; }
+        DWORD GetNumMoves() const { return m_dwNumMoves; }
+
+    protected:
+
+        struct Worker;
+
+        struct HostedRoom
+        {
+            RoomScheduler * pScheduler;
+            DWORD dwIndex;
+            Room room;
+            SOCKET sSocket;
+            DatagramBatch batch;
+
+            // Owned by the lobby
+            Worker * pWorker;               // Worker that runs the room
+            Worker * pDestination;          // Worker the room is moving to, or NULL
+
+            // Written by the room's worker and read by the lobby
+            volatile LONG lPendingLogOns;   // Logons handed to the worker that it hasn't handled
+            volatile DWORD dwPlayers;       // Players logged on
+            volatile DWORD dwLoad;          // Microseconds spent on the room in the last second
+
+            // Only touched by the room's worker
+            QWORD qwBusy;
+        };
+
+        struct Worker
+        {
+            RoomScheduler * pScheduler;
+            DWORD dwIndex;
+            Reactor reactor;
+            HANDLE hThread;
+            HostedRoom ** ppRooms;
+            DWORD dwNumRooms;
+            DWORD dwWindowStart;
+            volatile DWORD dwLoad;          // Microseconds of work in the last second
+        };
+
+        struct PendingLogOn
+        {
+            HostedRoom * pRoom;
+            SOCKADDR_IN Address;
+        };
+
+        // Lobby thread
+        static VOID LobbyReadable( LPVOID pContext );
+        static VOID RebalanceTimer( LPVOID pContext, DWORD dwTime );
+        static VOID RoomMoved( LPVOID pContext );
+        static VOID LogOnFailed( LPVOID pContext );
+        HostedRoom * PickRoom();
+        VOID ProcessLogOn( const SOCKADDR_IN * pAddress, const CHAR * pBuffer, DWORD dwSize );
+        VOID PlaceLogOn( const SOCKADDR_IN * pAddress );
+        VOID Rebalance();
+
+        // Worker threads
+        static VOID WorkerLogOn( LPVOID pContext );
+        static VOID RoomReadable( LPVOID pContext );
+        static VOID RoomDatagram( LPVOID pContext, const SOCKADDR_IN * pFrom, const CHAR * pBuffer, DWORD dwSize );
+        static VOID WorkerTick( LPVOID pContext, DWORD dwTime );
+        static VOID ReleaseRoom( LPVOID pContext );
+        static VOID AdoptRoom( LPVOID pContext );
+        static int RoomSend( LPVOID pContext, const SOCKADDR_IN * pAddress, const CHAR * pBuffer, int length );
+        static DWORD WINAPI ReactorThread( LPVOID pParameter );
+
+    protected:
+
+        HostedRoom * m_pRooms;
+        DWORD m_dwNumRooms;
+        Worker * m_pWorkers;
+        DWORD m_dwNumWorkers;
+
+        SOCKET m_sLobbySocket;
+        Reactor m_Lobby;
+        HANDLE m_hLobbyThread;
+        LogOnCookies m_Cookies;             // Logons have to prove their address before they're placed
+        AddressTable m_LogOnRooms;          // Room each address was put in, so a repeated logon goes back to it
+        HostedRoom * m_pMoving;             // Room being moved, if any
+        DWORD m_dwSettleRounds;             // Rebalances left to skip since the last move
+        DWORD m_dwNumMoves;
+};
+
+#endif // __ROOMSCHEDULER_H__
@@ -0,0 +1,682 @@
+//------------------------------------------------------------------------------------------------
+// File:    server.cpp
+//
+// Desc:    Server state and packet handling, independent of how packets reach the server
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "server.h"
+#include "metrics.h"
+#include "eventlog.h"
+
+// Settings shared by every room
+BOOL g_bSharedPort;
+FLOAT g_fWorldBound;
+BOOL g_bLogEvents = TRUE;
+BOOL g_bAuthoritative = FALSE;
+
+// Every user has these timers on the room's wheel, numbered slot * ROOM_TIMERS_PER_USER + kind
+#define ROOM_TIMER_IDLE         0       /* Logs the user off if nothing has arrived for a while */
+#define ROOM_TIMER_SNAPSHOT     1       /* Sends the user a snapshot once per tick */
+#define ROOM_TIMERS_PER_USER    2
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Room
+// Desc:  
+//------------------------------------------------------------------------------------------------
+Room::Room()
+{
+    m_dwMaxUsers = 0;
+    m_pUsers = NULL;
+    m_pPlayerStates = NULL;
+    m_pMovement = NULL;
+    m_pInputSequence = NULL;
+    m_pAckedInput = NULL;
+    m_pInputBudget = NULL;
+    m_pBudgetTime = NULL;
+    m_pHistories = NULL;
+    m_pNextSequence = NULL;
+    m_pAckedSequence = NULL;
+    m_pViewStates = NULL;
+    m_dwTime = 0;
+    m_pLastHeard = NULL;
+    m_pfnReplySend = NULL;
+    m_pReplyContext = NULL;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~Room
+// Desc:  
+//------------------------------------------------------------------------------------------------
+Room::~Room()
+{
+    Destroy();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Create
+// Desc:  Sizes every per-player table for dwMaxUsers players.  The users themselves still
+//        have to be created, since that depends on how packets are sent.  The room's clock
+//        starts at dwTime, and its logon cookies are keyed with pCookieSecret.
+//------------------------------------------------------------------------------------------------
+HRESULT Room::Create( DWORD dwMaxUsers, FLOAT fViewRadius, DWORD dwTime, const CookieSecret * pCookieSecret )
+{
+    m_dwMaxUsers = dwMaxUsers;
+    m_dwTime = dwTime;
+    m_Cookies.Create( pCookieSecret );
+    if( FAILED( m_Slots.Create( dwMaxUsers ) ) ||
+        FAILED( m_Timers.Create( dwMaxUsers * ROOM_TIMERS_PER_USER, TIMER_RESOLUTION, dwTime ) ) ||
+        FAILED( m_Interest.Create( dwMaxUsers, fViewRadius / 2.0f, fViewRadius, fViewRadius + VIEW_HYSTERESIS ) ) ||
+        FAILED( m_Addresses.Create( dwMaxUsers ) ) )
+    {
+        Destroy();
+        return E_FAIL;
+    }
+
+    m_pUsers = new User[dwMaxUsers];
+    m_pPlayerStates = new PlayerState[dwMaxUsers];
+    m_pMovement = new MovementState[dwMaxUsers];
+    m_pInputSequence = new DWORD[dwMaxUsers];
+    m_pAckedInput = new DWORD[dwMaxUsers];
+    m_pInputBudget = new DWORD[dwMaxUsers];
+    m_pBudgetTime = new DWORD[dwMaxUsers];
+    m_pHistories = new SnapshotHistory[dwMaxUsers];
+    m_pNextSequence = new DWORD[dwMaxUsers];
+    m_pAckedSequence = new DWORD[dwMaxUsers];
+    m_pViewStates = new QuantizedState[dwMaxUsers];
+    m_pLastHeard = new DWORD[dwMaxUsers];
+    for( DWORD i = 0; i < dwMaxUsers; ++i )
+    {
+        if( FAILED( m_pHistories[i].Create( SNAPSHOT_HISTORY_SIZE ) ) )
+        {
+            Destroy();
+            return E_FAIL;
+        }
+    }
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Destroy
+// Desc:  Frees everything Create allocated
+//------------------------------------------------------------------------------------------------
+VOID Room::Destroy()
+{
+    delete [] m_pUsers;
+    delete [] m_pPlayerStates;
+    delete [] m_pMovement;
+    delete [] m_pInputSequence;
+    delete [] m_pAckedInput;
+    delete [] m_pInputBudget;
+    delete [] m_pBudgetTime;
+    delete [] m_pHistories;
+    delete [] m_pNextSequence;
+    delete [] m_pAckedSequence;
+    delete [] m_pViewStates;
+    delete [] m_pLastHeard;
+    m_pUsers = NULL;
+    m_pPlayerStates = NULL;
+    m_pMovement = NULL;
+    m_pInputSequence = NULL;
+    m_pAckedInput = NULL;
+    m_pInputBudget = NULL;
+    m_pBudgetTime = NULL;
+    m_pHistories = NULL;
+    m_pNextSequence = NULL;
+    m_pAckedSequence = NULL;
+    m_pViewStates = NULL;
+    m_pLastHeard = NULL;
+    m_dwMaxUsers = 0;
+    m_Slots.Destroy();
+    m_Timers.Destroy();
+    m_Interest.Destroy();
+    m_Addresses.Destroy();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SetReplySend
+// Desc:  Sets how the room answers clients that don't have a session yet.  Without it, logons
+//        without a cookie are dropped.
+//------------------------------------------------------------------------------------------------
+VOID Room::SetReplySend( UserSendCallback pfnSend, LPVOID pContext )
+{
+    m_pfnReplySend = pfnSend;
+    m_pReplyContext = pContext;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetUser
+// Desc:  Finds the user that a player ID belongs to
+//------------------------------------------------------------------------------------------------
+User * Room::GetUser( DWORD dwPlayerID )
+{
+    return &m_pUsers[PLAYER_SLOT( dwPlayerID )];
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  DisconnectUser
+// Desc:  Logs a user off and gives its slot back
+//------------------------------------------------------------------------------------------------
+VOID Room::DisconnectUser( User * pUser )
+{
+    // This address no longer has a session
+    m_Addresses.Remove( pUser->GetAddress() );
+
+    // Take this player out of everyone's view
+    m_Interest.Remove( pUser->GetId() );
+
+    // Nothing more is due for this slot
+    DWORD dwSlot = PLAYER_SLOT( pUser->GetId() );
+    m_Timers.Cancel( dwSlot * ROOM_TIMERS_PER_USER + ROOM_TIMER_IDLE );
+    m_Timers.Cancel( dwSlot * ROOM_TIMERS_PER_USER + ROOM_TIMER_SNAPSHOT );
+
+    // Give the slot back
+    m_Slots.Free( pUser->GetId() );
+    pUser->Disconnect();
+    Metrics::Count( METRIC_SESSIONS_CLOSED, 1 );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  StorePlayerState
+// Desc:  Saves the newest state a user sent so the next tick can relay it
+//------------------------------------------------------------------------------------------------
+HRESULT Room::StorePlayerState( User * pUser, const PlayerState * pNewState )
+{
+    // Get this user's ID number
+    DWORD dwId = pUser->GetId();
+
+    // Drop updates that were sent under a previous logon
+    if( pNewState->dwPlayerID != dwId )
+        return E_FAIL;
+
+    // Replace whatever we had for this player; it goes out on the next tick
+    PlayerState * pState = &m_pPlayerStates[PLAYER_SLOT( dwId )];
+    *pState = *pNewState;
+
+    // Players are placed on the ground plane
+    m_Interest.Move( dwId, pState->fPosition[0], pState->fPosition[2] );
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ApplyPlayerInput
+// Desc:  Moves a user's player by the inputs it sent that haven't been applied yet.  Inputs
+//        can't add up to more time than has passed since the last ones, plus a little slack.
+//------------------------------------------------------------------------------------------------
+HRESULT Room::ApplyPlayerInput( User * pUser, const CHAR * pBuffer, DWORD dwSize )
+{
+    DWORD dwFirstSequence, dwCount;
+    PlayerInput inputs[MAX_INPUTS_PER_MESSAGE];
+    if( !DecodePlayerInput( (const BYTE*)pBuffer, dwSize, &dwFirstSequence, inputs, &dwCount ) )
+        return E_FAIL;
+
+    // Top up this user's budget with the time that has gone by
+    DWORD dwId = pUser->GetId();
+    DWORD dwSlot = PLAYER_SLOT( dwId );
+    DWORD dwBudget = m_pInputBudget[dwSlot] + (m_dwTime - m_pBudgetTime[dwSlot]);
+    m_pInputBudget[dwSlot] = dwBudget < MAX_INPUT_BUDGET ? dwBudget : MAX_INPUT_BUDGET;
+    m_pBudgetTime[dwSlot] = m_dwTime;
+
+    // Messages repeat inputs until they are acknowledged, so skip the ones already applied.  An
+    // input that would overdraw the budget is cut short, but still counts as applied.
+    for( DWORD i = 0; i < dwCount; ++i )
+    {
+        DWORD dwSequence = dwFirstSequence + i;
+        if( (int)(dwSequence - m_pInputSequence[dwSlot]) <= 0 )
+            continue;
+
+        if( inputs[i].wDuration > m_pInputBudget[dwSlot] )
+            inputs[i].wDuration = (WORD)m_pInputBudget[dwSlot];
+        m_pInputBudget[dwSlot] -= inputs[i].wDuration;
+
+        ApplyInput( &m_pMovement[dwSlot], &inputs[i] );
+        m_pInputSequence[dwSlot] = dwSequence;
+    }
+
+    // Relay the result like any other update
+    PlayerState state;
+    GetMovementPlayerState( &m_pMovement[dwSlot], dwId, &state );
+    return StorePlayerState( pUser, &state );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  LogOffPlayer
+// Desc:  Tells everyone else that a player has left, then disconnects it
+//------------------------------------------------------------------------------------------------
+VOID Room::LogOffPlayer( User * pUser )
+{
+    // Get this user's ID number
+    DWORD dwId = pUser->GetId();
+
+    // Build a disconnect message
+    PlayerLoggedOffMessage packet;
+    packet.dwPlayerID = dwId;
+
+    // Tell the users that were sent this player that it disconnected; the others never heard
+    // about it.  This has to happen before the user is disconnected, since that takes the
+    // player out of the interest grid.
+    DWORD dwNumViewers = m_Interest.GetViewerCount( dwId );
+    for( DWORD i = 0; i < dwNumViewers; ++i )
+        GetUser( m_Interest.GetViewer( dwId, i ) )->SendPacket( (CHAR*)&packet, sizeof(packet) );
+
+    // Disconnect the user
+    DisconnectUser( pUser );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ProcessUserPacket
+// Desc:  Handles one datagram from a logged-on user.  Returns S_FALSE if the user logged off,
+//        or E_FAIL if the datagram was malformed, which the caller counts as a drop.
+//------------------------------------------------------------------------------------------------
+HRESULT Room::ProcessUserPacket( User * pUser, const CHAR * pBuffer, DWORD dwSize )
+{
+    // Too short to even hold a message ID; the buffer might still have the last datagram in it
+    if( dwSize < sizeof(MessageHeader) )
+        return E_FAIL;
+
+    // Anything else from the user keeps the session alive
+    m_pLastHeard[PLAYER_SLOT( pUser->GetId() )] = m_dwTime;
+
+    // Process the message
+    switch( GetMessageID( pBuffer ) )
+    {
+        case MSG_LOGOFF:
+            {
+                LogOffPlayer( pUser );
+
+                // Return a success message, but the recieve loop can't continue
+                return S_FALSE;
+            }
+
+        case MSG_UPDATEPLAYER:
+            {
+                // Make sure the whole message is here.  An authoritative server decides where
+                // players are itself.
+                if( g_bAuthoritative || dwSize < sizeof(UpdatePlayerMessage) )
+                    return E_FAIL;
+
+                // Copy the fields out of the full-size message
+                const UpdatePlayerMessage * pUpm = (const UpdatePlayerMessage*)pBuffer;
+                PlayerState state;
+                state.dwPlayerID = pUpm->dwPlayerID;
+                memcpy( state.fVelocity, pUpm->fVelocity, sizeof(state.fVelocity) );
+                memcpy( state.fPosition, pUpm->fPosition, sizeof(state.fPosition) );
+                state.dwState = pUpm->dwState;
+                state.fYaw = pUpm->fYaw;
+
+                return StorePlayerState( pUser, &state );
+            }
+
+        case MSG_SNAPSHOTACK:
+            {
+                if( dwSize < sizeof(SnapshotAckMessage) )
+                    return E_FAIL;
+
+                // Only move forward, and only to snapshots that have actually been sent
+                DWORD dwSlot = PLAYER_SLOT( pUser->GetId() );
+                const SnapshotAckMessage * pSam = (const SnapshotAckMessage*)pBuffer;
+                if( pSam->dwSequence > m_pAckedSequence[dwSlot] && pSam->dwSequence < m_pNextSequence[dwSlot] )
+                    m_pAckedSequence[dwSlot] = pSam->dwSequence;
+            } break;
+
+        case MSG_COMPACTUPDATE:
+            {
+                PlayerState state;
+                if( g_bAuthoritative || !DecodeCompactUpdate( (const BYTE*)pBuffer, dwSize, g_fWorldBound, &state ) )
+                    return E_FAIL;
+
+                return StorePlayerState( pUser, &state );
+            }
+
+        case MSG_PLAYERINPUT:
+            {
+                if( !g_bAuthoritative )
+                    return E_FAIL;
+
+                return ApplyPlayerInput( pUser, pBuffer, dwSize );
+            }
+
+        default:
+            {
+                // This message type couldn't be processed
+                return E_FAIL;
+            }
+    }
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  LogOnNewPlayer
+// Desc:  Gives a slot to the client at pAddr and tells it its ID.  A client that already has a
+//        session is just told its ID again, since it only asks twice if the reply was lost.
+//------------------------------------------------------------------------------------------------
+HRESULT Room::LogOnNewPlayer( const SOCKADDR_IN * pAddr )
+{
+    DWORD dwExisting = m_Addresses.Find( pAddr );
+    if( dwExisting != ADDRESS_NOT_FOUND )
+    {
+        ConfirmLogOnMessage packet;
+        packet.dwPlayerID = dwExisting;
+        packet.fWorldBound = g_fWorldBound;
+        packet.dwFlags = g_bAuthoritative ? LOGON_AUTHORITATIVE : 0;
+        GetUser( dwExisting )->SendPacket( (CHAR*)&packet, sizeof(packet) );
+        return S_FALSE;
+    }
+
+    // Take a free slot
+    DWORD dwId = m_Slots.Allocate();
+    if( dwId == INVALID_PLAYER_ID )
+    {
+        Metrics::Count( METRIC_DROPPED_SERVER_FULL, 1 );
+        return E_FAIL;
+    }
+
+    // Set up the connection
+    User * pUser = GetUser( dwId );
+    if( FAILED( pUser->Connect( pAddr, dwId ) ) )
+    {
+        m_Slots.Free( dwId );
+        return E_FAIL;
+    }
+    if( g_bLogEvents )
+        EventLog::Write( "\nLogged on user %u", dwId );
+
+    // Start the user's snapshots over
+    DWORD dwSlot = PLAYER_SLOT( dwId );
+    m_pHistories[dwSlot].Reset();
+    m_pNextSequence[dwSlot] = 1;
+    m_pAckedSequence[dwSlot] = 0;
+
+    // Players start out standing still in the middle of the world, which is also where the
+    // client starts predicting from
+    ZeroMemory( &m_pMovement[dwSlot], sizeof(MovementState) );
+    m_pMovement[dwSlot].dwState = MOVEMENT_IDLE;
+    m_pInputSequence[dwSlot] = 0;
+    m_pAckedInput[dwSlot] = 0;
+    m_pInputBudget[dwSlot] = MAX_INPUT_BUDGET;
+    m_pBudgetTime[dwSlot] = m_dwTime;
+
+    // Start the idle timeout.  Snapshots are spread across the tick by slot, so that a full room
+    // doesn't send all of them in one burst.
+    m_pLastHeard[dwSlot] = m_dwTime;
+    m_Timers.Schedule( dwSlot * ROOM_TIMERS_PER_USER + ROOM_TIMER_IDLE, IDLE_TIMEOUT );
+    m_Timers.Schedule( dwSlot * ROOM_TIMERS_PER_USER + ROOM_TIMER_SNAPSHOT,
+                       TIMER_RESOLUTION * (1 + dwSlot % (TICK_PERIOD / TIMER_RESOLUTION)) );
+
+    // Route this address's datagrams to the user, and keep it from logging on twice
+    m_Addresses.Insert( pAddr, dwId );
+
+    // Send a message to the user telling them that they have successfully logged on
+    ConfirmLogOnMessage packet;
+    packet.dwPlayerID = dwId;
+    packet.fWorldBound = g_fWorldBound;
+    packet.dwFlags = g_bAuthoritative ? LOGON_AUTHORITATIVE : 0;
+    pUser->SendPacket( (CHAR*)&packet, sizeof(packet) );
+    Metrics::Count( METRIC_SESSIONS_OPENED, 1 );
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ProcessServerPacket
+// Desc:  Handles one datagram that arrived on the shared server socket, routing it to the
+//        user it came from or treating it as a logon
+//------------------------------------------------------------------------------------------------
+VOID Room::ProcessServerPacket( const SOCKADDR_IN * pAddress, const CHAR * pBuffer, DWORD dwSize )
+{
+    Metrics::CountReceived( pBuffer, dwSize );
+    if( dwSize < sizeof(MessageHeader) )
+    {
+        Metrics::Count( METRIC_DROPPED_MALFORMED, 1 );
+        return;
+    }
+
+    // Logons are checked the same way whether or not the address already has a session, so a
+    // client whose confirmation was lost can ask again
+    if( GetMessageID( pBuffer ) == MSG_LOGON )
+    {
+        ProcessLogOn( pAddress, pBuffer, dwSize );
+        return;
+    }
+
+    // Anything else has to come from a logged-on client, and goes to that user
+    if( g_bSharedPort )
+    {
+        DWORD dwId = m_Addresses.Find( pAddress );
+        if( dwId == ADDRESS_NOT_FOUND )
+        {
+            Metrics::Count( METRIC_DROPPED_UNKNOWN, 1 );
+            return;
+        }
+
+        User * pUser = GetUser( dwId );
+        HRESULT hr = ProcessUserPacket( pUser, pBuffer, dwSize );
+        if( FAILED( hr ) )
+            Metrics::Count( METRIC_DROPPED_MALFORMED, 1 );
+        else if( S_FALSE == hr && g_bLogEvents )
+            EventLog::Write( "\n[%u] disconnected", pUser->GetId() );
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ProcessLogOn
+// Desc:  Only logs on a client that has echoed the cookie for its address.  Anything else gets
+//        the cookie, which costs the server nothing to remember.
+//------------------------------------------------------------------------------------------------
+VOID Room::ProcessLogOn( const SOCKADDR_IN * pAddress, const CHAR * pBuffer, DWORD dwSize )
+{
+    const LogOnMessage * pLom = (const LogOnMessage*)pBuffer;
+    if( dwSize >= sizeof(LogOnMessage) && m_Cookies.Check( pAddress, pLom->dwCookie, m_dwTime ) )
+    {
+        LogOnNewPlayer( pAddress );
+        return;
+    }
+
+    // The challenge is no bigger than the logon, so forged logons can't be used to flood
+    // someone else with replies
+    if( m_pfnReplySend )
+    {
+        LogOnChallengeMessage packet;
+        packet.dwCookie = m_Cookies.Make( pAddress, m_dwTime );
+        if( SOCKET_ERROR == m_pfnReplySend( m_pReplyContext, pAddress, (const CHAR*)&packet, sizeof(packet) ) )
+            Metrics::Count( METRIC_DROPPED_SEND, 1 );
+        else
+            Metrics::CountSent( (const CHAR*)&packet, sizeof(packet) );
+        Metrics::Count( METRIC_LOGON_CHALLENGES, 1 );
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SendSnapshot
+// Desc:  Sends one user the players it can see, delta-encoded against its last acknowledged
+//        snapshot
+//------------------------------------------------------------------------------------------------
+VOID Room::SendSnapshot( DWORD dwId )
+{
+    DWORD dwSlot = PLAYER_SLOT( dwId );
+    SnapshotHistory * pHistory = &m_pHistories[dwSlot];
+
+    // Quantize everyone in view, sorted by ID the way the encoder wants them
+    DWORD dwNumVisible = m_Interest.GetVisibleCount( dwId );
+    for( DWORD i = 0; i < dwNumVisible; ++i )
+        QuantizeState( &m_pPlayerStates[PLAYER_SLOT( m_Interest.GetVisible( dwId, i ) )], g_fWorldBound, &m_pViewStates[i] );
+    SortByPlayerID( m_pViewStates, dwNumVisible );
+    Metrics::Record( METRIC_RELAY_FANOUT, dwNumVisible );
+
+    // Use the newest acknowledged snapshot as the baseline, as long as it's still in the history
+    DWORD dwSequence = m_pNextSequence[dwSlot]++;
+    const SnapshotFrame * pBaseline = NULL;
+    if( dwSequence - m_pAckedSequence[dwSlot] < SNAPSHOT_HISTORY_SIZE )
+        pBaseline = pHistory->Find( m_pAckedSequence[dwSlot] );
+
+    // Build the datagram, and remember what it contained
+    BYTE buffer[MAX_PACKET_SIZE];
+    SnapshotFrame * pSent = pHistory->Store( dwSequence, dwNumVisible + (pBaseline ? pBaseline->dwNumPlayers : 0) );
+    if( !pSent )
+        return;
+
+    DWORD dwSize = EncodeDeltaSnapshot( dwSequence, pBaseline, m_pViewStates, dwNumVisible, pSent, buffer, sizeof(buffer) );
+
+    // A baseline too big to even list doesn't leave room for anything else, so start over
+    if( !dwSize && pBaseline )
+        dwSize = EncodeDeltaSnapshot( dwSequence, NULL, m_pViewStates, dwNumVisible, pSent, buffer, sizeof(buffer) );
+    if( dwSize )
+        GetUser( dwId )->SendPacket( (const CHAR*)buffer, dwSize );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SendInputAck
+// Desc:  Tells a user where the newest of its inputs has put its player, if that has changed
+//        since the last time it was told
+//------------------------------------------------------------------------------------------------
+VOID Room::SendInputAck( DWORD dwId )
+{
+    DWORD dwSlot = PLAYER_SLOT( dwId );
+    if( m_pAckedInput[dwSlot] == m_pInputSequence[dwSlot] )
+        return;
+
+    const MovementState * pMovement = &m_pMovement[dwSlot];
+    InputAckMessage packet;
+    packet.dwSequence = m_pInputSequence[dwSlot];
+    memcpy( packet.fPosition, pMovement->fPosition, sizeof(packet.fPosition) );
+    packet.fVelocity = pMovement->fVelocity;
+    packet.fYaw = pMovement->fYaw;
+    packet.fTargetYaw = pMovement->fTargetYaw;
+    packet.dwState = pMovement->dwState;
+    GetUser( dwId )->SendPacket( (const CHAR*)&packet, sizeof(packet) );
+
+    // Acks aren't resent if they get lost; the next input will bring another one
+    m_pAckedInput[dwSlot] = m_pInputSequence[dwSlot];
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SendSnapshots
+// Desc:  Relays player states to every user at once.  The server paces snapshots with Advance
+//        instead; this sends a whole tick's worth in one go, for measuring.
+//------------------------------------------------------------------------------------------------
+VOID Room::SendSnapshots()
+{
+    for( DWORD i = 0; i < m_Slots.GetActiveCount(); ++i )
+    {
+        DWORD dwId = m_Slots.GetActive( i );
+
+        // Work out who came into or went out of view since the last tick; the snapshot tells
+        // the user about them
+        m_Interest.Update( dwId, NULL, NULL, NULL );
+
+        // Every user gets a snapshot every tick, even if nothing changed, so that it keeps
+        // acknowledging new baselines
+        SendSnapshot( dwId );
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Advance
+// Desc:  Moves the room's clock forward to dwTime and runs every timer that came due: each
+//        user's snapshot, and the timeouts of users who have stopped sending.  Should be called
+//        about every TIMER_RESOLUTION milliseconds.  Passes that ran anything are timed.
+//------------------------------------------------------------------------------------------------
+VOID Room::Advance( DWORD dwTime )
+{
+    m_dwTime = dwTime;
+    QWORD qwStart = GetMicrosecondCount();
+    if( m_Timers.Advance( dwTime, TimerExpired, this ) )
+        Metrics::Record( METRIC_TICK_TIME, (DWORD)(GetMicrosecondCount() - qwStart) );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  TimerExpired
+// Desc:  Runs one of a user's timers
+//------------------------------------------------------------------------------------------------
+VOID Room::TimerExpired( LPVOID pContext, DWORD dwTimer )
+{
+    Room * pRoom = (Room*)pContext;
+    DWORD dwSlot = dwTimer / ROOM_TIMERS_PER_USER;
+    User * pUser = pRoom->GetUserBySlot( dwSlot );
+    DWORD dwId = pUser->GetId();
+
+    switch( dwTimer % ROOM_TIMERS_PER_USER )
+    {
+        case ROOM_TIMER_SNAPSHOT:
+            {
+                // Work out who came into or went out of view since the last tick; the snapshot
+                // tells the user about them.  Every user gets a snapshot every tick, even if
+                // nothing changed, so that it keeps acknowledging new baselines.
+                pRoom->m_Interest.Update( dwId, NULL, NULL, NULL );
+                pRoom->SendSnapshot( dwId );
+                if( g_bAuthoritative )
+                    pRoom->SendInputAck( dwId );
+                pRoom->m_Timers.Schedule( dwTimer, TICK_PERIOD );
+            } break;
+
+        case ROOM_TIMER_IDLE:
+            {
+                // Packets don't move the timeout, so check when the user was last heard from
+                // and wait out the rest if it's been less than the timeout
+                DWORD dwIdle = pRoom->m_dwTime - pRoom->m_pLastHeard[dwSlot];
+                if( dwIdle < IDLE_TIMEOUT )
+                {
+                    pRoom->m_Timers.Schedule( dwTimer, IDLE_TIMEOUT - dwIdle );
+                    break;
+                }
+
+                // Output message
+                if( g_bLogEvents )
+                    EventLog::Write( "\n[%u] lagged out", dwId );
+                Metrics::Count( METRIC_SESSIONS_TIMED_OUT, 1 );
+
+                // Log this player out, the same as if it had asked to
+                pRoom->LogOffPlayer( pUser );
+            } break;
+    }
+}
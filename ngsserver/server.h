@@ -0,0 +1,148 @@
+//------------------------------------------------------------------------------------------------
+// File:    server.h
+//
+// Desc:    Server state and packet handling, independent of how packets reach the server
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+
+// Include files required to compile this header
+#include "../common/platform.h"
+#include "../common/protocol.h"
+#include "../common/wireformat.h"
+#include "../common/snapshot.h"
+#include "../common/movement.h"
+#include "addresstable.h"
+#include "slotallocator.h"
+#include "interestgrid.h"
+#include "logoncookies.h"
+#include "timerwheel.h"
+#include "user.h"
+
+// Settings that define how the server operates
+#define DEFAULT_MAX_USERS   16
+#define IDLE_TIMEOUT        5000
+#define TICK_PERIOD         SNAPSHOT_PERIOD
+#define TIMER_RESOLUTION    10      /* How often each room's timers are checked */
+#define VIEW_RADIUS         40.0f   /* Players closer than this are sent to each other */
+#define VIEW_HYSTERESIS     8.0f    /* How much farther away a player has to go to leave view */
+
+
+// Settings shared by every room.  These are set once by the main thread before any room starts,
+// and only read after that.
+extern BOOL g_bSharedPort;      // All users share one socket instead of binding their own ports
+extern FLOAT g_fWorldBound;     // Compact updates hold positions between plus and minus this value
+extern BOOL g_bLogEvents;       // Send logons and disconnects to the EventLog
+extern BOOL g_bAuthoritative;   // Players send their inputs and the server moves them
+
+
+/**
+ * One world instance: its players, what each of them can see, and the snapshots sent to them.
+ * Nothing in a room is shared with any other room, so each one can be run by a different thread
+ * as long as only one thread touches it at a time.  The tables are indexed by the slot part of
+ * a player ID and sized when the room is created.
+ *   @author Karl Gluck
+ */
+class Room
+{
+    public:
+
+        Room();
+        ~Room();
+        HRESULT Create( DWORD dwMaxUsers, FLOAT fViewRadius, DWORD dwTime, const CookieSecret * pCookieSecret );
+        VOID Destroy();
+        VOID SetReplySend( UserSendCallback pfnSend, LPVOID pContext );
+
+        User * GetUser( DWORD dwPlayerID );
+        User * GetUserBySlot( DWORD dwSlot ) { return &m_pUsers[dwSlot]; }
+        DWORD GetMaxUsers() const { return m_dwMaxUsers; }
+        DWORD GetPlayerCount() const { return m_Slots.GetActiveCount(); }
+        DWORD GetPlayer( DWORD i ) const { return m_Slots.GetActive( i ); }
+        DWORD FindPlayer( const SOCKADDR_IN * pAddress ) const { return m_Addresses.Find( pAddress ); }
+        DWORD GetVisibleCount( DWORD dwPlayerID ) const { return m_Interest.GetVisibleCount( dwPlayerID ); }
+        DWORD GetNextSequence( DWORD dwPlayerID ) const { return m_pNextSequence[PLAYER_SLOT( dwPlayerID )]; }
+
+        VOID DisconnectUser( User * pUser );
+        HRESULT LogOnNewPlayer( const SOCKADDR_IN * pAddr );
+        HRESULT ProcessUserPacket( User * pUser, const CHAR * pBuffer, DWORD dwSize );
+        VOID ProcessServerPacket( const SOCKADDR_IN * pAddress, const CHAR * pBuffer, DWORD dwSize );
+
+        VOID SendSnapshots();
+        VOID Advance( DWORD dwTime );
+
+    protected:
+
+        HRESULT StorePlayerState( User * pUser, const PlayerState * pNewState );
+        HRESULT ApplyPlayerInput( User * pUser, const CHAR * pBuffer, DWORD dwSize );
+        VOID SendSnapshot( DWORD dwId );
+        VOID SendInputAck( DWORD dwId );
+        VOID LogOffPlayer( User * pUser );
+        VOID ProcessLogOn( const SOCKADDR_IN * pAddress, const CHAR * pBuffer, DWORD dwSize );
+        static VOID TimerExpired( LPVOID pContext, DWORD dwTimer );
+
+    protected:
+
+        DWORD m_dwMaxUsers;             // Number of player slots
+        User * m_pUsers;                // List of all of the users
+        SlotAllocator m_Slots;          // Assigns player IDs and tracks which slots are in use
+        AddressTable m_Addresses;       // Finds the session that an address already has
+        LogOnCookies m_Cookies;         // Checks that a logon came from where it says it did
+        UserSendCallback m_pfnReplySend;// Sends logon challenges, which go out before there's a user
+        LPVOID m_pReplyContext;
+        InterestGrid m_Interest;        // Decides which players each user is sent
+
+        // Latest state received from each user.  Updates that arrive between ticks overwrite each
+        // other, and only the latest one is sent out at the next tick.
+        PlayerState * m_pPlayerStates;
+
+        // When the server is authoritative, each player is moved by the inputs its user sends
+        // instead, and told how far the server has got so that it can correct its prediction.
+        // Inputs can only use up as much time as has really passed, give or take the budget.
+        MovementState * m_pMovement;
+        DWORD * m_pInputSequence;       // Newest input applied for each user
+        DWORD * m_pAckedInput;          // Newest input each user has been told about
+        DWORD * m_pInputBudget;         // Milliseconds of input each user may still send
+        DWORD * m_pBudgetTime;          // Value of m_dwTime when the budget was last topped up
+
+        // Snapshots sent to each user.  Each one is encoded against the newest snapshot that the
+        // user has acknowledged, so players that haven't changed cost almost nothing.
+        SnapshotHistory * m_pHistories;
+        DWORD * m_pNextSequence;        // Sequence number of the next snapshot for each user
+        DWORD * m_pAckedSequence;       // Newest snapshot each user has acknowledged, or 0
+        QuantizedState * m_pViewStates; // Holds the players one user can see while its snapshot is built
+
+        // Each user has an idle timeout and a snapshot timer on the wheel.  Time only moves when
+        // Advance is called, so a replay of the same calls expires the same sessions.
+        TimerWheel m_Timers;
+        DWORD m_dwTime;                 // Time passed to the last Advance
+        DWORD * m_pLastHeard;           // Value of m_dwTime when each user last sent something
+};
+
+#endif // __SERVER_H__
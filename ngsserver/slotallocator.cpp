@@ -0,0 +1,210 @@
+//------------------------------------------------------------------------------------------------
+// File:    slotallocator.cpp
+//
+// Desc:    Hands out player IDs from a fixed pool of session slots
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "slotallocator.h"
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  SlotAllocator
+// Desc:  
+//------------------------------------------------------------------------------------------------
+SlotAllocator::SlotAllocator()
+{
+    m_dwCapacity = 0;
+    m_pGenerations = NULL;
+    m_pFree = NULL;
+    m_dwNumFree = 0;
+    m_pActive = NULL;
+    m_pActivePosition = NULL;
+    m_dwNumActive = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~SlotAllocator
+// Desc:  
+//------------------------------------------------------------------------------------------------
+SlotAllocator::~SlotAllocator()
+{
+    Destroy();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Create
+// Desc:  Sets up dwCapacity free slots
+//------------------------------------------------------------------------------------------------
+HRESULT SlotAllocator::Create( DWORD dwCapacity )
+{
+    Destroy();
+
+    // The slot has to fit in the low bits of a player ID
+    if( dwCapacity == 0 || dwCapacity > MAX_PLAYER_SLOTS )
+        return E_FAIL;
+
+    m_pGenerations = new WORD[dwCapacity];
+    m_pFree = new DWORD[dwCapacity];
+    m_pActive = new DWORD[dwCapacity];
+    m_pActivePosition = new DWORD[dwCapacity];
+    if( !m_pGenerations || !m_pFree || !m_pActive || !m_pActivePosition )
+    {
+        Destroy();
+        return E_OUTOFMEMORY;
+    }
+
+    // Push the slots so that the lowest ones are handed out first.  Generations start at 1 so
+    // that no valid ID is ever zero.
+    for( DWORD i = 0; i < dwCapacity; ++i )
+    {
+        m_pGenerations[i] = 1;
+        m_pFree[i] = dwCapacity - 1 - i;
+        m_pActivePosition[i] = 0;
+    }
+
+    m_dwCapacity = dwCapacity;
+    m_dwNumFree = dwCapacity;
+    m_dwNumActive = 0;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Destroy
+// Desc:  
+//------------------------------------------------------------------------------------------------
+VOID SlotAllocator::Destroy()
+{
+    if( m_pGenerations )    { delete [] m_pGenerations;    m_pGenerations = NULL; }
+    if( m_pFree )           { delete [] m_pFree;           m_pFree = NULL; }
+    if( m_pActive )         { delete [] m_pActive;         m_pActive = NULL; }
+    if( m_pActivePosition ) { delete [] m_pActivePosition; m_pActivePosition = NULL; }
+
+    m_dwCapacity = 0;
+    m_dwNumFree = 0;
+    m_dwNumActive = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Allocate
+// Desc:  Takes a free slot and returns the player ID for it, or INVALID_PLAYER_ID if the
+//        server is full
+//------------------------------------------------------------------------------------------------
+DWORD SlotAllocator::Allocate()
+{
+    if( m_dwNumFree == 0 )
+        return INVALID_PLAYER_ID;
+
+    // Pop a slot
+    DWORD dwSlot = m_pFree[--m_dwNumFree];
+    DWORD dwPlayerID = MAKE_PLAYER_ID( dwSlot, m_pGenerations[dwSlot] );
+
+    // Add it to the active list
+    m_pActivePosition[dwSlot] = m_dwNumActive;
+    m_pActive[m_dwNumActive++] = dwPlayerID;
+
+    return dwPlayerID;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Free
+// Desc:  Returns a player's slot to the pool.  Stale IDs are ignored.
+//------------------------------------------------------------------------------------------------
+VOID SlotAllocator::Free( DWORD dwPlayerID )
+{
+    if( !IsValid( dwPlayerID ) )
+        return;
+
+    DWORD dwSlot = PLAYER_SLOT( dwPlayerID );
+
+    // Fill the hole in the active list with the last entry
+    DWORD dwPosition = m_pActivePosition[dwSlot];
+    DWORD dwLast = m_pActive[--m_dwNumActive];
+    m_pActive[dwPosition] = dwLast;
+    m_pActivePosition[PLAYER_SLOT( dwLast )] = dwPosition;
+
+    // Invalidate every ID that was handed out for this slot.  Zero is skipped on wraparound.
+    if( ++m_pGenerations[dwSlot] == 0 )
+        m_pGenerations[dwSlot] = 1;
+
+    // Push the slot
+    m_pFree[m_dwNumFree++] = dwSlot;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  IsValid
+// Desc:  Determines whether an ID belongs to the current occupant of its slot
+//------------------------------------------------------------------------------------------------
+BOOL SlotAllocator::IsValid( DWORD dwPlayerID ) const
+{
+    DWORD dwSlot = PLAYER_SLOT( dwPlayerID );
+    if( dwSlot >= m_dwCapacity || m_pGenerations[dwSlot] != PLAYER_GENERATION( dwPlayerID ) )
+        return FALSE;
+
+    // The generation matches, but the slot might be sitting on the free stack
+    DWORD dwPosition = m_pActivePosition[dwSlot];
+    return dwPosition < m_dwNumActive && m_pActive[dwPosition] == dwPlayerID;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetCapacity
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DWORD SlotAllocator::GetCapacity() const
+{
+    return m_dwCapacity;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetActiveCount
+// Desc:  
+//------------------------------------------------------------------------------------------------
+DWORD SlotAllocator::GetActiveCount() const
+{
+    return m_dwNumActive;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetActive
+// Desc:  Gets the ID of the i-th player in use.  Freeing a player moves the last one into its
+//        position, so loops that free players should walk the list backward.
+//------------------------------------------------------------------------------------------------
+DWORD SlotAllocator::GetActive( DWORD i ) const
+{
+    return m_pActive[i];
+}
@@ -0,0 +1,76 @@
+//------------------------------------------------------------------------------------------------
+// File:    slotallocator.h
+//
+// Desc:    Hands out player IDs from a fixed pool of session slots
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __SLOTALLOCATOR_H__
+#define __SLOTALLOCATOR_H__
+
+
+// Include files required to compile this header
+#include "../common/platform.h"
+#include "../common/protocol.h"
+
+/**
+ * Allocates session slots in constant time.  Free slots are kept on a stack, and the slots in use
+ * are kept in a dense list so that the server can loop over connected players without touching
+ * empty ones.  Each slot has a generation counter that is bumped when it is freed, and player IDs
+ * carry the generation (see MAKE_PLAYER_ID) so that an ID from a previous occupant of the slot
+ * never matches the current one.
+ *   @author Karl Gluck
+ */
+class SlotAllocator
+{
+    public:
+
+        SlotAllocator();
+        ~SlotAllocator();
+        HRESULT Create( DWORD dwCapacity );
+        VOID Destroy();
+
+        DWORD Allocate();
+        VOID Free( DWORD dwPlayerID );
+        BOOL IsValid( DWORD dwPlayerID ) const;
+
+        DWORD GetCapacity() const;
+        DWORD GetActiveCount() const;
+        DWORD GetActive( DWORD i ) const;
+
+    protected:
+
+        DWORD m_dwCapacity;
+        WORD * m_pGenerations;      // Current generation of each slot
+        DWORD * m_pFree;            // Stack of free slot indices
+        DWORD m_dwNumFree;
+        DWORD * m_pActive;          // Dense list of the player IDs in use
+        DWORD * m_pActivePosition;  // Where each slot sits in m_pActive
+        DWORD m_dwNumActive;
+};
+
+#endif // __SLOTALLOCATOR_H__
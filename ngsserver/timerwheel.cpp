@@ -0,0 +1,287 @@
+//------------------------------------------------------------------------------------------------
+// File:    timerwheel.cpp
+//
+// Desc:    Hierarchical timing wheel for per-session timers
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "timerwheel.h"
+
+// Marks the end of a slot's list, and timers that aren't in any slot
+#define END_OF_LIST         0xFFFFFFFF
+#define NOT_SCHEDULED       0xFFFFFFFF
+
+// Slot that holds the timers being fired
+#define FIRING_SLOT         (WHEEL_LEVELS * WHEEL_SLOTS)
+
+// Furthest out a timer can be scheduled, in steps
+#define MAX_STEPS           ((1 << (WHEEL_LEVELS * WHEEL_LEVEL_BITS)) - 1)
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  TimerWheel
+// Desc:  
+//------------------------------------------------------------------------------------------------
+TimerWheel::TimerWheel()
+{
+    m_dwCapacity = 0;
+    m_dwResolution = 1;
+    m_dwCurrent = 0;
+    m_dwCurrentTime = 0;
+    m_bFiring = FALSE;
+    m_pNext = NULL;
+    m_pPrev = NULL;
+    m_pExpiry = NULL;
+    m_pSlot = NULL;
+    for( DWORD i = 0; i <= FIRING_SLOT; ++i )
+        m_Heads[i] = END_OF_LIST;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~TimerWheel
+// Desc:  
+//------------------------------------------------------------------------------------------------
+TimerWheel::~TimerWheel()
+{
+    Destroy();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Create
+// Desc:  Makes room for timers 0 through dwCapacity - 1, none of them scheduled.  The wheel
+//        turns in steps of dwResolution milliseconds, starting from dwTime.
+//------------------------------------------------------------------------------------------------
+HRESULT TimerWheel::Create( DWORD dwCapacity, DWORD dwResolution, DWORD dwTime )
+{
+    Destroy();
+
+    if( dwResolution == 0 )
+        return E_FAIL;
+
+    m_dwCapacity = dwCapacity;
+    m_dwResolution = dwResolution;
+    m_dwCurrent = 0;
+    m_dwCurrentTime = dwTime;
+    m_pNext = new DWORD[dwCapacity];
+    m_pPrev = new DWORD[dwCapacity];
+    m_pExpiry = new DWORD[dwCapacity];
+    m_pSlot = new DWORD[dwCapacity];
+    for( DWORD i = 0; i < dwCapacity; ++i )
+        m_pSlot[i] = NOT_SCHEDULED;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Destroy
+// Desc:  
+//------------------------------------------------------------------------------------------------
+VOID TimerWheel::Destroy()
+{
+    delete [] m_pNext;
+    delete [] m_pPrev;
+    delete [] m_pExpiry;
+    delete [] m_pSlot;
+    m_pNext = NULL;
+    m_pPrev = NULL;
+    m_pExpiry = NULL;
+    m_pSlot = NULL;
+    m_dwCapacity = 0;
+    for( DWORD i = 0; i <= FIRING_SLOT; ++i )
+        m_Heads[i] = END_OF_LIST;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Schedule
+// Desc:  Sets a timer to fire dwDelay milliseconds from the wheel's current time, replacing
+//        whatever it was set to before.  The delay is rounded up to a whole step.  From inside
+//        a callback it counts from the step that fired, so periodic timers don't drift.
+//------------------------------------------------------------------------------------------------
+VOID TimerWheel::Schedule( DWORD dwTimer, DWORD dwDelay )
+{
+    if( dwTimer >= m_dwCapacity )
+        return;
+
+    Cancel( dwTimer );
+
+    DWORD dwSteps = (dwDelay + m_dwResolution - 1) / m_dwResolution;
+    if( dwSteps > MAX_STEPS )
+        dwSteps = MAX_STEPS;
+
+    // The current step starts after the last Advance, so the timer never goes off early.  The
+    // step that's firing has already been counted, so callbacks start from the one before.
+    m_pExpiry[dwTimer] = (m_bFiring ? m_dwCurrent - 1 : m_dwCurrent) + dwSteps;
+    Insert( dwTimer );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Cancel
+// Desc:  Stops a timer from firing.  Does nothing if it isn't scheduled.
+//------------------------------------------------------------------------------------------------
+VOID TimerWheel::Cancel( DWORD dwTimer )
+{
+    if( dwTimer < m_dwCapacity && m_pSlot[dwTimer] != NOT_SCHEDULED )
+        Unlink( dwTimer );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  IsScheduled
+// Desc:  
+//------------------------------------------------------------------------------------------------
+BOOL TimerWheel::IsScheduled( DWORD dwTimer ) const
+{
+    return dwTimer < m_dwCapacity && m_pSlot[dwTimer] != NOT_SCHEDULED;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Advance
+// Desc:  Turns the wheel up to dwTime, calling pfnCallback for every timer that comes due on
+//        the way, in the order they were due.  Returns how many fired.
+//------------------------------------------------------------------------------------------------
+DWORD TimerWheel::Advance( DWORD dwTime, TimerWheelCallback pfnCallback, LPVOID pContext )
+{
+    DWORD dwFired = 0;
+
+    // The signed difference handles wraparound of the tick count
+    while( (int)(dwTime - m_dwCurrentTime) >= 0 )
+    {
+        // At the start of each turn, bring the next slot of the level above down, and so on up
+        DWORD dwIndex = m_dwCurrent & (WHEEL_SLOTS - 1);
+        for( DWORD dwLevel = 1; dwLevel < WHEEL_LEVELS && dwIndex == 0; ++dwLevel )
+        {
+            dwIndex = (m_dwCurrent >> (dwLevel * WHEEL_LEVEL_BITS)) & (WHEEL_SLOTS - 1);
+            Cascade( dwLevel );
+        }
+
+        // Set the due timers aside, so that anything the callbacks schedule goes in the wheel
+        DWORD dwSlot = m_dwCurrent & (WHEEL_SLOTS - 1);
+        m_dwCurrent++;
+        m_dwCurrentTime += m_dwResolution;
+        m_Heads[FIRING_SLOT] = m_Heads[dwSlot];
+        m_Heads[dwSlot] = END_OF_LIST;
+        for( DWORD i = m_Heads[FIRING_SLOT]; i != END_OF_LIST; i = m_pNext[i] )
+            m_pSlot[i] = FIRING_SLOT;
+
+        m_bFiring = TRUE;
+        while( m_Heads[FIRING_SLOT] != END_OF_LIST )
+        {
+            DWORD dwTimer = m_Heads[FIRING_SLOT];
+            Unlink( dwTimer );
+            pfnCallback( pContext, dwTimer );
+            dwFired++;
+        }
+        m_bFiring = FALSE;
+    }
+
+    return dwFired;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Link
+// Desc:  Puts a timer at the front of a slot's list
+//------------------------------------------------------------------------------------------------
+VOID TimerWheel::Link( DWORD dwTimer, DWORD dwSlot )
+{
+    DWORD dwHead = m_Heads[dwSlot];
+    m_pNext[dwTimer] = dwHead;
+    m_pPrev[dwTimer] = END_OF_LIST;
+    if( dwHead != END_OF_LIST )
+        m_pPrev[dwHead] = dwTimer;
+    m_Heads[dwSlot] = dwTimer;
+    m_pSlot[dwTimer] = dwSlot;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Unlink
+// Desc:  Takes a timer out of whatever slot it's in
+//------------------------------------------------------------------------------------------------
+VOID TimerWheel::Unlink( DWORD dwTimer )
+{
+    DWORD dwNext = m_pNext[dwTimer];
+    DWORD dwPrev = m_pPrev[dwTimer];
+    if( dwPrev != END_OF_LIST )
+        m_pNext[dwPrev] = dwNext;
+    else
+        m_Heads[m_pSlot[dwTimer]] = dwNext;
+    if( dwNext != END_OF_LIST )
+        m_pPrev[dwNext] = dwPrev;
+    m_pSlot[dwTimer] = NOT_SCHEDULED;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Insert
+// Desc:  Links a timer into the slot for its expiry.  The level depends on how far away that is,
+//        and the slot within the level on the expiry's bits for that level.
+//------------------------------------------------------------------------------------------------
+VOID TimerWheel::Insert( DWORD dwTimer )
+{
+    DWORD dwExpiry = m_pExpiry[dwTimer];
+    DWORD dwSteps = dwExpiry - m_dwCurrent;
+
+    // Anything already due goes in the slot that runs next
+    if( (int)dwSteps < 0 )
+    {
+        dwExpiry = m_dwCurrent;
+        dwSteps = 0;
+    }
+
+    DWORD dwLevel = 0;
+    while( dwLevel + 1 < WHEEL_LEVELS && dwSteps >= (1u << ((dwLevel + 1) * WHEEL_LEVEL_BITS)) )
+        dwLevel++;
+
+    DWORD dwIndex = (dwExpiry >> (dwLevel * WHEEL_LEVEL_BITS)) & (WHEEL_SLOTS - 1);
+    Link( dwTimer, dwLevel * WHEEL_SLOTS + dwIndex );
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Cascade
+// Desc:  Moves the timers in one level's current slot down to wherever they belong now
+//------------------------------------------------------------------------------------------------
+VOID TimerWheel::Cascade( DWORD dwLevel )
+{
+    DWORD dwSlot = dwLevel * WHEEL_SLOTS + ((m_dwCurrent >> (dwLevel * WHEEL_LEVEL_BITS)) & (WHEEL_SLOTS - 1));
+    DWORD dwTimer = m_Heads[dwSlot];
+    m_Heads[dwSlot] = END_OF_LIST;
+    while( dwTimer != END_OF_LIST )
+    {
+        DWORD dwNext = m_pNext[dwTimer];
+        Insert( dwTimer );
+        dwTimer = dwNext;
+    }
+}
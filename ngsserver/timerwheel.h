@@ -0,0 +1,97 @@
+//------------------------------------------------------------------------------------------------
+// File:    timerwheel.h
+//
+// Desc:    Hierarchical timing wheel for per-session timers
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __TIMERWHEEL_H__
+#define __TIMERWHEEL_H__
+
+
+// Include files required to compile this header
+#include "../common/platform.h"
+
+// Called by Advance for each timer that comes due.  The timer is no longer scheduled, so the
+// callback can schedule it again.
+typedef VOID (*TimerWheelCallback)( LPVOID pContext, DWORD dwTimer );
+
+// Each level of the wheel has 64 slots, and each slot on a level spans a whole turn of the
+// level below it
+#define WHEEL_LEVEL_BITS    6
+#define WHEEL_SLOTS         (1 << WHEEL_LEVEL_BITS)
+#define WHEEL_LEVELS        4
+
+/**
+ * Keeps thousands of timers, such as one per session, and finds the ones that are due without
+ * looking at the rest.  Timers are numbered from zero up to the capacity and linked into the
+ * slot for the time they expire, so scheduling and cancelling are constant time.  The first
+ * level has one slot per step of the wheel's resolution; timers further out go on coarser levels
+ * and move down as their time approaches.  Four levels of 64 slots at 10ms cover 46 hours.
+ *   @author Karl Gluck
+ */
+class TimerWheel
+{
+    public:
+
+        TimerWheel();
+        ~TimerWheel();
+        HRESULT Create( DWORD dwCapacity, DWORD dwResolution, DWORD dwTime );
+        VOID Destroy();
+
+        VOID Schedule( DWORD dwTimer, DWORD dwDelay );
+        VOID Cancel( DWORD dwTimer );
+        BOOL IsScheduled( DWORD dwTimer ) const;
+
+        DWORD Advance( DWORD dwTime, TimerWheelCallback pfnCallback, LPVOID pContext );
+
+    protected:
+
+        VOID Link( DWORD dwTimer, DWORD dwSlot );
+        VOID Unlink( DWORD dwTimer );
+        VOID Insert( DWORD dwTimer );
+        VOID Cascade( DWORD dwLevel );
+
+    protected:
+
+        DWORD m_dwCapacity;
+        DWORD m_dwResolution;       // Milliseconds per step
+        DWORD m_dwCurrent;          // Next step to be run, counted from Create
+        DWORD m_dwCurrentTime;      // Time that step is due
+        BOOL m_bFiring;             // Set while callbacks run for the step before m_dwCurrent
+
+        // Each slot heads a doubly-linked list of timers.  The extra slot at the end holds the
+        // timers being fired, so that a callback can cancel one that hasn't been reached yet.
+        DWORD m_Heads[WHEEL_LEVELS * WHEEL_SLOTS + 1];
+
+        DWORD * m_pNext;
+        DWORD * m_pPrev;
+        DWORD * m_pExpiry;          // Step each timer is due on
+        DWORD * m_pSlot;            // Slot each timer is linked into, or NOT_SCHEDULED
+};
+
+#endif // __TIMERWHEEL_H__
@@ -0,0 +1,705 @@
+//------------------------------------------------------------------------------------------------
+// File:    uringengine.cpp
+//
+// Desc:    Completion-based datagram loop for Linux built on io_uring
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#include "uringengine.h"
+#include "../common/protocol.h"
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#endif
+
+// Marks the end of the free send slot list
+#define END_OF_LIST         0xFFFFFFFF
+
+#if defined(IORING_RECV_MULTISHOT)
+
+// Size of the submission queue; the completion queue is four times bigger
+#define URING_QUEUE_DEPTH   1024
+
+// Each receive buffer holds the kernel's header, the source address and the largest datagram
+#define URING_BUFFER_GROUP  0
+#define URING_BUFFER_SIZE   ((sizeof(struct io_uring_recvmsg_out) + sizeof(SOCKADDR_IN) + MAX_PACKET_SIZE + 63) & ~63)
+
+// The top half of each request's user data says what kind of request it was
+#define URING_OP_RECV       1
+#define URING_OP_SEND       2
+#define URING_OP_WAKE       3
+#define URING_USER_DATA( op, index )    (((QWORD)(op) << 32) | (DWORD)(index))
+
+/**
+ * An outgoing datagram.  The kernel reads it after Send has returned, so it has to stay put
+ * until the send completes.
+ */
+struct UringSendSlot
+{
+    struct msghdr Msg;
+    struct iovec Iov;
+    SOCKADDR_IN Address;
+    DWORD dwNextFree;
+    CHAR Data[MAX_PACKET_SIZE];
+};
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetSendSlot
+// Desc:  
+//------------------------------------------------------------------------------------------------
+static inline UringSendSlot * GetSendSlot( BYTE * pSlots, DWORD dwIndex )
+{
+    return &((UringSendSlot*)pSlots)[dwIndex];
+}
+
+#endif
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  UringEngine
+// Desc:  
+//------------------------------------------------------------------------------------------------
+UringEngine::UringEngine()
+{
+    m_iRing = -1;
+    m_pSqRing = NULL;
+    m_dwSqRingSize = 0;
+    m_pSqes = NULL;
+    m_dwSqesSize = 0;
+    m_dwSqLocalTail = 0;
+    m_dwSqSubmitted = 0;
+    m_pCqRing = NULL;
+    m_dwCqRingSize = 0;
+    m_pBufferRing = NULL;
+    m_dwBufferRingSize = 0;
+    m_pBuffers = NULL;
+    m_dwNumBuffers = 0;
+    m_wBufferTail = 0;
+    m_pSendSlots = NULL;
+    m_dwNumSendSlots = 0;
+    m_dwFirstFreeSend = END_OF_LIST;
+    m_pDeferred = NULL;
+    m_dwNumDeferred = 0;
+    m_dwMaxDeferred = 0;
+    m_dwNumEntries = 0;
+    m_dwNumTimers = 0;
+    m_iWakeEvent = -1;
+    m_qwWakeValue = 0;
+    m_bWakeArmed = FALSE;
+    m_bRunning = FALSE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ~UringEngine
+// Desc:  
+//------------------------------------------------------------------------------------------------
+UringEngine::~UringEngine()
+{
+    Destroy();
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Create
+// Desc:  Sets up the rings.  dwBuffers receive buffers are given to the kernel, which has to be
+//        a power of two, and up to dwSendSlots datagrams can be waiting to go out at once.
+//------------------------------------------------------------------------------------------------
+HRESULT UringEngine::Create( DWORD dwBuffers, DWORD dwSendSlots )
+{
+#if defined(IORING_RECV_MULTISHOT)
+    Destroy();
+
+    if( dwBuffers == 0 || dwBuffers > 32768 || (dwBuffers & (dwBuffers - 1)) || dwSendSlots == 0 )
+        return E_FAIL;
+
+    // Set up the ring.  It's refused if io_uring is missing or has been disabled.
+    struct io_uring_params params;
+    ZeroMemory( &params, sizeof(params) );
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = URING_QUEUE_DEPTH * 4;
+    m_iRing = (int)syscall( __NR_io_uring_setup, URING_QUEUE_DEPTH, &params );
+    if( m_iRing < 0 )
+    {
+        m_iRing = -1;
+        return E_FAIL;
+    }
+
+    // Everything used here is in 5.11 and later, except the buffer ring which is checked below
+    DWORD dwNeeded = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if( (params.features & dwNeeded) != dwNeeded )
+    {
+        Destroy();
+        return E_FAIL;
+    }
+
+    // Map the two queues, which share one mapping, and the submission entries
+    m_dwSqRingSize = params.sq_off.array + params.sq_entries * sizeof(DWORD);
+    m_dwCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if( m_dwCqRingSize > m_dwSqRingSize )
+        m_dwSqRingSize = m_dwCqRingSize;
+    m_pSqRing = mmap( NULL, m_dwSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_iRing, IORING_OFF_SQ_RING );
+    if( m_pSqRing == MAP_FAILED )
+    {
+        m_pSqRing = NULL;
+        Destroy();
+        return E_FAIL;
+    }
+    m_pCqRing = m_pSqRing;
+
+    m_dwSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    m_pSqes = mmap( NULL, m_dwSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_iRing, IORING_OFF_SQES );
+    if( m_pSqes == MAP_FAILED )
+    {
+        m_pSqes = NULL;
+        Destroy();
+        return E_FAIL;
+    }
+
+    BYTE * pSq = (BYTE*)m_pSqRing;
+    m_pSqHead = (DWORD*)(pSq + params.sq_off.head);
+    m_pSqTail = (DWORD*)(pSq + params.sq_off.tail);
+    m_dwSqMask = *(DWORD*)(pSq + params.sq_off.ring_mask);
+    m_dwSqEntries = params.sq_entries;
+    m_dwSqLocalTail = *m_pSqTail;
+
+    // Submission entries are always used in order, so the index array never changes
+    DWORD * pArray = (DWORD*)(pSq + params.sq_off.array);
+    for( DWORD i = 0; i < m_dwSqEntries; ++i )
+        pArray[i] = i;
+
+    BYTE * pCq = (BYTE*)m_pCqRing;
+    m_pCqHead = (DWORD*)(pCq + params.cq_off.head);
+    m_pCqTail = (DWORD*)(pCq + params.cq_off.tail);
+    m_dwCqMask = *(DWORD*)(pCq + params.cq_off.ring_mask);
+    m_pCqes = pCq + params.cq_off.cqes;
+
+    // Give the kernel a ring of receive buffers to pick from.  This needs 5.19 or later.
+    m_dwBufferRingSize = dwBuffers * sizeof(struct io_uring_buf);
+    m_pBufferRing = mmap( NULL, m_dwBufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( m_pBufferRing == MAP_FAILED )
+    {
+        m_pBufferRing = NULL;
+        Destroy();
+        return E_FAIL;
+    }
+    struct io_uring_buf_reg reg;
+    ZeroMemory( &reg, sizeof(reg) );
+    reg.ring_addr = (QWORD)(uintptr_t)m_pBufferRing;
+    reg.ring_entries = dwBuffers;
+    reg.bgid = URING_BUFFER_GROUP;
+    if( 0 != syscall( __NR_io_uring_register, m_iRing, IORING_REGISTER_PBUF_RING, &reg, 1 ) )
+    {
+        Destroy();
+        return E_FAIL;
+    }
+
+    m_dwNumBuffers = dwBuffers;
+    m_pBuffers = new BYTE[dwBuffers * URING_BUFFER_SIZE];
+    m_wBufferTail = 0;
+    for( DWORD i = 0; i < dwBuffers; ++i )
+        RecycleBuffer( i );
+
+    // Chain the send slots into a free list
+    m_pSendSlots = new BYTE[dwSendSlots * sizeof(UringSendSlot)];
+    m_dwNumSendSlots = dwSendSlots;
+    for( DWORD i = 0; i < dwSendSlots; ++i )
+        GetSendSlot( m_pSendSlots, i )->dwNextFree = i + 1 < dwSendSlots ? i + 1 : END_OF_LIST;
+    m_dwFirstFreeSend = 0;
+
+    // Every buffer and every socket's receive can produce at most one completion that has to
+    // be set aside, plus the wake event
+    m_dwMaxDeferred = dwBuffers + URING_MAX_SOCKETS + 1;
+    m_pDeferred = new Completion[m_dwMaxDeferred];
+    m_dwNumDeferred = 0;
+
+    // This event is written by Stop() to end the wait
+    if( -1 == (m_iWakeEvent = eventfd( 0, EFD_NONBLOCK )) )
+    {
+        Destroy();
+        return E_FAIL;
+    }
+
+    // Success
+    return S_OK;
+#else
+    // This system has no io_uring
+    return E_FAIL;
+#endif
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Destroy
+// Desc:  Closing the ring cancels anything still outstanding
+//------------------------------------------------------------------------------------------------
+VOID UringEngine::Destroy()
+{
+#if defined(IORING_RECV_MULTISHOT)
+    if( m_iRing != -1 )
+    {
+        close( m_iRing );
+        m_iRing = -1;
+    }
+    if( m_pSqes )
+        munmap( m_pSqes, m_dwSqesSize );
+    if( m_pSqRing )
+        munmap( m_pSqRing, m_dwSqRingSize );
+    if( m_pBufferRing )
+        munmap( m_pBufferRing, m_dwBufferRingSize );
+    if( m_iWakeEvent != -1 )
+        close( m_iWakeEvent );
+#endif
+
+    m_pSqes = NULL;
+    m_pSqRing = NULL;
+    m_pCqRing = NULL;
+    m_pBufferRing = NULL;
+    m_iWakeEvent = -1;
+    m_bWakeArmed = FALSE;
+
+    delete [] m_pBuffers;
+    delete [] m_pSendSlots;
+    delete [] m_pDeferred;
+    m_pBuffers = NULL;
+    m_pSendSlots = NULL;
+    m_pDeferred = NULL;
+    m_dwNumBuffers = 0;
+    m_dwNumSendSlots = 0;
+    m_dwFirstFreeSend = END_OF_LIST;
+    m_dwNumDeferred = 0;
+    m_dwNumEntries = 0;
+    m_dwNumTimers = 0;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Register
+// Desc:  Starts receiving on a socket.  pfnCallback gets every datagram that arrives on it.
+//------------------------------------------------------------------------------------------------
+HRESULT UringEngine::Register( SOCKET sSocket, DatagramCallback pfnCallback, LPVOID pContext )
+{
+#if defined(IORING_RECV_MULTISHOT)
+    if( m_iRing == -1 || m_dwNumEntries >= URING_MAX_SOCKETS )
+        return E_FAIL;
+
+    Entry * pEntry = &m_Entries[m_dwNumEntries];
+    pEntry->sSocket = sSocket;
+    pEntry->pfnCallback = pfnCallback;
+    pEntry->pContext = pContext;
+    pEntry->bArmed = FALSE;
+
+    // Each buffer gets the source address followed by the datagram
+    ZeroMemory( &pEntry->Header, sizeof(pEntry->Header) );
+    pEntry->Header.msg_namelen = sizeof(SOCKADDR_IN);
+
+    // The receive is started by Run
+    m_dwNumEntries++;
+
+    // Success
+    return S_OK;
+#else
+    return E_FAIL;
+#endif
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  AddTimer
+// Desc:  Calls pfnCallback every dwPeriod milliseconds from inside Run()
+//------------------------------------------------------------------------------------------------
+HRESULT UringEngine::AddTimer( DWORD dwPeriod, ReactorTimerCallback pfnCallback, LPVOID pContext )
+{
+    if( m_dwNumTimers >= REACTOR_MAX_TIMERS )
+        return E_FAIL;
+
+    Timer * pTimer = &m_Timers[m_dwNumTimers++];
+    pTimer->dwPeriod = dwPeriod;
+    pTimer->dwNextTime = GetTickCount() + dwPeriod;
+    pTimer->pfnCallback = pfnCallback;
+    pTimer->pContext = pContext;
+
+    // Success
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Send
+// Desc:  Queues a datagram.  It goes to the kernel along with everything else queued the next
+//        time the loop waits.  pAddress can be NULL for a connected socket.  Must be called on
+//        the thread running the engine.
+//------------------------------------------------------------------------------------------------
+int UringEngine::Send( SOCKET sSocket, const SOCKADDR_IN * pAddress, const CHAR * pBuffer, int length )
+{
+#if defined(IORING_RECV_MULTISHOT)
+    if( length < 0 || length > MAX_PACKET_SIZE )
+        return SOCKET_ERROR;
+
+    // If every slot is still with the kernel, wait for some sends to finish
+    for( DWORD dwTries = 0; m_dwFirstFreeSend == END_OF_LIST && dwTries < 3; ++dwTries )
+    {
+        Submit( 1, 10 );
+        ReapCompletions( TRUE );
+    }
+    if( m_dwFirstFreeSend == END_OF_LIST )
+        return SOCKET_ERROR;
+
+    DWORD dwSlot = m_dwFirstFreeSend;
+    UringSendSlot * pSlot = GetSendSlot( m_pSendSlots, dwSlot );
+
+    struct io_uring_sqe * pSqe = (struct io_uring_sqe*)GetSqe();
+    if( !pSqe )
+        return SOCKET_ERROR;
+    m_dwFirstFreeSend = pSlot->dwNextFree;
+
+    // Copy the datagram, since the caller's buffer won't be around when the kernel sends it
+    memcpy( pSlot->Data, pBuffer, length );
+    pSlot->Iov.iov_base = pSlot->Data;
+    pSlot->Iov.iov_len = length;
+    ZeroMemory( &pSlot->Msg, sizeof(pSlot->Msg) );
+    pSlot->Msg.msg_iov = &pSlot->Iov;
+    pSlot->Msg.msg_iovlen = 1;
+    if( pAddress )
+    {
+        pSlot->Address = *pAddress;
+        pSlot->Msg.msg_name = &pSlot->Address;
+        pSlot->Msg.msg_namelen = sizeof(SOCKADDR_IN);
+    }
+
+    pSqe->opcode = IORING_OP_SENDMSG;
+    pSqe->fd = sSocket;
+    pSqe->addr = (QWORD)(uintptr_t)&pSlot->Msg;
+    pSqe->len = 1;
+    pSqe->user_data = URING_USER_DATA( URING_OP_SEND, dwSlot );
+
+    return length;
+#else
+    return SOCKET_ERROR;
+#endif
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Run
+// Desc:  Dispatches datagrams and timers until Stop() is called
+//------------------------------------------------------------------------------------------------
+VOID UringEngine::Run()
+{
+#if defined(IORING_RECV_MULTISHOT)
+    m_bRunning = TRUE;
+    while( m_bRunning )
+    {
+        // Start receiving on new sockets, and on any whose receive has ended
+        for( DWORD i = 0; i < m_dwNumEntries; ++i )
+            ArmReceive( i );
+
+        // Make sure Stop() can reach us
+        if( !m_bWakeArmed )
+        {
+            struct io_uring_sqe * pSqe = (struct io_uring_sqe*)GetSqe();
+            if( pSqe )
+            {
+                pSqe->opcode = IORING_OP_READ;
+                pSqe->fd = m_iWakeEvent;
+                pSqe->addr = (QWORD)(uintptr_t)&m_qwWakeValue;
+                pSqe->len = sizeof(m_qwWakeValue);
+                pSqe->user_data = URING_USER_DATA( URING_OP_WAKE, 0 );
+                m_bWakeArmed = TRUE;
+            }
+        }
+
+        // Fire any timers that are due and find out how long we can sleep
+        DWORD dwTimeout = RunTimers();
+
+        // Hand over everything queued since the last wait, and wait for something to finish
+        Submit( 1, dwTimeout );
+
+        // Handle what was set aside by Send first, since it arrived earlier
+        for( DWORD i = 0; i < m_dwNumDeferred; ++i )
+        {
+            Completion completion = m_pDeferred[i];
+            HandleCompletion( completion.qwUserData, completion.iResult, completion.dwFlags );
+        }
+        m_dwNumDeferred = 0;
+
+        ReapCompletions( FALSE );
+    }
+
+    // Don't lose what the last callbacks queued
+    Submit( 0, 0 );
+#endif
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Stop
+// Desc:  Makes Run() return.  This can be called from any thread.
+//------------------------------------------------------------------------------------------------
+VOID UringEngine::Stop()
+{
+    m_bRunning = FALSE;
+
+#if defined(IORING_RECV_MULTISHOT)
+    // Complete the read that the loop has outstanding on the wake event
+    uint64_t qwValue = 1;
+    ssize_t iWritten = write( m_iWakeEvent, &qwValue, sizeof(qwValue) );
+    (void)iWritten;
+#endif
+}
+
+
+#if defined(IORING_RECV_MULTISHOT)
+
+//------------------------------------------------------------------------------------------------
+// Name:  GetSqe
+// Desc:  Takes the next submission entry, cleared.  If the queue is full, what's in it is
+//        submitted first.  Returns NULL if the kernel won't take any more.
+//------------------------------------------------------------------------------------------------
+LPVOID UringEngine::GetSqe()
+{
+    if( m_dwSqLocalTail - __atomic_load_n( m_pSqHead, __ATOMIC_ACQUIRE ) >= m_dwSqEntries )
+    {
+        Submit( 0, 0 );
+        if( m_dwSqLocalTail - __atomic_load_n( m_pSqHead, __ATOMIC_ACQUIRE ) >= m_dwSqEntries )
+            return NULL;
+    }
+
+    struct io_uring_sqe * pSqe = &((struct io_uring_sqe*)m_pSqes)[m_dwSqLocalTail & m_dwSqMask];
+    ZeroMemory( pSqe, sizeof(*pSqe) );
+    m_dwSqLocalTail++;
+    return pSqe;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Submit
+// Desc:  Tells the kernel about every entry filled in since the last call.  If dwWaitFor is
+//        nonzero, also waits up to dwTimeout milliseconds for that many completions.
+//------------------------------------------------------------------------------------------------
+BOOL UringEngine::Submit( DWORD dwWaitFor, DWORD dwTimeout )
+{
+    __atomic_store_n( m_pSqTail, m_dwSqLocalTail, __ATOMIC_RELEASE );
+    DWORD dwPending = m_dwSqLocalTail - __atomic_load_n( m_pSqHead, __ATOMIC_ACQUIRE );
+    if( !dwPending && !dwWaitFor )
+        return TRUE;
+
+    // Don't wait if there's already something to do
+    if( dwWaitFor && (m_dwNumDeferred ||
+        *m_pCqHead != __atomic_load_n( m_pCqTail, __ATOMIC_ACQUIRE )) )
+        dwWaitFor = 0;
+
+    DWORD dwFlags = dwWaitFor ? IORING_ENTER_GETEVENTS : 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    ZeroMemory( &arg, sizeof(arg) );
+    if( dwWaitFor && dwTimeout != INFINITE )
+    {
+        ts.tv_sec = dwTimeout / 1000;
+        ts.tv_nsec = (dwTimeout % 1000) * 1000000;
+        arg.ts = (QWORD)(uintptr_t)&ts;
+        arg.sigmask_sz = _NSIG / 8;
+        dwFlags |= IORING_ENTER_EXT_ARG;
+    }
+
+    int iResult = (int)syscall( __NR_io_uring_enter, m_iRing, dwPending, dwWaitFor, dwFlags,
+                                (dwFlags & IORING_ENTER_EXT_ARG) ? &arg : NULL,
+                                (dwFlags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0 );
+
+    // Timing out and being interrupted are both normal ways for a wait to end
+    return iResult >= 0 || errno == ETIME || errno == EINTR;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ReapCompletions
+// Desc:  Handles everything in the completion queue.  While a Send is waiting for a free slot,
+//        only sends are handled and the rest are set aside, so that no callback runs inside
+//        another one.
+//------------------------------------------------------------------------------------------------
+VOID UringEngine::ReapCompletions( BOOL bSendsOnly )
+{
+    // The head is read fresh each time, since a callback can send and reap on its own
+    for( ;; )
+    {
+        DWORD dwHead = *m_pCqHead;
+        if( dwHead == __atomic_load_n( m_pCqTail, __ATOMIC_ACQUIRE ) )
+            break;
+
+        const struct io_uring_cqe * pCqe = &((const struct io_uring_cqe*)m_pCqes)[dwHead & m_dwCqMask];
+        Completion completion = { pCqe->user_data, pCqe->res, pCqe->flags };
+        __atomic_store_n( m_pCqHead, dwHead + 1, __ATOMIC_RELEASE );
+
+        if( bSendsOnly && (completion.qwUserData >> 32) != URING_OP_SEND &&
+            m_dwNumDeferred < m_dwMaxDeferred )
+            m_pDeferred[m_dwNumDeferred++] = completion;
+        else
+            HandleCompletion( completion.qwUserData, completion.iResult, completion.dwFlags );
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  HandleCompletion
+// Desc:  Finishes one request
+//------------------------------------------------------------------------------------------------
+VOID UringEngine::HandleCompletion( QWORD qwUserData, int iResult, DWORD dwFlags )
+{
+    DWORD dwIndex = (DWORD)qwUserData;
+    switch( qwUserData >> 32 )
+    {
+        case URING_OP_SEND:
+        {
+            // The kernel is done with the datagram; errors are dropped like any lost datagram
+            GetSendSlot( m_pSendSlots, dwIndex )->dwNextFree = m_dwFirstFreeSend;
+            m_dwFirstFreeSend = dwIndex;
+        } break;
+
+        case URING_OP_RECV:
+        {
+            Entry * pEntry = &m_Entries[dwIndex];
+            if( iResult >= 0 && (dwFlags & IORING_CQE_F_BUFFER) )
+            {
+                DWORD dwBuffer = dwFlags >> IORING_CQE_BUFFER_SHIFT;
+                const BYTE * pBuffer = m_pBuffers + dwBuffer * URING_BUFFER_SIZE;
+
+                // The buffer holds the kernel's header, the address and then the datagram
+                const struct io_uring_recvmsg_out * pOut = (const struct io_uring_recvmsg_out*)pBuffer;
+                DWORD dwHeaderSize = sizeof(*pOut) + pEntry->Header.msg_namelen + pEntry->Header.msg_controllen;
+                if( (DWORD)iResult >= dwHeaderSize && pOut->namelen >= sizeof(SOCKADDR_IN) )
+                {
+                    // A datagram too big for the buffer was cut short
+                    DWORD dwSize = pOut->payloadlen;
+                    if( dwSize > (DWORD)iResult - dwHeaderSize )
+                        dwSize = (DWORD)iResult - dwHeaderSize;
+
+                    pEntry->pfnCallback( pEntry->pContext, (const SOCKADDR_IN*)(pOut + 1),
+                                         (const CHAR*)(pBuffer + dwHeaderSize), dwSize );
+                }
+
+                RecycleBuffer( dwBuffer );
+            }
+
+            // The receive ends if it runs out of buffers or hits an error.  Run starts another
+            // one once the buffers held by set-aside completions have been given back.
+            if( !(dwFlags & IORING_CQE_F_MORE) )
+                pEntry->bArmed = FALSE;
+        } break;
+
+        case URING_OP_WAKE:
+        {
+            m_bWakeArmed = FALSE;
+        } break;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  ArmReceive
+// Desc:  Starts a multishot receive on a socket, which keeps completing until it's stopped
+//------------------------------------------------------------------------------------------------
+VOID UringEngine::ArmReceive( DWORD dwEntry )
+{
+    Entry * pEntry = &m_Entries[dwEntry];
+    if( pEntry->bArmed )
+        return;
+
+    struct io_uring_sqe * pSqe = (struct io_uring_sqe*)GetSqe();
+    if( !pSqe )
+        return;
+
+    pSqe->opcode = IORING_OP_RECVMSG;
+    pSqe->fd = pEntry->sSocket;
+    pSqe->addr = (QWORD)(uintptr_t)&pEntry->Header;
+    pSqe->len = 1;
+    pSqe->ioprio = IORING_RECV_MULTISHOT;
+    pSqe->flags = IOSQE_BUFFER_SELECT;
+    pSqe->buf_group = URING_BUFFER_GROUP;
+    pSqe->user_data = URING_USER_DATA( URING_OP_RECV, dwEntry );
+    pEntry->bArmed = TRUE;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RecycleBuffer
+// Desc:  Gives a receive buffer back to the kernel
+//------------------------------------------------------------------------------------------------
+VOID UringEngine::RecycleBuffer( DWORD dwBuffer )
+{
+    // The header's flexible array doesn't start at the front of the ring when compiled as C++,
+    // so the entries are indexed directly.  The tail shares the first entry's reserved field.
+    struct io_uring_buf_ring * pRing = (struct io_uring_buf_ring*)m_pBufferRing;
+    struct io_uring_buf * pBuf = (struct io_uring_buf*)m_pBufferRing + (m_wBufferTail & (m_dwNumBuffers - 1));
+    pBuf->addr = (QWORD)(uintptr_t)(m_pBuffers + dwBuffer * URING_BUFFER_SIZE);
+    pBuf->len = URING_BUFFER_SIZE;
+    pBuf->bid = (WORD)dwBuffer;
+    m_wBufferTail++;
+
+    // The kernel can take it as soon as the tail moves past it
+    __atomic_store_n( &pRing->tail, m_wBufferTail, __ATOMIC_RELEASE );
+}
+
+#endif
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  RunTimers
+// Desc:  Calls every timer that has come due and returns the milliseconds until the next one
+//------------------------------------------------------------------------------------------------
+DWORD UringEngine::RunTimers()
+{
+    DWORD dwTime = GetTickCount();
+    DWORD dwTimeout = INFINITE;
+
+    for( DWORD i = 0; i < m_dwNumTimers; ++i )
+    {
+        Timer * pTimer = &m_Timers[i];
+
+        // The signed difference handles wraparound of the tick count
+        if( (int)(dwTime - pTimer->dwNextTime) >= 0 )
+        {
+            pTimer->pfnCallback( pTimer->pContext, dwTime );
+
+            // Schedule the next call.  If we fell far behind, don't try to catch up.
+            pTimer->dwNextTime += pTimer->dwPeriod;
+            if( (int)(dwTime - pTimer->dwNextTime) >= 0 )
+                pTimer->dwNextTime = dwTime + pTimer->dwPeriod;
+        }
+
+        // Keep track of the soonest timer
+        DWORD dwUntil = pTimer->dwNextTime - dwTime;
+        if( dwUntil < dwTimeout )
+            dwTimeout = dwUntil;
+    }
+
+    return dwTimeout;
+}
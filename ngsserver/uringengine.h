@@ -0,0 +1,164 @@
+//------------------------------------------------------------------------------------------------
+// File:    uringengine.h
+//
+// Desc:    Completion-based datagram loop for Linux built on io_uring
+//
+//  Copyright 2006-2010 Karl Gluck. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without modification, are
+//  permitted provided that the following conditions are met:
+//
+//     1. Redistributions of source code must retain the above copyright notice, this list of
+//        conditions and the following disclaimer.
+//
+//     2. Redistributions in binary form must reproduce the above copyright notice, this list
+//        of conditions and the following disclaimer in the documentation and/or other materials
+//        provided with the distribution.
+//
+//  THIS SOFTWARE IS PROVIDED BY KARL GLUCK ``AS IS'' AND ANY EXPRESS OR IMPLIED
+//  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+//  FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL KARL GLUCK OR
+//  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+//  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+//  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+//  ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//  The views and conclusions contained in the software and documentation are those of the
+//  authors and should not be interpreted as representing official policies, either expressed
+//  or implied, of Karl Gluck.
+//------------------------------------------------------------------------------------------------
+#ifndef __URINGENGINE_H__
+#define __URINGENGINE_H__
+
+
+// Include files required to compile this header
+#include "../common/platform.h"
+#include "reactor.h"
+
+#define URING_MAX_SOCKETS   8
+
+// Number of receive buffers the server hands to the kernel
+#define URING_DEFAULT_BUFFERS   1024
+
+/**
+ * Does the same job as the Reactor, but the kernel does the receiving.  Each socket has one
+ * multishot receive outstanding, which fills buffers from a ring that the kernel picks from.
+ * The callback reads the datagram straight out of that buffer, which then goes back in the ring.
+ * Sends are queued and handed to the kernel in batches whenever the loop waits, so a whole
+ * tick's worth of snapshots costs one system call.
+ * Create fails on systems without io_uring, or a kernel older than 6.0, and the caller should
+ * fall back to the Reactor.
+ *   @author Karl Gluck
+ */
+class UringEngine
+{
+    public:
+
+        UringEngine();
+        ~UringEngine();
+        HRESULT Create( DWORD dwBuffers, DWORD dwSendSlots );
+        VOID Destroy();
+
+        HRESULT Register( SOCKET sSocket, DatagramCallback pfnCallback, LPVOID pContext );
+        HRESULT AddTimer( DWORD dwPeriod, ReactorTimerCallback pfnCallback, LPVOID pContext );
+        int Send( SOCKET sSocket, const SOCKADDR_IN * pAddress, const CHAR * pBuffer, int length );
+
+        VOID Run();
+        VOID Stop();
+
+    protected:
+
+        struct Entry
+        {
+            SOCKET sSocket;
+            DatagramCallback pfnCallback;
+            LPVOID pContext;
+            BOOL bArmed;                // A multishot receive is outstanding
+#if !defined(WIN32) && !defined(_WIN32)
+            struct msghdr Header;       // Tells the kernel how to lay out each buffer
+#endif
+        };
+
+        struct Timer
+        {
+            DWORD dwPeriod;
+            DWORD dwNextTime;
+            ReactorTimerCallback pfnCallback;
+            LPVOID pContext;
+        };
+
+        /**
+         * A completion that was taken out of the ring while Send was waiting for a free slot,
+         * to be handled once the sender is done
+         */
+        struct Completion
+        {
+            QWORD qwUserData;
+            int iResult;
+            DWORD dwFlags;
+        };
+
+        LPVOID GetSqe();
+        BOOL Submit( DWORD dwWaitFor, DWORD dwTimeout );
+        VOID ReapCompletions( BOOL bSendsOnly );
+        VOID HandleCompletion( QWORD qwUserData, int iResult, DWORD dwFlags );
+        VOID ArmReceive( DWORD dwEntry );
+        VOID RecycleBuffer( DWORD dwBuffer );
+        DWORD RunTimers();
+
+    protected:
+
+        int m_iRing;
+
+        // Submission queue
+        LPVOID m_pSqRing;
+        DWORD m_dwSqRingSize;
+        DWORD * m_pSqHead;
+        DWORD * m_pSqTail;
+        DWORD m_dwSqMask;
+        DWORD m_dwSqEntries;
+        LPVOID m_pSqes;
+        DWORD m_dwSqesSize;
+        DWORD m_dwSqLocalTail;      // Filled in, but not yet visible to the kernel
+        DWORD m_dwSqSubmitted;      // Tail the kernel has been told about
+
+        // Completion queue
+        LPVOID m_pCqRing;
+        DWORD m_dwCqRingSize;
+        DWORD * m_pCqHead;
+        DWORD * m_pCqTail;
+        DWORD m_dwCqMask;
+        LPVOID m_pCqes;
+
+        // Receive buffers that the kernel picks from
+        LPVOID m_pBufferRing;
+        DWORD m_dwBufferRingSize;
+        BYTE * m_pBuffers;
+        DWORD m_dwNumBuffers;
+        WORD m_wBufferTail;
+
+        // Outgoing datagrams waiting for the kernel to finish with them
+        BYTE * m_pSendSlots;
+        DWORD m_dwNumSendSlots;
+        DWORD m_dwFirstFreeSend;
+
+        // Completions set aside while a Send waited
+        Completion * m_pDeferred;
+        DWORD m_dwNumDeferred;
+        DWORD m_dwMaxDeferred;
+
+        Entry m_Entries[URING_MAX_SOCKETS];
+        DWORD m_dwNumEntries;
+
+        Timer m_Timers[REACTOR_MAX_TIMERS];
+        DWORD m_dwNumTimers;
+
+        int m_iWakeEvent;
+        QWORD m_qwWakeValue;
+        BOOL m_bWakeArmed;
+        volatile BOOL m_bRunning;
+};
+
+#endif // __URINGENGINE_H__
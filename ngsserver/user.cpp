@@ -29,7 +29,9 @@
 //  authors and should not be interpreted as representing official policies, either expressed
 //  or implied, of Karl Gluck.
 //------------------------------------------------------------------------------------------------
+#include "../common/protocol.h"
 #include "user.h"
+#include "metrics.h"
 
 //------------------------------------------------------------------------------------------------
 // Name:  User
@@ -37,9 +39,12 @@
 //------------------------------------------------------------------------------------------------
 User::User()
 {
-    m_hRecvEvent = NULL;
+    m_bConnected = FALSE;
     m_sSocket = INVALID_SOCKET;
-    m_hThread = NULL;
+    m_bOwnsSocket = FALSE;
+    m_pReactor = NULL;
+    m_pfnSend = NULL;
+    m_pSendContext = NULL;
 }
 
 
@@ -55,18 +60,14 @@ User::~User()
 
 //------------------------------------------------------------------------------------------------
 // Name:  Create
-// Desc:  
+// Desc:  Binds this user's socket and registers it with the reactor.  pfnOnPacket is called
+//        with this object as the context whenever the socket becomes readable.
 //------------------------------------------------------------------------------------------------
-HRESULT User::Create( DWORD dwId, WORD wPort )
+HRESULT User::Create( WORD wPort, Reactor * pReactor, ReactorCallback pfnOnPacket )
 {
     // We are not connected
     m_bConnected = FALSE;
-
-    // Store the ID number
-    m_dwId = dwId;
-
-    // Create the termination event
-    m_hDisconnectEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+    m_dwId = INVALID_PLAYER_ID;
 
     // Create the socket to recieve and send data on
     if( INVALID_SOCKET == (m_sSocket = socket( AF_INET, SOCK_DGRAM, IPPROTO_UDP )) )
@@ -74,12 +75,14 @@ HRESULT User::Create( DWORD dwId, WORD wPort )
         Destroy();
         return E_FAIL;
     }
+    m_bOwnsSocket = TRUE;
 
     // Create the address to bind to
     SOCKADDR_IN addr;
+    ZeroMemory( &addr, sizeof(addr) );
     addr.sin_family = AF_INET;
     addr.sin_port = htons( wPort );
-    addr.sin_addr.S_un.S_addr = INADDR_ANY;
+    addr.sin_addr.s_addr = INADDR_ANY;
 
     // Bind it to a port
     if( SOCKET_ERROR == bind( m_sSocket, (LPSOCKADDR)&addr, sizeof(SOCKADDR_IN) ) )
@@ -88,16 +91,37 @@ HRESULT User::Create( DWORD dwId, WORD wPort )
         return E_FAIL;
     }
 
-    // Create the event
-    m_hRecvEvent = WSACreateEvent();
-    if( SOCKET_ERROR == WSAEventSelect( m_sSocket, m_hRecvEvent, FD_READ ) )
+    // Have the reactor tell us when packets arrive
+    if( FAILED( pReactor->Register( m_sSocket, pfnOnPacket, (LPVOID)this ) ) )
     {
         Destroy();
         return E_FAIL;
     }
+    m_pReactor = pReactor;
 
     // Successful initialization
-    return true;
+    return S_OK;
+}
+
+
+//------------------------------------------------------------------------------------------------
+// Name:  Create
+// Desc:  Sets up a user that has no socket.  Everything sent to it is passed to pfnSend along
+//        with pContext, and the caller feeds its incoming packets to the server directly.
+//------------------------------------------------------------------------------------------------
+HRESULT User::Create( UserSendCallback pfnSend, LPVOID pContext )
+{
+    // We are not connected
+    m_bConnected = FALSE;
+    m_dwId = INVALID_PLAYER_ID;
+
+    m_sSocket = INVALID_SOCKET;
+    m_bOwnsSocket = FALSE;
+    m_pfnSend = pfnSend;
+    m_pSendContext = pContext;
+
+    // Success
+    return S_OK;
 }
 
 
@@ -107,45 +131,29 @@ HRESULT User::Create( DWORD dwId, WORD wPort )
 //------------------------------------------------------------------------------------------------
 VOID User::Destroy()
 {
-    // If the program is still running, tell it to shut off and wait for the thread to close
-    if( m_sSocket != INVALID_SOCKET )
-    {
-        // Disconnect the user
+    // Drop the user if anyone is still logged on
+    if( m_bConnected )
         Disconnect();
 
-        // Wait for the thread to close
-        WaitForSingleObject( m_hThread, INFINITE );
-    }
-
-    if( m_hDisconnectEvent != NULL )
+    // Stop listening on the socket
+    if( m_pReactor != NULL )
     {
-        CloseHandle( m_hDisconnectEvent );
-        m_hDisconnectEvent = NULL;
+        m_pReactor->Unregister( m_sSocket );
+        m_pReactor = NULL;
     }
 
-    if( m_hRecvEvent != NULL )
-    {
-        WSACloseEvent( m_hRecvEvent );
-        m_hRecvEvent = NULL;
-    }
-
-    if( m_sSocket != INVALID_SOCKET )
-    {
+    if( m_bOwnsSocket && m_sSocket != INVALID_SOCKET )
         closesocket( m_sSocket );
-        m_sSocket = INVALID_SOCKET;
-    }
 
-    if( m_hThread != NULL )
-    {
-        CloseHandle( m_hThread );
-        m_hThread = NULL;
-    }
+    m_sSocket = INVALID_SOCKET;
+    m_bOwnsSocket = FALSE;
+    m_pfnSend = NULL;
 }
 
 
 //------------------------------------------------------------------------------------------------
 // Name:  GetId
-// Desc:  
+// Desc:  Player ID of whoever is logged on through this user
 //------------------------------------------------------------------------------------------------
 DWORD User::GetId()
 {
@@ -157,17 +165,18 @@ DWORD User::GetId()
 // Name:  Connect
 // Desc:  
 //------------------------------------------------------------------------------------------------
-HRESULT User::Connect( const SOCKADDR_IN * pAddress, LPTHREAD_START_ROUTINE lpProcAddress )
+HRESULT User::Connect( const SOCKADDR_IN * pAddress, DWORD dwId )
 {
-    // Connect the socket so that it only receives from this address
-    connect( m_sSocket, (LPSOCKADDR)pAddress, sizeof(SOCKADDR_IN) );
-
-    // Create the client thraed
-    if( NULL == (m_hThread = CreateThread( NULL, 0, lpProcAddress, (LPVOID)this, 0, NULL )) )
+    // Connect our own socket so that it only receives from this address
+    if( m_bOwnsSocket &&
+        SOCKET_ERROR == connect( m_sSocket, (LPSOCKADDR)pAddress, sizeof(SOCKADDR_IN) ) )
         return E_FAIL;
 
-    // Make the disconnect event non-triggered
-    ResetEvent( m_hDisconnectEvent );
+    // Save the address to send to
+    memcpy( &m_Address, pAddress, sizeof(SOCKADDR_IN) );
+
+    // Store the ID number of the player logging on
+    m_dwId = dwId;
 
     // We are now connected
     m_bConnected = TRUE;
@@ -179,26 +188,18 @@ HRESULT User::Connect( const SOCKADDR_IN * pAddress, LPTHREAD_START_ROUTINE lpPr
 
 //------------------------------------------------------------------------------------------------
 // Name:  Disconnect
-// Desc:  
+// Desc:  Frees this user so that another client can log on.  The socket stays registered.
 //------------------------------------------------------------------------------------------------
 VOID User::Disconnect()
 {
-    // Simply set the disconnect event.  We wait for the thread to exit before finally
-    // disconnecting for real.
-    SetEvent( m_hDisconnectEvent );
-}
-
-
-//------------------------------------------------------------------------------------------------
-// Name:  ThreadFinished
-// Desc:  
-//------------------------------------------------------------------------------------------------
-VOID User::ThreadFinished()
-{
-    // Get rid of the target address
-    SOCKADDR_IN addr;
-    memset( &addr, 0, sizeof(SOCKADDR_IN) );
-    connect( m_sSocket, (LPSOCKADDR)&addr, sizeof(SOCKADDR_IN) );
+    // Get rid of the target address.  An all-zero address is AF_UNSPEC, which dissolves the
+    // association on every platform.
+    if( m_bOwnsSocket )
+    {
+        SOCKADDR_IN addr;
+        memset( &addr, 0, sizeof(SOCKADDR_IN) );
+        connect( m_sSocket, (LPSOCKADDR)&addr, sizeof(SOCKADDR_IN) );
+    }
 
     // The user is no longer connected
     m_bConnected = FALSE;
@@ -216,20 +217,12 @@ BOOL User::IsConnected()
 
 
 //------------------------------------------------------------------------------------------------
-// Name:  WaitForPackets
-// Desc:  
+// Name:  GetAddress
+// Desc:  Where this user's client is sending from
 //------------------------------------------------------------------------------------------------
-EndWaitResult User::WaitForPackets( DWORD dwTimeout )
+const SOCKADDR_IN * User::GetAddress()
 {
-    HANDLE hEvents[] = { m_hRecvEvent, m_hDisconnectEvent };
-
-    // Call the wait function to see what events have been triggered
-    switch( WSAWaitForMultipleEvents( 2, hEvents, FALSE, dwTimeout, FALSE ) )
-    {
-        case WAIT_OBJECT_0 + 0: return EWR_RECVPACKET;
-        case WAIT_OBJECT_0 + 1: return EWR_DISCONNECT;
-        default:                return EWR_TIMEOUT;
-    }
+    return &m_Address;
 }
 
 
@@ -239,22 +232,37 @@ EndWaitResult User::WaitForPackets( DWORD dwTimeout )
 //------------------------------------------------------------------------------------------------
 int User::SendPacket( const CHAR * pBuffer, int length )
 {
+    int result;
+
+    // Users without a socket hand their packets to whoever created them
+    if( m_pfnSend )
+        result = m_pfnSend( m_pSendContext, &m_Address, pBuffer, length );
+
     // We can use "send" even though this is a UDP connection because we 'connected' the socket.
     // This doesn't make it reliable, but does make it send and recieve only to one address.
-    return send( m_sSocket, pBuffer, length, 0 );
+    else
+        result = send( m_sSocket, pBuffer, length, 0 );
+
+    // Queued packets that the kernel refuses later are counted by whoever queued them
+    if( result == SOCKET_ERROR )
+        Metrics::Count( METRIC_DROPPED_SEND, 1 );
+    else
+        Metrics::CountSent( pBuffer, (DWORD)length );
+    return result;
 }
 
 
 //------------------------------------------------------------------------------------------------
 // Name:  RecvPacket
-// Desc:  
+// Desc:  Returns SOCKET_ERROR once the socket has been drained
 //------------------------------------------------------------------------------------------------
 int User::RecvPacket( char * pBuffer, int length )
 {
-    // We have to reset the receive event otherwise Winsock forgets to do this...
-    ResetEvent( m_hRecvEvent );
-
     // Receive messages
-    return recv( m_sSocket, pBuffer, length, 0 );
-}
+    int size = recv( m_sSocket, pBuffer, length, 0 );
+
+    if( size != SOCKET_ERROR )
+        Metrics::CountReceived( pBuffer, (DWORD)size );
 
+    return size;
+}
\ No newline at end of file
@@ -32,14 +32,12 @@
 
 
 // Include files required to compile this header
-#include <winsock2.h>
+#include "../common/platform.h"
+#include "reactor.h"
 
-enum EndWaitResult
-{
-    EWR_RECVPACKET,
-    EWR_DISCONNECT,
-    EWR_TIMEOUT,
-};
+// Called in place of a socket send by users that were created with one, such as the in-memory
+// stand-in that the benchmarks use
+typedef int (*UserSendCallback)( LPVOID pContext, const SOCKADDR_IN * pAddress, const CHAR * pBuffer, int length );
 
 class User
 {
@@ -47,17 +45,17 @@ class User
 
         User();
         ~User();
-        HRESULT Create( DWORD dwId, WORD wPort );
+        HRESULT Create( WORD wPort, Reactor * pReactor, ReactorCallback pfnOnPacket );
+        HRESULT Create( UserSendCallback pfnSend, LPVOID pContext );
         VOID Destroy();
 
         DWORD GetId();
 
-        HRESULT Connect( const SOCKADDR_IN * pAddress, LPTHREAD_START_ROUTINE lpProcAddress );
+        HRESULT Connect( const SOCKADDR_IN * pAddress, DWORD dwId );
         VOID Disconnect();
         BOOL IsConnected();
-        VOID ThreadFinished();
+        const SOCKADDR_IN * GetAddress();
 
-        EndWaitResult WaitForPackets( DWORD dwTimeout );
         int SendPacket( const CHAR * pBuffer, int length );
         int RecvPacket( char * pBuffer, int length );
 
@@ -65,10 +63,12 @@ class User
 
         BOOL m_bConnected;
         DWORD m_dwId;
-        HANDLE m_hThread;
-        WSAEVENT m_hRecvEvent;
         SOCKET m_sSocket;
-        HANDLE m_hDisconnectEvent;
+        BOOL m_bOwnsSocket;
+        SOCKADDR_IN m_Address;
+        Reactor * m_pReactor;
+        UserSendCallback m_pfnSend;
+        LPVOID m_pSendContext;
 };
 
 #endif // __USER_H__
\ No newline at end of file